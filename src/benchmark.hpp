@@ -0,0 +1,343 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+// In-process benchmark harness shared by all the benchmark executables.
+//
+// Every program times its phases (setup, compile, upload, integrate,
+// readback) separately and runs warm-up and measured repetitions of the
+// per-repetition phases in a single process:
+//
+//   benchmark::harness bench("reference_lorenz", n);
+//
+//   bench.start("setup");
+//   ...
+//   bench.stop("setup");
+//
+//   while(bench.next()) {
+//       bench.start("integrate");
+//       ...
+//       bench.stop("integrate");
+//
+//       bench.bytes(bytes_touched);
+//   }
+//
+//   bench.report();
+//
+// The harness is configured through the environment, same as the device
+// filters:
+//
+//   BENCH_WARMUP     number of untimed repetitions (default 0);
+//   BENCH_REPEAT     number of timed repetitions (default 1);
+//   BENCH_FORMAT     json, csv or dat (default json);
+//   BENCH_OUTPUT     file to append the results to (default stdout);
+//   BENCH_REFERENCE  state file to compare against, see check().
+//
+// json writes one object per run, csv writes one row per phase (with a
+// header when the file is empty), dat writes "n median-integrate-time" lines
+// compatible with the data/*/*.dat files, followed by "gain max_dev rms_dev"
+// when the run was checked against a reference.
+//
+// Only C++03 and POSIX are used here, so the header may be included from
+// the CUDA sources as well.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+
+#include "precision.hpp"
+
+namespace benchmark {
+
+// Monotonic wall clock, in seconds.
+inline double now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+inline size_t env(const char *name, size_t def) {
+    const char *v = getenv(name);
+    return v ? static_cast<size_t>(atol(v)) : def;
+}
+
+inline std::string env(const char *name, const std::string &def) {
+    const char *v = getenv(name);
+    return v ? std::string(v) : def;
+}
+
+struct statistics {
+    size_t count;
+    double median, min, mean, stddev;
+
+    statistics(std::vector<double> s) : count(s.size()),
+        median(0), min(0), mean(0), stddev(0)
+    {
+        if (s.empty()) return;
+
+        std::sort(s.begin(), s.end());
+
+        min    = s.front();
+        median = count % 2 ? s[count / 2] : 0.5 * (s[count / 2 - 1] + s[count / 2]);
+        mean   = std::accumulate(s.begin(), s.end(), 0.0) / count;
+
+        if (count > 1) {
+            double sum = 0;
+            for(size_t i = 0; i < count; ++i)
+                sum += (s[i] - mean) * (s[i] - mean);
+            stddev = std::sqrt(sum / (count - 1));
+        }
+    }
+};
+
+class harness {
+    public:
+        harness(const std::string &name, size_t n)
+            : name(name), n(n),
+              warmup(env("BENCH_WARMUP", 0)),
+              repeat(std::max<size_t>(1, env("BENCH_REPEAT", 1))),
+              format(env("BENCH_FORMAT", std::string("json"))),
+              output(env("BENCH_OUTPUT", std::string())),
+              reference(env("BENCH_REFERENCE", std::string())),
+              rep(0), bytes_per_rep(0), flops_per_rep(0),
+              checked(false), gain(0), max_dev(0), rms_dev(0)
+        {}
+
+        // Advances to the next repetition. Returns false when all warm-up and
+        // timed repetitions are done.
+        bool next() {
+            return rep++ < warmup + repeat;
+        }
+
+        // Makes at least k warm-up repetitions (e.g. to tune the kernels
+        // in).
+        void warm_up(size_t k) {
+            warmup = std::max(warmup, k);
+        }
+
+        // True during the warm-up repetitions.
+        bool warming() const {
+            return rep > 0 && rep <= warmup;
+        }
+
+        void start(const std::string &phase) {
+            started[phase] = now();
+        }
+
+        void stop(const std::string &phase) {
+            double t = now() - started[phase];
+
+            if (warming()) return;
+
+            if (!samples.count(phase)) order.push_back(phase);
+            samples[phase].push_back(t);
+        }
+
+        // Number of bytes moved by a single repetition of the integration.
+        void bytes(size_t b) {
+            if (!warming()) bytes_per_rep = b;
+        }
+
+        // Number of floating point operations of a single repetition, for
+        // the programs that count them (see roofline/).
+        void flops(double f) {
+            if (!warming()) flops_per_rep = f;
+        }
+
+        statistics stats(const std::string &phase) const {
+            std::map< std::string, std::vector<double> >::const_iterator s = samples.find(phase);
+            return statistics(s == samples.end() ? std::vector<double>() : s->second);
+        }
+
+        // Achieved bandwidth of the integration loop, GB/s.
+        double gbps() const {
+            statistics s = stats("integrate");
+            return s.median > 0 ? 1e-9 * bytes_per_rep / s.median : 0;
+        }
+
+        // Achieved floating point rate of the integration loop, GFLOP/s.
+        double gflops() const {
+            statistics s = stats("integrate");
+            return s.median > 0 ? 1e-9 * flops_per_rep / s.median : 0;
+        }
+
+        // True when check() will do something, for programs that have to
+        // gather the state from the device element by element.
+        bool checking() const {
+            return !reference.empty();
+        }
+
+        // Compares the final state x (usually the first component of the
+        // state, on the host) with a reference run. The first run with
+        // BENCH_REFERENCE set, normally the double precision build, saves its
+        // state and integration time there. Later runs report the speedup
+        // over it together with the max and relative rms deviation of x.
+        template <class Vector>
+        void check(const Vector &x) {
+            if (reference.empty()) return;
+
+            std::vector<double> ref;
+            double ref_time;
+
+            if (!load_reference(ref, ref_time)) {
+                save_reference(x);
+                return;
+            }
+
+            if (ref.size() != x.size()) {
+                std::cerr << "BENCH_REFERENCE: size mismatch, ignored" << std::endl;
+                return;
+            }
+
+            double sum_d = 0, sum_r = 0;
+            max_dev = 0;
+            for(size_t i = 0; i < ref.size(); ++i) {
+                double d = std::fabs(static_cast<double>(x[i]) - ref[i]);
+
+                max_dev = std::max(max_dev, d);
+                sum_d  += d * d;
+                sum_r  += ref[i] * ref[i];
+            }
+
+            rms_dev = sum_r > 0 ? std::sqrt(sum_d / sum_r) : std::sqrt(sum_d);
+
+            double t = stats("integrate").median;
+            gain     = t > 0 ? ref_time / t : 0;
+            checked  = true;
+        }
+
+        void report() const {
+            if (output.empty()) {
+                write(std::cout, true);
+            } else {
+                bool empty;
+                {
+                    std::ifstream f(output.c_str());
+                    empty = !f || f.peek() == std::ifstream::traits_type::eof();
+                }
+
+                std::ofstream f(output.c_str(), std::ios::app);
+                write(f, empty);
+            }
+        }
+    private:
+        std::string name;
+        size_t      n;
+        size_t      warmup, repeat;
+        std::string format, output, reference;
+        size_t      rep;
+        size_t      bytes_per_rep;
+        double      flops_per_rep;
+
+        bool        checked;
+        double      gain, max_dev, rms_dev;
+
+        std::map< std::string, double > started;
+        std::map< std::string, std::vector<double> > samples;
+        std::vector< std::string > order;
+
+        bool load_reference(std::vector<double> &x, double &time) const {
+            std::ifstream f(reference.c_str(), std::ios::binary);
+            if (!f) return false;
+
+            unsigned long long size;
+            f.read(reinterpret_cast<char*>(&size), sizeof(size));
+            f.read(reinterpret_cast<char*>(&time), sizeof(time));
+
+            x.resize(size);
+            if (size) f.read(reinterpret_cast<char*>(&x[0]), sizeof(double) * size);
+
+            return static_cast<bool>(f);
+        }
+
+        template <class Vector>
+        void save_reference(const Vector &x) const {
+            std::vector<double> v(x.size());
+            for(size_t i = 0; i < v.size(); ++i) v[i] = static_cast<double>(x[i]);
+
+            unsigned long long size = v.size();
+            double time = stats("integrate").median;
+
+            std::ofstream f(reference.c_str(), std::ios::binary);
+            f.write(reinterpret_cast<const char*>(&size), sizeof(size));
+            f.write(reinterpret_cast<const char*>(&time), sizeof(time));
+            if (size) f.write(reinterpret_cast<const char*>(&v[0]), sizeof(double) * size);
+        }
+
+        void write(std::ostream &os, bool header) const {
+            std::ostringstream s;
+            s.precision(6);
+
+            if (format == "csv") {
+                if (header)
+                    s << "name,n,phase,count,median,min,mean,stddev,bytes,gbps,"
+                         "precision,gain,max_dev,rms_dev,gflops\n";
+
+                for(size_t i = 0; i < order.size(); ++i) {
+                    statistics st = stats(order[i]);
+                    bool loop = order[i] == "integrate";
+
+                    s << name << "," << n << "," << order[i] << ","
+                      << st.count << "," << st.median << "," << st.min << ","
+                      << st.mean << "," << st.stddev << ","
+                      << (loop ? bytes_per_rep : 0) << ","
+                      << (loop ? gbps() : 0) << ","
+                      << precision::name() << ",";
+
+                    if (loop && checked)
+                        s << gain << "," << max_dev << "," << rms_dev << ",";
+                    else
+                        s << ",,,";
+
+                    s << (loop ? gflops() : 0) << "\n";
+                }
+            } else if (format == "dat") {
+                s << n << " " << stats("integrate").median;
+                if (checked)
+                    s << " " << gain << " " << max_dev << " " << rms_dev;
+                s << "\n";
+            } else {
+                s << "{\"name\": \"" << name << "\", \"n\": " << n
+                  << ", \"precision\": \"" << precision::name() << "\""
+                  << ", \"warmup\": " << warmup << ", \"repeat\": " << repeat
+                  << ", \"bytes\": " << bytes_per_rep << ", \"gbps\": " << gbps();
+
+                if (flops_per_rep > 0)
+                    s << ", \"gflops\": " << gflops();
+
+                if (checked)
+                    s << ", \"gain\": " << gain
+                      << ", \"max_dev\": " << max_dev
+                      << ", \"rms_dev\": " << rms_dev;
+
+                s << ", \"phases\": {";
+
+                for(size_t i = 0; i < order.size(); ++i) {
+                    statistics st = stats(order[i]);
+
+                    s << (i ? ", " : "") << "\"" << order[i] << "\": {"
+                      << "\"count\": "    << st.count
+                      << ", \"median\": " << st.median
+                      << ", \"min\": "    << st.min
+                      << ", \"mean\": "   << st.mean
+                      << ", \"stddev\": " << st.stddev
+                      << "}";
+                }
+
+                s << "}}\n";
+            }
+
+            os << s.str() << std::flush;
+        }
+};
+
+} // namespace benchmark
+
+#endif
@@ -0,0 +1,272 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "clbuf/checkpoint.hpp"
+
+namespace clbuf {
+
+namespace {
+
+const char     magic[8] = { 'C', 'L', 'B', 'U', 'F', 'C', 'K', 'P' };
+const uint32_t version  = 1;
+
+struct file_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t scalar;
+    uint64_t size;
+    uint64_t seed;
+    uint64_t page;
+};
+
+struct slot_header {
+    uint64_t sequence;
+    double   t;
+};
+
+file_header* header(char *base) {
+    return reinterpret_cast<file_header*>(base);
+}
+
+slot_header* header(char *base, unsigned k) {
+    return reinterpret_cast<slot_header*>(base + 64 + 16 * k);
+}
+
+size_t pages(size_t bytes, size_t page) {
+    return (bytes + page - 1) / page;
+}
+
+char* data(char *base, unsigned k, size_t bytes, size_t page) {
+    return base + page * (1 + k * pages(bytes, page));
+}
+
+void sync(void *p, size_t len) {
+    if (msync(p, len, MS_SYNC))
+        throw std::runtime_error("clbuf: can not sync the checkpoint");
+}
+
+} // namespace
+
+//---------------------------------------------------------------------------
+// checkpoint
+//---------------------------------------------------------------------------
+checkpoint::checkpoint(context &ctx, const std::string &path,
+        size_t scalar, size_t size, unsigned every, unsigned long long seed)
+    : ctx(ctx),
+      copy_queue(ctx.queue.size() > 1 ? ctx.queue.size() - 1 : ctx.add_queue()),
+      bytes(scalar * size), page(sysconf(_SC_PAGESIZE)),
+      length(page * (1 + 2 * pages(bytes, page))),
+      K(std::max(every, 1U)), calls(0), fd(-1), base(0), sequence(0),
+      next(0), done(false)
+{
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) throw std::runtime_error("clbuf: can not open " + path);
+
+    struct stat st;
+    bool keep = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == length;
+
+    if (ftruncate(fd, length)) {
+        close(fd);
+        throw std::runtime_error("clbuf: can not resize " + path);
+    }
+
+    void *m = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("clbuf: can not map " + path);
+    }
+    base = static_cast<char*>(m);
+
+    file_header *h = header(base);
+
+    keep = keep && std::equal(magic, magic + 8, h->magic)
+        && h->version == version && h->scalar == scalar
+        && h->size == size && h->seed == seed && h->page == page;
+
+    if (keep) {
+        // Overwrite the older slot first.
+        sequence = std::max(header(base, 0)->sequence, header(base, 1)->sequence);
+        next     = header(base, 0)->sequence > header(base, 1)->sequence;
+    } else {
+        std::memset(base, 0, page);
+
+        std::copy(magic, magic + 8, h->magic);
+        h->version = version;
+        h->scalar  = scalar;
+        h->size    = size;
+        h->seed    = seed;
+        h->page    = page;
+
+        sync(base, page);
+    }
+
+    for(int i = 0; i < 2; ++i) {
+        slots[i].staging = cl::Buffer(ctx.ctx, CL_MEM_READ_WRITE, bytes);
+        slots[i].busy    = false;
+    }
+
+    writer = std::thread(&checkpoint::write, this);
+}
+
+checkpoint::~checkpoint() {
+    {
+        std::lock_guard<std::mutex> lock(mx);
+        done = true;
+    }
+    cv.notify_all();
+    writer.join();
+
+    munmap(base, length);
+    close(fd);
+}
+
+void checkpoint::save(double t, unsigned q, const buffer_list &parts) {
+    size_t total = 0;
+    for(size_t i = 0; i < parts.size(); ++i) total += parts[i].second;
+
+    if (total != bytes)
+        throw std::length_error("clbuf: state does not match the checkpoint");
+
+    unsigned k = next;
+    slot    &s = slots[k];
+    next ^= 1;
+
+    {
+        std::unique_lock<std::mutex> lock(mx);
+        while(s.busy) cv.wait(lock);
+        s.busy = true;
+    }
+
+    size_t offset = 0;
+    for(size_t i = 0; i < parts.size(); ++i) {
+        ctx.queue[q].enqueueCopyBuffer(parts[i].first, s.staging,
+                0, offset, parts[i].second, 0,
+                i + 1 == parts.size() ? &s.copied : 0);
+
+        offset += parts[i].second;
+    }
+
+    // The writer thread waits on the copy, so it has to be submitted.
+    ctx.queue[q].flush();
+
+    s.t = t;
+
+    {
+        std::lock_guard<std::mutex> lock(mx);
+        pending.push_back(k);
+    }
+    cv.notify_all();
+}
+
+void checkpoint::write() {
+    for(;;) {
+        unsigned k;
+
+        {
+            std::unique_lock<std::mutex> lock(mx);
+            while(pending.empty() && !done) cv.wait(lock);
+            if (pending.empty()) return;
+
+            k = pending.front();
+            pending.pop_front();
+        }
+
+        slot        &s = slots[k];
+        slot_header *h = header(base, k);
+        char        *x = data(base, k, bytes, page);
+
+        h->sequence = 0;
+        sync(base, page);
+
+        std::vector<cl::Event> wait(1, s.copied);
+        ctx.queue[copy_queue].enqueueReadBuffer(s.staging, CL_TRUE, 0, bytes, x, &wait);
+        sync(x, page * pages(bytes, page));
+
+        h->t        = s.t;
+        h->sequence = ++sequence;
+        sync(base, page);
+
+        {
+            std::lock_guard<std::mutex> lock(mx);
+            s.busy = false;
+        }
+        cv.notify_all();
+    }
+}
+
+//---------------------------------------------------------------------------
+// snapshot
+//---------------------------------------------------------------------------
+snapshot::snapshot(const std::string &path) : length(0), fd(-1), base(0) {
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("clbuf: can not open " + path);
+
+    struct stat st;
+    if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < sizeof(file_header)) {
+        close(fd);
+        throw std::runtime_error("clbuf: " + path + " is not a checkpoint");
+    }
+    length = st.st_size;
+
+    void *m = mmap(0, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("clbuf: can not map " + path);
+    }
+    base = static_cast<char*>(m);
+
+    const file_header *h = header(base);
+
+    if (!std::equal(magic, magic + 8, h->magic) || h->version != version
+            || length != h->page * (1 + 2 * pages(h->scalar * h->size, h->page)))
+    {
+        munmap(base, length);
+        close(fd);
+        throw std::runtime_error("clbuf: " + path + " is not a checkpoint");
+    }
+}
+
+snapshot::~snapshot() {
+    munmap(base, length);
+    close(fd);
+}
+
+unsigned long long snapshot::seed() const {
+    return header(base)->seed;
+}
+
+double snapshot::restore(context &ctx, unsigned q, const buffer_list &parts) const {
+    const file_header *h     = header(base);
+    const size_t       bytes = h->scalar * h->size;
+
+    const slot_header *s0 = header(base, 0);
+    const slot_header *s1 = header(base, 1);
+
+    if (!s0->sequence && !s1->sequence)
+        throw std::runtime_error("clbuf: no valid state in the checkpoint");
+
+    unsigned k = s1->sequence > s0->sequence;
+
+    size_t total = 0;
+    for(size_t i = 0; i < parts.size(); ++i) total += parts[i].second;
+
+    if (total != bytes)
+        throw std::length_error("clbuf: state does not match the checkpoint");
+
+    const char *x = data(base, k, bytes, h->page);
+
+    for(size_t i = 0, offset = 0; i < parts.size(); offset += parts[i++].second)
+        ctx.queue[q].enqueueWriteBuffer(parts[i].first, CL_TRUE, 0,
+                parts[i].second, x + offset);
+
+    return header(base, k)->t;
+}
+
+} // namespace clbuf
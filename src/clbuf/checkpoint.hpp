@@ -0,0 +1,147 @@
+#ifndef CLBUF_CHECKPOINT_HPP
+#define CLBUF_CHECKPOINT_HPP
+
+// Checkpoints of long integrations in a memory mapped file, and restart
+// from them.
+//
+// The file holds two slots that are written in turns, so a run killed while
+// writing one still finds the other. The integration only waits for the
+// copy of the state into a device staging buffer; a writer thread then
+//
+//   1. clears the header of the slot and syncs it;
+//   2. reads the staging buffer straight into the mapping of the slot and
+//      syncs it;
+//   3. stores the time and a sequence number in the header and syncs it.
+//
+// snapshot maps the file on restart, takes the valid slot with the higher
+// sequence number and writes the state to the device directly from the
+// mapping.
+//
+// The steppers keep nothing between steps apart from the state and the
+// time, so that is all a checkpoint holds, along with the seed the program
+// drew its random initial data and disorder from. The state is stored in
+// the layout of the device vectors, so a run has to be restarted with the
+// same layout (e.g. the same matrix format).
+//
+// File format (native byte order):
+//
+//   header:  char     magic[8]   "CLBUFCKP"
+//            uint32   version    1
+//            uint32   scalar     sizeof of an element
+//            uint64   size       elements of the state
+//            uint64   seed
+//            uint64   page       page size of the file
+//   at 64 + 16 * k, the header of slot k:
+//            uint64   sequence   0 when the slot is not valid
+//            double   t
+//   at page * (1 + k * pages), the state of slot k, where pages is the
+//   number of pages scalar * size bytes take:
+//            scalar   x[size]
+
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "clbuf/vector.hpp"
+
+namespace clbuf {
+
+class checkpoint {
+    public:
+        // Opens or creates path. The slots of an earlier run with the same
+        // layout and seed are kept until they are overwritten, so a
+        // restarted run stays restartable.
+        checkpoint(context &ctx, const std::string &path,
+                size_t scalar, size_t size, unsigned every,
+                unsigned long long seed);
+
+        // Waits for the pending writes.
+        ~checkpoint();
+
+        // Counts an observation and tells if the state has to be saved
+        // (every K-th step, not the initial state). integrate_const observes
+        // the initial state before the first step, so call c follows step c.
+        bool due() {
+            const size_t c = calls++;
+            return c > 0 && c % K == 0;
+        }
+
+        // Saves the buffers (bytes each) written on queue q as the state at
+        // time t.
+        void save(double t, unsigned q, const buffer_list &parts);
+    private:
+        struct slot {
+            cl::Buffer staging;
+            cl::Event  copied;
+            double     t;
+            bool       busy;
+        };
+
+        context    &ctx;
+        unsigned    copy_queue;
+        size_t      bytes;
+        size_t      page;
+        size_t      length;
+        unsigned    K;
+        size_t      calls;
+        int         fd;
+        char       *base;
+
+        unsigned long long sequence;
+
+        slot        slots[2];
+        unsigned    next;
+
+        std::deque<unsigned>    pending;
+        std::mutex              mx;
+        std::condition_variable cv;
+        bool                    done;
+        std::thread             writer;
+
+        void write();
+
+        checkpoint(const checkpoint&);
+        checkpoint& operator=(const checkpoint&);
+};
+
+// odeint observer. Copies are cheap and share the checkpoint.
+class checkpoint_observer {
+    public:
+        checkpoint_observer(checkpoint &c) : c(&c) {}
+
+        template <class State>
+        void operator()(const State &x, double t) {
+            if (c->due()) c->save(t, queue_of(x), parts(x));
+        }
+    private:
+        checkpoint *c;
+};
+
+// A checkpoint file opened for restart.
+class snapshot {
+    public:
+        // Throws when the file is not a checkpoint.
+        explicit snapshot(const std::string &path);
+
+        ~snapshot();
+
+        unsigned long long seed() const;
+
+        // Writes the latest valid state to the buffers on queue q (blocking)
+        // and returns its time. Throws when there is no valid state or the
+        // buffers do not match it.
+        double restore(context &ctx, unsigned q, const buffer_list &parts) const;
+    private:
+        size_t  length;
+        int     fd;
+        char   *base;
+
+        snapshot(const snapshot&);
+        snapshot& operator=(const snapshot&);
+};
+
+} // namespace clbuf
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef CLBUF_HPP
+#define CLBUF_HPP
+
+// Plain OpenCL backend for odeint: device vectors (clbuf::vector) living in
+// a clbuf::context, and the operations odeint needs on them
+// (clbuf::basic_operations). The problem specific kernels are built into
+// the same context with context::build() and launched with
+// context::launch(), in launch configurations tuned per device
+// (clbuf::tuner). clbuf::stream writes trajectories in the background,
+// clbuf::reduction sums observables on the device, clbuf::checkpoint
+// saves states to restart from and clbuf::ode_ensemble generates fused
+// kernels for ensembles of small systems from their host code.
+
+#include "clbuf/context.hpp"
+#include "clbuf/vector.hpp"
+#include "clbuf/operations.hpp"
+#include "clbuf/stream.hpp"
+#include "clbuf/reduce.hpp"
+#include "clbuf/checkpoint.hpp"
+#include "clbuf/ensemble.hpp"
+
+#endif
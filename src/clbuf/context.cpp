@@ -0,0 +1,124 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+
+#include "clbuf/context.hpp"
+#include "program_cache.hpp"
+#include "vt_user.h"
+
+namespace clbuf {
+
+namespace {
+
+unsigned default_width(const cl::Device &device, size_t scalar) {
+    if (const char *v = getenv("CLBUF_VECTOR_WIDTH")) {
+        unsigned w = atoi(v);
+        return w == 2 || w == 4 || w == 8 ? w : 1;
+    }
+
+    unsigned w = scalar == sizeof(cl_double)
+        ? device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE>()
+        : device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT>();
+
+    if (!(device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU))
+        w = std::max<unsigned>(w, 16 / scalar);
+
+    // Largest of 1, 2, 4 and 8 not above w.
+    unsigned p = 1;
+    while(p < 8 && 2 * p <= w) p *= 2;
+    return p;
+}
+
+} // namespace
+
+context::context(const cl::CommandQueue &q)
+    : ctx(q.getInfo<CL_QUEUE_CONTEXT>()), device(q.getInfo<CL_QUEUE_DEVICE>()),
+      queue(1, q), buffers(ctx), tuning(device), wgsize(256), bytes_touched(0),
+      autotune(false),
+      float_width(default_width(device, sizeof(cl_float))),
+      double_width(default_width(device, sizeof(cl_double)))
+{ }
+
+context::context(const cl::Context &ctx, const cl::Device &device,
+        unsigned nq, cl_command_queue_properties props)
+    : ctx(ctx), device(device), buffers(ctx), tuning(device), wgsize(256),
+      bytes_touched(0), autotune(false),
+      float_width(default_width(device, sizeof(cl_float))),
+      double_width(default_width(device, sizeof(cl_double)))
+{
+    if (!nq) throw std::invalid_argument("clbuf: context without queues");
+
+    for(unsigned i = 0; i < nq; ++i)
+        queue.push_back(cl::CommandQueue(ctx, device, props));
+}
+
+unsigned context::add_queue() {
+    queue.push_back(cl::CommandQueue(ctx, device,
+                queue[0].getInfo<CL_QUEUE_PROPERTIES>()));
+    return queue.size() - 1;
+}
+
+void context::build(const std::string &source, const std::string &options) {
+    unsigned long long h = program_cache::hash(options, program_cache::hash(source));
+    if (built.count(h)) return;
+
+    cl::Program program = program_cache::build(ctx, source, options);
+
+    std::vector<cl::Kernel> k;
+    program.createKernels(&k);
+
+    for(std::vector<cl::Kernel>::const_iterator i = k.begin(); i != k.end(); ++i)
+        kernels[i->getInfo<CL_KERNEL_FUNCTION_NAME>()] = *i;
+
+    built.insert(h);
+}
+
+cl::Kernel& context::kernel(const std::string &name) {
+    std::map<std::string, cl::Kernel>::iterator k = kernels.find(name);
+
+    if (k == kernels.end())
+        throw std::out_of_range("clbuf: unknown kernel " + name);
+
+    return k->second;
+}
+
+cl::Event context::launch(unsigned q, const cl::Kernel &krn, size_t n,
+        const char *name, const std::vector<cl::Event> &wait)
+{
+    return launch(q, krn, n, std::string(name), name, wait);
+}
+
+cl::Event context::launch(unsigned q, const cl::Kernel &krn, size_t n,
+        const std::string &key, const char *name,
+        const std::vector<cl::Event> &wait)
+{
+    if (autotune && !tuning.swept(key, n))
+        tuning.tune(queue[q], krn, key, n, wait);
+
+    launch_config c = { wgsize, 0, 1 };
+    tuning.find(key, n, c);
+
+    return launch(q, krn, c.global(n, tuning.units()), c.wgsize, name, wait);
+}
+
+cl::Event context::launch(unsigned q, const cl::Kernel &krn,
+        const cl::NDRange &global, const cl::NDRange &local,
+        const char *name, const std::vector<cl::Event> &wait)
+{
+    cl::Event  done;
+    cl::Event *trace = VT_USER_KERNEL(name);
+
+    queue[q].enqueueNDRangeKernel(krn, cl::NullRange, global, local,
+            wait.empty() ? 0 : &wait,
+            trace ? trace : queue.size() > 1 ? &done : 0
+            );
+
+    return trace ? *trace : done;
+}
+
+void context::finish() {
+    for(std::vector<cl::CommandQueue>::iterator q = queue.begin(); q != queue.end(); ++q)
+        q->finish();
+}
+
+} // namespace clbuf
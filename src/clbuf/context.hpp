@@ -0,0 +1,110 @@
+#ifndef CLBUF_CONTEXT_HPP
+#define CLBUF_CONTEXT_HPP
+
+// An OpenCL context and device with one or more in-order command queues,
+// the kernels built for them and a pool of buffers. Every clbuf::vector
+// refers to the context it was allocated in and to one of its queues, so a
+// program may drive several devices, or several queues of one device,
+// side by side.
+//
+// Commands are enqueued without blocking. When a context has more than one
+// queue, each launch returns an event, which the vectors written by the
+// kernel keep as their ready event; commands on other queues wait for it
+// (see wait_list()). With a single queue the in-order queue is enough and
+// no events are created, unless kernels are traced (vt_user.h).
+//
+// One dimensional launches take their configuration from the tuner of the
+// context (see tuner.hpp), which loads the configurations saved for the
+// device. With autotune set, the first launch of every kernel and size
+// bucket sweeps the configurations first.
+//
+// A context has to outlive the vectors allocated in it.
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <vexcl/util.hpp>
+
+#include "clbuf/pool.hpp"
+#include "clbuf/tuner.hpp"
+
+namespace clbuf {
+
+inline size_t alignup(size_t n, size_t m = 16U) {
+    return n % m ? n - n % m + m : n;
+}
+
+struct context {
+    cl::Context                   ctx;
+    cl::Device                    device;
+    std::vector<cl::CommandQueue> queue;
+    pool                          buffers;
+    tuner                         tuning;
+
+    size_t   wgsize;        // when a kernel is not tuned
+    size_t   bytes_touched;
+    bool     autotune;
+
+    // Vector widths of the library kernels for float and double elements,
+    // see vector_width().
+    unsigned float_width, double_width;
+
+    // Uses an existing queue, e.g. one of a vex::Context.
+    explicit context(const cl::CommandQueue &q);
+
+    // Creates nq queues on the device.
+    context(const cl::Context &ctx, const cl::Device &device,
+            unsigned nq = 1, cl_command_queue_properties props = 0);
+
+    // Width of the loads of the library kernels for elements of scalar
+    // bytes. CPU devices take their preferred vector width, other devices
+    // load 16 bytes at a time; $CLBUF_VECTOR_WIDTH overrides both.
+    unsigned vector_width(size_t scalar) const {
+        return scalar == sizeof(cl_double) ? double_width : float_width;
+    }
+
+    // Adds a queue with the properties of the first one and returns its
+    // index.
+    unsigned add_queue();
+
+    // Builds the program (through the program cache) and registers its
+    // kernels by name. Sources that were built already are skipped.
+    void build(const std::string &source, const std::string &options = "");
+
+    bool has_kernel(const std::string &name) const {
+        return kernels.count(name) > 0;
+    }
+
+    // Throws std::out_of_range for kernels that were not built.
+    cl::Kernel& kernel(const std::string &name);
+
+    // Runs krn over n elements after the events in wait, with the launch
+    // configuration tuned for name and n. Returns the completion event,
+    // which is null when no event was needed.
+    cl::Event launch(unsigned q, const cl::Kernel &krn, size_t n,
+            const char *name,
+            const std::vector<cl::Event> &wait = std::vector<cl::Event>());
+
+    // Same, for kernels shared under several names (e.g. scale_sum): the
+    // configuration is tuned for key, and the launch is traced as name.
+    cl::Event launch(unsigned q, const cl::Kernel &krn, size_t n,
+            const std::string &key, const char *name,
+            const std::vector<cl::Event> &wait = std::vector<cl::Event>());
+
+    cl::Event launch(unsigned q, const cl::Kernel &krn,
+            const cl::NDRange &global, const cl::NDRange &local,
+            const char *name,
+            const std::vector<cl::Event> &wait = std::vector<cl::Event>());
+
+    void finish();
+
+    private:
+        std::map<std::string, cl::Kernel> kernels;
+        std::set<unsigned long long>      built;
+};
+
+} // namespace clbuf
+
+#endif
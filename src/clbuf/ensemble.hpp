@@ -0,0 +1,168 @@
+#ifndef CLBUF_ENSEMBLE_HPP
+#define CLBUF_ENSEMBLE_HPP
+
+// Fused kernels for ensembles of small ODE systems, for any system functor
+// and any explicit odeint stepper (the approach of
+// generated_lorenz_ensemble.cpp, made generic).
+//
+// A system tells the size of its state and of the parameters every member
+// has, and is called on std::arrays of some number type:
+//
+//   struct rossler {
+//       static const unsigned dim = 3, params = 3;
+//
+//       template <class State, class Params, class Time>
+//       void operator()(const State &x, State &dxdt, const Params &p,
+//               const Time &t) const;
+//   };
+//
+// source() runs one do_step of Stepper (e.g. runge_kutta4,
+// runge_kutta_dopri5, runge_kutta_fehlberg78) on clbuf::symbolic values
+// and wraps the recorded statements in
+//
+//   kernel void name(ulong n, ulong steps, real t0, real dt,
+//           global real *state, global const real *param)
+//
+// which makes `steps` steps of every member with the state in registers.
+// state holds the dim components and param the params components of all
+// members, a block of n per component. t and dt are arguments, so the
+// kernel serves any step size, and forced systems see the time of every
+// stage. The source expects the PRECISION_CL_PREAMBLE types.
+//
+// Steppers that reuse the last derivative of a step (dopri5) evaluate it
+// anew at the start of every step. native::ode_ensemble (native/ensemble.hpp)
+// runs the same functors on the CPU.
+
+#include <array>
+#include <string>
+#include <sstream>
+
+#include <boost/numeric/odeint/algebra/range_algebra.hpp>
+#include <boost/numeric/odeint/algebra/default_operations.hpp>
+#include <boost/numeric/odeint/util/resizer.hpp>
+
+#include "clbuf/vector.hpp"
+#include "clbuf/symbolic.hpp"
+
+namespace clbuf {
+
+template <class System,
+         template <class, class, class, class, class, class, class> class Stepper>
+class ode_ensemble {
+    public:
+        static const unsigned N = System::dim;
+        static const unsigned P = System::params;
+
+        ode_ensemble(context &ctx, const std::string &name)
+            : ctx(ctx), name(name) {}
+
+        static std::string source(const std::string &name, const System &sys = System()) {
+            namespace odeint = boost::numeric::odeint;
+
+            typedef std::array<symbolic, N> state_type;
+            typedef std::array<symbolic, P> param_type;
+
+            std::ostringstream body;
+            symbolic::record(body);
+
+            {
+                state_type x;
+                param_type p;
+
+                for(unsigned c = 0; c < N; ++c) x[c] = symbolic::bind(var("s", c), true);
+                for(unsigned c = 0; c < P; ++c) p[c] = symbolic::bind(var("p", c), true);
+
+                symbolic t  = symbolic::bind("t",  true);
+                symbolic dt = symbolic::bind("dt", true);
+
+                Stepper<state_type, double, state_type, symbolic,
+                    odeint::range_algebra, odeint::default_operations,
+                    odeint::initially_resizer> stepper;
+
+                stepper.do_step(member<param_type>(sys, p), x, t, dt);
+
+                for(unsigned c = 0; c < N; ++c) symbolic::bind(var("s", c)) = x[c];
+            }
+
+            symbolic::stop();
+
+            std::ostringstream s;
+            s << "kernel void " << name << "(\n"
+              << "    ulong n,\n"
+              << "    ulong steps,\n"
+              << "    real t0,\n"
+              << "    real dt,\n"
+              << "    global real *state,\n"
+              << "    global const real *param\n"
+              << "    )\n"
+              << "{\n"
+              << "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n";
+            for(unsigned c = 0; c < N; ++c)
+                s << "        real " << var("s", c) << " = state[" << c << " * n + i];\n";
+            for(unsigned c = 0; c < P; ++c)
+                s << "        real " << var("p", c) << " = param[" << c << " * n + i];\n";
+            s << "\n"
+              << "        for(ulong k = 0; k < steps; ++k) {\n"
+              << "            real t = t0 + k * dt;\n";
+            std::istringstream lines(body.str());
+            for(std::string line; std::getline(lines, line); )
+                s << "            " << line << "\n";
+            s << "        }\n"
+              << "\n";
+            for(unsigned c = 0; c < N; ++c)
+                s << "        state[" << c << " * n + i] = " << var("s", c) << ";\n";
+            s << "    }\n"
+              << "}\n";
+
+            return s.str();
+        }
+
+        // Makes `steps` steps of dt from t0 on the members in x with
+        // parameters p.
+        template <typename T>
+        void operator()(vector<T> &x, const vector<T> &p, T t0, T dt, size_t steps) {
+            cl::Kernel &krn = ctx.kernel(name);
+
+            const cl_ulong n = x.n / N;
+
+            uint pos = 0;
+            krn.setArg(pos++, n);
+            krn.setArg(pos++, static_cast<cl_ulong>(steps));
+            krn.setArg(pos++, t0);
+            krn.setArg(pos++, dt);
+            krn.setArg(pos++, x.data);
+            krn.setArg(pos++, p.data);
+
+            x.ready = ctx.launch(x.queue, krn, n, name.c_str(),
+                    wait_list(x.queue, x, p));
+
+            ctx.bytes_touched += sizeof(T) * (2 * N + P) * n;
+        }
+    private:
+        context    &ctx;
+        std::string name;
+
+        // odeint system of one member.
+        template <class Params>
+        struct member {
+            const System &sys;
+            const Params &p;
+
+            member(const System &sys, const Params &p) : sys(sys), p(p) {}
+
+            template <class State, class Time>
+            void operator()(const State &x, State &dxdt, const Time &t) const {
+                sys(x, dxdt, p, t);
+            }
+        };
+
+        static std::string var(const char *prefix, unsigned c) {
+            std::ostringstream s;
+            s << prefix << c;
+            return s.str();
+        }
+};
+
+} // namespace clbuf
+
+#endif
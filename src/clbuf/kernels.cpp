@@ -0,0 +1,57 @@
+#include <sstream>
+
+#include "clbuf/kernels.hpp"
+#include "precision.hpp"
+
+namespace clbuf {
+
+std::string scale_sum_source(const std::string &real, const std::string &accum,
+        const std::string &suffix, unsigned width)
+{
+    std::ostringstream s;
+
+    if (real == "double" || accum == "double")
+        s << PRECISION_CL_FP64 << "\n";
+
+    for(unsigned m = 2; m <= 5; ++m) {
+        s << "kernel void scale_sum" << m << suffix << "(\n"
+          << "    ulong n,\n"
+          << "    global " << real << " *v0,\n";
+        for(unsigned i = 1; i <= m; ++i)
+            s << "    global const " << real << " *v" << i << ",\n";
+        for(unsigned i = 1; i <= m; ++i)
+            s << "    " << accum << " a" << i << (i < m ? ",\n" : "\n");
+        s << "    )\n"
+          << "{\n";
+
+        if (width > 1) {
+            // The buffers start aligned to the widest vector type, so whole
+            // vectors are loaded and stored. The last n % width elements
+            // are left to the scalar loop.
+            const std::string W = std::to_string(width);
+            const std::string rw = real + W, aw = accum + W;
+
+            s << "    const size_t m = n / " << width << ";\n"
+              << "\n"
+              << "    for(size_t i = get_global_id(0); i < m; i += get_global_size(0))\n"
+              << "        ((global " << rw << "*)v0)[i] = convert_" << rw << "(\n";
+            for(unsigned i = 1; i <= m; ++i)
+                s << "            a" << i << " * convert_" << aw
+                  << "(((global const " << rw << "*)v" << i << ")[i])"
+                  << (i < m ? " +\n" : ");\n");
+            s << "\n"
+              << "    for(size_t i = " << width << " * m + get_global_id(0); i < n; i += get_global_size(0))\n";
+        } else {
+            s << "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0))\n";
+        }
+
+        s << "        v0[i] = (" << real << ")(\n";
+        for(unsigned i = 1; i <= m; ++i)
+            s << "            a" << i << " * v" << i << "[i]" << (i < m ? " +\n" : ");\n");
+        s << "}\n\n";
+    }
+
+    return s.str();
+}
+
+} // namespace clbuf
@@ -0,0 +1,64 @@
+#ifndef CLBUF_KERNELS_HPP
+#define CLBUF_KERNELS_HPP
+
+// Sources of the library kernels, generated for the value type of the
+// vectors and the type the linear combinations are accumulated in. Kernel
+// names carry a type suffix (scale_sum2_fd: float vectors, double
+// coefficients) and the vector width (scale_sum2_dd4: loads of double4), so
+// the variants for different types may live in one context.
+
+#include <string>
+#include <vector>
+
+namespace clbuf {
+
+template <typename T> struct type_name;
+
+template <> struct type_name<float> {
+    static const char* cl()   { return "float"; }
+    static char        code() { return 'f'; }
+};
+
+template <> struct type_name<double> {
+    static const char* cl()   { return "double"; }
+    static char        code() { return 'd'; }
+};
+
+// scale_sum2 ... scale_sum5 for vectors of real, accumulated in accum.
+// With width > 1 (2, 4 or 8) the kernels load and store whole vectors of
+// width elements and do the remainder one by one; n / width work-items are
+// enough.
+std::string scale_sum_source(const std::string &real, const std::string &accum,
+        const std::string &suffix, unsigned width = 1);
+
+template <typename T, typename A>
+struct kernels {
+    // _fd for width 1, _fd2 ... _fd8 for the vector variants.
+    static std::string suffix(unsigned width = 1) {
+        std::string s = std::string("_") + type_name<T>::code() + type_name<A>::code();
+        return width > 1 ? s + std::to_string(width) : s;
+    }
+
+    static std::string source(unsigned width = 1) {
+        return scale_sum_source(type_name<T>::cl(), type_name<A>::cl(),
+                suffix(width), width);
+    }
+
+    // Name of scale_sum<m>, 2 <= m <= 5, of the given width.
+    static const std::string& scale_sum(unsigned m, unsigned width = 1) {
+        static const std::vector<std::string> name = [] {
+            std::vector<std::string> n;
+            for(unsigned w = 1; w <= 8; w *= 2)
+                for(unsigned m = 2; m <= 5; ++m)
+                    n.push_back("scale_sum" + std::to_string(m) + suffix(w));
+            return n;
+        }();
+
+        const unsigned k = (width >= 2) + (width >= 4) + (width >= 8);
+        return name[4 * k + m - 2];
+    }
+};
+
+} // namespace clbuf
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef CLBUF_OPERATIONS_HPP
+#define CLBUF_OPERATIONS_HPP
+
+// odeint operations on clbuf vectors. The linear combinations are evaluated
+// in Accum precision (the state type when void) and rounded to the state
+// type on store. Kernels run on the queue of the result and wait for the
+// operands written on other queues. The kernels for a type are built on
+// first use; call compile<T>() to build them up front.
+
+#include <type_traits>
+
+#include "clbuf/vector.hpp"
+#include "clbuf/kernels.hpp"
+#include "vt_user.h"
+
+namespace clbuf {
+
+template <typename Accum = void>
+struct basic_operations {
+    template <typename T>
+    struct accum {
+        typedef typename std::conditional<std::is_void<Accum>::value, T, Accum>::type type;
+    };
+
+    template <typename T>
+    static void compile(context &ctx) {
+        ctx.build(kernels<T, typename accum<T>::type>::source(ctx.vector_width(sizeof(T))));
+    }
+
+    // v1 = sum a[i] * v[i], with m = sizeof...(V) terms.
+    template <typename A, typename T1, class... V>
+    static void scale_sum(const char *name, const A *a,
+            vector<T1> &v1, const V&... v)
+    {
+        const unsigned m = sizeof...(V);
+
+        context &ctx = *v1.ctx;
+
+        const unsigned w = ctx.vector_width(sizeof(T1));
+
+        const std::string &kname = kernels<T1, A>::scale_sum(m, w);
+        if (!ctx.has_kernel(kname)) ctx.build(kernels<T1, A>::source(w));
+
+        cl::Kernel &krn = ctx.kernel(kname);
+
+        VT_USER_START(name);
+
+        uint pos = 0;
+        krn.setArg(pos++, v1.n);
+        krn.setArg(pos++, v1.data);
+
+        int expand[] = { 0, (krn.setArg(pos++, v.data), 0)... };
+        (void)expand;
+
+        for(unsigned i = 0; i < m; ++i) krn.setArg(pos++, a[i]);
+
+        // Tuned per kernel, traced per caller.
+        v1.ready = ctx.launch(v1.queue, krn, (v1.n + w - 1) / w, kname, name,
+                wait_list(v1.queue, v...));
+
+        VT_USER_END(name);
+
+        size_t bytes[] = { v1.n * sizeof(T1), v.n * sizeof(typename V::value_type)... };
+        for(unsigned i = 0; i <= m; ++i) ctx.bytes_touched += bytes[i];
+    }
+
+    template< class Fac1 = double , class Fac2 = Fac1 >
+    struct scale_sum2
+    {
+        const Fac1 m_alpha1;
+        const Fac2 m_alpha2;
+
+        scale_sum2( Fac1 alpha1 , Fac2 alpha2 )
+            : m_alpha1( alpha1 ) , m_alpha2( alpha2 )
+        { }
+
+        template< class T1 , class T2 , class T3 >
+        void operator()(vector<T1> &v1 ,
+                  const vector<T2> &v2 ,
+                  const vector<T3> &v3
+                  ) const
+        {
+            typedef typename accum<T1>::type A;
+
+            const A a[] = { A(m_alpha1), A(m_alpha2) };
+
+            scale_sum("scale_sum2", a, v1, v2, v3);
+        }
+
+        typedef void result_type;
+    };
+
+    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 >
+    struct scale_sum3
+    {
+        const Fac1 m_alpha1;
+        const Fac2 m_alpha2;
+        const Fac3 m_alpha3;
+
+        scale_sum3( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 )
+            : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 )
+        { }
+
+        template< class T1 , class T2 , class T3 , class T4 >
+        void operator()(vector<T1> &v1 ,
+                  const vector<T2> &v2 ,
+                  const vector<T3> &v3 ,
+                  const vector<T4> &v4
+                  ) const
+        {
+            typedef typename accum<T1>::type A;
+
+            const A a[] = { A(m_alpha1), A(m_alpha2), A(m_alpha3) };
+
+            scale_sum("scale_sum3", a, v1, v2, v3, v4);
+        }
+
+        typedef void result_type;
+    };
+
+    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 , class Fac4 = Fac3 >
+    struct scale_sum4
+    {
+        const Fac1 m_alpha1;
+        const Fac2 m_alpha2;
+        const Fac3 m_alpha3;
+        const Fac4 m_alpha4;
+
+        scale_sum4( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 , Fac4 alpha4 )
+        : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 ) , m_alpha4( alpha4 ) { }
+
+        template< class T1 , class T2 , class T3 , class T4 , class T5 >
+        void operator()(vector<T1> &v1 ,
+                  const vector<T2> &v2 ,
+                  const vector<T3> &v3 ,
+                  const vector<T4> &v4 ,
+                  const vector<T5> &v5
+                  ) const
+        {
+            typedef typename accum<T1>::type A;
+
+            const A a[] = { A(m_alpha1), A(m_alpha2), A(m_alpha3), A(m_alpha4) };
+
+            scale_sum("scale_sum4", a, v1, v2, v3, v4, v5);
+        }
+
+        typedef void result_type;
+    };
+
+    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 , class Fac4 = Fac3 , class Fac5 = Fac4 >
+    struct scale_sum5
+    {
+        const Fac1 m_alpha1;
+        const Fac2 m_alpha2;
+        const Fac3 m_alpha3;
+        const Fac4 m_alpha4;
+        const Fac5 m_alpha5;
+
+        scale_sum5( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 , Fac4 alpha4 , Fac5 alpha5 )
+        : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 ) , m_alpha4( alpha4 ) , m_alpha5( alpha5 ) { }
+
+        template< class T1 , class T2 , class T3 , class T4 , class T5 , class T6 >
+        void operator()(vector<T1> &v1 ,
+                const vector<T2> &v2 ,
+                const vector<T3> &v3 ,
+                const vector<T4> &v4 ,
+                const vector<T5> &v5 ,
+                const vector<T6> &v6
+                ) const
+        {
+            typedef typename accum<T1>::type A;
+
+            const A a[] = { A(m_alpha1), A(m_alpha2), A(m_alpha3), A(m_alpha4), A(m_alpha5) };
+
+            scale_sum("scale_sum5", a, v1, v2, v3, v4, v5, v6);
+        }
+
+        typedef void result_type;
+    };
+};
+
+typedef basic_operations<> operations;
+
+} // namespace clbuf
+
+#endif
@@ -0,0 +1,87 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include "clbuf/pool.hpp"
+
+namespace clbuf {
+
+size_t pool::size_class(size_t bytes) {
+    const size_t min = 256;
+
+    if (bytes <= min) return min;
+
+    size_t p = min;
+    while (p <= bytes / 2) p *= 2;
+
+    size_t step = p / 4;
+    return (bytes + step - 1) / step * step;
+}
+
+cl::Buffer pool::acquire(unsigned queue, size_t bytes) {
+    const size_t c = size_class(bytes);
+
+    free_list::iterator f = free.find(std::make_pair(queue, c));
+
+    cl::Buffer buf;
+
+    if (f == free.end()) {
+        buf = cl::Buffer(ctx, CL_MEM_READ_WRITE, c);
+        ++used.allocations;
+    } else {
+        buf = f->second;
+        free.erase(f);
+
+        used.cached -= c;
+        ++used.reuses;
+    }
+
+    used.current += c;
+    used.peak     = std::max(used.peak, used.current);
+
+    return buf;
+}
+
+void pool::release(unsigned queue, size_t bytes, const cl::Buffer &buf) {
+    const size_t c = size_class(bytes);
+
+    free.insert(std::make_pair(std::make_pair(queue, c), buf));
+
+    used.current -= c;
+    used.cached  += c;
+}
+
+void pool::clear() {
+    free.clear();
+    used.cached = 0;
+}
+
+pool::usage& pool::usage::operator+=(const usage &u) {
+    current     += u.current;
+    peak        += u.peak;
+    cached      += u.cached;
+    allocations += u.allocations;
+    reuses      += u.reuses;
+    return *this;
+}
+
+std::ostream& operator<<(std::ostream &os, const pool::usage &u) {
+    const double MB = 1024.0 * 1024.0;
+
+    std::ios_base::fmtflags f = os.flags();
+    std::streamsize         p = os.precision();
+
+    os << std::fixed << std::setprecision(2)
+       << "current " << u.current / MB << " MB, "
+       << "peak "    << u.peak    / MB << " MB, "
+       << "cached "  << u.cached  / MB << " MB, "
+       << u.allocations << " allocations, "
+       << u.reuses      << " reuses";
+
+    os.flags(f);
+    os.precision(p);
+
+    return os;
+}
+
+} // namespace clbuf
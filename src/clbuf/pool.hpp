@@ -0,0 +1,64 @@
+#ifndef CLBUF_POOL_HPP
+#define CLBUF_POOL_HPP
+
+// Recycles device buffers of a context. odeint resizes its internal
+// temporaries every time a stepper is created, so without the pool every
+// integration would allocate fresh buffers.
+//
+// Requests are rounded up to size classes, four per power of two, so that
+// ensembles of slightly different sizes share buffers while at most a
+// quarter of a buffer goes unused. Free buffers are kept per size class and
+// per queue, and are only handed out for the same queue again: the
+// in-order queue then takes care of the commands still pending on a
+// released buffer.
+
+#include <map>
+#include <utility>
+#include <iosfwd>
+
+#include <vexcl/util.hpp>
+
+namespace clbuf {
+
+class pool {
+    public:
+        // Bytes are counted in size classes, not in requested sizes.
+        struct usage {
+            size_t current;     // handed out
+            size_t peak;        // maximum of current
+            size_t cached;      // held in the free lists
+            size_t allocations; // buffers created
+            size_t reuses;      // requests served from the free lists
+
+            usage() : current(0), peak(0), cached(0), allocations(0), reuses(0) {}
+
+            usage& operator+=(const usage &u);
+        };
+
+        explicit pool(const cl::Context &ctx) : ctx(ctx) {}
+
+        cl::Buffer acquire(unsigned queue, size_t bytes);
+
+        void release(unsigned queue, size_t bytes, const cl::Buffer &buf);
+
+        // Frees all the unused buffers.
+        void clear();
+
+        const usage& stats() const {
+            return used;
+        }
+
+        static size_t size_class(size_t bytes);
+    private:
+        typedef std::multimap<std::pair<unsigned, size_t>, cl::Buffer> free_list;
+
+        cl::Context ctx;
+        free_list   free;
+        usage       used;
+};
+
+std::ostream& operator<<(std::ostream &os, const pool::usage &u);
+
+} // namespace clbuf
+
+#endif
@@ -0,0 +1,53 @@
+#include <sstream>
+
+#include "clbuf/reduce.hpp"
+
+namespace clbuf {
+
+std::string reduce_source(const std::string &name, const std::string &args,
+        unsigned quantities, const std::string &body, size_t wgsize)
+{
+    std::ostringstream s;
+
+    s << "kernel void " << name << "(\n"
+      << "    ulong n,\n"
+      << "    global accum *partial,\n"
+      << "    " << args << "\n"
+      << "    )\n"
+      << "{\n"
+      << "    const size_t seg = get_global_id(1);\n"
+      << "    const size_t lid = get_local_id(0);\n"
+      << "\n"
+      << "    accum sum[" << quantities << "];\n"
+      << "    for(int k = 0; k < " << quantities << "; ++k) sum[k] = 0;\n"
+      << "\n"
+      << "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+      << "        accum v[" << quantities << "];\n"
+      << "        {\n"
+      << body
+      << "        }\n"
+      << "        for(int k = 0; k < " << quantities << "; ++k) sum[k] += v[k];\n"
+      << "    }\n"
+      << "\n"
+      << "    local accum buf[" << wgsize << "];\n"
+      << "\n"
+      << "    for(int k = 0; k < " << quantities << "; ++k) {\n"
+      << "        buf[lid] = sum[k];\n"
+      << "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+      << "\n"
+      << "        for(size_t w = " << wgsize / 2 << "; w > 0; w >>= 1) {\n"
+      << "            if (lid < w) buf[lid] += buf[lid + w];\n"
+      << "            barrier(CLK_LOCAL_MEM_FENCE);\n"
+      << "        }\n"
+      << "\n"
+      << "        if (lid == 0)\n"
+      << "            partial[(seg * get_num_groups(0) + get_group_id(0)) * "
+      << quantities << " + k] = buf[0];\n"
+      << "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+      << "    }\n"
+      << "}\n\n";
+
+    return s.str();
+}
+
+} // namespace clbuf
@@ -0,0 +1,84 @@
+#ifndef CLBUF_REDUCE_HPP
+#define CLBUF_REDUCE_HPP
+
+// Sums of a few quantities over the sites of a state, reduced on the
+// device so that only the sums are read back.
+//
+// reduce_source() wraps the body of a per-site loop into a kernel
+//
+//   kernel void name(ulong n, global accum *partial, <args>)
+//
+// The body sees the site i < n and the segment seg (the second dimension
+// of the range) and sets v[0] ... v[quantities - 1]. Every work group sums
+// its sites in local memory and writes one partial sum per quantity, which
+// reduction then reads and adds up on the host. The source expects the
+// PRECISION_CL_PREAMBLE types.
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "clbuf/vector.hpp"
+
+namespace clbuf {
+
+// wgsize is the work group size the kernel will be launched with, a power
+// of two.
+std::string reduce_source(const std::string &name, const std::string &args,
+        unsigned quantities, const std::string &body, size_t wgsize);
+
+template <typename Accum>
+class reduction {
+    public:
+        // Reduces segments segments of n sites each.
+        reduction(context &ctx, size_t n, unsigned quantities,
+                size_t segments = 1, unsigned q = 0)
+            : ctx(ctx), n(n), Q(quantities), segments(segments),
+              groups(std::max<size_t>(1, std::min<size_t>(
+                        alignup(n, ctx.wgsize) / ctx.wgsize,
+                        4 * ctx.device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>()))),
+              partial(ctx, segments * groups * quantities, q),
+              host(segments * groups * quantities)
+        { }
+
+        // Sets the first two arguments of krn (the others are up to the
+        // caller), runs it after the events in wait and returns the sums,
+        // quantities per segment.
+        std::vector<double> operator()(cl::Kernel &krn, const char *name,
+                const std::vector<cl::Event> &wait = std::vector<cl::Event>())
+        {
+            krn.setArg(0, static_cast<cl_ulong>(n));
+            krn.setArg(1, partial.data);
+
+            partial.ready = ctx.launch(partial.queue, krn,
+                    cl::NDRange(groups * ctx.wgsize, segments),
+                    cl::NDRange(ctx.wgsize, 1), name, wait);
+
+            partial.read(host);
+
+            std::vector<double> sum(segments * Q, 0.0);
+            for(size_t s = 0; s < segments; ++s)
+                for(size_t g = 0; g < groups; ++g)
+                    for(unsigned k = 0; k < Q; ++k)
+                        sum[s * Q + k] += host[(s * groups + g) * Q + k];
+
+            return sum;
+        }
+
+        unsigned queue() const {
+            return partial.queue;
+        }
+    private:
+        context  &ctx;
+        size_t    n;
+        unsigned  Q;
+        size_t    segments;
+        size_t    groups;
+
+        vector<Accum>      partial;
+        std::vector<Accum> host;
+};
+
+} // namespace clbuf
+
+#endif
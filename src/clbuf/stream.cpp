@@ -0,0 +1,133 @@
+#include <stdexcept>
+#include <algorithm>
+
+#include "clbuf/stream.hpp"
+
+namespace clbuf {
+
+// Transfers go through the last queue of the context, which is added when
+// the context has only one.
+stream::stream(context &ctx, const std::string &path,
+        size_t scalar, size_t size, unsigned every, transform f)
+    : ctx(ctx),
+      copy_queue(ctx.queue.size() > 1 ? ctx.queue.size() - 1 : ctx.add_queue()),
+      bytes(scalar * size), K(std::max(every, 1U)), f(f),
+      file(std::fopen(path.c_str(), "wb")), next(0), calls(0), done(false)
+{
+    if (!file) throw std::runtime_error("clbuf: can not open " + path);
+
+    const char         magic[8] = { 'C', 'L', 'B', 'U', 'F', 'T', 'R', 'J' };
+    const unsigned int version  = 1;
+    const unsigned int scalar32 = scalar;
+    const unsigned long long size64 = size;
+
+    std::fwrite(magic,     1,                 8, file);
+    std::fwrite(&version,  sizeof(version),   1, file);
+    std::fwrite(&scalar32, sizeof(scalar32),  1, file);
+    std::fwrite(&size64,   sizeof(size64),    1, file);
+
+    for(int i = 0; i < 2; ++i) {
+        slot &s = slots[i];
+
+        s.staging = cl::Buffer(ctx.ctx, CL_MEM_READ_WRITE, bytes);
+        s.pinned  = cl::Buffer(ctx.ctx, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bytes);
+        s.host    = ctx.queue[copy_queue].enqueueMapBuffer(s.pinned, CL_TRUE,
+                CL_MAP_READ | CL_MAP_WRITE, 0, bytes);
+        s.busy    = false;
+    }
+
+    writer = std::thread(&stream::write, this);
+}
+
+stream::~stream() {
+    {
+        std::lock_guard<std::mutex> lock(mx);
+        done = true;
+    }
+    cv.notify_all();
+    writer.join();
+
+    for(int i = 0; i < 2; ++i)
+        ctx.queue[copy_queue].enqueueUnmapMemObject(slots[i].pinned, slots[i].host);
+    ctx.queue[copy_queue].finish();
+
+    std::fclose(file);
+}
+
+void stream::record(double t, unsigned q, const buffer_list &parts)
+{
+    size_t total = 0;
+    for(size_t i = 0; i < parts.size(); ++i) total += parts[i].second;
+
+    if (total != bytes)
+        throw std::length_error("clbuf: state does not match the stream frame");
+
+    slot &s = slots[next];
+    next ^= 1;
+
+    {
+        std::unique_lock<std::mutex> lock(mx);
+        while(s.busy) cv.wait(lock);
+        s.busy = true;
+    }
+
+    std::vector<cl::Event> copied(1);
+
+    size_t offset = 0;
+    for(size_t i = 0; i < parts.size(); ++i) {
+        ctx.queue[q].enqueueCopyBuffer(parts[i].first, s.staging,
+                0, offset, parts[i].second, 0,
+                i + 1 == parts.size() ? &copied[0] : 0);
+
+        offset += parts[i].second;
+    }
+
+    ctx.queue[copy_queue].enqueueReadBuffer(s.staging, CL_FALSE, 0, bytes,
+            s.host, &copied, &s.read);
+
+    // The writer thread waits on the read, so both have to be submitted.
+    ctx.queue[q].flush();
+    ctx.queue[copy_queue].flush();
+
+    s.t    = t;
+    s.step = calls - 1;
+
+    {
+        std::lock_guard<std::mutex> lock(mx);
+        pending.push_back(&s);
+    }
+    cv.notify_all();
+}
+
+void stream::write() {
+    for(;;) {
+        slot *s;
+
+        {
+            std::unique_lock<std::mutex> lock(mx);
+            while(pending.empty() && !done) cv.wait(lock);
+            if (pending.empty()) return;
+
+            s = pending.front();
+            pending.pop_front();
+        }
+
+        s->read.wait();
+
+        if (f) f(s->host);
+
+        const unsigned long long step = s->step;
+
+        std::fwrite(&s->t,   sizeof(double), 1,     file);
+        std::fwrite(&step,   sizeof(step),   1,     file);
+        std::fwrite(s->host, 1,              bytes, file);
+
+        {
+            std::lock_guard<std::mutex> lock(mx);
+            s->busy = false;
+        }
+        cv.notify_all();
+    }
+}
+
+} // namespace clbuf
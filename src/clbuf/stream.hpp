@@ -0,0 +1,114 @@
+#ifndef CLBUF_STREAM_HPP
+#define CLBUF_STREAM_HPP
+
+// Streams the state of an integration to a file while the integration goes
+// on. Pass stream_observer() to integrate_const(); every K-th call (the
+// initial state included) records a frame:
+//
+//   1. the state is copied into a device staging buffer on its own queue,
+//      which is fast and lets the next steps overwrite the state;
+//   2. a second queue reads the staging buffer into pinned host memory
+//      without blocking;
+//   3. a writer thread waits for the read and appends the frame to the
+//      file.
+//
+// There are two staging/pinned slots, so the compute queue is only held up
+// when the writer falls two frames behind.
+//
+// File format (native byte order):
+//
+//   header:  char     magic[8]   "CLBUFTRJ"
+//            uint32   version    1
+//            uint32   scalar     sizeof of an element (4 or 8)
+//            uint64   size       elements per frame
+//   frames:  double   t
+//            uint64   step
+//            scalar   x[size]
+//
+// States made of several vectors (the coordinates and momenta of the
+// symplectic steppers) are written one after another.
+
+#include <string>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+
+#include "clbuf/vector.hpp"
+
+namespace clbuf {
+
+class stream {
+    public:
+        // Called on the writer thread with each frame before it is written,
+        // e.g. to undo a permutation of the state.
+        typedef std::function<void(void *frame)> transform;
+
+        stream(context &ctx, const std::string &path,
+                size_t scalar, size_t size, unsigned every,
+                transform f = transform());
+
+        // Waits for the pending frames.
+        ~stream();
+
+        // Counts an observation and tells if it has to be recorded.
+        bool due() {
+            return calls++ % K == 0;
+        }
+
+        // Records the buffers (bytes each) written on queue q as one frame
+        // of the current observation.
+        void record(double t, unsigned q, const buffer_list &parts);
+    private:
+        struct slot {
+            cl::Buffer staging;
+            cl::Buffer pinned;
+            void      *host;
+            cl::Event  read;
+            double     t;
+            size_t     step;
+            bool       busy;
+        };
+
+        context    &ctx;
+        unsigned    copy_queue;
+        size_t      bytes;
+        unsigned    K;
+        transform   f;
+        std::FILE  *file;
+
+        slot        slots[2];
+        unsigned    next;
+        size_t      calls;
+
+        std::deque<slot*>       pending;
+        std::mutex              mx;
+        std::condition_variable cv;
+        bool                    done;
+        std::thread             writer;
+
+        void write();
+
+        stream(const stream&);
+        stream& operator=(const stream&);
+};
+
+// odeint observer. Copies are cheap and share the stream (and its count of
+// observations).
+class stream_observer {
+    public:
+        stream_observer(stream &s) : s(&s) {}
+
+        template <class State>
+        void operator()(const State &x, double t) {
+            if (s->due()) s->record(t, queue_of(x), parts(x));
+        }
+    private:
+        stream *s;
+};
+
+} // namespace clbuf
+
+#endif
@@ -0,0 +1,139 @@
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <limits>
+
+#include "clbuf/symbolic.hpp"
+
+namespace clbuf {
+
+namespace {
+
+std::ostream *recorder = 0;
+size_t        counter  = 0;
+
+std::ostream& out() {
+    if (!recorder) throw std::logic_error("clbuf::symbolic: not recording");
+    return *recorder;
+}
+
+std::string next_name() {
+    std::ostringstream s;
+    s << "v" << counter++;
+    return s.str();
+}
+
+std::string call(const char *f, const symbolic &x) {
+    return std::string(f) + "(" + x.str() + ")";
+}
+
+std::string call(const char *f, const symbolic &x, const symbolic &y) {
+    return std::string(f) + "(" + x.str() + ", " + y.str() + ")";
+}
+
+std::string binary(const symbolic &a, const char *op, const symbolic &b) {
+    return a.str() + " " + op + " " + b.str();
+}
+
+} // namespace
+
+void symbolic::record(std::ostream &os) {
+    recorder = &os;
+    counter  = 0;
+}
+
+void symbolic::stop() {
+    recorder = 0;
+}
+
+symbolic symbolic::declare(const std::string &e) {
+    std::string name = next_name();
+    out() << "real " << name << " = " << e << ";\n";
+    return symbolic(name, true);
+}
+
+symbolic symbolic::bind(const std::string &name, bool parameter) {
+    return symbolic(name, !parameter);
+}
+
+symbolic::symbolic() : expr(next_name()), lvalue(true) {
+    out() << "real " << expr << ";\n";
+}
+
+symbolic::symbolic(const symbolic &x) : expr(next_name()), lvalue(true) {
+    out() << "real " << expr << " = " << x.expr << ";\n";
+}
+
+symbolic::symbolic(double v) : lvalue(false) {
+    std::ostringstream s;
+    s.precision(std::numeric_limits<double>::digits10 + 2);
+    s << "(real)" << v;
+    expr = s.str();
+}
+
+symbolic& symbolic::operator=(const symbolic &x) {
+    if (!lvalue)
+        throw std::logic_error("clbuf::symbolic: assignment to " + expr);
+
+    if (&x != this) out() << expr << " = " << x.expr << ";\n";
+    return *this;
+}
+
+symbolic& symbolic::operator+=(const symbolic &x) {
+    return *this = *this + x;
+}
+
+symbolic& symbolic::operator-=(const symbolic &x) {
+    return *this = *this - x;
+}
+
+symbolic& symbolic::operator*=(const symbolic &x) {
+    return *this = *this * x;
+}
+
+symbolic& symbolic::operator/=(const symbolic &x) {
+    return *this = *this / x;
+}
+
+symbolic operator+(const symbolic &a, const symbolic &b) {
+    return symbolic::declare(binary(a, "+", b));
+}
+
+symbolic operator-(const symbolic &a, const symbolic &b) {
+    return symbolic::declare(binary(a, "-", b));
+}
+
+symbolic operator*(const symbolic &a, const symbolic &b) {
+    return symbolic::declare(binary(a, "*", b));
+}
+
+symbolic operator/(const symbolic &a, const symbolic &b) {
+    return symbolic::declare(binary(a, "/", b));
+}
+
+symbolic operator-(const symbolic &a) {
+    return symbolic::declare("-" + a.str());
+}
+
+symbolic operator+(const symbolic &a) {
+    return a;
+}
+
+symbolic sin (const symbolic &x) { return symbolic::declare(call("sin",  x)); }
+symbolic cos (const symbolic &x) { return symbolic::declare(call("cos",  x)); }
+symbolic tan (const symbolic &x) { return symbolic::declare(call("tan",  x)); }
+symbolic exp (const symbolic &x) { return symbolic::declare(call("exp",  x)); }
+symbolic log (const symbolic &x) { return symbolic::declare(call("log",  x)); }
+symbolic sqrt(const symbolic &x) { return symbolic::declare(call("sqrt", x)); }
+symbolic fabs(const symbolic &x) { return symbolic::declare(call("fabs", x)); }
+symbolic tanh(const symbolic &x) { return symbolic::declare(call("tanh", x)); }
+
+symbolic pow (const symbolic &x, const symbolic &y) { return symbolic::declare(call("pow",  x, y)); }
+symbolic fmin(const symbolic &x, const symbolic &y) { return symbolic::declare(call("fmin", x, y)); }
+symbolic fmax(const symbolic &x, const symbolic &y) { return symbolic::declare(call("fmax", x, y)); }
+
+std::ostream& operator<<(std::ostream &os, const symbolic &x) {
+    return os << x.str();
+}
+
+} // namespace clbuf
@@ -0,0 +1,93 @@
+#ifndef CLBUF_SYMBOLIC_HPP
+#define CLBUF_SYMBOLIC_HPP
+
+// Scalars that record the arithmetic done on them as OpenCL statements, so
+// that host code written for plain numbers (an odeint stepper calling a
+// system functor) becomes the body of a kernel (see ensemble.hpp).
+//
+// Every result is a new local variable of type real:
+//
+//   symbolic a = symbolic::bind("x"), b = symbolic::bind("y");
+//   a = a + 2 * b;     // real v0 = (real)2 * y;
+//                      // real v1 = x + v0;
+//                      // x = v1;
+//
+// Default and copy construction declare a variable too, which is what the
+// temporaries of a stepper need. Numbers convert to constants, so mixed
+// arithmetic works, but constants and bound parameters can not be assigned
+// to. There are no comparisons: the recorded code has no branches.
+//
+// Recording goes to one stream at a time; symbolic values must not be
+// created outside of record() and stop().
+
+#include <iosfwd>
+#include <string>
+
+namespace clbuf {
+
+class symbolic {
+    public:
+        // A new variable, not initialized.
+        symbolic();
+
+        // A new variable, initialized from x.
+        symbolic(const symbolic &x);
+
+        // A constant.
+        symbolic(double v);
+
+        // A variable or parameter the kernel around the body declares.
+        // Parameters are read only.
+        static symbolic bind(const std::string &name, bool parameter = false);
+
+        symbolic& operator=(const symbolic &x);
+
+        symbolic& operator+=(const symbolic &x);
+        symbolic& operator-=(const symbolic &x);
+        symbolic& operator*=(const symbolic &x);
+        symbolic& operator/=(const symbolic &x);
+
+        const std::string& str() const {
+            return expr;
+        }
+
+        // Starts recording statements to os, numbering the variables from
+        // zero.
+        static void record(std::ostream &os);
+        static void stop();
+
+        // Declares a new variable holding the expression e.
+        static symbolic declare(const std::string &e);
+    private:
+        std::string expr;
+        bool        lvalue;
+
+        symbolic(const std::string &e, bool lvalue) : expr(e), lvalue(lvalue) {}
+};
+
+symbolic operator+(const symbolic &a, const symbolic &b);
+symbolic operator-(const symbolic &a, const symbolic &b);
+symbolic operator*(const symbolic &a, const symbolic &b);
+symbolic operator/(const symbolic &a, const symbolic &b);
+symbolic operator-(const symbolic &a);
+symbolic operator+(const symbolic &a);
+
+// OpenCL built-ins, found by argument dependent lookup from functors that
+// also call them on numbers or SIMD types.
+symbolic sin  (const symbolic &x);
+symbolic cos  (const symbolic &x);
+symbolic tan  (const symbolic &x);
+symbolic exp  (const symbolic &x);
+symbolic log  (const symbolic &x);
+symbolic sqrt (const symbolic &x);
+symbolic fabs (const symbolic &x);
+symbolic tanh (const symbolic &x);
+symbolic pow  (const symbolic &x, const symbolic &y);
+symbolic fmin (const symbolic &x, const symbolic &y);
+symbolic fmax (const symbolic &x, const symbolic &y);
+
+std::ostream& operator<<(std::ostream &os, const symbolic &x);
+
+} // namespace clbuf
+
+#endif
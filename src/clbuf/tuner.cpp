@@ -0,0 +1,160 @@
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <limits>
+#include <chrono>
+
+#include "clbuf/context.hpp"
+#include "clbuf/tuner.hpp"
+#include "program_cache.hpp"
+
+namespace clbuf {
+
+namespace {
+
+const std::string& directory() {
+    static const std::string dir = program_cache::cache_directory("CL_TUNE_CACHE", "cltune");
+    return dir;
+}
+
+// Seconds per launch of krn with the given ranges.
+double time_launch(const cl::CommandQueue &q, const cl::Kernel &krn,
+        size_t global, size_t local)
+{
+    const int reps = 5;
+
+    q.enqueueNDRangeKernel(krn, cl::NullRange, global, local);
+    q.finish();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < reps; ++i)
+        q.enqueueNDRangeKernel(krn, cl::NullRange, global, local);
+    q.finish();
+
+    return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count() / reps;
+}
+
+} // namespace
+
+size_t launch_config::global(size_t n, size_t units) const {
+    size_t g = alignup((n + per_item - 1) / per_item, wgsize);
+    if (grid) g = std::min(g, grid * units * wgsize);
+    return std::max(g, wgsize);
+}
+
+tuner::tuner(const cl::Device &device)
+    : device(device), cu(device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>())
+{
+    key = device.getInfo<CL_DEVICE_NAME>() + "\n" + device.getInfo<CL_DRIVER_VERSION>();
+
+    if (!directory().empty()) {
+        std::ostringstream p;
+        p << directory() << "/" << std::hex << std::setw(16) << std::setfill('0')
+          << program_cache::hash(key) << ".tune";
+        file = p.str();
+    }
+
+    load();
+}
+
+unsigned tuner::bucket(size_t n) {
+    unsigned b = 0;
+    while(n >>= 1) ++b;
+    return b;
+}
+
+bool tuner::find(const std::string &name, size_t n, launch_config &c) const {
+    std::map<slot, launch_config>::const_iterator i = configs.find(slot(name, bucket(n)));
+    if (i == configs.end()) return false;
+
+    c = i->second;
+    return true;
+}
+
+bool tuner::swept(const std::string &name, size_t n) const {
+    return done.count(slot(name, bucket(n))) > 0;
+}
+
+launch_config tuner::tune(const cl::CommandQueue &q, const cl::Kernel &krn,
+        const std::string &name, size_t n, const std::vector<cl::Event> &wait)
+{
+    static const unsigned grids[] = { 0, 1, 2, 4, 8, 16, 32 };
+    static const unsigned items[] = { 1, 2, 4, 8, 16 };
+
+    if (!wait.empty()) cl::Event::waitForEvents(wait);
+
+    // Work group sizes are swept from 32 (or the largest allowed, when that
+    // is smaller) up to 1024.
+    const size_t kmax = krn.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+
+    size_t top = 1;
+    while(top * 2 <= std::min<size_t>(kmax, 1024)) top *= 2;
+
+    launch_config best = { top, 0, 1 };
+    double        best_time = std::numeric_limits<double>::max();
+
+    std::set< std::pair<size_t, size_t> > tried;
+
+    for(size_t wg = std::min<size_t>(32, top); wg <= top; wg *= 2) {
+        for(size_t g = 0; g < sizeof(grids) / sizeof(grids[0]); ++g) {
+            for(size_t k = 0; k < sizeof(items) / sizeof(items[0]); ++k) {
+                launch_config c = { wg, grids[g], items[k] };
+
+                size_t global = c.global(n, cu);
+                if (!tried.insert(std::make_pair(global, wg)).second) continue;
+
+                double t = time_launch(q, krn, global, wg);
+                if (t < best_time) {
+                    best      = c;
+                    best_time = t;
+                }
+            }
+        }
+    }
+
+    configs[slot(name, bucket(n))] = best;
+    done.insert(slot(name, bucket(n)));
+
+    save();
+
+    return best;
+}
+
+// File format: the key (device name and driver version) on the first two
+// lines, then one "kernel bucket wgsize grid per_item" line per
+// configuration.
+void tuner::load() {
+    if (file.empty()) return;
+
+    std::ifstream f(file.c_str());
+    if (!f) return;
+
+    std::string name, driver;
+    if (!std::getline(f, name) || !std::getline(f, driver) || name + "\n" + driver != key)
+        return;
+
+    std::string   kernel;
+    unsigned      b;
+    launch_config c;
+
+    while(f >> kernel >> b >> c.wgsize >> c.grid >> c.per_item)
+        if (c.wgsize && c.per_item) configs[slot(kernel, b)] = c;
+}
+
+// Written to a temporary name and renamed (see program_cache::save_file),
+// so concurrent jobs may share the directory.
+void tuner::save() const {
+    if (file.empty()) return;
+
+    program_cache::save_file(directory(), file, [this](std::ofstream &f) {
+            f << key << "\n";
+            for(std::map<slot, launch_config>::const_iterator i = configs.begin(); i != configs.end(); ++i)
+                f << i->first.first << " " << i->first.second << " " << i->second.wgsize
+                  << " " << i->second.grid << " " << i->second.per_item << "\n";
+            });
+}
+
+} // namespace clbuf
@@ -0,0 +1,82 @@
+#ifndef CLBUF_TUNER_HPP
+#define CLBUF_TUNER_HPP
+
+// Launch configurations of the one dimensional kernels, tuned per device
+// and problem size.
+//
+// All the hand-written kernels loop over their elements with a stride of
+// the global size, so any global size covers the range. A configuration
+// picks the work group size, a grid limit in groups per compute unit and
+// the number of elements every work-item handles at least:
+//
+//   global = min(alignup(n / per_item, wgsize), grid * units * wgsize)
+//
+// tune() sweeps the candidates for a kernel whose arguments are set and
+// keeps the fastest. It launches the kernel many times, so it must only run
+// on a state that may be thrown away (e.g. a warm-up repetition).
+//
+// Configurations are kept per kernel name and size bucket (the power of two
+// below n), and saved per device: the file is named after the device name
+// and the driver version and lives in $CL_TUNE_CACHE, or in
+// $HOME/.cache/cltune when that is not set. CL_TUNE_CACHE=off disables it.
+// The tuner loads the file of its device on construction.
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <vexcl/util.hpp>
+
+namespace clbuf {
+
+struct launch_config {
+    size_t   wgsize;
+    unsigned grid;      // groups per compute unit at most, 0: no limit
+    unsigned per_item;  // elements per work-item at least
+
+    size_t global(size_t n, size_t units) const;
+};
+
+class tuner {
+    public:
+        explicit tuner(const cl::Device &device);
+
+        static unsigned bucket(size_t n);
+
+        // Sets c to the configuration of kernel name for n elements, when
+        // there is one.
+        bool find(const std::string &name, size_t n, launch_config &c) const;
+
+        // True when kernel name was swept for the bucket of n by this
+        // process.
+        bool swept(const std::string &name, size_t n) const;
+
+        // Sweeps the configurations of krn over n elements on q after the
+        // events in wait, then stores and saves the fastest one.
+        launch_config tune(const cl::CommandQueue &q, const cl::Kernel &krn,
+                const std::string &name, size_t n,
+                const std::vector<cl::Event> &wait = std::vector<cl::Event>());
+
+        size_t units() const {
+            return cu;
+        }
+    private:
+        typedef std::pair<std::string, unsigned> slot;
+
+        cl::Device  device;
+        size_t      cu;
+        std::string key;
+        std::string file;
+
+        std::map<slot, launch_config> configs;
+        std::set<slot>                done;
+
+        void load();
+        void save() const;
+};
+
+} // namespace clbuf
+
+#endif
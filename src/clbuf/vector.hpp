@@ -0,0 +1,167 @@
+#ifndef CLBUF_VECTOR_HPP
+#define CLBUF_VECTOR_HPP
+
+// Device vector for odeint. The buffer is taken from and returned to the
+// pool of its context, copies are deep and happen on the device. Host
+// transfers are blocking and go through the queue of the vector.
+//
+// ready is the event of the last command that wrote the vector (null when
+// there is none to wait for). Kernels writing a vector set it to their
+// launch event; commands on other queues that use the vector collect it
+// with wait_list(). Only writes are tracked: a vector read on one queue may
+// not be overwritten from another one without synchronizing first.
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include <boost/numeric/odeint/util/is_resizeable.hpp>
+#include <boost/numeric/odeint/util/resize.hpp>
+#include <boost/numeric/odeint/util/same_size.hpp>
+
+#include "clbuf/context.hpp"
+
+namespace clbuf {
+
+// Events a command on queue q has to wait for before using the vectors.
+template <class... V>
+std::vector<cl::Event> wait_list(unsigned q, const V&... v) {
+    std::vector<cl::Event> wait;
+    int expand[] = { 0, (v.depend(q, wait), 0)... };
+    (void)expand;
+    return wait;
+}
+
+template <typename T>
+struct vector {
+    typedef T value_type;
+
+    context    *ctx;
+    unsigned    queue;
+    size_t      n;
+    cl::Buffer  data;
+    cl::Event   ready;
+
+    vector() : ctx(0), queue(0), n(0) {}
+
+    vector(context &c, size_t n, unsigned q = 0)
+        : ctx(&c), queue(q), n(n)
+    {
+        if (n) data = ctx->buffers.acquire(queue, sizeof(T) * n);
+    }
+
+    vector(context &c, const std::vector<T> &host, unsigned q = 0)
+        : ctx(&c), queue(q), n(host.size())
+    {
+        if (n) {
+            data = ctx->buffers.acquire(queue, sizeof(T) * n);
+            write(host);
+        }
+    }
+
+    vector(const vector &other)
+        : ctx(other.ctx), queue(other.queue), n(other.n)
+    {
+        if (!n) return;
+
+        data = ctx->buffers.acquire(queue, sizeof(T) * n);
+
+        std::vector<cl::Event> wait = wait_list(queue, other);
+
+        cl::Event done;
+        ctx->queue[queue].enqueueCopyBuffer(other.data, data, 0, 0, sizeof(T) * n,
+                wait.empty() ? 0 : &wait, ctx->queue.size() > 1 ? &done : 0);
+        ready = done;
+    }
+
+    vector& operator=(vector other) {
+        swap(other);
+        return *this;
+    }
+
+    ~vector() {
+        if (n) ctx->buffers.release(queue, sizeof(T) * n, data);
+    }
+
+    void swap(vector &other) {
+        std::swap(ctx,   other.ctx);
+        std::swap(queue, other.queue);
+        std::swap(n,     other.n);
+        std::swap(data,  other.data);
+        std::swap(ready, other.ready);
+    }
+
+    // Blocking transfers of host.size() elements.
+    void write(const std::vector<T> &host) {
+        ctx->queue[queue].enqueueWriteBuffer(data, CL_TRUE, 0,
+                sizeof(T) * host.size(), host.data());
+        ready = cl::Event();
+    }
+
+    void read(std::vector<T> &host) const {
+        ctx->queue[queue].enqueueReadBuffer(data, CL_TRUE, 0,
+                sizeof(T) * host.size(), host.data());
+    }
+
+    // Adds the ready event to wait when commands on queue q use the vector.
+    void depend(unsigned q, std::vector<cl::Event> &wait) const {
+        if (q != queue && ready()) wait.push_back(ready);
+    }
+};
+
+// The buffers of a state, with their sizes in bytes, for the transfers of
+// whole states (see stream and checkpoint). A state is a vector, or the
+// pair of coordinates and momenta of the symplectic steppers.
+typedef std::vector< std::pair<cl::Buffer, size_t> > buffer_list;
+
+template <typename T>
+buffer_list parts(const vector<T> &x) {
+    return buffer_list(1, std::make_pair(x.data, sizeof(T) * x.n));
+}
+
+template <typename T>
+buffer_list parts(const std::pair< vector<T>, vector<T> > &x) {
+    buffer_list p;
+    p.push_back(std::make_pair(x.first.data,  sizeof(T) * x.first.n));
+    p.push_back(std::make_pair(x.second.data, sizeof(T) * x.second.n));
+    return p;
+}
+
+template <typename T>
+unsigned queue_of(const vector<T> &x) {
+    return x.queue;
+}
+
+template <typename T>
+unsigned queue_of(const std::pair< vector<T>, vector<T> > &x) {
+    return x.first.queue;
+}
+
+} // namespace clbuf
+
+namespace boost { namespace numeric { namespace odeint {
+
+template <typename T>
+struct is_resizeable< clbuf::vector<T> > : boost::true_type {};
+
+template< typename T >
+struct resize_impl< clbuf::vector<T> , clbuf::vector<T> >
+{
+    static void resize( clbuf::vector<T> &x1 , const clbuf::vector<T> &x2 )
+    {
+        clbuf::vector<T>(*x2.ctx, x2.n, x2.queue).swap(x1);
+    }
+};
+
+template< typename T >
+struct same_size_impl< clbuf::vector<T> , clbuf::vector<T> >
+{
+    static bool same_size( const clbuf::vector<T> &x1 , const clbuf::vector<T> &x2 )
+    {
+        return x1.n == x2.n && x1.ctx == x2.ctx && x1.queue == x2.queue;
+    }
+};
+
+} } }
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef CLBUF_VEXCL_HPP
+#define CLBUF_VEXCL_HPP
+
+// odeint resizing of vex::vector on top of clbuf::pool. Include instead of
+// boost/numeric/odeint/external/vexcl/vexcl_resize.hpp.
+//
+// While a clbuf::vexcl::scope is open, the vectors odeint resizes (the
+// stepper temporaries) are given pooled buffers. The buffers go back to
+// the pool when the scope closes and are picked up by the steppers of the
+// next integration, so a stepper must not outlive the scope it was used
+// in:
+//
+//   {
+//       clbuf::vexcl::scope temporaries;
+//       odeint::runge_kutta4< ... > stepper;
+//       odeint::integrate_const( stepper , ... );
+//   }
+//
+// Outside of a scope, for vectors spanning several devices and for
+// multivectors, vectors are resized as usual. There is one pool per command
+// queue; usage() sums them up.
+
+#include <map>
+#include <vector>
+#include <memory>
+
+#include <vexcl/vexcl.hpp>
+
+#include <boost/numeric/odeint/util/is_resizeable.hpp>
+#include <boost/numeric/odeint/util/resize.hpp>
+#include <boost/numeric/odeint/util/same_size.hpp>
+
+#include "clbuf/pool.hpp"
+
+namespace clbuf {
+namespace vexcl {
+
+typedef std::map<cl_command_queue, std::unique_ptr<clbuf::pool> > pool_map;
+
+inline pool_map& pools() {
+    static pool_map p;
+    return p;
+}
+
+inline clbuf::pool& pool(const cl::CommandQueue &q) {
+    std::unique_ptr<clbuf::pool> &p = pools()[q()];
+    if (!p) p.reset(new clbuf::pool(q.getInfo<CL_QUEUE_CONTEXT>()));
+    return *p;
+}
+
+// Peak is the sum of the peaks of the individual pools.
+inline clbuf::pool::usage usage() {
+    clbuf::pool::usage u;
+    for(pool_map::const_iterator p = pools().begin(); p != pools().end(); ++p)
+        u += p->second->stats();
+    return u;
+}
+
+class scope {
+    public:
+        scope() : prev(top()) {
+            top() = this;
+        }
+
+        ~scope() {
+            for(std::vector<lease>::const_iterator l = leased.begin(); l != leased.end(); ++l)
+                pool(l->queue).release(0, l->bytes, l->buffer);
+            top() = prev;
+        }
+
+        static scope* current() {
+            return top();
+        }
+
+        cl::Buffer acquire(const cl::CommandQueue &q, size_t bytes) {
+            lease l = { q, bytes, pool(q).acquire(0, bytes) };
+            leased.push_back(l);
+            return l.buffer;
+        }
+    private:
+        struct lease {
+            cl::CommandQueue queue;
+            size_t           bytes;
+            cl::Buffer       buffer;
+        };
+
+        std::vector<lease> leased;
+        scope             *prev;
+
+        static scope*& top() {
+            static scope *s = 0;
+            return s;
+        }
+
+        scope(const scope&);
+        scope& operator=(const scope&);
+};
+
+} // namespace vexcl
+} // namespace clbuf
+
+namespace boost { namespace numeric { namespace odeint {
+
+template< typename T >
+struct is_resizeable< vex::vector< T > > : boost::true_type { };
+
+template< typename T >
+struct resize_impl< vex::vector< T > , vex::vector< T > >
+{
+    static void resize( vex::vector< T > &x1 , const vex::vector< T > &x2 )
+    {
+        const std::vector< cl::CommandQueue > &q = x2.queue_list();
+        clbuf::vexcl::scope *s = clbuf::vexcl::scope::current();
+
+        if( s && q.size() == 1 )
+        {
+            vex::vector< T > tmp( q[0] , s->acquire( q[0] , sizeof( T ) * x2.size() ) , x2.size() );
+            x1.swap( tmp );
+        }
+        else
+        {
+            x1.resize( q , x2.size() );
+        }
+    }
+};
+
+template< typename T >
+struct same_size_impl< vex::vector< T > , vex::vector< T > >
+{
+    static bool same_size( const vex::vector< T > &x1 , const vex::vector< T > &x2 )
+    {
+        return x1.size() == x2.size();
+    }
+};
+
+template< typename T , size_t N >
+struct is_resizeable< vex::multivector< T , N > > : boost::true_type { };
+
+template< typename T , size_t N >
+struct resize_impl< vex::multivector< T , N > , vex::multivector< T , N > >
+{
+    static void resize( vex::multivector< T , N > &x1 , const vex::multivector< T , N > &x2 )
+    {
+        x1.resize( x2.queue_list() , x2.size() );
+    }
+};
+
+template< typename T , size_t N >
+struct same_size_impl< vex::multivector< T , N > , vex::multivector< T , N > >
+{
+    static bool same_size( const vex::multivector< T , N > &x1 , const vex::multivector< T , N > &x2 )
+    {
+        return x1.size() == x2.size();
+    }
+};
+
+} } }
+
+#endif
@@ -24,7 +24,8 @@
 #include <boost/numeric/odeint.hpp>
 #include <boost/numeric/odeint/algebra/vector_space_algebra.hpp>
 
-#include <boost/timer.hpp>
+#include "precision.hpp"
+#include "benchmark.hpp"
 
 
 namespace odeint = boost::numeric::odeint;
@@ -71,7 +72,7 @@ int main(int argc, char* argv[])
     using namespace mtl;
     mtl::vampir_trace<9999>                            tracer;
 
-    typedef double                                     value_type;
+    typedef precision::real                              value_type;
     typedef unsigned                                   size_type;
     typedef matrix::parameters<row_major, mtl::index::c_index, non_fixed::dimensions, false, size_type> para;
     // typedef mtl::compressed2D<value_type, para>              matrix_type;
@@ -81,6 +82,9 @@ int main(int argc, char* argv[])
     size_type n1 = argc > 1 ? atoi(argv[1]) : 512 /* 64 */, n2= n1, n= n1 * n2;
     const value_type K = 0.1, beta = 0.01, dt= 0.01, t_max= 100.0;
 
+    benchmark::harness bench("cmtl_disordered_lattice", n1);
+
+    bench.start("setup");
     std::vector<value_type> disorder( n );
     std::generate( disorder.begin(), disorder.end(), drand48 );
 
@@ -99,21 +103,46 @@ int main(int argc, char* argv[])
 	    }
     }
 
-    std::pair<state_type, state_type> X= std::make_pair(state_type(n, 0.0), state_type(n, 0.0));
-    X.first[ n1/2 * n2 + n2/2 ]= 1.0;
-
-    odeint::symplectic_rkn_sb3a_mclachlan<
-        state_type, state_type, value_type, state_type, state_type, value_type,
-        odeint::vector_space_algebra , odeint::default_operations
-        > stepper;
-
     disordered_lattice<value_type, matrix_type> sys( beta, A);
-    boost::timer timer;
-    odeint::integrate_const(stepper, boost::ref(sys), X, value_type(0.0), t_max, dt);
     cudaThreadSynchronize();
-    std::cout << "Integration took " << timer.elapsed() << " s\n";
+    bench.stop("setup");
+
+    value_type q0= 0, p0= 0;
+    std::vector<value_type> q;
+
+    while (bench.next()) {
+	bench.start("upload");
+	std::pair<state_type, state_type> X= std::make_pair(state_type(n, 0.0), state_type(n, 0.0));
+	X.first[ n1/2 * n2 + n2/2 ]= 1.0;
+	cudaThreadSynchronize();
+	bench.stop("upload");
+
+	bench.start("integrate");
+	odeint::symplectic_rkn_sb3a_mclachlan<
+	    state_type, state_type, value_type, state_type, state_type, value_type,
+	    odeint::vector_space_algebra , odeint::default_operations
+	    > stepper;
+
+	odeint::integrate_const(stepper, boost::ref(sys), X, value_type(0.0), t_max, dt);
+	cudaThreadSynchronize();
+	bench.stop("integrate");
+
+	bench.start("readback");
+	q0= X.first[0];
+	p0= X.second[0];
+	if (bench.checking()) {
+	    q.resize(n);
+	    for (size_type i= 0; i < n; ++i)
+		q[i]= X.first[i];
+	}
+	bench.stop("readback");
+    }
+
+    std::cout << q0 << " " << p0 << std::endl;
+
+    bench.check(q);
+
+    bench.report();
 
-    std::cout << X.first[0] << " " << X.second[0] << std::endl;
     return 0;
 }
-
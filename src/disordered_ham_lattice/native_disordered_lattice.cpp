@@ -0,0 +1,357 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <native/vector.hpp>
+#include <native/operations.hpp>
+
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "sell.hpp"
+#include "observer.hpp"
+#include "observables.hpp"
+
+#include <boost/numeric/odeint.hpp>
+
+namespace odeint = boost::numeric::odeint;
+typedef precision::real value_type;
+
+typedef native::vector<value_type> state_type;
+
+static const value_type K = 0.1;
+static const value_type beta = 0.01;
+static const value_type t_max = 100.0;
+static const value_type dt = 0.01;
+
+struct index_modulus {
+    int N;
+
+    index_modulus(int n) : N(n) {}
+
+    inline int operator()(int idx) const {
+	if( idx <  0 ) return idx + N;
+	if( idx >= N ) return idx - N;
+	return idx;
+    }
+};
+
+// The lattice operator in SELL-C-sigma format with the chunk height set to
+// the SIMD width, so that a chunk is processed with full vector loads of
+// the matrix and a gather of the coordinates. The state is kept in the
+// row order of the matrix.
+struct sys_func
+{
+    sell::matrix<value_type>   A;
+    native::vector<int>        ptr;
+    native::vector<int>        len;
+    native::vector<int>        col;
+    native::vector<value_type> val;
+    size_t n;
+
+    sys_func(int n1, int n2, const std::vector<value_type> &disorder)
+        : A(build(n1, n2, disorder)), ptr(A.ptr), len(A.len), col(A.col), val(A.val), n(A.n)
+    { }
+
+    std::vector<value_type> permute(const std::vector<value_type> &x) const {
+        return A.permute(x);
+    }
+
+    std::vector<value_type> unpermute(const std::vector<value_type> &x) const {
+        return A.unpermute(x);
+    }
+
+    // Where each site of the lattice is stored in the state.
+    std::vector<int> sites() const {
+        std::vector<int> at(n);
+        for(size_t i = 0; i < n; ++i) at[A.perm[i]] = i;
+        return at;
+    }
+
+    static sell::matrix<value_type> build(int n1, int n2,
+            const std::vector<value_type> &disorder)
+    {
+        const size_t n = n1 * n2;
+
+        std::vector<int>        row;
+        std::vector<int>        col;
+        std::vector<value_type> val;
+
+        row.reserve(n + 1);
+        col.reserve(5 * n);
+        val.reserve(5 * n);
+
+        index_modulus index(n);
+
+        row.push_back(0);
+        for( int i=0 ; i < n1 ; ++i ) {
+            for( int j=0 ; j < n2 ; ++j ) {
+                int idx = i * n2 + j;
+                int is[5] = { idx , index( idx + 1 ) , index( idx - 1 ) , index( idx - n2 ) , index( idx + n2 ) };
+                std::sort( is , is + 5 );
+                for( int k=0 ; k < 5 ; ++k ) {
+                    col.push_back(is[k]);
+                    val.push_back(is[k] == idx ? -disorder[idx] - 4.0 * K : K);
+                }
+                row.push_back(col.size());
+            }
+        }
+
+        return sell::matrix<value_type>(n, row, col, val,
+                native::simd<value_type>::width(), 256);
+    }
+
+    void operator()( const state_type &q , state_type &dp ) const
+    {
+        const int        *P = ptr.data();
+        const int        *L = len.data();
+        const int        *C = col.data();
+        const value_type *V = val.data();
+        const value_type *x = q.data();
+        value_type       *y = dp.data();
+
+        const size_t h = A.C;
+
+        // Vector iterations cover a whole chunk (i % h == 0), the scalar
+        // tail handles the lanes of the last, partial one.
+        native::simd_loop<value_type>(0, n, [=](auto v, size_t i) {
+                typedef decltype(v) W;
+
+                const size_t k   = i / h;
+                const size_t off = P[k] + i % h;
+
+                W X   = native::load<W>(x + i);
+                W sum = W(-beta) * X * X * X;
+
+                for(int j = 0; j < L[k]; ++j) {
+                    const int *c = C + off + j * h;
+                    W xc([c, x](auto l) { return x[c[l]]; });
+                    sum += native::load<W>(V + off + j * h) * xc;
+                }
+
+                native::store(sum, y + i);
+                });
+
+        native::bytes_touched +=
+            (sizeof(int) + 2 * sizeof(value_type)) * A.stored() +
+            sizeof(value_type) * 2 * n;
+    }
+};
+
+// Matrix-free lattice operator: only the diagonal (disorder and the -4K
+// of the Laplacian) is stored, the neighbour coupling is computed on the
+// fly. The lattice is swept in tiles of tile_rows rows by tile_cols
+// columns; inside a tile the three rows a row depends on stay in L1.
+//
+// Neighbours are taken modulo the flat site index, like in the matrix.
+// Only the first and the last row ever wrap around, those are done with
+// scalar code.
+struct stencil_func
+{
+    native::vector<value_type> diag;
+    size_t n1, n2, n;
+
+    static const size_t tile_rows = 64;
+    static const size_t tile_cols = 4096 / sizeof(value_type);
+
+    stencil_func(int n1, int n2, const std::vector<value_type> &disorder)
+        : n1(n1), n2(n2), n(n1 * n2)
+    {
+        std::vector<value_type> D(n);
+        for(size_t i = 0; i < n; ++i) D[i] = -disorder[i] - 4.0 * K;
+
+        native::vector<value_type>(D).swap(diag);
+    }
+
+    std::vector<value_type> permute(const std::vector<value_type> &x) const {
+        return x;
+    }
+
+    std::vector<value_type> unpermute(const std::vector<value_type> &x) const {
+        return x;
+    }
+
+    std::vector<int> sites() const {
+        return std::vector<int>();
+    }
+
+    void operator()( const state_type &q , state_type &dp ) const
+    {
+        const value_type *D = diag.data();
+        const value_type *x = q.data();
+        value_type       *y = dp.data();
+
+        const size_t    n2 = this->n2;
+        const ptrdiff_t tr = n1 > 2 ? (n1 - 2 + tile_rows - 1) / tile_rows : 0;
+        const ptrdiff_t tc = (n2 + tile_cols - 1) / tile_cols;
+
+        auto site = [=](auto v, size_t i) {
+            typedef decltype(v) V;
+
+            V X = native::load<V>(x + i);
+            V s = native::load<V>(x + i - n2) + native::load<V>(x + i - 1) +
+                  native::load<V>(x + i + 1)  + native::load<V>(x + i + n2);
+
+            native::store(V(-beta) * X * X * X + native::load<V>(D + i) * X + V(K) * s, y + i);
+        };
+
+#pragma omp parallel for collapse(2) schedule(static)
+        for(ptrdiff_t bi = 0; bi < tr; ++bi) {
+            for(ptrdiff_t bj = 0; bj < tc; ++bj) {
+                size_t i1 = std::min(n1 - 1, 1 + (bi + 1) * tile_rows);
+                size_t j0 = bj * tile_cols;
+                size_t j1 = std::min(n2, j0 + tile_cols);
+
+                for(size_t i = 1 + bi * tile_rows; i < i1; ++i)
+                    native::simd_for<value_type>(i * n2 + j0, i * n2 + j1, site);
+            }
+        }
+
+        for(size_t i : { size_t(0), n1 - 1 }) {
+            for(size_t j = 0; j < n2; ++j) {
+                size_t     k = i * n2 + j;
+                value_type X = x[k];
+                value_type s = x[(k + n - n2) % n] + x[(k + n - 1) % n] +
+                               x[(k + 1) % n]      + x[(k + n2) % n];
+
+                y[k] = -beta * X * X * X + D[k] * X + K * s;
+            }
+        }
+
+        native::bytes_touched += sizeof(value_type) * 3 * n;
+    }
+};
+
+// Energy, second moment and participation (see observables.hpp), summed
+// in place over the possibly permuted state.
+struct probe
+{
+    size_t n1, n2;
+    const std::vector<value_type> &disorder;
+    std::vector<int> at;
+
+    probe(size_t n1, size_t n2, const std::vector<value_type> &disorder,
+            const std::vector<int> &at)
+        : n1(n1), n2(n2), disorder(disorder), at(at)
+    { }
+
+    std::vector<double> operator()( const std::pair<state_type, state_type> &x , double t ) const
+    {
+        return lattice::row(lattice::sums(n1, n2, 1, K, beta, disorder.data(),
+                    at.empty() ? static_cast<const int*>(0) : at.data(),
+                    x.first.data(), x.second.data()));
+    }
+};
+
+// Samples the observables of every observe-th step into <name>.obs
+// (nothing when observe is 0).
+template <class System>
+void run(benchmark::harness &bench, System &sys,
+        const std::string &name, unsigned observe,
+        size_t n1, size_t n2, const std::vector<value_type> &disorder,
+        const std::vector<value_type> &q, const std::vector<value_type> &p,
+        std::vector<value_type> &res)
+{
+    while(bench.next()) {
+        bench.start("upload");
+        std::pair<state_type, state_type> X;
+        state_type(sys.permute(q)).swap(X.first);
+        state_type(sys.permute(p)).swap(X.second);
+        bench.stop("upload");
+
+        std::unique_ptr<observer::table> table;
+        std::unique_ptr<probe>           obs;
+        if (observe) {
+            table.reset(new observer::table(name + ".obs", lattice::columns, observe));
+            obs.reset(new probe(n1, n2, disorder, sys.sites()));
+        }
+
+        native::bytes_touched = 0;
+
+        bench.start("integrate");
+        odeint::symplectic_rkn_sb3a_mclachlan<
+            state_type , state_type , value_type , state_type , state_type , value_type ,
+                       odeint::vector_space_algebra , native::basic_operations<precision::accum>
+                           > stepper;
+
+        if (table)
+            odeint::integrate_const( stepper , std::ref( sys ) , X , value_type(0.0) , t_max , dt ,
+                    observer::sample( *table , *obs ) );
+        else
+            odeint::integrate_const( stepper , std::ref( sys ) , X , value_type(0.0) , t_max , dt );
+        bench.stop("integrate");
+
+        bench.start("readback");
+        std::copy(X.first.begin(), X.first.end(), res.begin());
+        res = sys.unpermute(res);
+        bench.stop("readback");
+
+        bench.bytes(native::bytes_touched);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const size_t n1 = argc > 1 ? atoi(argv[1]) : 64;
+    const size_t n2 = n1;
+    const size_t n = n1 * n2;
+
+    // Modes: "stencil" (matrix-free operator) and "observe=K" (write the
+    // observables of every K-th step to <name>.obs).
+    bool     stencil = false;
+    unsigned observe = 0;
+    for(int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        stencil = stencil || a == "stencil";
+        if (a.compare(0, 8, "observe=") == 0) observe = atoi(a.c_str() + 8);
+    }
+
+    try {
+        std::string name = "native_disordered_lattice";
+        if (stencil) name += "_stencil";
+        if (observe) name += "_observe";
+
+        benchmark::harness bench(name, n1);
+
+        bench.start("setup");
+
+        native::flush_denormals();
+        native::info<value_type>(std::cout) << std::endl;
+
+        std::vector<value_type> disorder( n );
+        std::generate(disorder.begin(), disorder.end(), drand48);
+
+        std::vector<value_type> q(n, 0);
+        std::vector<value_type> p(n, 0);
+        q[n1/2*n2 + n2/2] = 1;
+
+        std::unique_ptr<sys_func>     matrix;
+        std::unique_ptr<stencil_func> matrix_free;
+
+        if (stencil)
+            matrix_free.reset(new stencil_func(n1, n2, disorder));
+        else
+            matrix.reset(new sys_func(n1, n2, disorder));
+
+        bench.stop("setup");
+
+        std::vector<value_type> res( n );
+
+        if (stencil)
+            run(bench, *matrix_free, name, observe, n1, n2, disorder, q, p, res);
+        else
+            run(bench, *matrix, name, observe, n1, n2, disorder, q, p, res);
+
+        std::cout << res[0] << std::endl;
+        std::cout << "bytes io: " << native::bytes_touched << std::endl;
+
+        bench.check(res);
+
+        bench.report();
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
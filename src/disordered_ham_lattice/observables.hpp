@@ -0,0 +1,170 @@
+#ifndef DISORDERED_LATTICE_OBSERVABLES_HPP
+#define DISORDERED_LATTICE_OBSERVABLES_HPP
+
+// Observables of a batch of disordered lattices. Realization m occupies
+// sites [m * n1 * n2, (m + 1) * n1 * n2) of q, p and disorder, in the
+// lattice order of the sites.
+//
+// The Hamiltonian of the lattice is
+//
+//   H = sum_i p_i^2 / 2 + e_i q_i^2 / 2 + beta q_i^4 / 4
+//     + K / 2 sum_<ij> (q_i - q_j)^2,
+//
+// with the disorder e_i and the bonds <ij> to the neighbours i +- 1 and
+// i +- n2 (modulo the flat site index). Splitting every bond evenly between
+// its sites gives non-negative local energies E_i. Per realization:
+//
+//   energy         E = sum E_i;
+//   m2             the second moment sum |r_i - r_0|^2 E_i / E of the energy
+//                  distribution around the initially excited site r_0 =
+//                  (n1 / 2, n2 / 2);
+//   participation  P = E^2 / sum E_i^2, the number of sites the energy is
+//                  spread over.
+//
+// Every backend reduces the state where it lives to sum E_i, sum E_i^2 and
+// sum |r_i - r_0|^2 E_i (quantities per realization) and passes those to
+// finish(), which gives the rows of the observer table (see observer.hpp).
+// sums() is the host version, for the native backend and for measure(),
+// which evaluates the final state after readback; reduce_args and
+// reduce_body make the clbuf kernel (see clbuf::reduce_source()).
+
+#include <iostream>
+#include <vector>
+
+namespace lattice {
+
+const char     columns[]  = "energy\tm2\tparticipation";
+const unsigned quantities = 3;
+
+struct observables {
+    double energy;
+    double m2;
+    double participation;
+};
+
+// Site i of the lattice is stored at at[i] of q and p, or at i when at is
+// null (a matrix may keep the state permuted).
+template <typename T>
+std::vector<double> sums(size_t n1, size_t n2, size_t M,
+        T K, T beta, const T *disorder, const int *at, const T *q, const T *p)
+{
+    const long n = n1 * n2;
+
+    std::vector<double> s(M * quantities, 0.0);
+
+    for(size_t m = 0; m < M; ++m) {
+        const long off = m * n;
+
+        double s0 = 0, s1 = 0, s2 = 0;
+
+#pragma omp parallel for reduction(+:s0,s1,s2) schedule(static)
+        for(long i = 0; i < n; ++i) {
+            const long nb[4] = { i + 1, i - 1, i + (long)n2, i - (long)n2 };
+
+            double X = q[at ? at[off + i] : off + i];
+            double P = p[at ? at[off + i] : off + i];
+            double E = 0.5 * P * P + 0.5 * disorder[off + i] * X * X + 0.25 * beta * X * X * X * X;
+
+            for(int k = 0; k < 4; ++k) {
+                long   j = off + (nb[k] % n + n) % n;
+                double d = X - q[at ? at[j] : j];
+                E += 0.25 * K * d * d;
+            }
+
+            double r = double(i / (long)n2) - double(n1 / 2);
+            double c = double(i % (long)n2) - double(n2 / 2);
+
+            s0 += E;
+            s1 += E * E;
+            s2 += (r * r + c * c) * E;
+        }
+
+        s[m * quantities + 0] = s0;
+        s[m * quantities + 1] = s1;
+        s[m * quantities + 2] = s2;
+    }
+
+    return s;
+}
+
+inline std::vector<observables> finish(const std::vector<double> &s) {
+    std::vector<observables> obs(s.size() / quantities);
+
+    for(size_t m = 0; m < obs.size(); ++m) {
+        const double *S = &s[m * quantities];
+
+        obs[m].energy        = S[0];
+        obs[m].m2            = S[0] > 0 ? S[2] / S[0] : 0;
+        obs[m].participation = S[1] > 0 ? S[0] * S[0] / S[1] : 0;
+    }
+
+    return obs;
+}
+
+// Row of the observer table.
+inline std::vector<double> row(const std::vector<double> &s) {
+    std::vector<observables> obs = finish(s);
+
+    std::vector<double> r;
+    r.reserve(obs.size() * quantities);
+
+    for(size_t m = 0; m < obs.size(); ++m) {
+        r.push_back(obs[m].energy);
+        r.push_back(obs[m].m2);
+        r.push_back(obs[m].participation);
+    }
+
+    return r;
+}
+
+template <typename T>
+std::vector<observables> measure(size_t n1, size_t n2, size_t M,
+        T K, T beta, const std::vector<T> &disorder,
+        const std::vector<T> &q, const std::vector<T> &p)
+{
+    return finish(sums(n1, n2, M, K, beta, disorder.data(),
+                static_cast<const int*>(0), q.data(), p.data()));
+}
+
+inline void print(std::ostream &os, const std::vector<observables> &obs) {
+    os << "realization\tenergy\tm2\tparticipation\n";
+    for(size_t m = 0; m < obs.size(); ++m)
+        os << m << "\t" << obs[m].energy << "\t" << obs[m].m2
+           << "\t" << obs[m].participation << "\n";
+}
+
+// The range of the kernel covers the sites of one realization, the
+// realizations are the segments.
+const char reduce_args[] =
+"uint n1,\n"
+"    uint n2,\n"
+"    real K,\n"
+"    real beta,\n"
+"    global const real *disorder,\n"
+"    global const int *at,\n"
+"    global const real *q,\n"
+"    global const real *p";
+
+const char reduce_body[] =
+"            const size_t off = seg * n;\n"
+"            const size_t nb[4] = { (i + 1) % n, (i + n - 1) % n, (i + n2) % n, (i + n - n2) % n };\n"
+"\n"
+"            real X = q[at[off + i]];\n"
+"            real P = p[at[off + i]];\n"
+"            accum E = 0.5f * P * P + 0.5f * disorder[off + i] * X * X + 0.25f * beta * X * X * X * X;\n"
+"\n"
+"            for(int k = 0; k < 4; ++k) {\n"
+"                real d = X - q[at[off + nb[k]]];\n"
+"                E += 0.25f * K * d * d;\n"
+"            }\n"
+"\n"
+"            accum r = (accum)(i / n2) - (accum)(n1 / 2);\n"
+"            accum c = (accum)(i % n2) - (accum)(n2 / 2);\n"
+"\n"
+"            v[0] = E;\n"
+"            v[1] = E * E;\n"
+"            v[2] = (r * r + c * c) * E;\n";
+
+} // namespace lattice
+
+#endif
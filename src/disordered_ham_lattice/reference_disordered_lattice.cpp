@@ -4,380 +4,275 @@
 #include <tuple>
 #include <random>
 #include <algorithm>
+#include <string>
+#include <memory>
 
 #include <vexcl/devlist.hpp>
 
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "vt_user.h"
+#include "clbuf/clbuf.hpp"
+#include "sell.hpp"
+#include "observer.hpp"
+#include "observables.hpp"
+
 #include <boost/numeric/odeint.hpp>
-#include <boost/numeric/odeint/util/is_resizeable.hpp>
-#include <boost/numeric/odeint/util/resize.hpp>
-#include <boost/numeric/odeint/util/same_size.hpp>
 
 namespace odeint = boost::numeric::odeint;
-typedef double value_type;
-
-static const size_t wgsize = 256;
-
-static cl::Context      ctx;
-static cl::Device       device;
-static cl::CommandQueue queue;
-static cl::Program      program;
-
-size_t bytes_touched = 0;
-
-const char clbuf_source[] =
-"#if defined(cl_khr_fp64)\n"
-"#  pragma OPENCL EXTENSION cl_khr_fp64: enable\n"
-"#elif defined(cl_amd_fp64)\n"
-"#  pragma OPENCL EXTENSION cl_amd_fp64: enable\n"
-"#endif\n"
-"\n"
-"typedef double real;\n"
+typedef precision::real value_type;
+typedef clbuf::basic_operations<precision::accum> operations;
+
+const char lattice_source[] =
+PRECISION_CL_PREAMBLE
+"// Force on site i at the coordinates x + a * p (p is only read when a is\n"
+"// not zero).\n"
+"real ham_force(\n"
+"    size_t i, uint C,\n"
+"    global const int *ptr,\n"
+"    global const int *len,\n"
+"    global const int *col,\n"
+"    global const real *val,\n"
+"    global const real *x,\n"
+"    global const real *p,\n"
+"    real a,\n"
+"    real beta\n"
+"    )\n"
+"{\n"
+"    size_t k   = i / C;\n"
+"    size_t off = ptr[k] + i % C;\n"
+"    real X = a != 0 ? x[i] + a * p[i] : x[i];\n"
+"    real sum = -beta * X * X * X;\n"
+"    for(int j = 0, w = len[k]; j < w; j++, off += C) {\n"
+"        int c = col[off];\n"
+"        sum += val[off] * (a != 0 ? x[c] + a * p[c] : x[c]);\n"
+"    }\n"
+"    return sum;\n"
+"}\n"
 "\n"
-"kernel void scale_sum2(\n"
-"    ulong n,\n"
-"    global real *v0, \n"
-"    global real *v1, \n"
-"    global real *v2, \n"
-"    real a1,\n"
-"    real a2\n"
+"kernel void ham_system(\n"
+"    ulong n, uint C,\n"
+"    global const int *ptr,\n"
+"    global const int *len,\n"
+"    global const int *col,\n"
+"    global const real *val,\n"
+"    global const real *x,\n"
+"    global real *dx,\n"
+"    real beta\n"
 "    )\n"
 "{\n"
 "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0))\n"
-"        v0[i] =\n"
-"            a1 * v1[i] +\n"
-"            a2 * v2[i];\n"
+"        dx[i] = ham_force(i, C, ptr, len, col, val, x, x, 0, beta);\n"
 "}\n"
 "\n"
-"kernel void scale_sum3(\n"
-"    ulong n,\n"
-"    global real *v0, \n"
-"    global real *v1, \n"
-"    global real *v2, \n"
-"    global real *v3, \n"
-"    real a1,\n"
-"    real a2,\n"
-"    real a3\n"
+"// One force evaluation of the fused stepper: with q' = q + a p,\n"
+"//   p_out = p + b F(q'),  q_out = q' + c p_out.\n"
+"kernel void ham_step(\n"
+"    ulong n, uint C,\n"
+"    global const int *ptr,\n"
+"    global const int *len,\n"
+"    global const int *col,\n"
+"    global const real *val,\n"
+"    global const real *q,\n"
+"    global const real *p,\n"
+"    global real *q_out,\n"
+"    global real *p_out,\n"
+"    real beta,\n"
+"    real a,\n"
+"    real b,\n"
+"    real c\n"
 "    )\n"
 "{\n"
-"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0))\n"
-"        v0[i] =\n"
-"            a1 * v1[i] +\n"
-"            a2 * v2[i] +\n"
-"            a3 * v3[i];\n"
+"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+"        real P = p[i] + b * ham_force(i, C, ptr, len, col, val, q, p, a, beta);\n"
+"        p_out[i] = P;\n"
+"        q_out[i] = q[i] + a * p[i] + c * P;\n"
+"    }\n"
 "}\n"
 "\n"
-"kernel void scale_sum4(\n"
-"    ulong n,\n"
-"    global real *v0, \n"
-"    global real *v1, \n"
-"    global real *v2, \n"
-"    global real *v3, \n"
-"    global real *v4, \n"
-"    real a1,\n"
-"    real a2,\n"
-"    real a3,\n"
-"    real a4\n"
+"#define TILE_X 16\n"
+"#define TILE_Y 16\n"
+"\n"
+"// Matrix-free version: a 2D work-group loads its tile of the lattice and\n"
+"// a one site halo into local memory (at the coordinates x + a * p, same\n"
+"// as ham_force). Neighbours are taken modulo the flat site index, like in\n"
+"// the assembled matrix. The lattices of a batch are stacked along the\n"
+"// third dimension of the NDRange.\n"
+"void load_tile(\n"
+"    uint n1, uint n2,\n"
+"    global const real *x,\n"
+"    global const real *p,\n"
+"    real a,\n"
+"    local real tile[TILE_Y + 2][TILE_X + 2]\n"
 "    )\n"
 "{\n"
-"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0))\n"
-"        v0[i] =\n"
-"            a1 * v1[i] +\n"
-"            a2 * v2[i] +\n"
-"            a3 * v3[i] +\n"
-"            a4 * v4[i];\n"
+"    long n  = (long)n1 * n2;\n"
+"    long i0 = (long)get_group_id(1) * TILE_Y - 1;\n"
+"    long j0 = (long)get_group_id(0) * TILE_X - 1;\n"
+"\n"
+"    for(size_t ty = get_local_id(1); ty < TILE_Y + 2; ty += TILE_Y)\n"
+"        for(size_t tx = get_local_id(0); tx < TILE_X + 2; tx += TILE_X) {\n"
+"            long idx = ((i0 + (long)ty) * n2 + j0 + (long)tx) % n;\n"
+"            if (idx < 0) idx += n;\n"
+"            tile[ty][tx] = a != 0 ? x[idx] + a * p[idx] : x[idx];\n"
+"        }\n"
+"\n"
+"    barrier(CLK_LOCAL_MEM_FENCE);\n"
 "}\n"
 "\n"
-"kernel void scale_sum5(\n"
-"    ulong n,\n"
-"    global real *v0, \n"
-"    global real *v1, \n"
-"    global real *v2, \n"
-"    global real *v3, \n"
-"    global real *v4, \n"
-"    global real *v5, \n"
-"    real a1,\n"
-"    real a2,\n"
-"    real a3,\n"
-"    real a4,\n"
-"    real a5\n"
+"real stencil_force(\n"
+"    size_t i,\n"
+"    global const real *diag,\n"
+"    real K,\n"
+"    real beta,\n"
+"    local real tile[TILE_Y + 2][TILE_X + 2]\n"
 "    )\n"
 "{\n"
-"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0))\n"
-"        v0[i] =\n"
-"            a1 * v1[i] +\n"
-"            a2 * v2[i] +\n"
-"            a3 * v3[i] +\n"
-"            a4 * v4[i] +\n"
-"            a5 * v5[i];\n"
+"    size_t ly = get_local_id(1) + 1;\n"
+"    size_t lx = get_local_id(0) + 1;\n"
+"\n"
+"    real X = tile[ly][lx];\n"
+"    return -beta * X * X * X + diag[i] * X + K * (\n"
+"        tile[ly - 1][lx] + tile[ly][lx - 1] + tile[ly][lx + 1] + tile[ly + 1][lx]);\n"
 "}\n"
 "\n"
-"kernel void ham_system(\n"
-"    ulong n, uint w, ulong pitch,\n"
-"    global const int *col,\n"
-"    global const real *val,\n"
+"kernel void stencil_system(\n"
+"    uint n1, uint n2,\n"
+"    global const real *diag,\n"
+"    real K,\n"
 "    global const real *x,\n"
 "    global real *dx,\n"
 "    real beta\n"
 "    )\n"
 "{\n"
-"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
-"        real X = x[i];\n"
-"        real sum = -beta * X * X * X;\n"
-"        for(size_t j = 0; j < w; j++) {\n"
-"            int c = col[i + j * pitch];\n"
-"            if (c != -1) sum += val[i + j * pitch] * x[c];\n"
-"        }\n"
-"        dx[i] = sum;\n"
+"    local real tile[TILE_Y + 2][TILE_X + 2];\n"
+"\n"
+"    size_t m = get_global_id(2) * n1 * n2;\n"
+"    x += m; dx += m; diag += m;\n"
+"\n"
+"    load_tile(n1, n2, x, x, 0, tile);\n"
+"\n"
+"    size_t i = get_global_id(1), j = get_global_id(0);\n"
+"    if (i < n1 && j < n2)\n"
+"        dx[i * n2 + j] = stencil_force(i * n2 + j, diag, K, beta, tile);\n"
+"}\n"
+"\n"
+"kernel void stencil_step(\n"
+"    uint n1, uint n2,\n"
+"    global const real *diag,\n"
+"    real K,\n"
+"    global const real *q,\n"
+"    global const real *p,\n"
+"    global real *q_out,\n"
+"    global real *p_out,\n"
+"    real beta,\n"
+"    real a,\n"
+"    real b,\n"
+"    real c\n"
+"    )\n"
+"{\n"
+"    local real tile[TILE_Y + 2][TILE_X + 2];\n"
+"\n"
+"    size_t m = get_global_id(2) * n1 * n2;\n"
+"    q += m; p += m; q_out += m; p_out += m; diag += m;\n"
+"\n"
+"    load_tile(n1, n2, q, p, a, tile);\n"
+"\n"
+"    size_t i = get_global_id(1), j = get_global_id(0);\n"
+"    if (i < n1 && j < n2) {\n"
+"        size_t k = i * n2 + j;\n"
+"        real   P = p[k] + b * stencil_force(k, diag, K, beta, tile);\n"
+"\n"
+"        p_out[k] = P;\n"
+"        q_out[k] = tile[get_local_id(1) + 1][get_local_id(0) + 1] + c * P;\n"
 "    }\n"
 "}\n";
 
-inline size_t alignup(size_t n, size_t m = 16U) {
-    return n % m ? n - n % m + m : n;
-}
-
-template <typename T>
-struct clbuf {
-    size_t      n;
-    cl::Buffer  data;
-
-    clbuf() : n(0) {}
-
-    clbuf(size_t n)
-        : n(n), data(ctx, CL_MEM_READ_WRITE, sizeof(T) * n) 
-    {}
-
-    clbuf(const std::vector<T> &host)
-        : n(host.size()),
-          data(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
-                  sizeof(T) * host.size(), const_cast<T*>(host.data())) 
-    {}
-
-    void swap(clbuf &other) {
-        std::swap(n,    other.n);
-        std::swap(data, other.data);
-    }
-};
-
-// Resizing
-namespace boost { namespace numeric { namespace odeint {
-
-template <typename T>
-struct is_resizeable< clbuf<T> > : boost::true_type {};
-
-template< typename T >
-struct resize_impl< clbuf<T> , clbuf<T> >
-{
-    static void resize( clbuf<T> &x1 , const clbuf<T> &x2 )
-    {
-        clbuf<T>(x2.n).swap(x1);
-    }
-};
+// Fused operations mode. McLachlan's symplectic stepper with one kernel per
+// force evaluation. The coordinate updates q += a_l dt p between two force
+// evaluations are summed up and folded into the kernel before, so a step
+// is five launches and the state is read and written once in each. The
+// system has to provide step(q, p, q_out, p_out, a, b, c) which computes,
+// with q' = q + a p,
+//
+//   p_out = p + b F(q'),   q_out = q' + c p_out.
+//
+// a is the coordinate update in front of the first force evaluation (zero
+// for the others) and c the sum of those up to the next one. A force
+// evaluation reads neighbouring coordinates, so the kernels alternate
+// between the state and two temporaries, and the last one writes the state.
+// The last momentum coefficient is zero, so the last force evaluation of
+// each step is skipped altogether.
+struct fused_symplectic_rkn_sb3a_mclachlan {
+    typedef clbuf::vector< ::value_type >               coor_type;
+    typedef clbuf::vector< ::value_type >               momentum_type;
+    typedef std::pair<coor_type, momentum_type> state_type;
+    typedef ::value_type                        value_type;
+    typedef ::value_type                        time_type;
+    typedef unsigned short                      order_type;
+    typedef odeint::stepper_tag                 stepper_category;
+
+    typedef odeint::detail::symplectic_rkn_sb3a_mclachlan::coef_a_type<value_type> coef_a_type;
+    typedef odeint::detail::symplectic_rkn_sb3a_mclachlan::coef_b_type<value_type> coef_b_type;
+
+    static order_type order() { return 4; }
+
+    fused_symplectic_rkn_sb3a_mclachlan() : m_a(0) {
+        value_type a = 0;
+
+        for(size_t l = 0; l < m_coef_a.size(); ++l) {
+            a += m_coef_a[l];
+            if (m_coef_b[l] == 0) continue;
+
+            if (m_b.empty()) m_a = a; else m_c.back() = a;
+
+            m_b.push_back(m_coef_b[l]);
+            m_c.push_back(0);
+            a = 0;
+        }
 
-template< typename T >
-struct same_size_impl< clbuf<T> , clbuf<T> >
-{
-    static bool same_size( const clbuf<T> &x1 , const clbuf<T> &x2 )
-    {
-        return x1.n == x2.n;
+        m_c.back() = a;
     }
-};
-
-} } }
 
-// Operations
-struct clbuf_operations {
-    template< class Fac1 = double , class Fac2 = Fac1 >
-    struct scale_sum2
+    template< class System >
+    void do_step( System system , state_type &x , time_type t , time_type dt )
     {
-        const Fac1 m_alpha1;
-        const Fac2 m_alpha2;
-
-        scale_sum2( Fac1 alpha1 , Fac2 alpha2 )
-            : m_alpha1( alpha1 ) , m_alpha2( alpha2 )
-        { }
-
-        template< class T1 , class T2 , class T3 >
-        void operator()(clbuf<T1> &v1 ,
-                  const clbuf<T2> &v2 ,
-                  const clbuf<T3> &v3
-                  ) const
-        {
-            static cl::Kernel krn(program, "scale_sum2");
-
-            uint pos = 0;
-            krn.setArg(pos++, v1.n);
-            krn.setArg(pos++, v1.data);
-            krn.setArg(pos++, v2.data);
-            krn.setArg(pos++, v3.data);
-            krn.setArg(pos++, m_alpha1);
-            krn.setArg(pos++, m_alpha2);
-
-            queue.enqueueNDRangeKernel(
-                    krn, cl::NullRange, alignup(v1.n, wgsize), wgsize
-                    );
-
-            bytes_touched +=
-                v1.n * sizeof(T1) +
-                v2.n * sizeof(T2) +
-                v3.n * sizeof(T3);
-        }
-
-        typedef void result_type;
-    };
+        typename odeint::unwrap_reference< System >::type &sys = system;
 
-    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 >
-    struct scale_sum3
-    {
-        const Fac1 m_alpha1;
-        const Fac2 m_alpha2;
-        const Fac3 m_alpha3;
-
-        scale_sum3( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 )
-            : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 )
-        { }
-
-        template< class T1 , class T2 , class T3 , class T4 >
-        void operator()(clbuf<T1> &v1 ,
-                  const clbuf<T2> &v2 ,
-                  const clbuf<T3> &v3 ,
-                  const clbuf<T4> &v4
-                  ) const
-        {
-            static cl::Kernel krn(program, "scale_sum3");
-
-            uint pos = 0;
-            krn.setArg(pos++, v1.n);
-            krn.setArg(pos++, v1.data);
-            krn.setArg(pos++, v2.data);
-            krn.setArg(pos++, v3.data);
-            krn.setArg(pos++, v4.data);
-            krn.setArg(pos++, m_alpha1);
-            krn.setArg(pos++, m_alpha2);
-            krn.setArg(pos++, m_alpha3);
-
-            queue.enqueueNDRangeKernel(
-                    krn, cl::NullRange, alignup(v1.n, wgsize), wgsize
-                    );
-
-            bytes_touched +=
-                v1.n * sizeof(T1) +
-                v2.n * sizeof(T2) +
-                v3.n * sizeof(T2) +
-                v4.n * sizeof(T3);
+        for(int k = 0; k < 2; ++k) {
+            if (m_q[k].n != x.first.n)
+                coor_type(*x.first.ctx, x.first.n, x.first.queue).swap(m_q[k]);
+            if (m_p[k].n != x.second.n)
+                momentum_type(*x.second.ctx, x.second.n, x.second.queue).swap(m_p[k]);
         }
 
-        typedef void result_type;
-    };
+        VT_USER_START("fused_symplectic_rkn_sb3a_mclachlan");
+        const size_t s = m_b.size();
+        for(size_t k = 0; k < s; ++k) {
+            const coor_type     &q = k ? m_q[(k - 1) % 2] : x.first;
+            const momentum_type &p = k ? m_p[(k - 1) % 2] : x.second;
 
+            coor_type     &q_out = k + 1 < s ? m_q[k % 2] : x.first;
+            momentum_type &p_out = k + 1 < s ? m_p[k % 2] : x.second;
 
-    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 , class Fac4 = Fac3 >
-    struct scale_sum4
-    {
-        const Fac1 m_alpha1;
-        const Fac2 m_alpha2;
-        const Fac3 m_alpha3;
-        const Fac4 m_alpha4;
-
-        scale_sum4( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 , Fac4 alpha4 )
-        : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 ) , m_alpha4( alpha4 ) { }
-
-        template< class T1 , class T2 , class T3 , class T4 , class T5 >
-        void operator()(clbuf<T1> &v1 ,
-                  const clbuf<T2> &v2 ,
-                  const clbuf<T3> &v3 ,
-                  const clbuf<T4> &v4 ,
-                  const clbuf<T5> &v5
-                  ) const
-        {
-            static cl::Kernel krn(program, "scale_sum4");
-
-            uint pos = 0;
-            krn.setArg(pos++, v1.n);
-            krn.setArg(pos++, v1.data);
-            krn.setArg(pos++, v2.data);
-            krn.setArg(pos++, v3.data);
-            krn.setArg(pos++, v4.data);
-            krn.setArg(pos++, v5.data);
-            krn.setArg(pos++, m_alpha1);
-            krn.setArg(pos++, m_alpha2);
-            krn.setArg(pos++, m_alpha3);
-            krn.setArg(pos++, m_alpha4);
-
-            queue.enqueueNDRangeKernel(
-                    krn, cl::NullRange, alignup(v1.n, wgsize), wgsize
-                    );
-
-            bytes_touched +=
-                v1.n * sizeof(T1) +
-                v2.n * sizeof(T2) +
-                v3.n * sizeof(T2) +
-                v4.n * sizeof(T2) +
-                v5.n * sizeof(T3);
+            sys.step(q, p, q_out, p_out, k ? 0 : m_a * dt, m_b[k] * dt, m_c[k] * dt);
         }
+        VT_USER_END("fused_symplectic_rkn_sb3a_mclachlan");
+    }
 
-        typedef void result_type;
-    };
-
-
-    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 , class Fac4 = Fac3 , class Fac5 = Fac4 >
-    struct scale_sum5
-    {
-        const Fac1 m_alpha1;
-        const Fac2 m_alpha2;
-        const Fac3 m_alpha3;
-        const Fac4 m_alpha4;
-        const Fac5 m_alpha5;
-
-        scale_sum5( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 , Fac4 alpha4 , Fac5 alpha5 )
-        : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 ) , m_alpha4( alpha4 ) , m_alpha5( alpha5 ) { }
-
-        template< class T1 , class T2 , class T3 , class T4 , class T5 , class T6 >
-        void operator()(clbuf<T1> &v1 ,
-                const clbuf<T2> &v2 ,
-                const clbuf<T3> &v3 ,
-                const clbuf<T4> &v4 ,
-                const clbuf<T5> &v5 ,
-                const clbuf<T6> &v6
-                ) const
-        {
-
-            static cl::Kernel krn(program, "scale_sum5");
-
-            uint pos = 0;
-            krn.setArg(pos++, v1.n);
-            krn.setArg(pos++, v1.data);
-            krn.setArg(pos++, v2.data);
-            krn.setArg(pos++, v3.data);
-            krn.setArg(pos++, v4.data);
-            krn.setArg(pos++, v5.data);
-            krn.setArg(pos++, v6.data);
-            krn.setArg(pos++, m_alpha1);
-            krn.setArg(pos++, m_alpha2);
-            krn.setArg(pos++, m_alpha3);
-            krn.setArg(pos++, m_alpha4);
-            krn.setArg(pos++, m_alpha5);
-
-            queue.enqueueNDRangeKernel(
-                    krn, cl::NullRange, alignup(v1.n, wgsize), wgsize
-                    );
-
-            bytes_touched +=
-                v1.n * sizeof(T1) +
-                v2.n * sizeof(T2) +
-                v3.n * sizeof(T2) +
-                v4.n * sizeof(T2) +
-                v5.n * sizeof(T2) +
-                v6.n * sizeof(T3);
-        }
+    coef_a_type m_coef_a;
+    coef_b_type m_coef_b;
 
-        typedef void result_type;
-    };
+    value_type              m_a;
+    std::vector<value_type> m_b, m_c;
 
+    coor_type     m_q[2];
+    momentum_type m_p[2];
 };
 
 static const value_type K = 0.1;
 static const value_type beta = 0.01;
-static const value_type t_max = 100.0;
+static value_type t_max = 100.0;
 static const value_type dt = 0.01;
 
 struct index_modulus {
@@ -392,99 +287,554 @@ struct index_modulus {
     }
 };
 
+// Chunk height of the SELL matrix: the SIMD width on CPUs and the
+// wavefront size on GPUs (64 on AMD, a multiple of the NVIDIA warp).
+inline uint chunk_height(const cl::Device &d) {
+    if (d.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU)
+        return std::max<cl_uint>(1, sizeof(value_type) == sizeof(double)
+                ? d.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE>()
+                : d.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT>()
+                );
+    return 64;
+}
+
+// The lattice operator in SELL-C-sigma format (see sell.hpp). The state
+// is kept in the row order of the matrix. A batch of M realizations is a
+// block diagonal matrix.
 struct sys_func
 {
-    clbuf<int>        col;
-    clbuf<value_type> val;
-    size_t n, pitch;
-    uint   w;
+    sell::matrix<value_type> A;
+    clbuf::vector<int>        ptr;
+    clbuf::vector<int>        len;
+    clbuf::vector<int>        col;
+    clbuf::vector<value_type> val;
+    size_t n;
+    uint   C;
+
+    sys_func(clbuf::context &ctx, int n1, int n2, size_t M,
+            const std::vector<value_type> &disorder, uint C)
+        : A(build(n1, n2, M, disorder, C)),
+          ptr(ctx, A.ptr), len(ctx, A.len), col(ctx, A.col), val(ctx, A.val),
+          n(A.n), C(C)
+    { }
+
+    std::vector<value_type> permute(const std::vector<value_type> &x) const {
+        return A.permute(x);
+    }
 
-    sys_func(int n1, int n2) : n(n1 * n2), pitch(alignup(n, 16)), w(5) {
-        std::vector<value_type> disorder( n );
-        std::generate(disorder.begin(), disorder.end(), drand48);
+    std::vector<value_type> unpermute(const std::vector<value_type> &x) const {
+        return A.unpermute(x);
+    }
+
+    // Where each site of the lattice is stored in the state.
+    std::vector<int> sites() const {
+        std::vector<int> at(n);
+        for(size_t i = 0; i < n; ++i) at[A.perm[i]] = i;
+        return at;
+    }
+
+    static sell::matrix<value_type> build(int n1, int n2, size_t M,
+            const std::vector<value_type> &disorder, uint C)
+    {
+        const size_t n = n1 * n2;
+
+        std::vector<int>        row;
+        std::vector<int>        col;
+        std::vector<value_type> val;
 
-        std::vector<int>        C(w * pitch, -1);
-        std::vector<value_type> V(w * pitch);
+        row.reserve(M * n + 1);
+        col.reserve(M * 5 * n);
+        val.reserve(M * 5 * n);
 
         index_modulus index(n);
 
-        for( int i=0 ; i < n1 ; ++i ) {
-            for( int j=0 ; j < n2 ; ++j ) {
-                int idx = i * n2 + j;
-                int is[5] = { idx , index( idx + 1 ) , index( idx - 1 ) , index( idx - n2 ) , index( idx + n2 ) };
-                std::sort( is , is + 5 );
-                for( int k=0 ; k < 5 ; ++k ) {
-                    C[idx + pitch * k] = is[k];
-                    V[idx + pitch * k] = (is[k] == idx ? -disorder[idx] - 4.0 * K : K);
+        row.push_back(0);
+        for( size_t m=0 ; m < M ; ++m ) {
+            const int off = m * n;
+            for( int i=0 ; i < n1 ; ++i ) {
+                for( int j=0 ; j < n2 ; ++j ) {
+                    int idx = i * n2 + j;
+                    int is[5] = { idx , index( idx + 1 ) , index( idx - 1 ) , index( idx - n2 ) , index( idx + n2 ) };
+                    std::sort( is , is + 5 );
+                    for( int k=0 ; k < 5 ; ++k ) {
+                        col.push_back(off + is[k]);
+                        val.push_back(is[k] == idx ? -disorder[off + idx] - 4.0 * K : K);
+                    }
+                    row.push_back(col.size());
                 }
             }
         }
 
-        clbuf<int>       (C).swap(col);
-        clbuf<value_type>(V).swap(val);
+        return sell::matrix<value_type>(M * n, row, col, val, C, 256);
     }
 
-    void operator()( const clbuf<value_type> &q , clbuf<value_type> &dp )
+    void operator()( const clbuf::vector<value_type> &q , clbuf::vector<value_type> &dp )
     {
-        static cl::Kernel krn(program, "ham_system");
+        clbuf::context &ctx = *q.ctx;
+        cl::Kernel     &krn = ctx.kernel("ham_system");
+
+        VT_USER_START("ham_system");
 
         uint pos = 0;
         krn.setArg(pos++, n);
-        krn.setArg(pos++, w);
-        krn.setArg(pos++, pitch);
+        krn.setArg(pos++, C);
+        krn.setArg(pos++, ptr.data);
+        krn.setArg(pos++, len.data);
         krn.setArg(pos++, col.data);
         krn.setArg(pos++, val.data);
         krn.setArg(pos++, q.data);
         krn.setArg(pos++, dp.data);
         krn.setArg(pos++, beta);
 
-        queue.enqueueNDRangeKernel(
-                krn, cl::NullRange, alignup(n, wgsize), wgsize
-                );
+        dp.ready = ctx.launch(dp.queue, krn, n, "ham_system",
+                clbuf::wait_list(dp.queue, q, ptr, len, col, val));
+        VT_USER_END("ham_system");
 
-        bytes_touched += 
-            (sizeof(int) + 2 * sizeof(value_type)) * n * w +
+        ctx.bytes_touched += 
+            (sizeof(int) + 2 * sizeof(value_type)) * A.stored() +
             sizeof(value_type) * 2 * n;
     }
+
+    // One force evaluation of the fused stepper (see ham_step).
+    void step( const clbuf::vector<value_type> &q , const clbuf::vector<value_type> &p ,
+            clbuf::vector<value_type> &q_out , clbuf::vector<value_type> &p_out ,
+            value_type a , value_type b , value_type c )
+    {
+        clbuf::context &ctx = *q.ctx;
+        cl::Kernel     &krn = ctx.kernel("ham_step");
+
+        VT_USER_START("ham_step");
+
+        uint pos = 0;
+        krn.setArg(pos++, n);
+        krn.setArg(pos++, C);
+        krn.setArg(pos++, ptr.data);
+        krn.setArg(pos++, len.data);
+        krn.setArg(pos++, col.data);
+        krn.setArg(pos++, val.data);
+        krn.setArg(pos++, q.data);
+        krn.setArg(pos++, p.data);
+        krn.setArg(pos++, q_out.data);
+        krn.setArg(pos++, p_out.data);
+        krn.setArg(pos++, beta);
+        krn.setArg(pos++, a);
+        krn.setArg(pos++, b);
+        krn.setArg(pos++, c);
+
+        p_out.ready = q_out.ready = ctx.launch(p_out.queue, krn, n, "ham_step",
+                clbuf::wait_list(p_out.queue, q, p, ptr, len, col, val));
+        VT_USER_END("ham_step");
+
+        ctx.bytes_touched +=
+            (sizeof(int) + 2 * sizeof(value_type)) * A.stored() +
+            sizeof(value_type) * 4 * n;
+    }
+};
+
+// Matrix-free lattice operator. Only the diagonal (disorder and the
+// -4K of the Laplacian) is stored; the coupling to the four neighbours is
+// applied on the fly from 16x16 tiles held in local memory. This saves
+// the column indices and values of the matrix, 5 * (4 + sizeof(real))
+// bytes per site, in every force evaluation.
+struct stencil_func
+{
+    clbuf::vector<value_type> diag;
+    cl_uint n1, n2;
+    size_t  M, n;
+
+    static const size_t tile = 16;
+
+    stencil_func(clbuf::context &ctx, int n1, int n2, size_t M,
+            const std::vector<value_type> &disorder)
+        : n1(n1), n2(n2), M(M), n(M * n1 * n2)
+    {
+        std::vector<value_type> D(n);
+        for(size_t i = 0; i < n; ++i) D[i] = -disorder[i] - 4.0 * K;
+
+        clbuf::vector<value_type>(ctx, D).swap(diag);
+    }
+
+    std::vector<value_type> permute(const std::vector<value_type> &x) const {
+        return x;
+    }
+
+    std::vector<value_type> unpermute(const std::vector<value_type> &x) const {
+        return x;
+    }
+
+    std::vector<int> sites() const {
+        std::vector<int> at(n);
+        for(size_t i = 0; i < n; ++i) at[i] = i;
+        return at;
+    }
+
+    void operator()( const clbuf::vector<value_type> &q , clbuf::vector<value_type> &dp )
+    {
+        clbuf::context &ctx = *q.ctx;
+        cl::Kernel     &krn = ctx.kernel("stencil_system");
+
+        VT_USER_START("stencil_system");
+
+        uint pos = 0;
+        krn.setArg(pos++, n1);
+        krn.setArg(pos++, n2);
+        krn.setArg(pos++, diag.data);
+        krn.setArg(pos++, K);
+        krn.setArg(pos++, q.data);
+        krn.setArg(pos++, dp.data);
+        krn.setArg(pos++, beta);
+
+        dp.ready = ctx.launch(dp.queue, krn,
+                cl::NDRange(clbuf::alignup(n2, tile), clbuf::alignup(n1, tile), M),
+                cl::NDRange(tile, tile, 1), "stencil_system",
+                clbuf::wait_list(dp.queue, q, diag));
+        VT_USER_END("stencil_system");
+
+        ctx.bytes_touched += sizeof(value_type) * 3 * n;
+    }
+
+    void step( const clbuf::vector<value_type> &q , const clbuf::vector<value_type> &p ,
+            clbuf::vector<value_type> &q_out , clbuf::vector<value_type> &p_out ,
+            value_type a , value_type b , value_type c )
+    {
+        clbuf::context &ctx = *q.ctx;
+        cl::Kernel     &krn = ctx.kernel("stencil_step");
+
+        VT_USER_START("stencil_step");
+
+        uint pos = 0;
+        krn.setArg(pos++, n1);
+        krn.setArg(pos++, n2);
+        krn.setArg(pos++, diag.data);
+        krn.setArg(pos++, K);
+        krn.setArg(pos++, q.data);
+        krn.setArg(pos++, p.data);
+        krn.setArg(pos++, q_out.data);
+        krn.setArg(pos++, p_out.data);
+        krn.setArg(pos++, beta);
+        krn.setArg(pos++, a);
+        krn.setArg(pos++, b);
+        krn.setArg(pos++, c);
+
+        p_out.ready = q_out.ready = ctx.launch(p_out.queue, krn,
+                cl::NDRange(clbuf::alignup(n2, tile), clbuf::alignup(n1, tile), M),
+                cl::NDRange(tile, tile, 1), "stencil_step",
+                clbuf::wait_list(p_out.queue, q, p, diag));
+        VT_USER_END("stencil_step");
+
+        ctx.bytes_touched += sizeof(value_type) * 5 * n;
+    }
 };
 
-typedef clbuf<value_type> state_type;
+typedef clbuf::vector<value_type> state_type;
+
+// Energy, second moment and participation of every realization (see
+// observables.hpp), reduced on the device.
+struct probe
+{
+    cl_uint n1, n2;
+    clbuf::reduction<precision::accum> sum;
+    clbuf::vector<value_type>          disorder;
+    clbuf::vector<int>                 at;
+
+    probe(clbuf::context &ctx, size_t n1, size_t n2, size_t M,
+            const std::vector<value_type> &disorder, const std::vector<int> &at)
+        : n1(n1), n2(n2), sum(ctx, n1 * n2, lattice::quantities, M),
+          disorder(ctx, disorder), at(ctx, at)
+    { }
+
+    static std::string source(const clbuf::context &ctx) {
+        return PRECISION_CL_PREAMBLE + clbuf::reduce_source("lattice_observables",
+                lattice::reduce_args, lattice::quantities, lattice::reduce_body,
+                ctx.wgsize);
+    }
+
+    std::vector<double> operator()( const std::pair<state_type, state_type> &x , double t )
+    {
+        clbuf::context &ctx = *x.first.ctx;
+        cl::Kernel     &krn = ctx.kernel("lattice_observables");
+
+        VT_USER_START("lattice_observables");
+
+        uint pos = 2;
+        krn.setArg(pos++, n1);
+        krn.setArg(pos++, n2);
+        krn.setArg(pos++, K);
+        krn.setArg(pos++, beta);
+        krn.setArg(pos++, disorder.data);
+        krn.setArg(pos++, at.data);
+        krn.setArg(pos++, x.first.data);
+        krn.setArg(pos++, x.second.data);
+
+        std::vector<double> s = sum(krn, "lattice_observables",
+                clbuf::wait_list(sum.queue(), x.first, x.second, disorder, at));
+        VT_USER_END("lattice_observables");
+
+        return lattice::row(s);
+    }
+};
+
+// Optional outputs of a run, null when not wanted.
+struct outputs {
+    clbuf::stream     *trajectory;
+    observer::table   *table;
+    probe             *obs;
+    clbuf::checkpoint *checkpoint;
+};
+
+template <class Stepper, class System>
+void integrate(Stepper &stepper, System &sys, std::pair<state_type, state_type> &X,
+        value_type t0, const outputs &out)
+{
+    if (out.trajectory || out.table || out.checkpoint)
+        odeint::integrate_const( stepper , std::ref( sys ) , X , t0 , t_max , dt ,
+                [&out](const std::pair<state_type, state_type> &x, value_type t) {
+                    if (out.trajectory) {
+                        clbuf::stream_observer write(*out.trajectory);
+                        write(x, t);
+                    }
+                    if (out.table) {
+                        observer::sampler<probe> sample(*out.table, *out.obs);
+                        sample(x, t);
+                    }
+                    if (out.checkpoint) {
+                        clbuf::checkpoint_observer save(*out.checkpoint);
+                        save(x, t);
+                    }
+                } );
+    else
+        odeint::integrate_const( stepper , std::ref( sys ) , X , t0 , t_max , dt );
+}
+
+// Writes q and p to path once per `every` steps (not at all when every is 0). The
+// frames are brought back to the lattice order of the sites.
+template <class System>
+clbuf::stream* open_trajectory(clbuf::context &ctx, const System &sys,
+        const std::string &path, size_t n, unsigned every)
+{
+    if (!every) return 0;
+
+    return new clbuf::stream(ctx, path, sizeof(value_type), 2 * n, every,
+            [&sys, n](void *frame) {
+                value_type *x = static_cast<value_type*>(frame);
+
+                for(int h = 0; h < 2; ++h) {
+                    std::vector<value_type> y = sys.unpermute(
+                            std::vector<value_type>(x + h * n, x + (h + 1) * n));
+                    std::copy(y.begin(), y.end(), x + h * n);
+                }
+            });
+}
+
+// Command line options, see main().
+struct options {
+    std::string name;
+    bool        fused, tune;
+    size_t      n1, n2, M;
+    unsigned    stream, observe, checkpoint;
+    unsigned long long seed;
+    clbuf::snapshot   *restart;
+};
+
+template <class System>
+void run(benchmark::harness &bench, clbuf::context &ctx, System &sys, const options &opt,
+        const std::vector<value_type> &disorder,
+        const std::vector<value_type> &q, const std::vector<value_type> &p,
+        std::vector<value_type> &q_res, std::vector<value_type> &p_res)
+{
+    while(bench.next()) {
+        ctx.autotune = opt.tune && bench.warming();
+
+        bench.start("upload");
+        std::pair<state_type, state_type> X;
+        value_type t0 = 0;
+        if (opt.restart) {
+            state_type(ctx, q.size()).swap(X.first);
+            state_type(ctx, p.size()).swap(X.second);
+            t0 = opt.restart->restore(ctx, 0, clbuf::parts(X));
+        } else {
+            state_type(ctx, sys.permute(q)).swap(X.first);
+            state_type(ctx, sys.permute(p)).swap(X.second);
+        }
+        ctx.finish();
+        bench.stop("upload");
+
+        std::unique_ptr<clbuf::stream> trajectory(
+                open_trajectory(ctx, sys, opt.name + ".trj", q.size(), opt.stream));
+
+        std::unique_ptr<observer::table> table;
+        std::unique_ptr<probe>           obs;
+        if (opt.observe) {
+            table.reset(new observer::table(opt.name + ".obs", lattice::columns, opt.observe, opt.M));
+            obs.reset(new probe(ctx, opt.n1, opt.n2, opt.M, disorder, sys.sites()));
+        }
+
+        // The state of a tuning repetition is not worth saving.
+        std::unique_ptr<clbuf::checkpoint> checkpoint;
+        if (opt.checkpoint && !ctx.autotune)
+            checkpoint.reset(new clbuf::checkpoint(ctx, opt.name + ".ckp",
+                        sizeof(value_type), q.size() + p.size(), opt.checkpoint, opt.seed));
+
+        outputs out = { trajectory.get(), table.get(), obs.get(), checkpoint.get() };
+
+        ctx.bytes_touched = 0;
+
+        bench.start("integrate");
+        VT_USER_START("integrate");
+        if (opt.fused) {
+            fused_symplectic_rkn_sb3a_mclachlan stepper;
+
+            integrate(stepper, sys, X, t0, out);
+        } else {
+            odeint::symplectic_rkn_sb3a_mclachlan<
+                state_type , state_type , value_type , state_type , state_type , value_type ,
+                           odeint::vector_space_algebra , operations
+                               > stepper;
+
+            integrate(stepper, sys, X, t0, out);
+        }
+        trajectory.reset();
+        checkpoint.reset();
+        ctx.finish();
+        VT_USER_END("integrate");
+        bench.stop("integrate");
+
+        bench.start("readback");
+        X.first.read(q_res);
+        X.second.read(p_res);
+        q_res = sys.unpermute(q_res);
+        p_res = sys.unpermute(p_res);
+        bench.stop("readback");
+
+        bench.bytes(ctx.bytes_touched);
+    }
+}
 
 int main(int argc, char *argv[]) {
     const size_t n1 = argc > 1 ? atoi(argv[1]) : 64;
     const size_t n2 = n1;
     const size_t n = n1 * n2;
 
+    // Modes:
+    //   fused       fused symplectic stepper;
+    //   stencil     matrix-free operator;
+    //   batch=M     M disorder realizations integrated side by side;
+    //   stream=K    write every K-th step to <name>.trj;
+    //   observe=K   write the observables of every K-th step to <name>.obs;
+    //   checkpoint=K
+    //               save every K-th step to <name>.ckp;
+    //   restart     resume from <name>.ckp (with repetitions, each one
+    //               resumes from the latest checkpoint);
+    //   seed=S      seed of the disorder (the default state of drand48);
+    //   t_max=T     end of the integration;
+    //   tune        sweep the launch configurations of the kernels in a
+    //               warm-up repetition and save them for later runs.
+    options opt;
+    opt.fused   = false;
+    opt.tune    = false;
+    opt.n1      = n1;
+    opt.n2      = n2;
+    opt.M       = 0;
+    opt.stream  = opt.observe = opt.checkpoint = 0;
+    opt.seed    = 0x1234ABCD;
+    opt.restart = 0;
+
+    bool stencil = false, restart = false;
+    for(int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        opt.fused = opt.fused || a == "fused";
+        stencil   = stencil   || a == "stencil";
+        restart   = restart   || a == "restart";
+        opt.tune  = opt.tune  || a == "tune";
+        if (a.compare(0,  6, "batch=")      == 0) opt.M          = atoi(a.c_str() + 6);
+        if (a.compare(0,  7, "stream=")     == 0) opt.stream     = atoi(a.c_str() + 7);
+        if (a.compare(0,  8, "observe=")    == 0) opt.observe    = atoi(a.c_str() + 8);
+        if (a.compare(0, 11, "checkpoint=") == 0) opt.checkpoint = atoi(a.c_str() + 11);
+        if (a.compare(0,  5, "seed=")       == 0) opt.seed       = strtoull(a.c_str() + 5, 0, 0);
+        if (a.compare(0,  6, "t_max=")      == 0) t_max          = atof(a.c_str() + 6);
+    }
+    const bool batch = opt.M > 0;
+    if (!batch) opt.M = 1;
+
+    const size_t M = opt.M;
+
     try {
-        vex::Context vctx( vex::Filter::Exclusive( vex::Filter::Env && vex::Filter::Count(1) ) );
+        // Checkpoints are found by name, so checkpoint and restart do not
+        // change it.
+        std::string &name = opt.name;
+        name = "reference_disordered_lattice";
+        if (opt.fused)   name += "_fused";
+        if (stencil)     name += "_stencil";
+        if (batch)       name += "_batch";
+        if (opt.stream)  name += "_stream";
+        if (opt.observe) name += "_observe";
+
+        benchmark::harness bench(name, n1);
+        if (opt.tune) bench.warm_up(1);
+
+        bench.start("setup");
+
+        std::unique_ptr<clbuf::snapshot> snapshot;
+        if (restart) {
+            snapshot.reset(new clbuf::snapshot(name + ".ckp"));
+            opt.seed    = snapshot->seed();
+            opt.restart = snapshot.get();
+        }
+
+        vex::Context vctx(
+                vex::Filter::Exclusive( vex::Filter::Env && vex::Filter::Count(1) ),
+                vt::queue_properties()
+                );
         if (!vctx) throw std::runtime_error("No compute devices");
 
         std::cout << vctx << std::endl;
 
-        ctx     = vctx.context(0);
-        device  = vctx.device(0);
-        queue   = vctx.queue(0);
-        program = vex::build_sources(ctx, clbuf_source);
+        clbuf::context ctx(vctx.queue(0));
 
-        std::vector<value_type> q(n, 0);
-        std::vector<value_type> p(n, 0);
-        q[n1/2*n2 + n2/2] = 1;
+        srand48(opt.seed);
 
-        std::pair<state_type, state_type> X;
-        state_type(q).swap(X.first);
-        state_type(p).swap(X.second);
+        std::vector<value_type> disorder( M * n );
+        std::generate(disorder.begin(), disorder.end(), drand48);
+
+        std::vector<value_type> q(M * n, 0);
+        std::vector<value_type> p(M * n, 0);
+        for(size_t m = 0; m < M; ++m) q[m * n + n1/2*n2 + n2/2] = 1;
+
+        std::unique_ptr<sys_func>     matrix;
+        std::unique_ptr<stencil_func> matrix_free;
+
+        if (stencil)
+            matrix_free.reset(new stencil_func(ctx, n1, n2, M, disorder));
+        else
+            matrix.reset(new sys_func(ctx, n1, n2, M, disorder, chunk_height(ctx.device)));
+
+        bench.stop("setup");
+
+        bench.start("compile");
+        ctx.build(lattice_source);
+        if (opt.observe) ctx.build(probe::source(ctx));
+        operations::compile<value_type>(ctx);
+        bench.stop("compile");
+
+        std::vector<value_type> res( M * n ), mom( M * n );
+
+        if (stencil)
+            run(bench, ctx, *matrix_free, opt, disorder, q, p, res, mom);
+        else
+            run(bench, ctx, *matrix, opt, disorder, q, p, res, mom);
+
+        std::cout << res[0] << std::endl;
+
+        if (batch)
+            lattice::print(std::cout,
+                    lattice::measure(n1, n2, M, K, beta, disorder, res, mom));
 
-        odeint::symplectic_rkn_sb3a_mclachlan<
-            state_type , state_type , value_type , state_type , state_type , value_type ,
-                       odeint::vector_space_algebra , clbuf_operations
-                           > stepper;
+        std::cout << "bytes io: " << ctx.bytes_touched << std::endl;
+        std::cout << "device memory: " << ctx.buffers.stats() << std::endl;
 
-        sys_func sys(n1, n2);
-        odeint::integrate_const( stepper , std::ref( sys ) , X , value_type(0.0) , t_max , dt );
+        bench.check(res);
 
-        queue.enqueueReadBuffer(X.first.data, CL_TRUE, 0, sizeof(value_type), q.data());
-        std::cout << q[0] << std::endl;
-        std::cout << "bytes io: " << bytes_touched << std::endl;
+        bench.report();
     } catch (const cl::Error &e) {
         std::cerr << "OpenCL error: " << e << std::endl;
         return 1;
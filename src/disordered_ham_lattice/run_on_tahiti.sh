@@ -2,6 +2,10 @@
 
 export OCL_DEVICE=Tahiti
 
+# timings are taken by the programs themselves, see benchmark.hpp
+export BENCH_FORMAT=dat
+export BENCH_WARMUP=1
+
 # warming runs
 ./vexcl_disordered_lattice
 ./viennacl_disordered_lattice
@@ -20,12 +24,10 @@ for ((a=16;a<=2048;a*=2)); do
 	for ((ndev=1;ndev<=3;ndev++)); do
 	    echo "    vexcl ${ndev}"
 	    export OCL_MAX_DEVICES=${ndev}
-	    echo -n "$a " >> vexcl_${ndev}gpu.dat
-	    /usr/bin/time -f %e -o vexcl_${ndev}gpu.dat -a ./vexcl_disordered_lattice $a > /dev/null
+	    BENCH_OUTPUT=vexcl_${ndev}gpu.dat ./vexcl_disordered_lattice $a > /dev/null
 	done
 
 	echo "    viennacl"
-	echo -n "$a " >> viennacl_gpu.dat
-	/usr/bin/time -f %e -o viennacl_gpu.dat -a ./viennacl_disordered_lattice $a > /dev/null
+	BENCH_OUTPUT=viennacl_gpu.dat ./viennacl_disordered_lattice $a > /dev/null
     done
 done
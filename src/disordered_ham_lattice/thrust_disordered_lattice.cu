@@ -2,10 +2,12 @@
 #include <vector>
 #include <utility>
 #include <algorithm>
+#include <string>
 
 #include <thrust/device_vector.h>
 #include <thrust/reduce.h>
 #include <thrust/functional.h>
+#include <thrust/iterator/counting_iterator.h>
 
 #include <boost/numeric/odeint.hpp>
 #include <boost/numeric/odeint/external/thrust/thrust_algebra.hpp>
@@ -14,12 +16,48 @@
 
 #include <cusparse_v2.h>
 
+#include "precision.hpp"
+#include "benchmark.hpp"
+
 using namespace std;
 namespace odeint = boost::numeric::odeint;
 
-typedef double value_type;
+typedef precision::real value_type;
 typedef thrust::device_vector< value_type > state_type;
 
+// Precision dispatch for the two CUSPARSE calls we need.
+inline cusparseStatus_t hybmv(cusparseHandle_t handle, const float *alpha,
+	cusparseMatDescr_t descr, cusparseHybMat_t A,
+	const float *x, const float *beta, float *y)
+{
+    return cusparseShybmv(handle, CUSPARSE_OPERATION_NON_TRANSPOSE,
+	    alpha, descr, A, x, beta, y);
+}
+
+inline cusparseStatus_t hybmv(cusparseHandle_t handle, const double *alpha,
+	cusparseMatDescr_t descr, cusparseHybMat_t A,
+	const double *x, const double *beta, double *y)
+{
+    return cusparseDhybmv(handle, CUSPARSE_OPERATION_NON_TRANSPOSE,
+	    alpha, descr, A, x, beta, y);
+}
+
+inline cusparseStatus_t csr2hyb(cusparseHandle_t handle, int m, int n,
+	cusparseMatDescr_t descr, const float *val, const int *row, const int *col,
+	cusparseHybMat_t A)
+{
+    return cusparseScsr2hyb(handle, m, n, descr, val, row, col,
+	    A, 5, CUSPARSE_HYB_PARTITION_AUTO);
+}
+
+inline cusparseStatus_t csr2hyb(cusparseHandle_t handle, int m, int n,
+	cusparseMatDescr_t descr, const double *val, const int *row, const int *col,
+	cusparseHybMat_t A)
+{
+    return cusparseDcsr2hyb(handle, m, n, descr, val, row, col,
+	    A, 5, CUSPARSE_HYB_PARTITION_AUTO);
+}
+
 struct ham_lattice {
     value_type beta;
     cusparseHandle_t   handle;
@@ -47,8 +85,7 @@ struct ham_lattice {
 	thrust::transform(q.begin(), q.end(), dp.begin(),
 		scaled_pow3_functor(-beta));
 
-	cusparseDhybmv(handle, CUSPARSE_OPERATION_NON_TRANSPOSE,
-		&one, descr, A,
+	hybmv(handle, &one, descr, A,
 		thrust::raw_pointer_cast(&q[0]), &one,
 		thrust::raw_pointer_cast(&dp[0])
 		);
@@ -56,6 +93,48 @@ struct ham_lattice {
 
 };
 
+// Matrix-free version of the lattice operator. Only the diagonal (disorder
+// and the -4K of the Laplacian) is stored, the coupling to the neighbours
+// is computed from the site index. Neighbours are taken modulo the flat
+// index, like in the assembled matrix.
+struct ham_stencil {
+    value_type beta, K;
+    int        n2, n;
+    const value_type *diag;
+
+    ham_stencil( value_type beta, value_type K, int n1, int n2,
+	    const thrust::device_vector< value_type > &diag
+	    ) : beta(beta), K(K), n2(n2), n(n1 * n2),
+		diag(thrust::raw_pointer_cast(&diag[0])) { }
+
+    struct force_functor {
+        value_type beta, K;
+        int        n2, n;
+        const value_type *diag, *q;
+
+        force_functor( const ham_stencil &s, const value_type *q )
+            : beta(s.beta), K(s.K), n2(s.n2), n(s.n), diag(s.diag), q(q) {}
+
+        __host__ __device__ int wrap( int idx ) const {
+	    return idx < 0 ? idx + n : (idx >= n ? idx - n : idx);
+        }
+
+        __host__ __device__ value_type operator()( int i ) const {
+	    value_type X = q[i];
+	    return -beta * X * X * X + diag[i] * X + K * (
+		    q[wrap(i - n2)] + q[wrap(i - 1)] + q[wrap(i + 1)] + q[wrap(i + n2)]);
+        }
+    };
+
+    void operator()( const state_type &q , state_type &dp ) const
+    {
+	thrust::transform(
+		thrust::counting_iterator<int>(0), thrust::counting_iterator<int>(n),
+		dp.begin(), force_functor(*this, thrust::raw_pointer_cast(&q[0]))
+		);
+    }
+};
+
 struct index_modulus {
     int N;
 
@@ -80,9 +159,20 @@ int main( int argc , char **argv )
     value_type t_max = 100.0;
     value_type dt = 0.01;
 
+    // "stencil" selects the matrix-free operator.
+    const bool stencil = argc > 2 && std::string(argv[2]) == "stencil";
+
+    benchmark::harness bench( stencil ? "thrust_disordered_lattice_stencil" : "thrust_disordered_lattice" , n1 );
+
+    bench.start( "setup" );
+
     std::vector<value_type> disorder( n );
     std::generate( disorder.begin(), disorder.end(), drand48 );
 
+    std::vector< value_type > diag( n );
+    for( size_t i=0 ; i < n ; ++i ) diag[i] = - disorder[i] - 4.0 * K;
+    thrust::device_vector< value_type > dev_diag( diag );
+
     // Create CUSPARSE matrix.
     cusparseHandle_t   handle;
     cusparseMatDescr_t descr;
@@ -95,8 +185,8 @@ int main( int argc , char **argv )
     cusparseSetMatType(descr, CUSPARSE_MATRIX_TYPE_GENERAL);
     cusparseSetMatIndexBase(descr, CUSPARSE_INDEX_BASE_ZERO);
 
-    {
-	std::vector< double > val;
+    if( !stencil ) {
+	std::vector< value_type > val;
 	std::vector< int > col;
 	std::vector< int > row;
 
@@ -125,37 +215,59 @@ int main( int argc , char **argv )
 
 	thrust::device_vector<int>    dev_row(row);
 	thrust::device_vector<int>    dev_col(col);
-	thrust::device_vector<double> dev_val(val);
+	thrust::device_vector<value_type> dev_val(val);
 
-	cusparseDcsr2hyb(handle, N, N, descr,
+	csr2hyb(handle, N, N, descr,
 		thrust::raw_pointer_cast(&dev_val[0]),
 		thrust::raw_pointer_cast(&dev_row[0]),
 		thrust::raw_pointer_cast(&dev_col[0]),
-		hyb, 5, CUSPARSE_HYB_PARTITION_AUTO
+		hyb
 		);
     }
 
-    std::pair<state_type, state_type> X(
-	    state_type( n1 * n2 ),
-	    state_type( n1 * n2 )
-	    );
-    thrust::fill(X.first.begin(),  X.first.end(),  0);
-    thrust::fill(X.second.begin(), X.second.end(), 0);
-    X.first[ n1/2*n2+n2/2 ] = 1.0;
-
+    bench.stop( "setup" );
 
-    odeint::symplectic_rkn_sb3a_mclachlan<
-        state_type , state_type , value_type , state_type , state_type , value_type ,
-        odeint::thrust_algebra , odeint::thrust_operations
-        > stepper;
+    std::vector< value_type > x1( n ) , p1( n );
 
-    odeint::integrate_const( stepper , ham_lattice(beta , handle, descr, hyb),
-	    X, value_type(0.0), t_max, dt );
+    while( bench.next() )
+    {
+	bench.start( "upload" );
+	std::pair<state_type, state_type> X(
+		state_type( n1 * n2 ),
+		state_type( n1 * n2 )
+		);
+	thrust::fill(X.first.begin(),  X.first.end(),  0);
+	thrust::fill(X.second.begin(), X.second.end(), 0);
+	X.first[ n1/2*n2+n2/2 ] = 1.0;
+	cudaThreadSynchronize();
+	bench.stop( "upload" );
+
+
+	bench.start( "integrate" );
+	odeint::symplectic_rkn_sb3a_mclachlan<
+	    state_type , state_type , value_type , state_type , state_type , value_type ,
+	    odeint::thrust_algebra , odeint::thrust_operations
+	    > stepper;
+
+	if( stencil )
+	    odeint::integrate_const( stepper , ham_stencil(beta, K, n1, n2, dev_diag),
+		    X, value_type(0.0), t_max, dt );
+	else
+	    odeint::integrate_const( stepper , ham_lattice(beta , handle, descr, hyb),
+		    X, value_type(0.0), t_max, dt );
+	cudaThreadSynchronize();
+	bench.stop( "integrate" );
+
+
+	bench.start( "readback" );
+	thrust::copy( X.first.begin(),  X.first.end(),  x1.begin() );
+	thrust::copy( X.second.begin(), X.second.end(), p1.begin() );
+	bench.stop( "readback" );
+    }
 
+    cout << x1[0] << "\t" << p1[0] << std::endl;
 
-    std::vector< value_type > x1( n ) , p1( n );
-    thrust::copy( X.first.begin(),  X.first.end(),  x1.begin() );
-    thrust::copy( X.second.begin(), X.second.end(), p1.begin() );
+    bench.check(x1);
 
-    cout << x1[0] << "\t" << p1[0] << std::endl;
+    bench.report();
 }
@@ -4,16 +4,23 @@
 #include <tuple>
 #include <random>
 #include <algorithm>
+#include <string>
+#include <memory>
 
 #include <vexcl/vexcl.hpp>
 
 #include <boost/numeric/odeint.hpp>
 #include <boost/numeric/odeint/algebra/vector_space_algebra.hpp>
-#include <boost/numeric/odeint/external/vexcl/vexcl_resize.hpp>
+
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "clbuf/vexcl.hpp"
+#include "observer.hpp"
+#include "observables.hpp"
 
 namespace odeint = boost::numeric::odeint;
 
-typedef double value_type;
+typedef precision::real value_type;
 typedef vex::vector< value_type > state_type;
 
 using namespace std;
@@ -21,14 +28,94 @@ using namespace std;
 VEX_FUNCTION(pow3, value_type(value_type),  "return prm1 * prm1 * prm1;");
 
 struct ham_lattice {
-    ham_lattice(value_type beta, const vex::SpMat<double> &A) : beta(beta), A(A) { }
+    ham_lattice(value_type beta, const vex::SpMat<value_type> &A) : beta(beta), A(A) { }
 
     void operator()(const state_type &q, state_type &dp) const {
         dp = (-beta) * pow3(q) + A * q;
     }
 
     value_type beta;
-    const vex::SpMat< double > &A;
+    const vex::SpMat< value_type > &A;
+};
+
+// Energy, second moment and participation of every realization (see
+// observables.hpp), reduced on the device. The neighbour sums of the local
+// energies come from the lattice matrix A, whose diagonal is -e - 4K:
+//
+//   K sum_j q_j   = A q   + (e + 4K) q,
+//   K sum_j q_j^2 = A q^2 + (e + 4K) q^2.
+//
+// S adds up the sites of every realization, so only M values per quantity
+// are read back.
+struct probe {
+    size_t n, M;
+    value_type K, beta;
+    const vex::SpMat< value_type > &A;
+    vex::SpMat< value_type > S;
+    state_type e, d2, q2, Aq, Aq2, E, tmp, y;
+    std::vector< value_type > host;
+
+    probe(const std::vector< cl::CommandQueue > &queue, size_t n1, size_t n2, size_t M,
+	    value_type K, value_type beta, const vex::SpMat< value_type > &A,
+	    const std::vector< value_type > &disorder)
+	: n(n1 * n2), M(M), K(K), beta(beta), A(A), S(sum_matrix(queue, n1 * n2, M)),
+	  e(queue, disorder), d2(queue, distance2(n1, n2, M)),
+	  q2(queue, M * n), Aq(queue, M * n), Aq2(queue, M * n), E(queue, M * n),
+	  tmp(queue, M * n), y(queue, M), host(M)
+    { }
+
+    std::vector<double> operator()(const std::pair< state_type, state_type > &x, double t) {
+	const state_type &q = x.first;
+	const state_type &p = x.second;
+
+	q2  = q * q;
+	Aq  = A * q;
+	Aq2 = A * q2;
+	E   = 0.5 * p * p + 0.5 * e * q2 + 0.25 * beta * q2 * q2 + K * q2
+	    - 0.5 * q * (Aq + (e + 4 * K) * q) + 0.25 * (Aq2 + (e + 4 * K) * q2);
+
+	std::vector<double> s(M * lattice::quantities);
+
+	for(unsigned k = 0; k < lattice::quantities; ++k) {
+	    switch(k) {
+		case 0: tmp = E;      break;
+		case 1: tmp = E * E;  break;
+		case 2: tmp = d2 * E; break;
+	    }
+
+	    y = S * tmp;
+	    vex::copy(y, host);
+
+	    for(size_t m = 0; m < M; ++m) s[m * lattice::quantities + k] = host[m];
+	}
+
+	return lattice::row(s);
+    }
+
+    static vex::SpMat< value_type > sum_matrix(const std::vector< cl::CommandQueue > &queue,
+	    size_t n, size_t M)
+    {
+	std::vector< size_t > row(M + 1), col(M * n);
+	std::vector< value_type > val(M * n, 1);
+
+	for(size_t m = 0; m <= M; ++m) row[m] = m * n;
+	for(size_t i = 0; i < M * n; ++i) col[i] = i;
+
+	return vex::SpMat< value_type >(queue, M, M * n, row.data(), col.data(), val.data());
+    }
+
+    // Squared distance of every site to the initially excited one.
+    static std::vector< value_type > distance2(size_t n1, size_t n2, size_t M) {
+	std::vector< value_type > d(M * n1 * n2);
+
+	for(size_t i = 0; i < d.size(); ++i) {
+	    double r = double(i % (n1 * n2) / n2) - double(n1 / 2);
+	    double c = double(i % n2) - double(n2 / 2);
+	    d[i] = r * r + c * c;
+	}
+
+	return d;
+    }
 };
 
 struct index_modulus {
@@ -49,68 +136,124 @@ int main( int argc , char **argv )
     size_t n1 = argc > 1 ? atoi(argv[1]) : 64;
     size_t n2 = n1;
 
+    // "batch=M" integrates M disorder realizations side by side, as one
+    // block diagonal system. "observe=K" writes the observables of every
+    // K-th step to <name>.obs.
+    size_t   M = 0;
+    unsigned observe = 0;
+    for(int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a.compare(0, 6, "batch=")   == 0) M       = atoi(a.c_str() + 6);
+        if (a.compare(0, 8, "observe=") == 0) observe = atoi(a.c_str() + 8);
+    }
+    const bool batch = M > 0;
+    if (!batch) M = 1;
+
     size_t n = n1 * n2;
     value_type K = 0.1;
     value_type beta = 0.01;
     value_type t_max = 100.0;
     value_type dt = 0.01;
 
+    std::string name = "vexcl_disordered_lattice";
+    if (batch)   name += "_batch";
+    if (observe) name += "_observe";
+
+    benchmark::harness bench(name, n1);
+
+    bench.start("setup");
+
     vex::Context ctx( vex::Filter::Exclusive( vex::Filter::Env && vex::Filter::DoublePrecision ) );
     std::cout << ctx << std::endl;
 
-    std::vector<value_type> disorder( n );
+    std::vector<value_type> disorder( M * n );
     std::generate(disorder.begin(), disorder.end(), drand48);
 
-    std::vector< double > val;
+    std::vector< value_type > val;
     std::vector< size_t > col;
     std::vector< size_t > row;
 
     size_t N = n1 * n2;
 
-    val.reserve(N * 5);
-    col.reserve(N * 5);
-    row.reserve(N + 1);
+    val.reserve(M * N * 5);
+    col.reserve(M * N * 5);
+    row.reserve(M * N + 1);
 
     index_modulus index(N);
 
     row.push_back( 0 );
-    for( int i=0 ; i < n1 ; ++i ) {
-	for( int j=0 ; j < n2 ; ++j ) {
-	    row.push_back( row.back() + 5 );
-	    int idx = i * n2 + j;
-	    int is[5] = { idx , index( idx + 1 ) , index( idx - 1 ) , index( idx - n2 ) , index( idx + n2 ) };
-	    std::sort( is , is + 5 );
-	    for( int i=0 ; i < 5 ; ++i ) {
-		col.push_back( is[i] );
-		if( is[i] == idx ) val.push_back( - disorder[idx]  - 4.0 * K );
-		else val.push_back( K );
+    for( size_t m=0 ; m < M ; ++m ) {
+	const size_t off = m * N;
+	for( int i=0 ; i < n1 ; ++i ) {
+	    for( int j=0 ; j < n2 ; ++j ) {
+		row.push_back( row.back() + 5 );
+		int idx = i * n2 + j;
+		int is[5] = { idx , index( idx + 1 ) , index( idx - 1 ) , index( idx - n2 ) , index( idx + n2 ) };
+		std::sort( is , is + 5 );
+		for( int i=0 ; i < 5 ; ++i ) {
+		    col.push_back( off + is[i] );
+		    if( is[i] == idx ) val.push_back( - disorder[off + idx]  - 4.0 * K );
+		    else val.push_back( K );
+		}
 	    }
 	}
     }
 
-    vex::SpMat<double> A(ctx.queue(), N, N, row.data(), col.data(), val.data());
+    vex::SpMat<value_type> A(ctx.queue(), M * N, M * N, row.data(), col.data(), val.data());
 
-    std::pair< state_type , state_type > X( state_type( ctx.queue() , n1 * n2 ) , state_type( ctx.queue() , n1 * n2 ) );
-    X.first = 0.0;
-    X.second = 0.0;
-    X.first[ n1/2*n2+n2/2 ] = 1.0;
+    std::pair< state_type , state_type > X( state_type( ctx.queue() , M * n ) , state_type( ctx.queue() , M * n ) );
 
+    ham_lattice sys( beta, A );
 
+    std::unique_ptr< probe > obs;
+    if (observe)
+	obs.reset( new probe( ctx.queue(), n1, n2, M, K, beta, A, disorder ) );
 
+    bench.stop("setup");
 
-    odeint::symplectic_rkn_sb3a_mclachlan<
-        state_type , state_type , value_type , state_type , state_type , value_type ,
-        odeint::vector_space_algebra , odeint::default_operations
-        > stepper;
+    std::vector< value_type > x1( M * n ) , p1( M * n );
 
-    ham_lattice sys( beta, A );
-    odeint::integrate_const( stepper , std::ref( sys ) , X , value_type(0.0) , t_max , dt );
+    // Kernels are compiled on first use, so the first (warm-up) repetition
+    // includes the compilation time.
+    while(bench.next()) {
+	bench.start("upload");
+	X.first = 0.0;
+	X.second = 0.0;
+	for( size_t m=0 ; m < M ; ++m )
+	    X.first[ m*n + n1/2*n2+n2/2 ] = 1.0;
+	ctx.finish();
+	bench.stop("upload");
+
+	std::unique_ptr< observer::table > table;
+	if( observe )
+	    table.reset( new observer::table( name + ".obs" , lattice::columns , observe , M ) );
 
+	bench.start("integrate");
+	clbuf::vexcl::scope temporaries;
+	odeint::symplectic_rkn_sb3a_mclachlan<
+	    state_type , state_type , value_type , state_type , state_type , value_type ,
+	    odeint::vector_space_algebra , odeint::default_operations
+	    > stepper;
+
+	if( table )
+	    odeint::integrate_const( stepper , std::ref( sys ) , X , value_type(0.0) , t_max , dt ,
+		    observer::sample( *table , *obs ) );
+	else
+	    odeint::integrate_const( stepper , std::ref( sys ) , X , value_type(0.0) , t_max , dt );
+	ctx.finish();
+	bench.stop("integrate");
+
+	bench.start("readback");
+	vex::copy( X.first , x1 );
+	vex::copy( X.second , p1 );
+	bench.stop("readback");
+    }
 
-    std::vector< value_type > x1( n ) , p1( n );
-    vex::copy( X.first , x1 );
-    vex::copy( X.second , p1 );
     cout << x1[0] << "\t" << p1[0] << std::endl;
+    cout << "device memory: " << clbuf::vexcl::usage() << std::endl;
+
+    if( batch )
+        lattice::print( cout , lattice::measure( n1 , n2 , M , K , beta , disorder , x1 , p1 ) );
     /*
     for( size_t i=0 ; i<n1 ; ++i )
     {
@@ -119,4 +262,8 @@ int main( int argc , char **argv )
         cout << "\n";
     }
     */
+
+    bench.check(x1);
+
+    bench.report();
 }
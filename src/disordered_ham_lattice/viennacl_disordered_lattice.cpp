@@ -1,6 +1,7 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <memory>
 #include <utility>
 #include <tuple>
 #include <random>
@@ -13,6 +14,9 @@
 #include <viennacl/linalg/prod.hpp>
 #include <viennacl/io/kernel_parameters.hpp>
 
+#include "precision.hpp"
+#include "benchmark.hpp"
+
 #include <boost/numeric/odeint.hpp>
 #include <boost/numeric/odeint/algebra/vector_space_algebra.hpp>
 
@@ -21,7 +25,7 @@
 
 namespace odeint = boost::numeric::odeint;
 
-typedef double value_type;
+typedef precision::real value_type;
 typedef viennacl::vector< value_type > state_type;
 
 using namespace std;
@@ -50,7 +54,7 @@ struct ham_lattice
 	    }
 	}
 
-	copy(viennacl::tools::const_sparse_matrix_adapter<double>(
+	copy(viennacl::tools::const_sparse_matrix_adapter<value_type>(
 		    cpu_matrix, m_N, m_N), m_A);
     }
 
@@ -88,6 +92,10 @@ int main( int argc , char **argv )
     value_type t_max = 100.0;
     value_type dt = 0.01;
 
+    benchmark::harness bench("viennacl_disordered_lattice", n1);
+
+    bench.start("setup");
+
     vex::Context ctx( vex::Filter::Exclusive( vex::Filter::Env && vex::Filter::DoublePrecision && vex::Filter::Count(1)) );
     std::vector<cl_device_id> dev_id(1, ctx.queue(0).getInfo<CL_QUEUE_DEVICE>()());
     std::vector<cl_command_queue> queue_id(1, ctx.queue(0)());
@@ -100,34 +108,55 @@ int main( int argc , char **argv )
     bool cpu = ctx.queue(0).getInfo<CL_QUEUE_DEVICE>().getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU;
 
     std::vector<value_type> disorder( n, 0 );
+    std::vector<value_type> zero( n, 0 );
 
     std::pair< state_type , state_type > X( state_type( n1 * n2 ) , state_type( n1 * n2 ) );
-    viennacl::copy(disorder, X.first);
-    viennacl::copy(disorder, X.second);
-    X.first[ n1/2*n2+n2/2 ] = 1.0;
 
     std::generate(disorder.begin(), disorder.end(), drand48);
 
+    std::unique_ptr< ham_lattice< viennacl::compressed_matrix<value_type> > > csr;
+    std::unique_ptr< ham_lattice< viennacl::ell_matrix<value_type> > > ell;
 
-    odeint::symplectic_rkn_sb3a_mclachlan<
-        state_type , state_type , value_type , state_type , state_type , value_type ,
-        odeint::vector_space_algebra , odeint::viennacl_operations
-        > stepper;
-
-    if (cpu) {
-	ham_lattice< viennacl::compressed_matrix<value_type> > sys(
-		n1 , n2 , K , beta , disorder );
-	odeint::integrate_const( stepper , std::ref( sys ) , X , value_type(0.0) , t_max , dt );
-    } else {
-	ham_lattice< viennacl::ell_matrix<value_type> > sys(
-		n1 , n2 , K , beta , disorder );
-	odeint::integrate_const( stepper , std::ref( sys ) , X , value_type(0.0) , t_max , dt );
-    }
+    if (cpu)
+	csr.reset(new ham_lattice< viennacl::compressed_matrix<value_type> >(
+		    n1 , n2 , K , beta , disorder ));
+    else
+	ell.reset(new ham_lattice< viennacl::ell_matrix<value_type> >(
+		    n1 , n2 , K , beta , disorder ));
 
+    bench.stop("setup");
 
     std::vector< value_type > x1( n ) , p1( n );
-    viennacl::copy( X.first , x1 );
-    viennacl::copy( X.second , p1 );
+
+    // Kernels are compiled on first use, so the first (warm-up) repetition
+    // includes the compilation time.
+    while(bench.next()) {
+	bench.start("upload");
+	viennacl::copy(zero, X.first);
+	viennacl::copy(zero, X.second);
+	X.first[ n1/2*n2+n2/2 ] = 1.0;
+	ctx.finish();
+	bench.stop("upload");
+
+	bench.start("integrate");
+	odeint::symplectic_rkn_sb3a_mclachlan<
+	    state_type , state_type , value_type , state_type , state_type , value_type ,
+	    odeint::vector_space_algebra , odeint::viennacl_operations
+	    > stepper;
+
+	if (cpu)
+	    odeint::integrate_const( stepper , std::ref( *csr ) , X , value_type(0.0) , t_max , dt );
+	else
+	    odeint::integrate_const( stepper , std::ref( *ell ) , X , value_type(0.0) , t_max , dt );
+	ctx.finish();
+	bench.stop("integrate");
+
+	bench.start("readback");
+	viennacl::copy( X.first , x1 );
+	viennacl::copy( X.second , p1 );
+	bench.stop("readback");
+    }
+
     cout << x1[0] << "\t" << p1[0] << std::endl;
     /*
     for( size_t i=0 ; i<n1 ; ++i )
@@ -138,5 +167,9 @@ int main( int argc , char **argv )
     }
     */
 
+    bench.check(x1);
+
+    bench.report();
+
     exit(0);
 }
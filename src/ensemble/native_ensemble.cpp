@@ -0,0 +1,136 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string>
+
+#include <native/vector.hpp>
+#include <native/operations.hpp>
+#include <native/ensemble.hpp>
+
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "systems.hpp"
+
+#include <boost/numeric/odeint.hpp>
+
+namespace odeint = boost::numeric::odeint;
+typedef precision::real value_type;
+
+typedef native::vector<value_type> state_type;
+
+static const value_type dt = 0.01;
+static const value_type t_max = 100.0;
+
+struct options {
+    size_t n, batch;
+};
+
+template <class System,
+         template <class, class, class, class, class, class, class> class Stepper>
+void run(const std::string &name, const options &opt) {
+    const size_t n = opt.n, N = System::dim, P = System::params;
+
+    benchmark::harness bench(name, n);
+
+    bench.start("setup");
+
+    native::flush_denormals();
+    native::info<value_type>(std::cout) << std::endl;
+
+    std::vector<value_type> x( N * n ), p( P * n );
+    for(size_t i = 0; i < n; ++i) {
+        std::array<double, System::dim>    x0 = System::initial();
+        std::array<double, System::params> p0 = System::parameters(i, n);
+
+        for(size_t c = 0; c < N; ++c) x[c * n + i] = x0[c];
+        for(size_t c = 0; c < P; ++c) p[c * n + i] = p0[c];
+    }
+
+    state_type prm(p);
+
+    native::ode_ensemble<System, Stepper> step;
+
+    // Same number of steps as integrate_const makes.
+    size_t steps_total = 0;
+    for(value_type t = 0; t < t_max; t += dt) ++steps_total;
+
+    const size_t batch = opt.batch ? opt.batch : steps_total;
+
+    bench.stop("setup");
+
+    std::vector<value_type> res( n );
+
+    while(bench.next()) {
+        bench.start("upload");
+        state_type X(x);
+        bench.stop("upload");
+
+        native::bytes_touched = 0;
+
+        bench.start("integrate");
+        for(size_t k = 0; k < steps_total; k += batch)
+            step(X.data(), prm.data(), n, k * dt, dt, std::min(batch, steps_total - k));
+        bench.stop("integrate");
+
+        bench.start("readback");
+        std::copy(X.begin(), X.begin() + n, res.begin());
+        bench.stop("readback");
+
+        bench.bytes(native::bytes_touched);
+    }
+
+    std::cout << res[0] << std::endl;
+    std::cout << "bytes io: " << native::bytes_touched << std::endl;
+
+    bench.check(res);
+
+    bench.report();
+}
+
+template <class System>
+void dispatch(const std::string &stepper, const options &opt) {
+    std::string name = std::string("native_ensemble_") + System::name() + "_" + stepper;
+
+    if (stepper == "rk4")
+        run<System, odeint::runge_kutta4>(name, opt);
+    else if (stepper == "dopri5")
+        run<System, odeint::runge_kutta_dopri5>(name, opt);
+    else if (stepper == "fehlberg78")
+        run<System, odeint::runge_kutta_fehlberg78>(name, opt);
+    else
+        throw std::invalid_argument("unknown stepper " + stepper);
+}
+
+int main(int argc, char *argv[]) {
+    options opt = { argc > 1 ? size_t(atoi(argv[1])) : size_t(1024), 0 };
+
+    // Modes:
+    //   system=S    lorenz (default), rossler, duffing or vanderpol, see
+    //               systems.hpp;
+    //   stepper=M   rk4 (default), dopri5 or fehlberg78, with a fixed step;
+    //   batch=K     steps per pass over the ensemble (default: all of them,
+    //               every member stays in registers to the end).
+    std::string system = "lorenz", stepper = "rk4";
+    for(int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a.compare(0, 7, "system=")  == 0) system    = a.substr(7);
+        if (a.compare(0, 8, "stepper=") == 0) stepper   = a.substr(8);
+        if (a.compare(0, 6, "batch=")   == 0) opt.batch = atoi(a.c_str() + 6);
+    }
+
+    try {
+        if (system == "lorenz")
+            dispatch<systems::lorenz>(stepper, opt);
+        else if (system == "rossler")
+            dispatch<systems::rossler>(stepper, opt);
+        else if (system == "duffing")
+            dispatch<systems::duffing>(stepper, opt);
+        else if (system == "vanderpol")
+            dispatch<systems::vanderpol>(stepper, opt);
+        else
+            throw std::invalid_argument("unknown system " + system);
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
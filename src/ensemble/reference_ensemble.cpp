@@ -0,0 +1,175 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string>
+
+#include <vexcl/devlist.hpp>
+
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "vt_user.h"
+#include "clbuf/clbuf.hpp"
+#include "systems.hpp"
+
+#include <boost/numeric/odeint.hpp>
+
+namespace odeint = boost::numeric::odeint;
+typedef precision::real value_type;
+
+static const value_type dt = 0.01;
+static const value_type t_max = 100.0;
+
+// Number of time steps to make per kernel launch (see
+// generated_lorenz_ensemble.cpp).
+size_t steps_per_launch(size_t n) {
+    const size_t min_work  = 1 << 22; // member-steps per launch
+    const size_t max_steps = 1024;
+
+    size_t k = 1;
+    while(k < max_steps && n * k < min_work) k *= 2;
+    return k;
+}
+
+struct options {
+    size_t n, batch;
+    bool   tune;
+};
+
+template <class System,
+         template <class, class, class, class, class, class, class> class Stepper>
+void run(const std::string &name, const options &opt) {
+    typedef clbuf::ode_ensemble<System, Stepper> engine;
+
+    const size_t n = opt.n, N = System::dim, P = System::params;
+
+    benchmark::harness bench(name, n);
+    if (opt.tune) bench.warm_up(1);
+
+    bench.start("setup");
+
+    vex::Context vctx(
+            vex::Filter::Exclusive( vex::Filter::Env && vex::Filter::Count(1) ),
+            vt::queue_properties()
+            );
+    if (!vctx) throw std::runtime_error("No compute devices");
+
+    std::cout << vctx << std::endl;
+
+    clbuf::context ctx(vctx.queue(0));
+
+    std::vector<value_type> x( N * n ), p( P * n );
+    for(size_t i = 0; i < n; ++i) {
+        std::array<double, System::dim>    x0 = System::initial();
+        std::array<double, System::params> p0 = System::parameters(i, n);
+
+        for(size_t c = 0; c < N; ++c) x[c * n + i] = x0[c];
+        for(size_t c = 0; c < P; ++c) p[c * n + i] = p0[c];
+    }
+
+    clbuf::vector<value_type> prm(ctx, p);
+
+    bench.stop("setup");
+
+    bench.start("compile");
+    ctx.build(PRECISION_CL_PREAMBLE + engine::source("ensemble"));
+    bench.stop("compile");
+
+    engine step(ctx, "ensemble");
+
+    const size_t batch = opt.batch ? opt.batch : steps_per_launch(n);
+    std::cout << "steps per launch: " << batch << std::endl;
+
+    // Same number of steps as integrate_const makes.
+    size_t steps_total = 0;
+    for(value_type t = 0; t < t_max; t += dt) ++steps_total;
+
+    std::vector<value_type> res( n );
+
+    while(bench.next()) {
+        ctx.autotune = opt.tune && bench.warming();
+
+        bench.start("upload");
+        clbuf::vector<value_type> X(ctx, x);
+        ctx.finish();
+        bench.stop("upload");
+
+        ctx.bytes_touched = 0;
+
+        bench.start("integrate");
+        VT_USER_START("integrate");
+        for(size_t k = 0; k < steps_total; k += batch)
+            step(X, prm, k * dt, dt, std::min(batch, steps_total - k));
+        ctx.finish();
+        VT_USER_END("integrate");
+        bench.stop("integrate");
+
+        bench.start("readback");
+        std::vector<value_type> y( N * n );
+        X.read(y);
+        std::copy(y.begin(), y.begin() + n, res.begin());
+        bench.stop("readback");
+
+        bench.bytes(ctx.bytes_touched);
+    }
+
+    std::cout << res[0] << std::endl;
+    std::cout << "bytes io: " << ctx.bytes_touched << std::endl;
+
+    bench.check(res);
+
+    bench.report();
+}
+
+template <class System>
+void dispatch(const std::string &stepper, const options &opt) {
+    std::string name = std::string("reference_ensemble_") + System::name() + "_" + stepper;
+
+    if (stepper == "rk4")
+        run<System, odeint::runge_kutta4>(name, opt);
+    else if (stepper == "dopri5")
+        run<System, odeint::runge_kutta_dopri5>(name, opt);
+    else if (stepper == "fehlberg78")
+        run<System, odeint::runge_kutta_fehlberg78>(name, opt);
+    else
+        throw std::invalid_argument("unknown stepper " + stepper);
+}
+
+int main(int argc, char *argv[]) {
+    options opt = { argc > 1 ? size_t(atoi(argv[1])) : size_t(1024), 0, false };
+
+    // Modes:
+    //   system=S    lorenz (default), rossler, duffing or vanderpol, see
+    //               systems.hpp;
+    //   stepper=M   rk4 (default), dopri5 or fehlberg78, with a fixed step;
+    //   batch=K     steps per kernel launch (default: enough member-steps
+    //               per launch to hide the launch latency);
+    //   tune        sweep the launch configurations of the kernel in a
+    //               warm-up repetition and save them for later runs.
+    std::string system = "lorenz", stepper = "rk4";
+    for(int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        opt.tune = opt.tune || a == "tune";
+        if (a.compare(0, 7, "system=")  == 0) system    = a.substr(7);
+        if (a.compare(0, 8, "stepper=") == 0) stepper   = a.substr(8);
+        if (a.compare(0, 6, "batch=")   == 0) opt.batch = atoi(a.c_str() + 6);
+    }
+
+    try {
+        if (system == "lorenz")
+            dispatch<systems::lorenz>(stepper, opt);
+        else if (system == "rossler")
+            dispatch<systems::rossler>(stepper, opt);
+        else if (system == "duffing")
+            dispatch<systems::duffing>(stepper, opt);
+        else if (system == "vanderpol")
+            dispatch<systems::vanderpol>(stepper, opt);
+        else
+            throw std::invalid_argument("unknown system " + system);
+    } catch (const cl::Error &e) {
+        std::cerr << "OpenCL error: " << e << std::endl;
+        return 1;
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef ENSEMBLE_SYSTEMS_HPP
+#define ENSEMBLE_SYSTEMS_HPP
+
+// Systems of the ensemble engine (see clbuf/ensemble.hpp and
+// native/ensemble.hpp). The right hand side is a template, so that the same
+// code runs on clbuf::symbolic values for the OpenCL kernel and on simd
+// values for the CPU. All constants of a system are parameters, so every
+// member may have its own; parameters(i, n) sweeps one of them over the
+// ensemble, the way the Lorenz programs sweep R. Numbers in the right hand
+// sides are written as int literals, which convert to every value type.
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+
+namespace systems {
+
+// Sweep of [lo, hi] over n members.
+inline double sweep(double lo, double hi, size_t i, size_t n) {
+    return n > 1 ? lo + (hi - lo) * i / (n - 1) : lo;
+}
+
+struct lorenz {
+    static const unsigned dim = 3, params = 3;
+
+    static const char* name() { return "lorenz"; }
+
+    // sigma, R, b
+    template <class State, class Params, class Time>
+    void operator()(const State &x, State &dxdt, const Params &p, const Time &t) const {
+        dxdt[0] = p[0] * (x[1] - x[0]);
+        dxdt[1] = p[1] * x[0] - x[1] - x[0] * x[2];
+        dxdt[2] = x[0] * x[1] - p[2] * x[2];
+    }
+
+    static std::array<double, params> parameters(size_t i, size_t n) {
+        std::array<double, params> p = {{10.0, sweep(0.1, 50.0, i, n), 8.0 / 3.0}};
+        return p;
+    }
+
+    static std::array<double, dim> initial() {
+        std::array<double, dim> x = {{10.0, 10.0, 10.0}};
+        return x;
+    }
+};
+
+struct rossler {
+    static const unsigned dim = 3, params = 3;
+
+    static const char* name() { return "rossler"; }
+
+    // a, b, c
+    template <class State, class Params, class Time>
+    void operator()(const State &x, State &dxdt, const Params &p, const Time &t) const {
+        dxdt[0] = -x[1] - x[2];
+        dxdt[1] = x[0] + p[0] * x[1];
+        dxdt[2] = p[1] + x[2] * (x[0] - p[2]);
+    }
+
+    static std::array<double, params> parameters(size_t i, size_t n) {
+        std::array<double, params> p = {{0.2, 0.2, sweep(2.0, 10.0, i, n)}};
+        return p;
+    }
+
+    static std::array<double, dim> initial() {
+        std::array<double, dim> x = {{1.0, 1.0, 1.0}};
+        return x;
+    }
+};
+
+// Forced oscillator, the one system here that depends on t.
+struct duffing {
+    static const unsigned dim = 2, params = 5;
+
+    static const char* name() { return "duffing"; }
+
+    // delta, alpha, beta, gamma, omega
+    template <class State, class Params, class Time>
+    void operator()(const State &x, State &dxdt, const Params &p, const Time &t) const {
+        using std::cos;
+
+        dxdt[0] = x[1];
+        dxdt[1] = p[3] * cos(p[4] * t)
+            - p[0] * x[1] - p[1] * x[0] - p[2] * x[0] * x[0] * x[0];
+    }
+
+    static std::array<double, params> parameters(size_t i, size_t n) {
+        std::array<double, params> p = {{0.3, -1.0, 1.0, sweep(0.2, 0.65, i, n), 1.2}};
+        return p;
+    }
+
+    static std::array<double, dim> initial() {
+        std::array<double, dim> x = {{1.0, 0.0}};
+        return x;
+    }
+};
+
+struct vanderpol {
+    static const unsigned dim = 2, params = 1;
+
+    static const char* name() { return "vanderpol"; }
+
+    // mu
+    template <class State, class Params, class Time>
+    void operator()(const State &x, State &dxdt, const Params &p, const Time &t) const {
+        dxdt[0] = x[1];
+        dxdt[1] = p[0] * (1 - x[0] * x[0]) * x[1] - x[0];
+    }
+
+    static std::array<double, params> parameters(size_t i, size_t n) {
+        std::array<double, params> p = {{sweep(0.1, 5.0, i, n)}};
+        return p;
+    }
+
+    static std::array<double, dim> initial() {
+        std::array<double, dim> x = {{2.0, 0.0}};
+        return x;
+    }
+};
+
+} // namespace systems
+
+#endif
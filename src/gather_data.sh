@@ -1,6 +1,6 @@
 #!/bin/bash
 
-for mask in thrust_cpu vexcl_cpu_intel vexcl_cpu_amd \
+for mask in thrust_cpu vexcl_cpu_intel vexcl_cpu_amd native_cpu \
     viennacl_cpu_intel viennacl_cpu_amd \
     thrust_gpu vexcl_1gpu viennacl_gpu \
     vexcl_2gpu vexcl_3gpu
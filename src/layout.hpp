@@ -0,0 +1,116 @@
+#ifndef LAYOUT_HPP
+#define LAYOUT_HPP
+
+// Memory layouts of ensemble states: n systems of C components each, held
+// in one flat buffer. Component c of system i lives at
+//
+//   soa:    c * n + i                          (a block per component)
+//   aos:    i * C + c                          (systems one after another)
+//   aosoa:  (i / B) * C * B + c * B + i % B    (soa within blocks of B systems)
+//
+// B should match the hardware: the SIMD width on CPUs and the warp or
+// wavefront size on GPUs. The aosoa buffer is padded to whole blocks, so
+// the ensemble has padded() >= n systems; the padding has to be a valid
+// state of the system (e.g. a fixed point) as the steppers integrate it
+// along.
+//
+// The odeint operations work element by element on the flat buffer, so
+// they do not care about the layout; only the system functions and the
+// observables do. pack() and unpack() convert from and to the soa order
+// the programs set up the initial state and check their results in.
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <stdexcept>
+
+namespace layout {
+
+enum kind { soa, aos, aosoa };
+
+inline kind parse(const std::string &s) {
+    if (s == "soa")   return soa;
+    if (s == "aos")   return aos;
+    if (s == "aosoa") return aosoa;
+    throw std::invalid_argument("layout: unknown layout " + s);
+}
+
+inline const char* name(kind k) {
+    switch (k) {
+        case aos:   return "aos";
+        case aosoa: return "aosoa";
+        default:    return "soa";
+    }
+}
+
+template <unsigned C>
+struct ensemble {
+    kind   k;
+    size_t n;     // systems
+    size_t B;     // aosoa block
+
+    ensemble(kind k, size_t n, size_t B = 1) : k(k), n(n), B(k == aosoa ? B : 1) {
+        if (!B) throw std::invalid_argument("layout: zero block size");
+    }
+
+    // Systems in the buffer, including the padding.
+    size_t padded() const {
+        return (n + B - 1) / B * B;
+    }
+
+    // Elements of the buffer.
+    size_t size() const {
+        return C * padded();
+    }
+
+    size_t index(size_t i, unsigned c) const {
+        switch (k) {
+            case aos:   return i * C + c;
+            case aosoa: return i / B * C * B + c * B + i % B;
+            default:    return c * n + i;
+        }
+    }
+
+    // Soa state of n systems to this layout; the padding is set to pad.
+    template <typename T>
+    std::vector<T> pack(const std::vector<T> &x, T pad = T()) const {
+        std::vector<T> y(size(), pad);
+        for(unsigned c = 0; c < C; ++c)
+            for(size_t i = 0; i < n; ++i) y[index(i, c)] = x[c * n + i];
+        return y;
+    }
+
+    template <typename T>
+    std::vector<T> unpack(const std::vector<T> &y) const {
+        std::vector<T> x(C * n);
+        for(unsigned c = 0; c < C; ++c)
+            for(size_t i = 0; i < n; ++i) x[c * n + i] = y[index(i, c)];
+        return x;
+    }
+
+    // OpenCL version of index(), as a macro IDX(i, c). The soa stride is
+    // the kernel argument n.
+    std::string cl_index() const {
+        std::ostringstream s;
+
+        s << "#define IDX(i, c) ";
+        switch (k) {
+            case aos:
+                s << "((i) * " << C << " + (c))";
+                break;
+            case aosoa:
+                s << "((i) / " << B << " * " << C * B
+                  << " + (c) * " << B << " + (i) % " << B << ")";
+                break;
+            default:
+                s << "((c) * n + (i))";
+        }
+        s << "\n";
+
+        return s.str();
+    }
+};
+
+} // namespace layout
+
+#endif
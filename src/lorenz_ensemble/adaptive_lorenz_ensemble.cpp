@@ -0,0 +1,278 @@
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <numeric>
+
+#include <vexcl/vexcl.hpp>
+
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "program_cache.hpp"
+
+// Dormand-Prince 5(4) with per-member step size control. Every work-item
+// advances its members independently towards t_max, making at most
+// max_steps attempts per launch. Members that did not reach t_max yet are
+// counted with a work-group reduction and a single atomic per group, so the
+// host only has to read one number after every launch.
+static const char source[] =
+    PRECISION_CL_PREAMBLE
+    "real3 system_function(\n"
+    "    real r,\n"
+    "    real sigma,\n"
+    "    real b,\n"
+    "    real3 s\n"
+    "    )\n"
+    "{\n"
+    "    return (real3)(\n"
+    "       sigma * (s.y - s.x),\n"
+    "       r * s.x - s.y - s.x * s.z,\n"
+    "       s.x * s.y - b * s.z);\n"
+    "}\n"
+    "\n"
+    "kernel void lorenz_dopri5(\n"
+    "    ulong  n,\n"
+    "    global real *X,\n"
+    "    global real *Y,\n"
+    "    global real *Z,\n"
+    "    global real *T,\n"
+    "    global real *DT,\n"
+    "    global uint *steps,\n"
+    "    const global real *R,\n"
+    "    real sigma,\n"
+    "    real b,\n"
+    "    real t_max,\n"
+    "    real atol,\n"
+    "    real rtol,\n"
+    "    uint max_steps,\n"
+    "    global uint *active\n"
+    "    )\n"
+    "{\n"
+    "    local uint group_active;\n"
+    "    if (get_local_id(0) == 0) group_active = 0;\n"
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "\n"
+    "    for(size_t gid = get_global_id(0); gid < n; gid += get_global_size(0))\n"
+    "    {\n"
+    "        real  r   = R[gid];\n"
+    "        real3 s   = (real3)(X[gid], Y[gid], Z[gid]);\n"
+    "        real  t   = T[gid];\n"
+    "        real  dt  = DT[gid];\n"
+    "        uint  cnt = steps[gid];\n"
+    "\n"
+    "        if (t >= t_max) continue;\n"
+    "\n"
+    "        real3 k1 = system_function(r, sigma, b, s);\n"
+    "\n"
+    "        for(uint k = 0; k < max_steps && t < t_max; ++k, ++cnt) {\n"
+    "            bool last = dt >= t_max - t;\n"
+    "            if (last) dt = t_max - t;\n"
+    "\n"
+    "            real3 k2 = system_function(r, sigma, b, s + dt * (\n"
+    "                (real)(1.0 / 5) * k1));\n"
+    "            real3 k3 = system_function(r, sigma, b, s + dt * (\n"
+    "                (real)(3.0 / 40) * k1 + (real)(9.0 / 40) * k2));\n"
+    "            real3 k4 = system_function(r, sigma, b, s + dt * (\n"
+    "                (real)(44.0 / 45) * k1 - (real)(56.0 / 15) * k2 + (real)(32.0 / 9) * k3));\n"
+    "            real3 k5 = system_function(r, sigma, b, s + dt * (\n"
+    "                (real)(19372.0 / 6561) * k1 - (real)(25360.0 / 2187) * k2 +\n"
+    "                (real)(64448.0 / 6561) * k3 - (real)(212.0 / 729) * k4));\n"
+    "            real3 k6 = system_function(r, sigma, b, s + dt * (\n"
+    "                (real)(9017.0 / 3168) * k1 - (real)(355.0 / 33) * k2 +\n"
+    "                (real)(46732.0 / 5247) * k3 + (real)(49.0 / 176) * k4 -\n"
+    "                (real)(5103.0 / 18656) * k5));\n"
+    "\n"
+    "            real3 y = s + dt * (\n"
+    "                (real)(35.0 / 384) * k1 + (real)(500.0 / 1113) * k3 +\n"
+    "                (real)(125.0 / 192) * k4 - (real)(2187.0 / 6784) * k5 +\n"
+    "                (real)(11.0 / 84) * k6);\n"
+    "\n"
+    "            real3 k7 = system_function(r, sigma, b, y);\n"
+    "\n"
+    "            real3 e = dt * (\n"
+    "                (real)(71.0 / 57600) * k1 - (real)(71.0 / 16695) * k3 +\n"
+    "                (real)(71.0 / 1920) * k4 - (real)(17253.0 / 339200) * k5 +\n"
+    "                (real)(22.0 / 525) * k6 - (real)(1.0 / 40) * k7);\n"
+    "\n"
+    "            real3 q = fabs(e) / (atol + rtol * fmax(fabs(s), fabs(y)));\n"
+    "            real err = fmax(q.x, fmax(q.y, q.z));\n"
+    "\n"
+    "            if (err <= 1) {\n"
+    "                t  = last ? t_max : t + dt;\n"
+    "                s  = y;\n"
+    "                k1 = k7;\n"
+    "            }\n"
+    "\n"
+    "            dt *= clamp((real)0.9 * pow(err, (real)-0.2), (real)0.2, (real)5);\n"
+    "        }\n"
+    "\n"
+    "        X[gid]     = s.x;\n"
+    "        Y[gid]     = s.y;\n"
+    "        Z[gid]     = s.z;\n"
+    "        T[gid]     = t;\n"
+    "        DT[gid]    = dt;\n"
+    "        steps[gid] = cnt;\n"
+    "\n"
+    "        if (t < t_max) atomic_inc(&group_active);\n"
+    "    }\n"
+    "\n"
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "    if (get_local_id(0) == 0 && group_active) atomic_add(active, group_active);\n"
+    "}\n";
+
+typedef precision::real value_type;
+typedef vex::vector< value_type >    vector_type;
+typedef vex::multivector< value_type, 3 > state_type;
+
+int main( int argc , char **argv ) {
+    const value_type sigma = 10.0;
+    const value_type b = 8.0 / 3.0;
+    const value_type dt = 0.01;
+    const value_type t_max = 100.0;
+
+    // Attempted steps per launch between two polls of the active counter.
+    const cl_uint max_steps = 512;
+
+    try {
+	size_t n = argc > 1 ? atoi(argv[1]) : 1024;
+	// Single precision cannot resolve much below 1e-6 relative error.
+	value_type tol = argc > 2 ? atof(argv[2]) : (sizeof(value_type) < sizeof(double) ? 1e-4 : 1e-6);
+
+	benchmark::harness bench("adaptive_lorenz", n);
+
+	bench.start("setup");
+
+	vex::Context ctx( vex::Filter::Exclusive( vex::Filter::DoublePrecision && vex::Filter::Env ) );
+	std::cout << ctx << std::endl;
+
+	value_type Rmin = 0.1 , Rmax = 50.0 , dR = ( Rmax - Rmin ) / value_type( n - 1 );
+	std::vector<value_type> r( n );
+	for( size_t i=0 ; i<n ; ++i ) r[i] = Rmin + dR * value_type( i );
+	vector_type R(ctx.queue(), r);
+
+	state_type X(ctx.queue(), n);
+	vector_type T(ctx.queue(), n);
+	vector_type DT(ctx.queue(), n);
+	vex::vector<cl_uint> steps(ctx.queue(), n);
+
+	std::vector<cl::Buffer> active(ctx.size());
+	for(uint d = 0; d < ctx.size(); d++)
+	    active[d] = cl::Buffer(ctx.context(d), CL_MEM_READ_WRITE, sizeof(cl_uint));
+
+	bench.stop("setup");
+
+	bench.start("compile");
+
+	std::vector<cl::Kernel> kernel(ctx.size());
+	std::vector<size_t> wgsize(ctx.size());
+	std::vector<size_t> g_size(ctx.size());
+
+	for(uint d = 0; d < ctx.size(); d++) {
+	    if (size_t psize = X(0).part_size(d)) {
+		cl::Program program = program_cache::build(ctx.context(d), source);
+		kernel[d] = cl::Kernel(program, "lorenz_dopri5");
+
+		cl::Device device = ctx.device(d);
+		wgsize[d] = vex::kernel_workgroup_size(kernel[d], device);
+		g_size[d] = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * wgsize[d] * 4;
+	    }
+	}
+
+	bench.stop("compile");
+
+	size_t launches = 0;
+	std::vector<cl_uint> count( n );
+
+	while(bench.next()) {
+	    bench.start("upload");
+	    X     = 10.0;
+	    T     = 0.0;
+	    DT    = dt;
+	    steps = 0;
+	    ctx.finish();
+	    bench.stop("upload");
+
+	    launches = 0;
+
+	    bench.start("integrate");
+	    for(cl_uint remaining = n; remaining; ++launches) {
+		static const cl_uint zero = 0;
+
+		for(uint d = 0; d < ctx.size(); d++) {
+		    if (size_t psize = X(0).part_size(d)) {
+			ctx.queue(d).enqueueWriteBuffer(
+				active[d], CL_FALSE, 0, sizeof(cl_uint), &zero);
+
+			uint pos = 0;
+			kernel[d].setArg(pos++, psize);
+			kernel[d].setArg(pos++, X(0)(d));
+			kernel[d].setArg(pos++, X(1)(d));
+			kernel[d].setArg(pos++, X(2)(d));
+			kernel[d].setArg(pos++, T(d));
+			kernel[d].setArg(pos++, DT(d));
+			kernel[d].setArg(pos++, steps(d));
+			kernel[d].setArg(pos++, R(d));
+			kernel[d].setArg(pos++, sigma);
+			kernel[d].setArg(pos++, b);
+			kernel[d].setArg(pos++, t_max);
+			kernel[d].setArg(pos++, tol);
+			kernel[d].setArg(pos++, tol);
+			kernel[d].setArg(pos++, max_steps);
+			kernel[d].setArg(pos++, active[d]);
+
+			ctx.queue(d).enqueueNDRangeKernel(
+				kernel[d], cl::NullRange, g_size[d], wgsize[d]
+				);
+		    }
+		}
+
+		remaining = 0;
+		for(uint d = 0; d < ctx.size(); d++) {
+		    if (X(0).part_size(d)) {
+			cl_uint a;
+			ctx.queue(d).enqueueReadBuffer(
+				active[d], CL_TRUE, 0, sizeof(cl_uint), &a);
+			remaining += a;
+		    }
+		}
+	    }
+	    ctx.finish();
+	    bench.stop("integrate");
+
+	    bench.start("readback");
+	    vex::copy( X(0).begin(), X(0).end(), r.begin() );
+	    vex::copy( steps.begin(), steps.end(), count.begin() );
+	    bench.stop("readback");
+
+	    // Each launch reads R and reads and writes the state, time, step
+	    // size and step counter (upper bound, finished members are skipped).
+	    bench.bytes((11 * sizeof(value_type) + 2 * sizeof(cl_uint)) * n * launches);
+	}
+
+	std::cout << r[0] << std::endl;
+
+	// Right hand side evaluations: seven for the first attempt in a
+	// launch, six for every other one (first same as last). Compare to
+	// four per step for the fixed-step RK4 the other programs use.
+	size_t attempts = std::accumulate(count.begin(), count.end(), size_t(0));
+	size_t fixed    = 0;
+	for(value_type t = 0; t < t_max; t += dt) ++fixed;
+
+	double rhs_adaptive = 6.0 * attempts + 1.0 * n * launches;
+	double rhs_fixed    = 4.0 * n * fixed;
+
+	std::cout << "launches: " << launches << std::endl;
+	std::cout << "attempted steps: " << attempts
+	          << " (" << double(attempts) / n << " per member)" << std::endl;
+	std::cout << "rhs evaluations: " << rhs_adaptive
+	          << " (" << rhs_adaptive / rhs_fixed << " of fixed-step rk4)" << std::endl;
+
+	bench.check(r);
+
+	bench.report();
+
+    } catch(const cl::Error &e) {
+	using namespace vex;
+	std::cout << e << std::endl;
+    }
+}
@@ -24,7 +24,8 @@
 #include <boost/numeric/odeint.hpp>
 #include <boost/numeric/odeint/algebra/vector_space_algebra.hpp>
 
-#include <boost/timer.hpp>
+#include "precision.hpp"
+#include "benchmark.hpp"
 
 namespace odeint = boost::numeric::odeint;
 
@@ -58,7 +59,7 @@ const value_type sys_func<value_type>::b = 8.0 / 3.0;
 
 int main(int argc, char* argv[])
 {
-    typedef double                                     value_type;
+    typedef precision::real                              value_type;
     typedef typename sys_func<value_type>::vector_type vector_type;
     typedef typename sys_func<value_type>::state_type  state_type;
 
@@ -66,21 +67,46 @@ int main(int argc, char* argv[])
     const value_type dt= 0.01, t_max= 100.0, 
                      Rmin= 0.1, Rmax= 50.0, dR= (Rmax - Rmin) / value_type(n - 1);
 
+    benchmark::harness bench("cmtl_lorenz", n);
+
+    bench.start("setup");
     vector_type      R(n);
     for (size_t i= 0; i < n; ++i)
 	R[i]= Rmin + dR * value_type(i);
+    cudaThreadSynchronize();
+    bench.stop("setup");
+
+    value_type res= 0;
+    std::vector<value_type> x;
+
+    while (bench.next()) {
+	bench.start("upload");
+	state_type X(vector_type(n, 10.0), 3);
+	cudaThreadSynchronize();
+	bench.stop("upload");
+
+	bench.start("integrate");
+	odeint::runge_kutta4<state_type, value_type, state_type, value_type,
+			     odeint::vector_space_algebra , odeint::default_operations> stepper;
+	odeint::integrate_const(stepper, sys_func<value_type>(R), X, value_type(0), t_max, dt);
+	cudaThreadSynchronize();
+	bench.stop("integrate");
+
+	bench.start("readback");
+	res= X.at(0)[0];
+	if (bench.checking()) {
+	    x.resize(n);
+	    for (size_t i= 0; i < n; ++i)
+		x[i]= X.at(0)[i];
+	}
+	bench.stop("readback");
+    }
 
-    state_type X(vector_type(n, 10.0), 3);
+    std::cout << "Result = " << res << std::endl;
 
-    odeint::runge_kutta4<state_type, value_type, state_type, value_type,
-			 odeint::vector_space_algebra , odeint::default_operations> stepper;
-    boost::timer timer;
-    odeint::integrate_const(stepper, sys_func<value_type>(R), X, value_type(0), t_max, dt);
-    std::cout << "Integration took " << timer.elapsed() << " s\n";
+    bench.check(x);
 
-    std::cout << "Result = " << X.at(0)[0] << std::endl;
- 
+    bench.report();
 
     return 0;
 }
-
@@ -4,24 +4,33 @@
 #include <tuple>
 #include <random>
 #include <algorithm>
+#include <string>
+#include <cmath>
 
 #include <vexcl/vexcl.hpp>
 
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "program_cache.hpp"
+#include "clbuf/tuner.hpp"
+#include "observer.hpp"
+
+// lorenz_ensemble makes the steps of the members in registers.
+// lorenz_lyapunov integrates the tangent dynamics d' = J(s) d along with
+// the state. Every renorm steps, and after the last step, it normalizes d
+// and adds log |d| to L. L / t is then the largest Lyapunov exponent of
+// the member. Step numbers count from the start of the integration, so
+// the renormalization does not depend on the steps per launch.
 static const char source[] = 
-    "#if defined(cl_khr_fp64)\n"
-    "#  pragma OPENCL EXTENSION cl_khr_fp64: enable\n"
-    "#elif defined(cl_amd_fp64)\n"
-    "#  pragma OPENCL EXTENSION cl_amd_fp64: enable\n"
-    "#endif\n"
-    "\n"
-    "double3 system_function(\n"
-    "    double r,\n"
-    "    double sigma,\n"
-    "    double b,\n"
-    "    double3 s\n"
+    PRECISION_CL_PREAMBLE
+    "real3 system_function(\n"
+    "    real r,\n"
+    "    real sigma,\n"
+    "    real b,\n"
+    "    real3 s\n"
     "    )\n"
     "{\n"
-    "    return (double3)(\n"
+    "    return (real3)(\n"
     "       sigma * (s.y - s.x),\n"
     "       r * s.x - s.y - s.x * s.z,\n"
     "       s.x * s.y - b * s.z);\n"
@@ -29,41 +38,130 @@ static const char source[] =
     "\n"
     "kernel void lorenz_ensemble(\n"
     "    ulong  n,\n"
-    "    global double *X,\n"
-    "    global double *Y,\n"
-    "    global double *Z,\n"
-    "    const global double *R,\n"
-    "    double sigma,\n"
-    "    double b,\n"
-    "    double dt\n"
+    "    global real *X,\n"
+    "    global real *Y,\n"
+    "    global real *Z,\n"
+    "    const global real *R,\n"
+    "    real sigma,\n"
+    "    real b,\n"
+    "    real dt,\n"
+    "    ulong  steps\n"
     "    )\n"
     "{\n"
-    "    double r;\n"
-    "    double3 s;\n"
-    "    double3 dsdt;\n"
-    "    double3 k1, k2, k3, k4;\n"
+    "    real r;\n"
+    "    real3 s;\n"
+    "    real3 dsdt;\n"
+    "    real3 k1, k2, k3, k4;\n"
     "    for(size_t gid = get_global_id(0); gid < n; gid += get_global_size(0))\n"
     "    {\n"
     "        r = R[gid];\n"
-    "        s = (double3)(X[gid], Y[gid], Z[gid]);\n"
+    "        s = (real3)(X[gid], Y[gid], Z[gid]);\n"
     "\n"
-    "        k1 = dt * system_function(r, sigma, b, s);\n"
-    "        k2 = dt * system_function(r, sigma, b, s + 0.5 * k1);\n"
-    "        k3 = dt * system_function(r, sigma, b, s + 0.5 * k2);\n"
-    "        k4 = dt * system_function(r, sigma, b, s + k3);\n"
+    "        for(ulong k = 0; k < steps; ++k) {\n"
+    "            k1 = dt * system_function(r, sigma, b, s);\n"
+    "            k2 = dt * system_function(r, sigma, b, s + (real)0.5 * k1);\n"
+    "            k3 = dt * system_function(r, sigma, b, s + (real)0.5 * k2);\n"
+    "            k4 = dt * system_function(r, sigma, b, s + k3);\n"
     "\n"
-    "        s += (k1 + 2 * k2 + 2 * k3 + k4) / 6;\n"
+    "            s += (k1 + 2 * k2 + 2 * k3 + k4) / 6;\n"
+    "        }\n"
     "\n"
     "        X[gid] = s.x;\n"
     "        Y[gid] = s.y;\n"
     "        Z[gid] = s.z;\n"
     "    }\n"
+    "}\n"
+    "\n"
+    "real3 tangent_function(\n"
+    "    real r,\n"
+    "    real sigma,\n"
+    "    real b,\n"
+    "    real3 s,\n"
+    "    real3 d\n"
+    "    )\n"
+    "{\n"
+    "    return (real3)(\n"
+    "       sigma * (d.y - d.x),\n"
+    "       (r - s.z) * d.x - d.y - s.x * d.z,\n"
+    "       s.y * d.x + s.x * d.y - b * d.z);\n"
+    "}\n"
+    "\n"
+    "kernel void lorenz_lyapunov(\n"
+    "    ulong  n,\n"
+    "    global real *X,\n"
+    "    global real *Y,\n"
+    "    global real *Z,\n"
+    "    global real *DX,\n"
+    "    global real *DY,\n"
+    "    global real *DZ,\n"
+    "    global real *L,\n"
+    "    const global real *R,\n"
+    "    real sigma,\n"
+    "    real b,\n"
+    "    real dt,\n"
+    "    ulong  first,\n"
+    "    ulong  steps,\n"
+    "    ulong  total,\n"
+    "    ulong  renorm\n"
+    "    )\n"
+    "{\n"
+    "    real r, l;\n"
+    "    real3 s, d;\n"
+    "    real3 k1, k2, k3, k4;\n"
+    "    real3 j1, j2, j3, j4;\n"
+    "    for(size_t gid = get_global_id(0); gid < n; gid += get_global_size(0))\n"
+    "    {\n"
+    "        r = R[gid];\n"
+    "        l = L[gid];\n"
+    "        s = (real3)(X[gid], Y[gid], Z[gid]);\n"
+    "        d = (real3)(DX[gid], DY[gid], DZ[gid]);\n"
+    "\n"
+    "        for(ulong k = first; k < first + steps; ++k) {\n"
+    "            k1 = dt * system_function(r, sigma, b, s);\n"
+    "            j1 = dt * tangent_function(r, sigma, b, s, d);\n"
+    "            k2 = dt * system_function(r, sigma, b, s + (real)0.5 * k1);\n"
+    "            j2 = dt * tangent_function(r, sigma, b, s + (real)0.5 * k1, d + (real)0.5 * j1);\n"
+    "            k3 = dt * system_function(r, sigma, b, s + (real)0.5 * k2);\n"
+    "            j3 = dt * tangent_function(r, sigma, b, s + (real)0.5 * k2, d + (real)0.5 * j2);\n"
+    "            k4 = dt * system_function(r, sigma, b, s + k3);\n"
+    "            j4 = dt * tangent_function(r, sigma, b, s + k3, d + j3);\n"
+    "\n"
+    "            s += (k1 + 2 * k2 + 2 * k3 + k4) / 6;\n"
+    "            d += (j1 + 2 * j2 + 2 * j3 + j4) / 6;\n"
+    "\n"
+    "            if ((k + 1) % renorm == 0 || k + 1 == total) {\n"
+    "                real g = length(d);\n"
+    "                l += log(g);\n"
+    "                d /= g;\n"
+    "            }\n"
+    "        }\n"
+    "\n"
+    "        X[gid] = s.x;\n"
+    "        Y[gid] = s.y;\n"
+    "        Z[gid] = s.z;\n"
+    "        DX[gid] = d.x;\n"
+    "        DY[gid] = d.y;\n"
+    "        DZ[gid] = d.z;\n"
+    "        L[gid] = l;\n"
+    "    }\n"
     "}\n";
 
-typedef double value_type;
+typedef precision::real value_type;
 typedef vex::vector< value_type >    vector_type;
 typedef vex::multivector< value_type, 3 > state_type;
 
+// Number of time steps to make per kernel launch. Launch latency is a few
+// microseconds, so small ensembles get enough steps per launch to amortize
+// it, while large ensembles keep one step per launch.
+size_t steps_per_launch(size_t n) {
+    const size_t min_work  = 1 << 22; // member-steps per launch
+    const size_t max_steps = 1024;
+
+    size_t k = 1;
+    while(k < max_steps && n * k < min_work) k *= 2;
+    return k;
+}
+
 int main( int argc , char **argv ) {
     const value_type sigma = 10.0;
     const value_type b = 8.0 / 3.0;
@@ -73,6 +171,30 @@ int main( int argc , char **argv ) {
     try {
 	size_t n = argc > 1 ? atoi(argv[1]) : 1024;
 
+	// Modes: "batched", "tune" (sweep the launch configuration in a
+	// warm-up repetition and save it for later runs) and "lyapunov=K"
+	// (largest Lyapunov exponent of every member, renormalized every K
+	// steps on the device; lambda(R) is written to <name>.lyap and checked
+	// instead of the state).
+	bool batched = false, tune = false;
+	size_t renorm = 0;
+	for(int i = 2; i < argc; ++i) {
+	    std::string a = argv[i];
+	    batched = batched || a == "batched";
+	    tune    = tune    || a == "tune";
+	    if (a.compare(0, 9, "lyapunov=") == 0) renorm = atoi(a.c_str() + 9);
+	}
+
+	std::string name = batched ? "custom_lorenz_batched" : "custom_lorenz";
+	if (renorm) name += "_lyapunov";
+
+	const char *kname = renorm ? "lorenz_lyapunov" : "lorenz_ensemble";
+
+	benchmark::harness bench(name, n);
+	if (tune) bench.warm_up(1);
+
+	bench.start("setup");
+
 	vex::Context ctx( vex::Filter::Exclusive( vex::Filter::DoublePrecision && vex::Filter::Env ) );
 	std::cout << ctx << std::endl;
 
@@ -82,45 +204,141 @@ int main( int argc , char **argv ) {
 	vector_type R(ctx.queue(), r);
 
 	state_type X(ctx.queue(), n);
-	X = 10.0;
+
+	// Tangent vectors and log growths of the lyapunov mode.
+	state_type  D(ctx.queue(), renorm ? n : 0);
+	vector_type L(ctx.queue(), renorm ? n : 0);
+
+	bench.stop("setup");
+
+	bench.start("compile");
 
 	std::vector<cl::Kernel> kernel(ctx.size());
 	std::vector<size_t> wgsize(ctx.size());
 	std::vector<size_t> g_size(ctx.size());
+	std::vector<clbuf::tuner> tuner;
 
 	for(uint d = 0; d < ctx.size(); d++) {
+	    tuner.push_back(clbuf::tuner(ctx.device(d)));
+
 	    if (size_t psize = X(0).part_size(d)) {
-		cl::Program program = vex::build_sources(ctx.context(d), source);
-		kernel[d] = cl::Kernel(program, "lorenz_ensemble");
+		cl::Program program = program_cache::build(ctx.context(d), source);
+		kernel[d] = cl::Kernel(program, kname);
 
-		cl::Device device = ctx.device(d);
-		wgsize[d] = vex::kernel_workgroup_size(kernel[d], device);
-		g_size[d] = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * wgsize[d] * 4;
+		// Four groups per compute unit unless tuned otherwise.
+		clbuf::launch_config c = {
+		    vex::kernel_workgroup_size(kernel[d], ctx.device(d)), 4, 1 };
+		tuner[d].find(kname, psize, c);
+
+		wgsize[d] = c.wgsize;
+		g_size[d] = c.global(psize, tuner[d].units());
 	    }
 	}
 
-	for(value_type t = 0; t < t_max; t += dt) {
-	    for(uint d = 0; d < ctx.size(); d++) {
-		if (size_t psize = X(0).part_size(d)) {
-		    uint pos = 0;
-		    kernel[d].setArg(pos++, psize);
-		    kernel[d].setArg(pos++, X(0)(d));
-		    kernel[d].setArg(pos++, X(1)(d));
-		    kernel[d].setArg(pos++, X(2)(d));
-		    kernel[d].setArg(pos++, R(d));
-		    kernel[d].setArg(pos++, sigma);
-		    kernel[d].setArg(pos++, b);
-		    kernel[d].setArg(pos++, dt);
-
-		    ctx.queue(d).enqueueNDRangeKernel(
-			    kernel[d], cl::NullRange, g_size[d], wgsize[d]
-			    );
+	bench.stop("compile");
+
+	// Same number of steps as the one-step-per-launch loop makes.
+	size_t steps_total = 0;
+	for(value_type t = 0; t < t_max; t += dt) ++steps_total;
+
+	const size_t batch = batched ? steps_per_launch(n) : 1;
+
+	std::cout << "steps per launch: " << batch << std::endl;
+
+	std::vector<value_type> lambda(renorm ? n : 0);
+
+	while(bench.next()) {
+	    bench.start("upload");
+	    X = 10.0;
+	    if (renorm) {
+		D = 1 / std::sqrt(value_type(3));
+		L = value_type(0);
+	    }
+	    ctx.finish();
+	    bench.stop("upload");
+
+	    size_t launches = 0;
+
+	    bench.start("integrate");
+	    for(size_t step = 0; step < steps_total; step += batch, ++launches) {
+		cl_ulong steps = std::min(batch, steps_total - step);
+
+		for(uint d = 0; d < ctx.size(); d++) {
+		    if (size_t psize = X(0).part_size(d)) {
+			uint pos = 0;
+			kernel[d].setArg(pos++, psize);
+			kernel[d].setArg(pos++, X(0)(d));
+			kernel[d].setArg(pos++, X(1)(d));
+			kernel[d].setArg(pos++, X(2)(d));
+			if (renorm) {
+			    kernel[d].setArg(pos++, D(0)(d));
+			    kernel[d].setArg(pos++, D(1)(d));
+			    kernel[d].setArg(pos++, D(2)(d));
+			    kernel[d].setArg(pos++, L(d));
+			}
+			kernel[d].setArg(pos++, R(d));
+			kernel[d].setArg(pos++, sigma);
+			kernel[d].setArg(pos++, b);
+			kernel[d].setArg(pos++, dt);
+			if (renorm)
+			    kernel[d].setArg(pos++, static_cast<cl_ulong>(step));
+			kernel[d].setArg(pos++, steps);
+			if (renorm) {
+			    kernel[d].setArg(pos++, static_cast<cl_ulong>(steps_total));
+			    kernel[d].setArg(pos++, static_cast<cl_ulong>(renorm));
+			}
+
+			if (tune && bench.warming() && !tuner[d].swept(kname, psize)) {
+			    clbuf::launch_config c = tuner[d].tune(
+				    ctx.queue(d), kernel[d], kname, psize);
+
+			    wgsize[d] = c.wgsize;
+			    g_size[d] = c.global(psize, tuner[d].units());
+			}
+
+			ctx.queue(d).enqueueNDRangeKernel(
+				kernel[d], cl::NullRange, g_size[d], wgsize[d]
+				);
+		    }
 		}
 	    }
+	    ctx.finish();
+	    bench.stop("integrate");
+
+	    bench.start("readback");
+	    if (renorm) {
+		vex::copy( L.begin(), L.end(), lambda.begin() );
+		for(size_t i = 0; i < n; ++i) lambda[i] /= steps_total * dt;
+	    } else {
+		vex::copy( X(0).begin(), X(0).end(), r.begin() );
+	    }
+	    bench.stop("readback");
+
+	    // Each launch reads R and the state and writes the state back; the
+	    // lyapunov mode does the same with the tangent vector and L.
+	    bench.bytes((renorm ? 15 : 7) * sizeof(value_type) * n * launches);
+	}
+
+	if (renorm) {
+	    observer::table lyap(name + ".lyap", "R\tlambda", 1, n);
+
+	    std::vector<double> rows(2 * n);
+	    for(size_t i = 0; i < n; ++i) {
+		rows[2 * i]     = r[i];
+		rows[2 * i + 1] = lambda[i];
+	    }
+	    lyap.write(steps_total * dt, rows);
+
+	    std::cout << lambda[n - 1] << std::endl;
+
+	    bench.check(lambda);
+	} else {
+	    std::cout << r[0] << std::endl;
+
+	    bench.check(r);
 	}
 
-	vex::copy( X(0).begin(), X(0).end(), r.begin() );
-	std::cout << r[0] << std::endl;
+	bench.report();
 
     } catch(const cl::Error &e) {
 	using namespace vex;
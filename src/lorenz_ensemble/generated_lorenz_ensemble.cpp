@@ -3,16 +3,22 @@
 #include <array>
 #include <utility>
 #include <tuple>
-#include <memory>
+#include <algorithm>
+#include <string>
+#include <sstream>
 
 //#define VEXCL_SHOW_KERNELS
 #include <vexcl/vexcl.hpp>
 
 #include <boost/numeric/odeint.hpp>
 
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "program_cache.hpp"
+
 namespace odeint = boost::numeric::odeint;
 
-typedef double value_type;
+typedef precision::real value_type;
 
 typedef vex::symbolic< value_type > sym_vector;
 
@@ -35,19 +41,127 @@ struct sys_func
     }
 };
 
+// Kernel around a body recorded by vex::generator. The kernel is assembled
+// here rather than by vex::generator::build_kernel(), which compiles on
+// every run, so that it can go through the program cache. The state
+// components are read and written back, R is read only. The recorded body
+// makes a single step on the state kept in registers, so the kernel repeats
+// it `steps` times, a launch argument as in custom_lorenz.
+struct generated_kernel
+{
+    const vex::Context &ctx;
+    std::vector<cl::Kernel> kernel;
+    std::vector<size_t>     wgsize;
+
+    generated_kernel(const vex::Context &ctx, const std::string &name,
+	    const std::string &body, const sym_state &S, const sym_vector &R)
+	: ctx(ctx), kernel(ctx.size()), wgsize(ctx.size())
+    {
+	std::string x = var(S[0]), y = var(S[1]), z = var(S[2]), r = var(R);
+
+	std::ostringstream src;
+	src << PRECISION_CL_PREAMBLE
+	    << "kernel void " << name << "(\n"
+	    << "    ulong n,\n"
+	    << "    global real *p_x,\n"
+	    << "    global real *p_y,\n"
+	    << "    global real *p_z,\n"
+	    << "    global const real *p_r,\n"
+	    << "    ulong steps\n"
+	    << "    )\n"
+	    << "{\n"
+	    << "    for(size_t idx = get_global_id(0); idx < n; idx += get_global_size(0)) {\n"
+	    << "        real " << x << " = p_x[idx];\n"
+	    << "        real " << y << " = p_y[idx];\n"
+	    << "        real " << z << " = p_z[idx];\n"
+	    << "        real " << r << " = p_r[idx];\n"
+	    << "        for(ulong k = 0; k < steps; ++k) {\n"
+	    << body
+	    << "        }\n"
+	    << "        p_x[idx] = " << x << ";\n"
+	    << "        p_y[idx] = " << y << ";\n"
+	    << "        p_z[idx] = " << z << ";\n"
+	    << "    }\n"
+	    << "}\n";
+
+	for(uint d = 0; d < ctx.size(); d++) {
+	    cl::Program program = program_cache::build(ctx.context(d), src.str());
+	    kernel[d] = cl::Kernel(program, name.c_str());
+	    wgsize[d] = vex::kernel_workgroup_size(kernel[d], ctx.device(d));
+	}
+    }
+
+    void operator()(vex::vector<value_type> &X, vex::vector<value_type> &Y,
+	    vex::vector<value_type> &Z, const vex::vector<value_type> &R,
+	    cl_ulong steps)
+    {
+	for(uint d = 0; d < ctx.size(); d++) {
+	    if (size_t psize = X.part_size(d)) {
+		uint pos = 0;
+		kernel[d].setArg(pos++, psize);
+		kernel[d].setArg(pos++, X(d));
+		kernel[d].setArg(pos++, Y(d));
+		kernel[d].setArg(pos++, Z(d));
+		kernel[d].setArg(pos++, R(d));
+		kernel[d].setArg(pos++, steps);
+
+		ctx.queue(d).enqueueNDRangeKernel(kernel[d], cl::NullRange,
+			vex::alignup(psize, wgsize[d]), wgsize[d]);
+	    }
+	}
+    }
+
+    // Name of a symbolic variable in the recorded body.
+    static std::string var(const sym_vector &v) {
+	std::ostringstream s;
+	s << v;
+	return s.str();
+    }
+};
+
 size_t n;
 const value_type dt = 0.01;
 const value_type t_max = 100.0;
 
+// Number of time steps to make per kernel launch. Launch latency is a few
+// microseconds, so small ensembles get enough steps per launch to amortize
+// it, while large ensembles keep one step per launch.
+size_t steps_per_launch(size_t n) {
+    const size_t min_work  = 1 << 22; // member-steps per launch
+    const size_t max_steps = 1024;
+
+    size_t k = 1;
+    while(k < max_steps && n * k < min_work) k *= 2;
+    return k;
+}
+
 int main( int argc , char **argv )
 {
     using namespace std;
 
     n = argc > 1 ? atoi( argv[1] ) : 1024;
+    bool batched = argc > 2 && string(argv[2]) == "batched";
+
+    benchmark::harness bench(batched ? "generated_lorenz_batched" : "generated_lorenz", n);
+
+    bench.start("setup");
 
     vex::Context ctx( vex::Filter::Exclusive( vex::Filter::DoublePrecision && vex::Filter::Env ) );
     cout << ctx << endl;
 
+    // Real state initialization:
+    value_type Rmin = 0.1 , Rmax = 50.0 , dR = ( Rmax - Rmin ) / value_type( n - 1 );
+    std::vector<value_type> r( n );
+    for( size_t i=0 ; i<n ; ++i ) r[i] = Rmin + dR * value_type( i );
+
+    vex::vector<value_type> X(ctx.queue(), n);
+    vex::vector<value_type> Y(ctx.queue(), n);
+    vex::vector<value_type> Z(ctx.queue(), n);
+    vex::vector<value_type> R(ctx.queue(), r);
+
+    bench.stop("setup");
+
+    bench.start("compile");
 
     // Custom kernel body will be recorded here:
     std::ostringstream body;
@@ -71,28 +185,46 @@ int main( int argc , char **argv )
     sys_func sys(sym_R);
     sym_stepper.do_step(std::ref(sys), sym_S, 0, dt);
 
-    auto kernel = vex::generator::build_kernel(ctx.queue(), "lorenz", body.str(),
-	    sym_S[0], sym_S[1], sym_S[2], sym_R
-	    );
+    generated_kernel kernel(ctx, "lorenz", body.str(), sym_S, sym_R);
 
-    // Real state initialization:
-    value_type Rmin = 0.1 , Rmax = 50.0 , dR = ( Rmax - Rmin ) / value_type( n - 1 );
-    std::vector<value_type> r( n );
-    for( size_t i=0 ; i<n ; ++i ) r[i] = Rmin + dR * value_type( i );
+    bench.stop("compile");
 
-    vex::vector<value_type> X(ctx.queue(), n);
-    vex::vector<value_type> Y(ctx.queue(), n);
-    vex::vector<value_type> Z(ctx.queue(), n);
-    vex::vector<value_type> R(ctx.queue(), r);
+    const size_t batch = batched ? steps_per_launch(n) : 1;
+
+    cout << "steps per launch: " << batch << endl;
+
+    // Same number of steps as the one-step-per-launch loop makes.
+    size_t steps_total = 0;
+    for(value_type t = 0; t < t_max; t += dt) ++steps_total;
+
+    while(bench.next()) {
+	bench.start("upload");
+	X = 10.0;
+	Y = 10.0;
+	Z = 10.0;
+	ctx.finish();
+	bench.stop("upload");
 
-    X = 10.0;
-    Y = 10.0;
-    Z = 10.0;
+	size_t launches = 0;
 
-    // Integration loop:
-    for(value_type t = 0; t < t_max; t += dt)
-	kernel(X, Y, Z, R);
+	// Integration loop:
+	bench.start("integrate");
+	for(size_t step = 0; step < steps_total; step += batch, ++launches)
+	    kernel(X, Y, Z, R, std::min(batch, steps_total - step));
+	ctx.finish();
+	bench.stop("integrate");
+
+	bench.start("readback");
+	vex::copy( X , r );
+	bench.stop("readback");
+
+	// Each launch reads R and the state and writes the state back.
+	bench.bytes(7 * sizeof(value_type) * n * launches);
+    }
 
-    vex::copy( X , r );
     cout << r[0] << endl;
+
+    bench.check(r);
+
+    bench.report();
 }
@@ -0,0 +1,71 @@
+#!/bin/bash
+#
+# Runs the Lorenz ensemble in every state layout (see layout.hpp) and
+# reports which one wins on this machine, per program:
+#
+#   ./layouts.sh [n]
+#
+# Runs native_lorenz and reference_lorenz (plain and fused) from the
+# directory of the script, skipping the ones that were not built. The
+# OpenCL programs run on the device the environment selects (e.g.
+# OCL_DEVICE), so run the script once per device. BENCH_REPEAT and
+# BENCH_WARMUP are passed through.
+
+n=${1:-1048576}
+dir=$(cd "$(dirname "$0")" && pwd)
+csv=$(mktemp)
+trap 'rm -f "$csv"' EXIT
+
+export BENCH_FORMAT=csv BENCH_OUTPUT="$csv"
+unset BENCH_REFERENCE
+
+for run in "native_lorenz" "reference_lorenz" "reference_lorenz fused"; do
+    set -- $run
+    [ -x "$dir/$1" ] || continue
+
+    for layout in soa aos aosoa; do
+        "$dir/$1" $n "${@:2}" layout=$layout > /dev/null || exit 1
+    done
+done
+
+awk -F, '
+$3 != "integrate" { next }
+
+{
+    program = $1
+    layout  = "soa"
+    if (match(program, /_(aos|aosoa)$/)) {
+        layout  = substr(program, RSTART + 1)
+        program = substr(program, 1, RSTART - 1)
+    }
+
+    if (!(program in best)) order[++count] = program
+
+    key = program SUBSEP layout
+    time[key] = $5
+    gbps[key] = $10
+
+    if (!(program in best) || $5 < time[program SUBSEP best[program]])
+        best[program] = layout
+}
+
+END {
+    printf "%-26s %-6s %12s %10s %8s\n", "program", "layout", "integrate s", "GB/s", "vs best"
+
+    split("soa aos aosoa", layouts, " ")
+
+    for(i = 1; i <= count; ++i) {
+        p = order[i]
+        t = time[p SUBSEP best[p]]
+
+        for(j = 1; j <= 3; ++j) {
+            key = p SUBSEP layouts[j]
+            if (!(key in time)) continue
+
+            printf "%-26s %-6s %12.4g %10.2f %7.2fx%s\n", p, layouts[j],
+                time[key], gbps[key], time[key] / t,
+                layouts[j] == best[p] ? "  <- best" : ""
+        }
+    }
+}
+' "$csv"
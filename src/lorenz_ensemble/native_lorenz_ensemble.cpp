@@ -0,0 +1,202 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <memory>
+
+#include <native/vector.hpp>
+#include <native/operations.hpp>
+
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "layout.hpp"
+#include "observer.hpp"
+#include "observables.hpp"
+
+#include <boost/numeric/odeint.hpp>
+
+namespace odeint = boost::numeric::odeint;
+typedef precision::real value_type;
+
+typedef native::vector<value_type> state_type;
+
+static const value_type dt = 0.01;
+static const value_type t_max = 100.0;
+static const value_type sigma = 10.0;
+static const value_type b = 8.0 / 3.0;
+
+
+// The systems are processed in SIMD chunks. In soa and aosoa (blocked by
+// the SIMD width, so that a chunk is one block) a component of a chunk is
+// contiguous; in aos it is gathered and scattered.
+template <layout::kind L>
+struct sys_func
+{
+    const state_type &R;
+    layout::ensemble<3> l;
+
+    sys_func( const state_type &R , const layout::ensemble<3> &l ) : R(R) , l(l) { }
+
+    template <class V>
+    V get( const value_type *x , size_t i , unsigned c ) const
+    {
+        if constexpr (L == layout::aos)
+            return V([=](auto j) { return x[(i + j) * 3 + c]; });
+        else
+            return native::load<V>(x + l.index(i, c));
+    }
+
+    template <class V>
+    void put( const V &v , value_type *x , size_t i , unsigned c ) const
+    {
+        if constexpr (L == layout::aos) {
+            for(size_t j = 0; j < V::size(); ++j) x[(i + j) * 3 + c] = v[j];
+        } else {
+            native::store(v, x + l.index(i, c));
+        }
+    }
+
+    void operator()( const state_type &x , state_type &dxdt , value_type t ) const
+    {
+        const size_t n = l.padded();
+
+        const value_type *s  = x.data();
+        const value_type *r  = R.data();
+        value_type       *ds = dxdt.data();
+
+        native::simd_loop<value_type>(0, n, [=](auto v, size_t i) {
+                typedef decltype(v) V;
+
+                V x = get<V>(s, i, 0);
+                V y = get<V>(s, i, 1);
+                V z = get<V>(s, i, 2);
+                V R = native::load<V>(r + i);
+
+                put<V>(V(sigma) * (y - x),    ds, i, 0);
+                put<V>(R * x - y - x * z,     ds, i, 1);
+                put<V>(x * y - V(b) * z,      ds, i, 2);
+                });
+
+        native::bytes_touched += 7 * sizeof(value_type) * n;
+    }
+};
+
+// Mean and spread of z over the ensemble (see observables.hpp).
+struct probe
+{
+    layout::ensemble<3> l;
+
+    probe( const layout::ensemble<3> &l ) : l(l) { }
+
+    std::vector<double> operator()( const state_type &x , double t ) const
+    {
+        return lorenz::finish(l.n, lorenz::sums(l, x.data()));
+    }
+};
+
+template <layout::kind L>
+void integrate(const state_type &R, state_type &X, const layout::ensemble<3> &l,
+        observer::table *table)
+{
+    odeint::runge_kutta4<
+        state_type , value_type , state_type , value_type ,
+                   odeint::vector_space_algebra , native::basic_operations<precision::accum>
+                       > stepper;
+
+    probe obs( l );
+
+    if (table)
+        odeint::integrate_const( stepper , sys_func<L>( R , l ) , X , value_type(0.0) , t_max , dt ,
+                observer::sample( *table , obs ) );
+    else
+        odeint::integrate_const( stepper , sys_func<L>( R , l ) , X , value_type(0.0) , t_max , dt );
+}
+
+int main(int argc, char *argv[]) {
+    const size_t n = argc > 1 ? atoi(argv[1]) : 1024;
+
+    // Modes:
+    //   observe=K   write the observables of every K-th step to <name>.obs;
+    //   layout=L    soa (default), aos or aosoa, see layout.hpp; aosoa is
+    //               blocked by the SIMD width.
+    unsigned    observe = 0;
+    std::string lay     = "soa";
+    for(int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a.compare(0, 8, "observe=") == 0) observe = atoi(a.c_str() + 8);
+        if (a.compare(0, 7, "layout=")  == 0) lay     = a.substr(7);
+    }
+
+    try {
+        const layout::ensemble<3> l(layout::parse(lay), n, native::simd<value_type>::width());
+
+        std::string name = "native_lorenz";
+        if (l.k != layout::soa) name += std::string("_") + layout::name(l.k);
+        if (observe)            name += "_observe";
+
+        benchmark::harness bench(name, n);
+
+        bench.start("setup");
+
+        native::flush_denormals();
+        native::info<value_type>(std::cout) << std::endl;
+
+        value_type Rmin = 0.1 , Rmax = 50.0 , dR = ( Rmax - Rmin ) / value_type( n - 1 );
+        std::vector<value_type> r( n );
+        for( size_t i=0 ; i<n ; ++i ) r[i] = Rmin + dR * value_type( i );
+        std::vector<value_type> x( 3 * n, 10.0 );
+
+        // The padding of the ensemble sits at the fixed point 0 with R = 0.
+        r.resize( l.padded() );
+        x = l.pack( x );
+
+        state_type R(r);
+
+        bench.stop("setup");
+
+        std::vector<value_type> res( n );
+
+        while(bench.next()) {
+            bench.start("upload");
+            state_type X(x);
+            bench.stop("upload");
+
+            std::unique_ptr<observer::table> table;
+            if (observe)
+                table.reset(new observer::table(name + ".obs", lorenz::columns, observe));
+
+            native::bytes_touched = 0;
+
+            bench.start("integrate");
+            switch (l.k) {
+                case layout::soa:
+                    integrate<layout::soa>( R , X , l , table.get() );
+                    break;
+                case layout::aos:
+                    integrate<layout::aos>( R , X , l , table.get() );
+                    break;
+                case layout::aosoa:
+                    integrate<layout::aosoa>( R , X , l , table.get() );
+                    break;
+            }
+            bench.stop("integrate");
+
+            bench.start("readback");
+            std::vector<value_type> y = l.unpack( std::vector<value_type>( X.begin(), X.end() ) );
+            std::copy(y.begin(), y.begin() + n, res.begin());
+            bench.stop("readback");
+
+            bench.bytes(native::bytes_touched);
+        }
+
+        std::cout << res[0] << std::endl;
+        std::cout << "bytes io: " << native::bytes_touched << std::endl;
+
+        bench.check(res);
+
+        bench.report();
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
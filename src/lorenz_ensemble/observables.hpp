@@ -0,0 +1,65 @@
+#ifndef LORENZ_OBSERVABLES_HPP
+#define LORENZ_OBSERVABLES_HPP
+
+// Observables of the Lorenz ensemble: the mean and the spread of z over the
+// n systems. The state holds x, y and z of all systems in one of the
+// layouts of layout.hpp.
+//
+// Every backend reduces the state where it lives to the sums of z and z^2
+// (quantities of them) and passes those to finish(), which gives the row of
+// the observer table (see observer.hpp). sums() is the host version, for
+// the native backend; reduce_args and reduce_body make the clbuf kernel
+// (see clbuf::reduce_source()), which needs the IDX macro of the layout
+// (see layout::ensemble::cl_index()).
+//
+// Lyapunov exponents need the tangent dynamics; custom_lorenz computes
+// them on the device in its lyapunov mode.
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "layout.hpp"
+
+namespace lorenz {
+
+const char     columns[]  = "mean_z\tstd_z";
+const unsigned quantities = 2;
+
+template <typename T>
+std::vector<double> sums(const layout::ensemble<3> &l, const T *x) {
+    double s1 = 0, s2 = 0;
+
+#pragma omp parallel for reduction(+:s1,s2) schedule(static)
+    for(long i = 0; i < static_cast<long>(l.n); ++i) {
+        double Z = x[l.index(i, 2)];
+        s1 += Z;
+        s2 += Z * Z;
+    }
+
+    std::vector<double> s(quantities);
+    s[0] = s1;
+    s[1] = s2;
+    return s;
+}
+
+inline std::vector<double> finish(size_t n, const std::vector<double> &s) {
+    double mean = s[0] / n;
+
+    std::vector<double> row(2);
+    row[0] = mean;
+    row[1] = std::sqrt(std::max(0.0, s[1] / n - mean * mean));
+    return row;
+}
+
+const char reduce_args[] =
+"global const real *s";
+
+const char reduce_body[] =
+"            real Z = s[IDX(i, 2)];\n"
+"            v[0] = Z;\n"
+"            v[1] = Z * Z;\n";
+
+} // namespace lorenz
+
+#endif
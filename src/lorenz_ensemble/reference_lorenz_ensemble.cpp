@@ -1,454 +1,399 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <string>
+#include <memory>
 
 #include <vexcl/devlist.hpp>
 
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "vt_user.h"
+#include "clbuf/clbuf.hpp"
+#include "layout.hpp"
+#include "observer.hpp"
+#include "observables.hpp"
+
 #include <boost/numeric/odeint.hpp>
-#include <boost/numeric/odeint/util/is_resizeable.hpp>
-#include <boost/numeric/odeint/util/resize.hpp>
-#include <boost/numeric/odeint/util/same_size.hpp>
 
 namespace odeint = boost::numeric::odeint;
-typedef double value_type;
-
-static const size_t wgsize = 256;
-
-static cl::Context      ctx;
-static cl::Device       device;
-static cl::CommandQueue queue;
-static cl::Program      program;
-
-size_t bytes_touched = 0;
+typedef precision::real value_type;
+typedef clbuf::basic_operations<precision::accum> operations;
 
-const char clbuf_source[] =
-"#if defined(cl_khr_fp64)\n"
-"#  pragma OPENCL EXTENSION cl_khr_fp64: enable\n"
-"#elif defined(cl_amd_fp64)\n"
-"#  pragma OPENCL EXTENSION cl_amd_fp64: enable\n"
-"#endif\n"
-"\n"
-"typedef double real;\n"
-"\n"
-"kernel void scale_sum2(\n"
-"    ulong n,\n"
-"    global real *v0, \n"
-"    global real *v1, \n"
-"    global real *v2, \n"
-"    real a1,\n"
-"    real a2\n"
-"    )\n"
-"{\n"
-"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0))\n"
-"        v0[i] =\n"
-"            a1 * v1[i] +\n"
-"            a2 * v2[i];\n"
-"}\n"
-"\n"
-"kernel void scale_sum3(\n"
+// The state is in one of the layouts of layout.hpp; the IDX macro of the
+// layout is defined in front of the source and n counts the padding.
+const char lorenz_source[] =
+PRECISION_CL_PREAMBLE
+"kernel void lorenz_system(\n"
 "    ulong n,\n"
-"    global real *v0, \n"
-"    global real *v1, \n"
-"    global real *v2, \n"
-"    global real *v3, \n"
-"    real a1,\n"
-"    real a2,\n"
-"    real a3\n"
+"    global real *dsdt,\n"
+"    global real *s,\n"
+"    global real *r,\n"
+"    real sigma,\n"
+"    real b\n"
 "    )\n"
 "{\n"
-"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0))\n"
-"        v0[i] =\n"
-"            a1 * v1[i] +\n"
-"            a2 * v2[i] +\n"
-"            a3 * v3[i];\n"
-"}\n"
+"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+"        real X = s[IDX(i, 0)];\n"
+"        real Y = s[IDX(i, 1)];\n"
+"        real Z = s[IDX(i, 2)];\n"
+"        real R = r[i];\n"
 "\n"
-"kernel void scale_sum4(\n"
-"    ulong n,\n"
-"    global real *v0, \n"
-"    global real *v1, \n"
-"    global real *v2, \n"
-"    global real *v3, \n"
-"    global real *v4, \n"
-"    real a1,\n"
-"    real a2,\n"
-"    real a3,\n"
-"    real a4\n"
-"    )\n"
-"{\n"
-"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0))\n"
-"        v0[i] =\n"
-"            a1 * v1[i] +\n"
-"            a2 * v2[i] +\n"
-"            a3 * v3[i] +\n"
-"            a4 * v4[i];\n"
+"        dsdt[IDX(i, 0)] = sigma * (Y - X);\n"
+"        dsdt[IDX(i, 1)] = R * X - Y - X * Z;\n"
+"        dsdt[IDX(i, 2)] = X * Y - b * Z;\n"
+"    }\n"
 "}\n"
 "\n"
-"kernel void scale_sum5(\n"
-"    ulong n,\n"
-"    global real *v0, \n"
-"    global real *v1, \n"
-"    global real *v2, \n"
-"    global real *v3, \n"
-"    global real *v4, \n"
-"    global real *v5, \n"
-"    real a1,\n"
-"    real a2,\n"
-"    real a3,\n"
-"    real a4,\n"
-"    real a5\n"
-"    )\n"
-"{\n"
-"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0))\n"
-"        v0[i] =\n"
-"            a1 * v1[i] +\n"
-"            a2 * v2[i] +\n"
-"            a3 * v3[i] +\n"
-"            a4 * v4[i] +\n"
-"            a5 * v5[i];\n"
-"}\n"
+"#define STAGE_FIRST 0\n"
+"#define STAGE_INNER 1\n"
+"#define STAGE_LAST  2\n"
 "\n"
-"kernel void lorenz_system(\n"
+"kernel void lorenz_stage(\n"
 "    ulong n,\n"
-"    global real *dsdt,\n"
+"    uint stage,\n"
 "    global real *s,\n"
-"    global real *r,\n"
+"    global const real *src,\n"
+"    global real *dst,\n"
+"    global real *acc,\n"
+"    global const real *r,\n"
 "    real sigma,\n"
-"    real b\n"
+"    real b,\n"
+"    real a,\n"
+"    real w\n"
 "    )\n"
 "{\n"
-"    global real *dx = dsdt;\n"
-"    global real *dy = dx + n;\n"
-"    global real *dz = dy + n;\n"
-"\n"
-"    global real *x = s;\n"
-"    global real *y = x + n;\n"
-"    global real *z = y + n;\n"
-"\n"
 "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
-"        real X = x[i];\n"
-"        real Y = y[i];\n"
-"        real Z = z[i];\n"
+"        const size_t ix = IDX(i, 0), iy = IDX(i, 1), iz = IDX(i, 2);\n"
+"\n"
+"        real X = src[ix];\n"
+"        real Y = src[iy];\n"
+"        real Z = src[iz];\n"
 "        real R = r[i];\n"
 "\n"
-"        dx[i] = sigma * (Y - X);\n"
-"        dy[i] = R * X - Y - X * Z;\n"
-"        dz[i] = X * Y - b * Z;\n"
+"        real kx = sigma * (Y - X);\n"
+"        real ky = R * X - Y - X * Z;\n"
+"        real kz = X * Y - b * Z;\n"
+"\n"
+"        if (stage == STAGE_FIRST) {\n"
+"            acc[ix] = X + w * kx;\n"
+"            acc[iy] = Y + w * ky;\n"
+"            acc[iz] = Z + w * kz;\n"
+"\n"
+"            dst[ix] = X + a * kx;\n"
+"            dst[iy] = Y + a * ky;\n"
+"            dst[iz] = Z + a * kz;\n"
+"        } else if (stage == STAGE_INNER) {\n"
+"            acc[ix] += w * kx;\n"
+"            acc[iy] += w * ky;\n"
+"            acc[iz] += w * kz;\n"
+"\n"
+"            dst[ix] = s[ix] + a * kx;\n"
+"            dst[iy] = s[iy] + a * ky;\n"
+"            dst[iz] = s[iz] + a * kz;\n"
+"        } else {\n"
+"            s[ix] = acc[ix] + w * kx;\n"
+"            s[iy] = acc[iy] + w * ky;\n"
+"            s[iz] = acc[iz] + w * kz;\n"
+"        }\n"
 "    }\n"
 "}\n";
 
-inline size_t alignup(size_t n, size_t m = 16U) {
-    return n % m ? n - n % m + m : n;
-}
-
-template <typename T>
-struct clbuf {
-    size_t      n;
-    cl::Buffer  data;
-
-    clbuf() : n(0) {}
-
-    clbuf(size_t n)
-        : n(n), data(ctx, CL_MEM_READ_WRITE, sizeof(T) * n) 
-    {}
+// Fused operations mode. Classic Runge-Kutta stepper where each stage
+// evaluates the system function and applies the following scale_sum update
+// in a single kernel. Instead of keeping all the stage derivatives around,
+// the final update is accumulated in m_acc as the stages go, so the state
+// is only touched once per stage. The system has to provide
+// stage(kind, x, src, dst, acc, a, w) which computes k = f(src) and then
+//   first: acc  = x + w * k;  dst = x + a * k;
+//   inner: acc += w * k;      dst = x + a * k;
+//   last:  x    = acc + w * k.
+enum stage_kind { stage_first = 0, stage_inner = 1, stage_last = 2 };
+
+struct fused_runge_kutta4 {
+    typedef clbuf::vector< ::value_type > state_type;
+    typedef clbuf::vector< ::value_type > deriv_type;
+    typedef ::value_type          value_type;
+    typedef ::value_type          time_type;
+    typedef unsigned short        order_type;
+    typedef odeint::stepper_tag   stepper_category;
+
+    static order_type order() { return 4; }
+
+    template< class System >
+    void do_step( System system , state_type &x , time_type t , time_type dt )
+    {
+        typename odeint::unwrap_reference< System >::type &sys = system;
 
-    clbuf(const std::vector<T> &host)
-        : n(host.size()),
-          data(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
-                  sizeof(T) * host.size(), const_cast<T*>(host.data())) 
-    {}
+        if (!odeint::same_size(m_acc, x)) {
+            odeint::resize(m_acc,    x);
+            odeint::resize(m_tmp[0], x);
+            odeint::resize(m_tmp[1], x);
+        }
 
-    void swap(clbuf &other) {
-        std::swap(n,    other.n);
-        std::swap(data, other.data);
+        // Stage inputs are ping-ponged between two buffers, so that systems
+        // that read neighbouring elements never see a partially updated src.
+        VT_USER_START("fused_runge_kutta4");
+        sys.stage(stage_first, x, x,        m_tmp[0], m_acc, dt / 2, dt / 6);
+        sys.stage(stage_inner, x, m_tmp[0], m_tmp[1], m_acc, dt / 2, dt / 3);
+        sys.stage(stage_inner, x, m_tmp[1], m_tmp[0], m_acc, dt,     dt / 3);
+        sys.stage(stage_last,  x, m_tmp[0], m_tmp[1], m_acc, 0,      dt / 6);
+        VT_USER_END("fused_runge_kutta4");
     }
-};
 
-// Resizing
-namespace boost { namespace numeric { namespace odeint {
+    state_type m_acc;
+    state_type m_tmp[2];
+};
 
-template <typename T>
-struct is_resizeable< clbuf<T> > : boost::true_type {};
+static const value_type dt = 0.01;
+static const value_type t_max = 100.0;
+static const value_type sigma = 10.0;
+static const value_type b = 8.0 / 3.0;
 
-template< typename T >
-struct resize_impl< clbuf<T> , clbuf<T> >
-{
-    static void resize( clbuf<T> &x1 , const clbuf<T> &x2 )
-    {
-        clbuf<T>(x2.n).swap(x1);
-    }
-};
 
-template< typename T >
-struct same_size_impl< clbuf<T> , clbuf<T> >
+struct sys_func
 {
-    static bool same_size( const clbuf<T> &x1 , const clbuf<T> &x2 )
-    {
-        return x1.n == x2.n;
-    }
-};
+    const clbuf::vector<value_type> &R;
+    size_t n; // systems, with the padding of the layout
 
-} } }
+    sys_func( const clbuf::vector<value_type> &R ) : R(R), n(R.n) { }
 
-// Operations
-struct clbuf_operations {
-    template< class Fac1 = double , class Fac2 = Fac1 >
-    struct scale_sum2
+    void operator()( const clbuf::vector<value_type> &x , clbuf::vector<value_type> &dxdt , value_type t )
     {
-        const Fac1 m_alpha1;
-        const Fac2 m_alpha2;
-
-        scale_sum2( Fac1 alpha1 , Fac2 alpha2 )
-            : m_alpha1( alpha1 ) , m_alpha2( alpha2 )
-        { }
-
-        template< class T1 , class T2 , class T3 >
-        void operator()(clbuf<T1> &v1 ,
-                  const clbuf<T2> &v2 ,
-                  const clbuf<T3> &v3
-                  ) const
-        {
-            static cl::Kernel krn(program, "scale_sum2");
-
-            uint pos = 0;
-            krn.setArg(pos++, v1.n);
-            krn.setArg(pos++, v1.data);
-            krn.setArg(pos++, v2.data);
-            krn.setArg(pos++, v3.data);
-            krn.setArg(pos++, m_alpha1);
-            krn.setArg(pos++, m_alpha2);
-
-            queue.enqueueNDRangeKernel(
-                    krn, cl::NullRange, alignup(v1.n, wgsize), wgsize
-                    );
-
-            bytes_touched +=
-                v1.n * sizeof(T1) +
-                v2.n * sizeof(T2) +
-                v3.n * sizeof(T3);
-        }
+        clbuf::context &ctx = *x.ctx;
+        cl::Kernel     &krn = ctx.kernel("lorenz_system");
 
-        typedef void result_type;
-    };
+        VT_USER_START("lorenz_system");
 
-    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 >
-    struct scale_sum3
-    {
-        const Fac1 m_alpha1;
-        const Fac2 m_alpha2;
-        const Fac3 m_alpha3;
-
-        scale_sum3( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 )
-            : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 )
-        { }
-
-        template< class T1 , class T2 , class T3 , class T4 >
-        void operator()(clbuf<T1> &v1 ,
-                  const clbuf<T2> &v2 ,
-                  const clbuf<T3> &v3 ,
-                  const clbuf<T4> &v4
-                  ) const
-        {
-            static cl::Kernel krn(program, "scale_sum3");
-
-            uint pos = 0;
-            krn.setArg(pos++, v1.n);
-            krn.setArg(pos++, v1.data);
-            krn.setArg(pos++, v2.data);
-            krn.setArg(pos++, v3.data);
-            krn.setArg(pos++, v4.data);
-            krn.setArg(pos++, m_alpha1);
-            krn.setArg(pos++, m_alpha2);
-            krn.setArg(pos++, m_alpha3);
-
-            queue.enqueueNDRangeKernel(
-                    krn, cl::NullRange, alignup(v1.n, wgsize), wgsize
-                    );
-
-            bytes_touched +=
-                v1.n * sizeof(T1) +
-                v2.n * sizeof(T2) +
-                v3.n * sizeof(T2) +
-                v4.n * sizeof(T3);
-        }
+        uint pos = 0;
+        krn.setArg(pos++, n);
+        krn.setArg(pos++, dxdt.data);
+        krn.setArg(pos++, x.data);
+        krn.setArg(pos++, R.data);
+        krn.setArg(pos++, sigma);
+        krn.setArg(pos++, b);
 
-        typedef void result_type;
-    };
+        dxdt.ready = ctx.launch(dxdt.queue, krn, n, "lorenz_system",
+                clbuf::wait_list(dxdt.queue, x, R));
+        VT_USER_END("lorenz_system");
 
+        ctx.bytes_touched += 7 * sizeof(value_type) * n;
+    }
 
-    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 , class Fac4 = Fac3 >
-    struct scale_sum4
+    void stage(stage_kind kind, clbuf::vector<value_type> &x,
+            const clbuf::vector<value_type> &src, clbuf::vector<value_type> &dst,
+            clbuf::vector<value_type> &acc, value_type a, value_type w)
     {
-        const Fac1 m_alpha1;
-        const Fac2 m_alpha2;
-        const Fac3 m_alpha3;
-        const Fac4 m_alpha4;
-
-        scale_sum4( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 , Fac4 alpha4 )
-        : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 ) , m_alpha4( alpha4 ) { }
-
-        template< class T1 , class T2 , class T3 , class T4 , class T5 >
-        void operator()(clbuf<T1> &v1 ,
-                  const clbuf<T2> &v2 ,
-                  const clbuf<T3> &v3 ,
-                  const clbuf<T4> &v4 ,
-                  const clbuf<T5> &v5
-                  ) const
-        {
-            static cl::Kernel krn(program, "scale_sum4");
-
-            uint pos = 0;
-            krn.setArg(pos++, v1.n);
-            krn.setArg(pos++, v1.data);
-            krn.setArg(pos++, v2.data);
-            krn.setArg(pos++, v3.data);
-            krn.setArg(pos++, v4.data);
-            krn.setArg(pos++, v5.data);
-            krn.setArg(pos++, m_alpha1);
-            krn.setArg(pos++, m_alpha2);
-            krn.setArg(pos++, m_alpha3);
-            krn.setArg(pos++, m_alpha4);
-
-            queue.enqueueNDRangeKernel(
-                    krn, cl::NullRange, alignup(v1.n, wgsize), wgsize
-                    );
-
-            bytes_touched +=
-                v1.n * sizeof(T1) +
-                v2.n * sizeof(T2) +
-                v3.n * sizeof(T2) +
-                v4.n * sizeof(T2) +
-                v5.n * sizeof(T3);
-        }
+        clbuf::context &ctx = *x.ctx;
+        cl::Kernel     &krn = ctx.kernel("lorenz_stage");
 
-        typedef void result_type;
-    };
+        VT_USER_START("lorenz_stage");
 
-
-    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 , class Fac4 = Fac3 , class Fac5 = Fac4 >
-    struct scale_sum5
-    {
-        const Fac1 m_alpha1;
-        const Fac2 m_alpha2;
-        const Fac3 m_alpha3;
-        const Fac4 m_alpha4;
-        const Fac5 m_alpha5;
-
-        scale_sum5( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 , Fac4 alpha4 , Fac5 alpha5 )
-        : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 ) , m_alpha4( alpha4 ) , m_alpha5( alpha5 ) { }
-
-        template< class T1 , class T2 , class T3 , class T4 , class T5 , class T6 >
-        void operator()(clbuf<T1> &v1 ,
-                const clbuf<T2> &v2 ,
-                const clbuf<T3> &v3 ,
-                const clbuf<T4> &v4 ,
-                const clbuf<T5> &v5 ,
-                const clbuf<T6> &v6
-                ) const
-        {
-
-            static cl::Kernel krn(program, "scale_sum5");
-
-            uint pos = 0;
-            krn.setArg(pos++, v1.n);
-            krn.setArg(pos++, v1.data);
-            krn.setArg(pos++, v2.data);
-            krn.setArg(pos++, v3.data);
-            krn.setArg(pos++, v4.data);
-            krn.setArg(pos++, v5.data);
-            krn.setArg(pos++, v6.data);
-            krn.setArg(pos++, m_alpha1);
-            krn.setArg(pos++, m_alpha2);
-            krn.setArg(pos++, m_alpha3);
-            krn.setArg(pos++, m_alpha4);
-            krn.setArg(pos++, m_alpha5);
-
-            queue.enqueueNDRangeKernel(
-                    krn, cl::NullRange, alignup(v1.n, wgsize), wgsize
-                    );
-
-            bytes_touched +=
-                v1.n * sizeof(T1) +
-                v2.n * sizeof(T2) +
-                v3.n * sizeof(T2) +
-                v4.n * sizeof(T2) +
-                v5.n * sizeof(T2) +
-                v6.n * sizeof(T3);
+        uint pos = 0;
+        krn.setArg(pos++, n);
+        krn.setArg(pos++, static_cast<cl_uint>(kind));
+        krn.setArg(pos++, x.data);
+        krn.setArg(pos++, src.data);
+        krn.setArg(pos++, dst.data);
+        krn.setArg(pos++, acc.data);
+        krn.setArg(pos++, R.data);
+        krn.setArg(pos++, sigma);
+        krn.setArg(pos++, b);
+        krn.setArg(pos++, a);
+        krn.setArg(pos++, w);
+
+        // The stage writes either acc and dst or x, all on the queue of x.
+        cl::Event done = ctx.launch(x.queue, krn, n, "lorenz_stage",
+                clbuf::wait_list(x.queue, src, acc, R));
+        if (kind == stage_last)
+            x.ready = done;
+        else
+            acc.ready = dst.ready = done;
+        VT_USER_END("lorenz_stage");
+
+        // src and R are always read; first stage writes acc and dst, inner
+        // stages also read x and acc, last stage reads acc and writes x.
+        switch (kind) {
+            case stage_first:
+                ctx.bytes_touched += 10 * sizeof(value_type) * n;
+                break;
+            case stage_inner:
+                ctx.bytes_touched += 16 * sizeof(value_type) * n;
+                break;
+            case stage_last:
+                ctx.bytes_touched += 10 * sizeof(value_type) * n;
+                break;
         }
-
-        typedef void result_type;
-    };
-
+    }
 };
 
-static const value_type dt = 0.01;
-static const value_type t_max = 100.0;
-static const value_type sigma = 10.0;
-static const value_type b = 8.0 / 3.0;
-
-
-struct sys_func
+// Mean and spread of z over the ensemble (see observables.hpp), reduced on
+// the device.
+struct probe
 {
-    const clbuf<value_type> &R;
+    clbuf::reduction<precision::accum> sum;
+    size_t n;
+
+    probe(clbuf::context &ctx, size_t n) : sum(ctx, n, lorenz::quantities), n(n) { }
 
-    sys_func( const clbuf<value_type> &R ) : R(R) { }
+    static std::string source(const clbuf::context &ctx, const layout::ensemble<3> &l) {
+        return PRECISION_CL_PREAMBLE + l.cl_index() + clbuf::reduce_source("lorenz_observables",
+                lorenz::reduce_args, lorenz::quantities, lorenz::reduce_body,
+                ctx.wgsize);
+    }
 
-    void operator()( const clbuf<value_type> &x , clbuf<value_type> &dxdt , value_type t )
+    std::vector<double> operator()( const clbuf::vector<value_type> &x , double t )
     {
-        static cl::Kernel krn(program, "lorenz_system");
+        clbuf::context &ctx = *x.ctx;
+        cl::Kernel     &krn = ctx.kernel("lorenz_observables");
 
-        size_t n = x.n / 3;
+        VT_USER_START("lorenz_observables");
 
-        uint pos = 0;
-        krn.setArg(pos++, n);
-        krn.setArg(pos++, dxdt.data);
-        krn.setArg(pos++, x.data);
-        krn.setArg(pos++, R.data);
-        krn.setArg(pos++, sigma);
-        krn.setArg(pos++, b);
+        krn.setArg(2, x.data);
 
-        queue.enqueueNDRangeKernel(
-                krn, cl::NullRange, alignup(n, wgsize), wgsize
-                );
+        std::vector<double> s = sum(krn, "lorenz_observables",
+                clbuf::wait_list(sum.queue(), x));
+        VT_USER_END("lorenz_observables");
 
-        bytes_touched += 7 * sizeof(value_type) * n;
+        return lorenz::finish(n, s);
     }
 };
 
+template <class Stepper>
+void integrate(Stepper &stepper, const clbuf::vector<value_type> &R,
+        clbuf::vector<value_type> &X, observer::table *table, probe *obs)
+{
+    if (table)
+        odeint::integrate_const( stepper , sys_func( R ) , X , value_type(0.0) , t_max , dt ,
+                observer::sample( *table , *obs ) );
+    else
+        odeint::integrate_const( stepper , sys_func( R ) , X , value_type(0.0) , t_max , dt );
+}
+
 int main(int argc, char *argv[]) {
     const size_t n = argc > 1 ? atoi(argv[1]) : 1024;
 
+    // Modes:
+    //   fused       fused Runge-Kutta stepper;
+    //   observe=K   write the observables of every K-th step to <name>.obs;
+    //   layout=L    soa (default), aos or aosoa, see layout.hpp;
+    //   block=B     block of aosoa (default: the vector width on CPUs,
+    //               32 on other devices);
+    //   tune        sweep the launch configurations of the kernels in a
+    //               warm-up repetition and save them for later runs.
+    bool        fused = false, tune = false;
+    unsigned    observe = 0, block = 0;
+    std::string lay = "soa";
+    for(int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        fused = fused || a == "fused";
+        tune  = tune  || a == "tune";
+        if (a.compare(0, 8, "observe=") == 0) observe = atoi(a.c_str() + 8);
+        if (a.compare(0, 7, "layout=")  == 0) lay     = a.substr(7);
+        if (a.compare(0, 6, "block=")   == 0) block   = atoi(a.c_str() + 6);
+    }
+
     try {
-        vex::Context vctx( vex::Filter::Exclusive( vex::Filter::Env && vex::Filter::Count(1) ) );
+        const layout::kind k = layout::parse(lay);
+
+        std::string name = fused ? "reference_lorenz_fused" : "reference_lorenz";
+        if (k != layout::soa) name += std::string("_") + layout::name(k);
+        if (observe)          name += "_observe";
+
+        benchmark::harness bench(name, n);
+        if (tune) bench.warm_up(1);
+
+        bench.start("setup");
+
+        vex::Context vctx(
+                vex::Filter::Exclusive( vex::Filter::Env && vex::Filter::Count(1) ),
+                vt::queue_properties()
+                );
         if (!vctx) throw std::runtime_error("No compute devices");
 
         std::cout << vctx << std::endl;
 
-        ctx     = vctx.context(0);
-        device  = vctx.device(0);
-        queue   = vctx.queue(0);
-        program = vex::build_sources(ctx, clbuf_source);
+        clbuf::context ctx(vctx.queue(0));
+
+        if (!block)
+            block = ctx.device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU
+                ? ctx.vector_width(sizeof(value_type)) : 32;
+
+        const layout::ensemble<3> l(k, n, block);
 
         value_type Rmin = 0.1 , Rmax = 50.0 , dR = ( Rmax - Rmin ) / value_type( n - 1 );
         std::vector<value_type> r( n );
         for( size_t i=0 ; i<n ; ++i ) r[i] = Rmin + dR * value_type( i );
         std::vector<value_type> x( 3 * n, 10.0 );
 
-        clbuf<value_type> X(x);
-        clbuf<value_type> R(r);
-
-        odeint::runge_kutta4<
-            clbuf<value_type> , value_type , clbuf<value_type> , value_type ,
-                       odeint::vector_space_algebra , clbuf_operations
-                           > stepper;
-
-        odeint::integrate_const( stepper , sys_func( R ) , X , value_type(0.0) , t_max , dt );
+        // The padding of the ensemble sits at the fixed point 0 with R = 0.
+        r.resize( l.padded() );
+        x = l.pack( x );
+
+        clbuf::vector<value_type> R(ctx, r);
+
+        bench.stop("setup");
+
+        bench.start("compile");
+        ctx.build(l.cl_index() + lorenz_source);
+        if (observe) ctx.build(probe::source(ctx, l));
+        operations::compile<value_type>(ctx);
+        bench.stop("compile");
+
+        std::vector<value_type> res( n );
+
+        while(bench.next()) {
+            ctx.autotune = tune && bench.warming();
+
+            bench.start("upload");
+            clbuf::vector<value_type> X(ctx, x);
+            ctx.finish();
+            bench.stop("upload");
+
+            std::unique_ptr<observer::table> table;
+            std::unique_ptr<probe>           obs;
+            if (observe) {
+                table.reset(new observer::table(name + ".obs", lorenz::columns, observe));
+                obs.reset(new probe(ctx, n));
+            }
+
+            ctx.bytes_touched = 0;
+
+            bench.start("integrate");
+            VT_USER_START("integrate");
+            if (fused) {
+                fused_runge_kutta4 stepper;
+
+                integrate( stepper , R , X , table.get() , obs.get() );
+            } else {
+                odeint::runge_kutta4<
+                    clbuf::vector<value_type> , value_type , clbuf::vector<value_type> , value_type ,
+                               odeint::vector_space_algebra , operations
+                                   > stepper;
+
+                integrate( stepper , R , X , table.get() , obs.get() );
+            }
+            ctx.finish();
+            VT_USER_END("integrate");
+            bench.stop("integrate");
+
+            bench.start("readback");
+            std::vector<value_type> y( l.size() );
+            X.read(y);
+            y = l.unpack(y);
+            std::copy(y.begin(), y.begin() + n, res.begin());
+            bench.stop("readback");
+
+            bench.bytes(ctx.bytes_touched);
+        }
 
-        queue.enqueueReadBuffer(X.data, CL_TRUE, 0, sizeof(value_type), x.data());
+        std::cout << res[0] << std::endl;
+        std::cout << "bytes io: " << ctx.bytes_touched << std::endl;
+        std::cout << "device memory: " << ctx.buffers.stats() << std::endl;
 
-        std::cout << x[0] << std::endl;
-        std::cout << "bytes io: " << bytes_touched << std::endl;
+        bench.check(res);
 
+        bench.report();
     } catch (const cl::Error &e) {
         std::cerr << "OpenCL error: " << e << std::endl;
         return 1;
@@ -14,13 +14,16 @@
 #include <boost/numeric/odeint/external/thrust/thrust_operations.hpp>
 #include <boost/numeric/odeint/external/thrust/thrust_resize.hpp>
 
+#include "precision.hpp"
+#include "benchmark.hpp"
+
 
 
 using namespace std;
 using namespace boost::numeric::odeint;
 
 
-typedef double value_type;
+typedef precision::real value_type;
 
 typedef thrust::device_vector< value_type > state_type;
 
@@ -92,6 +95,10 @@ int main( int argc , char* argv[] )
 
     N = argc > 1 ? atoi(argv[1]) : 1024;
 
+    benchmark::harness bench( "thrust_lorenz" , N );
+
+    bench.start( "setup" );
+
     vector< value_type > beta_host( N );
     const value_type beta_min = value_type(0.1) , beta_max = value_type(50.0);
     for( size_t i=0 ; i<N ; ++i )
@@ -99,27 +106,45 @@ int main( int argc , char* argv[] )
 
     state_type beta = beta_host;
 
+    bench.stop( "setup" );
+
+    thrust::host_vector< value_type > res;
 
-    //[ thrust_lorenz_parameters_integration
-    state_type x( 3 * N );
+    while( bench.next() )
+    {
+        bench.start( "upload" );
+
+        //[ thrust_lorenz_parameters_integration
+        state_type x( 3 * N );
 
-    // initialize x,y,z
-    thrust::fill( x.begin() , x.end() , value_type(10.0) );
+        // initialize x,y,z
+        thrust::fill( x.begin() , x.end() , value_type(10.0) );
+        cudaThreadSynchronize();
 
+        bench.stop( "upload" );
 
 
-    typedef runge_kutta4< state_type , value_type , state_type , value_type ,
-			  thrust_algebra , thrust_operations > stepper_type;
+        typedef runge_kutta4< state_type , value_type , state_type , value_type ,
+                              thrust_algebra , thrust_operations > stepper_type;
 
 
-    lorenz_system lorenz( N , beta );
-    integrate_const( stepper_type() , lorenz , x , value_type(0.0) , t_max , dt );
+        bench.start( "integrate" );
+        lorenz_system lorenz( N , beta );
+        integrate_const( stepper_type() , lorenz , x , value_type(0.0) , t_max , dt );
+        cudaThreadSynchronize();
+        bench.stop( "integrate" );
+
+        bench.start( "readback" );
+        res = x;
+        bench.stop( "readback" );
+    }
 
-    thrust::host_vector< value_type > res = x;
     // for( size_t i=0 ; i<N ; ++i ) cout << res[i] << "\t" << beta_host[i] << "\n";
     cout << res[0] << endl;
 
+    bench.check( vector< value_type >( res.begin() , res.begin() + N ) );
 
+    bench.report();
 
     return 0;
 }
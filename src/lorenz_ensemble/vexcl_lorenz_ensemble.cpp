@@ -2,6 +2,8 @@
 #include <vector>
 #include <utility>
 #include <tuple>
+#include <string>
+#include <memory>
 
 #include <vexcl/vexcl.hpp>
 
@@ -9,9 +11,14 @@
 #include <boost/numeric/odeint/algebra/vector_space_algebra.hpp>
 #include <boost/numeric/odeint/external/vexcl/vexcl_resize.hpp>
 
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "observer.hpp"
+#include "observables.hpp"
+
 namespace odeint = boost::numeric::odeint;
 
-typedef double value_type;
+typedef precision::real value_type;
 
 typedef vex::vector< value_type >    vector_type;
 typedef vex::multivector< value_type, 3 > state_type;
@@ -35,6 +42,23 @@ struct sys_func
     }
 };
 
+// Mean and spread of z over the ensemble (see observables.hpp), reduced on
+// the device.
+struct probe
+{
+    vex::Reductor< precision::accum , vex::SUM > sum;
+
+    probe( const std::vector< cl::CommandQueue > &queue ) : sum( queue ) { }
+
+    std::vector<double> operator()( const state_type &x , double t ) const
+    {
+	std::vector<double> s( lorenz::quantities );
+	s[0] = sum( x(2) );
+	s[1] = sum( x(2) * x(2) );
+	return lorenz::finish( x(2).size() , s );
+    }
+};
+
 size_t n;
 const value_type dt = 0.01;
 const value_type t_max = 100.0;
@@ -44,6 +68,18 @@ int main( int argc , char **argv )
     n = argc > 1 ? atoi(argv[1]) : 1024;
     using namespace std;
 
+    // "observe=K" writes the observables of every K-th step to <name>.obs.
+    unsigned observe = 0;
+    for( int i = 2 ; i < argc ; ++i )
+	if( std::string( argv[i] ).compare( 0 , 8 , "observe=" ) == 0 )
+	    observe = atoi( argv[i] + 8 );
+
+    const std::string name = observe ? "vexcl_lorenz_observe" : "vexcl_lorenz";
+
+    benchmark::harness bench(name, n);
+
+    bench.start("setup");
+
     vex::Context ctx( vex::Filter::Exclusive( vex::Filter::Env ) );
     std::cout << ctx << std::endl;
 
@@ -54,21 +90,52 @@ int main( int argc , char **argv )
     for( size_t i=0 ; i<n ; ++i ) r[i] = Rmin + dR * value_type( i );
 
     state_type X(ctx.queue(), n);
-    X = 10.0;
 
     vector_type R( ctx.queue() , r );
 
-    odeint::runge_kutta4<
-	    state_type , value_type , state_type , value_type ,
-	    odeint::vector_space_algebra , odeint::default_operations
-	    > stepper;
+    probe obs( ctx.queue() );
 
-    odeint::integrate_const( stepper , sys_func( R ) , X , value_type(0.0) , t_max , dt );
+    bench.stop("setup");
 
     std::vector< value_type > res( n );
-    vex::copy( X(0) , res );
+
+    // Kernels are compiled on first use, so the first (warm-up) repetition
+    // includes the compilation time.
+    while(bench.next()) {
+	bench.start("upload");
+	X = 10.0;
+	ctx.finish();
+	bench.stop("upload");
+
+	std::unique_ptr< observer::table > table;
+	if( observe )
+	    table.reset( new observer::table( name + ".obs" , lorenz::columns , observe ) );
+
+	bench.start("integrate");
+	odeint::runge_kutta4<
+		state_type , value_type , state_type , value_type ,
+		odeint::vector_space_algebra , odeint::default_operations
+		> stepper;
+
+	if( table )
+	    odeint::integrate_const( stepper , sys_func( R ) , X , value_type(0.0) , t_max , dt ,
+		    observer::sample( *table , obs ) );
+	else
+	    odeint::integrate_const( stepper , sys_func( R ) , X , value_type(0.0) , t_max , dt );
+	ctx.finish();
+	bench.stop("integrate");
+
+	bench.start("readback");
+	vex::copy( X(0) , res );
+	bench.stop("readback");
+    }
+
     //for( size_t i=0 ; i<n ; ++i )
     //	cout << res[i] << "\t" << r[i] << "\n";
     cout << res[0] << endl;
 
+    bench.check(res);
+
+    bench.report();
+
 }
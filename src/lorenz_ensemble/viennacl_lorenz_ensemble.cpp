@@ -14,10 +14,13 @@
 #include <vexcl/vexcl.hpp>
 #include <viennacl/vector.hpp>
 
+#include "precision.hpp"
+#include "benchmark.hpp"
+
 namespace odeint = boost::numeric::odeint;
 namespace fusion = boost::fusion;
 
-typedef double value_type;
+typedef precision::real value_type;
 
 typedef fusion::vector<
     viennacl::vector< value_type > ,
@@ -67,6 +70,10 @@ int main( int argc , char **argv )
 
     n = argc > 1 ? atoi( argv[1] ) : 1024;
 
+    benchmark::harness bench("viennacl_lorenz", n);
+
+    bench.start("setup");
+
     vex::Context ctx( vex::Filter::Exclusive( vex::Filter::Env && vex::Filter::Count(1)) );
 
     std::vector<cl_device_id> dev_id(1, ctx.queue(0).getInfo<CL_QUEUE_DEVICE>()());
@@ -92,27 +99,47 @@ int main( int argc , char **argv )
     Y.resize( n );
     Z.resize( n );
 
-    viennacl::copy(tmp, X);
-    viennacl::copy(tmp, Y);
-    viennacl::copy(tmp, Z);
-
     viennacl::vector<value_type> R( n );
     viennacl::copy( r , R );
 
-    odeint::runge_kutta4<
-	    state_type , value_type , state_type , value_type ,
-	    odeint::fusion_algebra , odeint::viennacl_operations
-	    > stepper;
-
-    odeint::integrate_const( stepper , sys_func( R ) , S , value_type(0.0) , t_max , dt );
+    bench.stop("setup");
 
     std::vector< value_type > res( n );
-    viennacl::copy( X , res );
+
+    // Kernels are compiled on first use, so the first (warm-up) repetition
+    // includes the compilation time.
+    while(bench.next()) {
+	bench.start("upload");
+	viennacl::copy(tmp, X);
+	viennacl::copy(tmp, Y);
+	viennacl::copy(tmp, Z);
+	ctx.finish();
+	bench.stop("upload");
+
+	bench.start("integrate");
+	odeint::runge_kutta4<
+		state_type , value_type , state_type , value_type ,
+		odeint::fusion_algebra , odeint::viennacl_operations
+		> stepper;
+
+	odeint::integrate_const( stepper , sys_func( R ) , S , value_type(0.0) , t_max , dt );
+	ctx.finish();
+	bench.stop("integrate");
+
+	bench.start("readback");
+	viennacl::copy( X , res );
+	bench.stop("readback");
+    }
+
     /*
     for( size_t i=0 ; i<n ; ++i )
 	cout << res[i] << "\t" << r[i] << "\n";
     */
     cout << res[0] << endl;
 
+    bench.check(res);
+
+    bench.report();
+
     exit(0);
 }
@@ -0,0 +1,74 @@
+#ifndef NATIVE_ENSEMBLE_HPP
+#define NATIVE_ENSEMBLE_HPP
+
+// CPU version of clbuf::ode_ensemble (clbuf/ensemble.hpp): the same system
+// functors and odeint steppers, compiled for SIMD types. Every SIMD chunk
+// of members is loaded into std::arrays of simd values, makes all its
+// steps in registers and is stored back, so the state is read and written
+// once per call rather than once per stage.
+//
+// state and param are in the same order as in the OpenCL kernel, a block
+// of n per component.
+
+#include <array>
+#include <cstddef>
+
+#include <boost/numeric/odeint/algebra/range_algebra.hpp>
+#include <boost/numeric/odeint/algebra/default_operations.hpp>
+#include <boost/numeric/odeint/util/resizer.hpp>
+
+#include <native/operations.hpp>
+
+namespace native {
+
+template <class System,
+         template <class, class, class, class, class, class, class> class Stepper>
+class ode_ensemble {
+    public:
+        static const unsigned N = System::dim;
+        static const unsigned P = System::params;
+
+        explicit ode_ensemble(const System &sys = System()) : sys(sys) {}
+
+        // Makes `steps` steps of dt from t0 on the n members in state with
+        // parameters param.
+        template <typename T>
+        void operator()(T *state, const T *param, size_t n, T t0, T dt, size_t steps) const {
+            namespace odeint = boost::numeric::odeint;
+
+            const System sys = this->sys;
+
+            simd_loop<T>(0, n, [=](auto v, size_t i) {
+                    typedef decltype(v) V;
+                    typedef std::array<V, N> state_type;
+                    typedef std::array<V, P> param_type;
+
+                    state_type x;
+                    param_type p;
+
+                    for(unsigned c = 0; c < N; ++c) x[c] = load<V>(state + c * n + i);
+                    for(unsigned c = 0; c < P; ++c) p[c] = load<V>(param + c * n + i);
+
+                    Stepper<state_type, T, state_type, T,
+                        odeint::range_algebra, odeint::default_operations,
+                        odeint::initially_resizer> stepper;
+
+                    auto member = [&](const state_type &x, state_type &dxdt, T t) {
+                        sys(x, dxdt, p, t);
+                    };
+
+                    for(size_t k = 0; k < steps; ++k)
+                        stepper.do_step(member, x, t0 + k * dt, dt);
+
+                    for(unsigned c = 0; c < N; ++c) store(x[c], state + c * n + i);
+                    });
+
+            bytes_touched += sizeof(T) * (2 * N + P) * n;
+        }
+    private:
+        System sys;
+};
+
+} // namespace native
+
+#endif
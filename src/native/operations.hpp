@@ -0,0 +1,330 @@
+#ifndef NATIVE_OPERATIONS_HPP
+#define NATIVE_OPERATIONS_HPP
+
+#include <iostream>
+#include <cstddef>
+#include <type_traits>
+#include <experimental/simd>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+#ifdef __SSE__
+#  include <xmmintrin.h>
+#endif
+
+#include <native/vector.hpp>
+
+namespace native {
+
+namespace stdx = std::experimental;
+
+inline size_t bytes_touched = 0;
+
+// Widest SIMD type the target supports (-march decides).
+template <typename T>
+struct simd {
+    typedef stdx::native_simd<T>                     type;
+    typedef stdx::simd<T, stdx::simd_abi::scalar>    scalar;
+
+    static size_t width() { return type::size(); }
+};
+
+// Applies kernel to [begin, end). The bulk of the range is split between
+// OpenMP threads in full SIMD-width chunks, the tail is handled with a
+// scalar simd type. The kernel is a generic callable taking the simd type
+// as a tag and the starting index:
+//   kernel(V(), i) processes elements [i, i + V::size()).
+template <typename T, class Kernel>
+void simd_loop(size_t begin, size_t end, Kernel &&kernel) {
+    typedef typename simd<T>::type   V;
+    typedef typename simd<T>::scalar S;
+
+    const ptrdiff_t w = V::size();
+    const ptrdiff_t m = end > begin ? (end - begin) / w : 0;
+
+#pragma omp parallel for schedule(static)
+    for(ptrdiff_t j = 0; j < m; ++j)
+        kernel(V(), begin + j * w);
+
+    for(size_t i = begin + m * w; i < end; ++i)
+        kernel(S(), i);
+}
+
+// Sequential version of simd_loop, for kernels that distribute the work
+// between threads themselves (e.g. over 2D tiles).
+template <typename T, class Kernel>
+void simd_for(size_t begin, size_t end, Kernel &&kernel) {
+    typedef typename simd<T>::type   V;
+    typedef typename simd<T>::scalar S;
+
+    const size_t w = V::size();
+
+    size_t i = begin;
+    for(; i + w <= end; i += w) kernel(V(), i);
+    for(; i < end; ++i)         kernel(S(), i);
+}
+
+inline int num_threads() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// Treats subnormals as zero on every OpenMP thread, as GPUs do by default
+// in single precision. Otherwise the decaying tails of the lattice make a
+// float run several times slower than a double one.
+inline void flush_denormals() {
+#ifdef __SSE__
+#pragma omp parallel
+    _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ | DAZ
+#endif
+}
+
+template <typename T>
+std::ostream& info(std::ostream &os) {
+    return os << "native: " << num_threads() << " threads, "
+              << simd<T>::width() << " x " << sizeof(T) * 8 << "bit SIMD lanes";
+}
+
+template <class V, typename T>
+inline V load(const T *p) {
+    return V(p, stdx::element_aligned);
+}
+
+template <class V, typename T>
+inline void store(const V &v, T *p) {
+    v.copy_to(p, stdx::element_aligned);
+}
+
+// Loads a simd of type V and converts it to W (same width).
+template <class W, class V, typename T>
+inline W load_as(const T *p) {
+    return stdx::static_simd_cast<W>(load<V>(p));
+}
+
+// Operations. The linear combinations are evaluated in Accum precision
+// (the state type when void) and rounded to the state type on store.
+template <typename Accum = void>
+struct basic_operations {
+    template <typename T>
+    struct accum {
+        typedef typename std::conditional<std::is_void<Accum>::value, T, Accum>::type type;
+    };
+
+    template< class Fac1 = double , class Fac2 = Fac1 >
+    struct scale_sum2
+    {
+        const Fac1 m_alpha1;
+        const Fac2 m_alpha2;
+
+        scale_sum2( Fac1 alpha1 , Fac2 alpha2 )
+            : m_alpha1( alpha1 ) , m_alpha2( alpha2 )
+        { }
+
+        template< class T1 , class T2 , class T3 >
+        void operator()(vector<T1> &v1 ,
+                  const vector<T2> &v2 ,
+                  const vector<T3> &v3
+                  ) const
+        {
+            typedef typename accum<T1>::type A;
+
+            T1       *p1 = v1.data();
+            const T2 *p2 = v2.data();
+            const T3 *p3 = v3.data();
+
+            const A a1 = m_alpha1;
+            const A a2 = m_alpha2;
+
+            simd_loop<T1>(0, v1.size(), [=](auto v, size_t i) {
+                    typedef decltype(v) V;
+                    typedef stdx::rebind_simd_t<A, V> W;
+                    store(stdx::static_simd_cast<V>(
+                        a1 * load_as<W, V>(p2 + i) +
+                        a2 * load_as<W, V>(p3 + i)),
+                        p1 + i);
+                    });
+
+            bytes_touched +=
+                v1.size() * sizeof(T1) +
+                v2.size() * sizeof(T2) +
+                v3.size() * sizeof(T3);
+        }
+
+        typedef void result_type;
+    };
+
+    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 >
+    struct scale_sum3
+    {
+        const Fac1 m_alpha1;
+        const Fac2 m_alpha2;
+        const Fac3 m_alpha3;
+
+        scale_sum3( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 )
+            : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 )
+        { }
+
+        template< class T1 , class T2 , class T3 , class T4 >
+        void operator()(vector<T1> &v1 ,
+                  const vector<T2> &v2 ,
+                  const vector<T3> &v3 ,
+                  const vector<T4> &v4
+                  ) const
+        {
+            typedef typename accum<T1>::type A;
+
+            T1       *p1 = v1.data();
+            const T2 *p2 = v2.data();
+            const T3 *p3 = v3.data();
+            const T4 *p4 = v4.data();
+
+            const A a1 = m_alpha1;
+            const A a2 = m_alpha2;
+            const A a3 = m_alpha3;
+
+            simd_loop<T1>(0, v1.size(), [=](auto v, size_t i) {
+                    typedef decltype(v) V;
+                    typedef stdx::rebind_simd_t<A, V> W;
+                    store(stdx::static_simd_cast<V>(
+                        a1 * load_as<W, V>(p2 + i) +
+                        a2 * load_as<W, V>(p3 + i) +
+                        a3 * load_as<W, V>(p4 + i)),
+                        p1 + i);
+                    });
+
+            bytes_touched +=
+                v1.size() * sizeof(T1) +
+                v2.size() * sizeof(T2) +
+                v3.size() * sizeof(T3) +
+                v4.size() * sizeof(T4);
+        }
+
+        typedef void result_type;
+    };
+
+    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 , class Fac4 = Fac3 >
+    struct scale_sum4
+    {
+        const Fac1 m_alpha1;
+        const Fac2 m_alpha2;
+        const Fac3 m_alpha3;
+        const Fac4 m_alpha4;
+
+        scale_sum4( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 , Fac4 alpha4 )
+        : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 ) , m_alpha4( alpha4 ) { }
+
+        template< class T1 , class T2 , class T3 , class T4 , class T5 >
+        void operator()(vector<T1> &v1 ,
+                  const vector<T2> &v2 ,
+                  const vector<T3> &v3 ,
+                  const vector<T4> &v4 ,
+                  const vector<T5> &v5
+                  ) const
+        {
+            typedef typename accum<T1>::type A;
+
+            T1       *p1 = v1.data();
+            const T2 *p2 = v2.data();
+            const T3 *p3 = v3.data();
+            const T4 *p4 = v4.data();
+            const T5 *p5 = v5.data();
+
+            const A a1 = m_alpha1;
+            const A a2 = m_alpha2;
+            const A a3 = m_alpha3;
+            const A a4 = m_alpha4;
+
+            simd_loop<T1>(0, v1.size(), [=](auto v, size_t i) {
+                    typedef decltype(v) V;
+                    typedef stdx::rebind_simd_t<A, V> W;
+                    store(stdx::static_simd_cast<V>(
+                        a1 * load_as<W, V>(p2 + i) +
+                        a2 * load_as<W, V>(p3 + i) +
+                        a3 * load_as<W, V>(p4 + i) +
+                        a4 * load_as<W, V>(p5 + i)),
+                        p1 + i);
+                    });
+
+            bytes_touched +=
+                v1.size() * sizeof(T1) +
+                v2.size() * sizeof(T2) +
+                v3.size() * sizeof(T3) +
+                v4.size() * sizeof(T4) +
+                v5.size() * sizeof(T5);
+        }
+
+        typedef void result_type;
+    };
+
+    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 , class Fac4 = Fac3 , class Fac5 = Fac4 >
+    struct scale_sum5
+    {
+        const Fac1 m_alpha1;
+        const Fac2 m_alpha2;
+        const Fac3 m_alpha3;
+        const Fac4 m_alpha4;
+        const Fac5 m_alpha5;
+
+        scale_sum5( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 , Fac4 alpha4 , Fac5 alpha5 )
+        : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 ) , m_alpha4( alpha4 ) , m_alpha5( alpha5 ) { }
+
+        template< class T1 , class T2 , class T3 , class T4 , class T5 , class T6 >
+        void operator()(vector<T1> &v1 ,
+                const vector<T2> &v2 ,
+                const vector<T3> &v3 ,
+                const vector<T4> &v4 ,
+                const vector<T5> &v5 ,
+                const vector<T6> &v6
+                ) const
+        {
+            typedef typename accum<T1>::type A;
+
+            T1       *p1 = v1.data();
+            const T2 *p2 = v2.data();
+            const T3 *p3 = v3.data();
+            const T4 *p4 = v4.data();
+            const T5 *p5 = v5.data();
+            const T6 *p6 = v6.data();
+
+            const A a1 = m_alpha1;
+            const A a2 = m_alpha2;
+            const A a3 = m_alpha3;
+            const A a4 = m_alpha4;
+            const A a5 = m_alpha5;
+
+            simd_loop<T1>(0, v1.size(), [=](auto v, size_t i) {
+                    typedef decltype(v) V;
+                    typedef stdx::rebind_simd_t<A, V> W;
+                    store(stdx::static_simd_cast<V>(
+                        a1 * load_as<W, V>(p2 + i) +
+                        a2 * load_as<W, V>(p3 + i) +
+                        a3 * load_as<W, V>(p4 + i) +
+                        a4 * load_as<W, V>(p5 + i) +
+                        a5 * load_as<W, V>(p6 + i)),
+                        p1 + i);
+                    });
+
+            bytes_touched +=
+                v1.size() * sizeof(T1) +
+                v2.size() * sizeof(T2) +
+                v3.size() * sizeof(T3) +
+                v4.size() * sizeof(T4) +
+                v5.size() * sizeof(T5) +
+                v6.size() * sizeof(T6);
+        }
+
+        typedef void result_type;
+    };
+
+};
+
+typedef basic_operations<> operations;
+
+} // namespace native
+
+#endif
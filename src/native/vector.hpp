@@ -0,0 +1,131 @@
+#ifndef NATIVE_VECTOR_HPP
+#define NATIVE_VECTOR_HPP
+
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <algorithm>
+
+#include <boost/numeric/odeint/util/is_resizeable.hpp>
+#include <boost/numeric/odeint/util/resize.hpp>
+#include <boost/numeric/odeint/util/same_size.hpp>
+
+namespace native {
+
+// Storage is aligned to the cache line, which is also enough for AVX-512.
+static const size_t alignment = 64;
+
+// Plain host vector for the native backend. Memory is first touched by
+// the same OpenMP static schedule the kernels use, so that on NUMA systems
+// every thread works on pages that are local to it.
+template <typename T>
+class vector {
+    public:
+        typedef T value_type;
+
+        vector() : n(0), buf(0) {}
+
+        explicit vector(size_t n, T v = T()) : n(0), buf(0) {
+            resize(n, v);
+        }
+
+        template <class Container>
+        explicit vector(const Container &host) : n(0), buf(0) {
+            allocate(host.size());
+
+            const T *src = host.data();
+#pragma omp parallel for schedule(static)
+            for(ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i)
+                buf[i] = src[i];
+        }
+
+        vector(const vector &other) : n(0), buf(0) {
+            allocate(other.n);
+
+#pragma omp parallel for schedule(static)
+            for(ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i)
+                buf[i] = other.buf[i];
+        }
+
+        vector& operator=(vector other) {
+            swap(other);
+            return *this;
+        }
+
+        ~vector() {
+            std::free(buf);
+        }
+
+        void resize(size_t size, T v = T()) {
+            allocate(size);
+
+#pragma omp parallel for schedule(static)
+            for(ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i)
+                buf[i] = v;
+        }
+
+        void swap(vector &other) {
+            std::swap(n,   other.n);
+            std::swap(buf, other.buf);
+        }
+
+        size_t size() const { return n; }
+
+        T*       data()       { return buf; }
+        const T* data() const { return buf; }
+
+        T&       operator[](size_t i)       { return buf[i]; }
+        const T& operator[](size_t i) const { return buf[i]; }
+
+        T*       begin()       { return buf; }
+        const T* begin() const { return buf; }
+        T*       end()         { return buf + n; }
+        const T* end()   const { return buf + n; }
+    private:
+        size_t n;
+        T     *buf;
+
+        void allocate(size_t size) {
+            std::free(buf);
+            buf = 0;
+            n   = size;
+
+            if (!n) return;
+
+            size_t bytes = sizeof(T) * n;
+            if (bytes % alignment) bytes += alignment - bytes % alignment;
+
+            buf = static_cast<T*>(std::aligned_alloc(alignment, bytes));
+            if (!buf) throw std::bad_alloc();
+        }
+};
+
+} // namespace native
+
+// Resizing
+namespace boost { namespace numeric { namespace odeint {
+
+template <typename T>
+struct is_resizeable< native::vector<T> > : boost::true_type {};
+
+template< typename T >
+struct resize_impl< native::vector<T> , native::vector<T> >
+{
+    static void resize( native::vector<T> &x1 , const native::vector<T> &x2 )
+    {
+        x1.resize(x2.size());
+    }
+};
+
+template< typename T >
+struct same_size_impl< native::vector<T> , native::vector<T> >
+{
+    static bool same_size( const native::vector<T> &x1 , const native::vector<T> &x2 )
+    {
+        return x1.size() == x2.size();
+    }
+};
+
+} } }
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef OBSERVER_HPP
+#define OBSERVER_HPP
+
+// Sampled observations of an integration, shared by all the backends.
+//
+// A probe reduces the state to a few aggregates where the state lives (on
+// the device, or in place for the native backend) and hands back only
+// those:
+//
+//   struct probe {
+//       std::vector<double> operator()(const state_type &x, double t);
+//   };
+//
+// The values are rows of the table columns, one row per segment of the
+// state (e.g. per disorder realization of a batch). sample() wraps a probe
+// into an odeint observer that calls it on every K-th observer call (the
+// initial state included) and appends the rows to a tab separated table:
+//
+//   t  [segment]  column...
+//
+// The segment column is only written when there is more than one segment.
+//
+// Only C++03 is used here, so the header may be included from the CUDA
+// sources as well.
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+namespace observer {
+
+class table {
+    public:
+        // columns is the tab separated list of the column names.
+        table(const std::string &path, const std::string &columns,
+                unsigned every, unsigned segments = 1)
+            : out(path.c_str()),
+              width(std::count(columns.begin(), columns.end(), '\t') + 1),
+              K(std::max(every, 1U)), segments(segments), calls(0)
+        {
+            if (!out) throw std::runtime_error("observer: can not open " + path);
+
+            out << "t\t" << (segments > 1 ? "segment\t" : "") << columns << "\n";
+        }
+
+        // Counts an observer call and tells if it has to be sampled.
+        bool due() {
+            return calls++ % K == 0;
+        }
+
+        void write(double t, const std::vector<double> &values) {
+            if (values.size() != width * segments)
+                throw std::length_error("observer: probe does not match the table");
+
+            for(unsigned s = 0; s < segments; ++s) {
+                out << t;
+                if (segments > 1) out << "\t" << s;
+                for(size_t j = 0; j < width; ++j)
+                    out << "\t" << values[s * width + j];
+                out << "\n";
+            }
+        }
+    private:
+        std::ofstream out;
+        size_t        width;
+        unsigned      K;
+        unsigned      segments;
+        size_t        calls;
+};
+
+// odeint observer. Copies share the table and the probe.
+template <class Probe>
+class sampler {
+    public:
+        sampler(table &tab, Probe &probe) : tab(&tab), probe(&probe) {}
+
+        template <class State>
+        void operator()(const State &x, double t) {
+            if (tab->due()) tab->write(t, (*probe)(x, t));
+        }
+    private:
+        table *tab;
+        Probe *probe;
+};
+
+template <class Probe>
+sampler<Probe> sample(table &tab, Probe &probe) {
+    return sampler<Probe>(tab, probe);
+}
+
+} // namespace observer
+
+#endif
@@ -26,7 +26,8 @@
 #include <boost/numeric/odeint.hpp>
 #include <boost/numeric/odeint/algebra/vector_space_algebra.hpp>
 
-#include <boost/timer.hpp>
+#include "precision.hpp"
+#include "benchmark.hpp"
 
 
 namespace odeint = boost::numeric::odeint;
@@ -36,7 +37,7 @@ using namespace mtl;
 
 struct stencil_kernel
 {
-    typedef double value_type;
+    typedef precision::real value_type;
     static const int start= -1, end= 1;
 
     stencil_kernel(int n) : n(n) {}
@@ -82,32 +83,60 @@ int main(int argc, char* argv[])
     using namespace mtl;
     mtl::vampir_trace<9999>                            tracer;
 
-    typedef double                    value_type;
+    typedef precision::real             value_type;
     typedef dense_vector<value_type>  state_type;
 
     const value_type dt= 0.01, pi= M_PI, t_max= 100.0;
     const size_t n= argc > 1 ? atoi(argv[1]) : 1024;
     const value_type epsilon = 6.0 / ( n * n ); // should be < 8/N^2 to see phase locking
 
-    state_type omega(n), x(n), tmp(n);
+    benchmark::harness bench("cmtl_phase_oscillator_chain", n);
+
+    bench.start("setup");
+    state_type omega(n), x0(n);
     for (size_t i= 0; i < n; ++i) {
-        x[i] = 2.0 * pi * drand48();
+        x0[i] = 2.0 * pi * drand48();
         omega[i] = double(n - i) * epsilon; // decreasing frequencies
     }
 
-    odeint::runge_kutta4<
-	    state_type, value_type, state_type, value_type,
-	    odeint::vector_space_algebra, odeint::default_operations
-	    > stepper;
-
     sys_func<state_type> sys(omega);
-    boost::timer timer;
-    odeint::integrate_const(stepper, boost::ref(sys), x, 0.0, t_max, dt);
     cudaThreadSynchronize();
-    std::cout << "Integration took " << timer.elapsed() << " s\n";
-    
-    std::cout << "Result is " << x[0] << '\n';
+    bench.stop("setup");
+
+    value_type res = 0;
+    std::vector<value_type> phases;
+
+    while (bench.next()) {
+        bench.start("upload");
+        state_type x(x0);
+        cudaThreadSynchronize();
+        bench.stop("upload");
+
+        bench.start("integrate");
+        odeint::runge_kutta4<
+                state_type, value_type, state_type, value_type,
+                odeint::vector_space_algebra, odeint::default_operations
+                > stepper;
+
+        odeint::integrate_const(stepper, boost::ref(sys), x, 0.0, t_max, dt);
+        cudaThreadSynchronize();
+        bench.stop("integrate");
+
+        bench.start("readback");
+        res = x[0];
+        if (bench.checking()) {
+            phases.resize(n);
+            for (size_t i= 0; i < n; ++i)
+                phases[i] = x[i];
+        }
+        bench.stop("readback");
+    }
+
+    std::cout << "Result is " << res << '\n';
+
+    bench.check(phases);
+
+    bench.report();
 
     return 0;
 }
-
@@ -0,0 +1,441 @@
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <array>
+#include <algorithm>
+#include <string>
+#include <cmath>
+
+#include <vexcl/devlist.hpp>
+
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "vt_user.h"
+#include "clbuf/clbuf.hpp"
+
+#include <boost/numeric/odeint.hpp>
+#include <boost/numeric/odeint/util/is_resizeable.hpp>
+#include <boost/numeric/odeint/util/resize.hpp>
+#include <boost/numeric/odeint/util/same_size.hpp>
+
+// Domain decomposed phase oscillator chain.
+//
+// The chain is split into contiguous parts, one per compute device. Every
+// part owns its slice of the state and a two element halo buffer holding
+// the outer neighbours of its first and last site. Each evaluation of the
+// right hand side
+//
+//   1. reads the first and the last site of every part to the host,
+//   2. starts the interior kernel, which needs no halo,
+//   3. waits for the edges and writes the halos of the neighbouring parts
+//      on a second command queue while the interior kernels run,
+//   4. finishes the two boundary sites once the halo has arrived.
+//
+// Halos are staged through the host, so the parts may live on different
+// platforms. The devices are the ones selected by the usual VexCL
+// environment filters (OCL_DEVICE etc.), or sub-devices of the first one:
+//
+//   multi_phase_oscillator n        all matching devices
+//   multi_phase_oscillator n 4      first device split into 4 sub-devices
+//   multi_phase_oscillator n numa   first device split by NUMA domain
+//
+// The sub-device modes allow to test the exchange with a single pocl CPU
+// device.
+//
+// Every part has a clbuf::context of its own, so the operations are the
+// library ones and all launches use the configurations tuned for the
+// device.
+
+namespace odeint = boost::numeric::odeint;
+typedef precision::real value_type;
+
+typedef clbuf::basic_operations<precision::accum> operations;
+
+const char source[] =
+PRECISION_CL_PREAMBLE
+"kernel void chain_interior(\n"
+"    ulong n,\n"
+"    global real *dsdt,\n"
+"    global const real *s,\n"
+"    global const real *omega\n"
+"    )\n"
+"{\n"
+"    for(size_t i = get_global_id(0) + 1; i < n - 1; i += get_global_size(0)) {\n"
+"        real xl = s[i - 1];\n"
+"        real x0 = s[i];\n"
+"        real xr = s[i + 1];\n"
+"        dsdt[i] = omega[i] + sin(xl - x0) + sin(x0 - xr);\n"
+"    }\n"
+"}\n"
+"\n"
+"kernel void chain_boundary(\n"
+"    ulong n,\n"
+"    global real *dsdt,\n"
+"    global const real *s,\n"
+"    global const real *omega,\n"
+"    global const real *halo\n"
+"    )\n"
+"{\n"
+"    size_t k = get_global_id(0);\n"
+"    if (k > 1 || (k == 1 && n == 1)) return;\n"
+"\n"
+"    size_t i  = k ? n - 1 : 0;\n"
+"    real   xl = i > 0     ? s[i - 1] : halo[0];\n"
+"    real   x0 = s[i];\n"
+"    real   xr = i < n - 1 ? s[i + 1] : halo[1];\n"
+"    dsdt[i] = omega[i] + sin(xl - x0) + sin(x0 - xr);\n"
+"}\n";
+
+// A slice of the chain and the device it lives on. Kernels and edge reads
+// go to the queue of the context, halo writes to a queue of their own.
+struct part {
+    clbuf::context   ctx;
+    cl::CommandQueue copy;
+
+    size_t begin, size;
+
+    clbuf::vector<value_type> omega;
+    cl::Buffer                halo;
+
+    // Host staging for the exchange: own first and last site, and the
+    // outer neighbours to be written to the halo buffer.
+    value_type edge[2];
+    value_type ghost[2];
+
+    cl::Event edge_ready;
+    cl::Event halo_ready;
+
+    part(const cl::Device &device, size_t begin, size_t size)
+        : ctx(cl::Context(device), device, 1, vt::queue_properties()),
+          copy(ctx.ctx, device),
+          begin(begin), size(size),
+          halo(ctx.ctx, CL_MEM_READ_WRITE, 2 * sizeof(value_type))
+    { }
+
+    cl::CommandQueue& compute() {
+        return ctx.queue[0];
+    }
+};
+
+// A deque, as the parts can not be copied. Owned by main; the state and
+// the system function keep a pointer or a reference to it.
+typedef std::deque<part> partition;
+
+size_t bytes_touched(const partition &parts) {
+    size_t b = 0;
+    for(size_t d = 0; d < parts.size(); ++d) b += parts[d].ctx.bytes_touched;
+    return b;
+}
+
+// Sets the kernel arguments in order.
+inline void set_args(cl::Kernel&, uint) {}
+
+template <class Head, class... Tail>
+void set_args(cl::Kernel &krn, uint pos, const Head &head, const Tail&... tail) {
+    krn.setArg(pos, head);
+    set_args(krn, pos + 1, tail...);
+}
+
+// Slice of a host vector that belongs to part p.
+template <typename T>
+std::vector<T> slice(const std::vector<T> &host, const part &p) {
+    return std::vector<T>(host.begin() + p.begin, host.begin() + p.begin + p.size);
+}
+
+// State: one clbuf vector per part.
+struct chain_vector {
+    partition *parts;
+
+    std::vector< clbuf::vector<value_type> > data;
+
+    chain_vector() : parts(0) {}
+
+    chain_vector(partition &p, const std::vector<value_type> &host) : parts(&p) {
+        data.reserve(p.size());
+        for(size_t d = 0; d < p.size(); ++d)
+            data.push_back(clbuf::vector<value_type>(p[d].ctx, slice(host, p[d])));
+    }
+
+    void allocate(partition &p) {
+        parts = &p;
+        data.clear();
+        data.reserve(p.size());
+        for(size_t d = 0; d < p.size(); ++d)
+            data.push_back(clbuf::vector<value_type>(p[d].ctx, p[d].size));
+    }
+
+    void read(std::vector<value_type> &host) const {
+        for(size_t d = 0; d < data.size(); ++d) {
+            const part &p = (*parts)[d];
+
+            std::vector<value_type> h(p.size);
+            data[d].read(h);
+            std::copy(h.begin(), h.end(), host.begin() + p.begin);
+        }
+    }
+};
+
+// Resizing
+namespace boost { namespace numeric { namespace odeint {
+
+template <>
+struct is_resizeable< chain_vector > : boost::true_type {};
+
+template<>
+struct resize_impl< chain_vector , chain_vector >
+{
+    static void resize( chain_vector &x1 , const chain_vector &x2 )
+    {
+        x1.allocate(*x2.parts);
+    }
+};
+
+template<>
+struct same_size_impl< chain_vector , chain_vector >
+{
+    static bool same_size( const chain_vector &x1 , const chain_vector &x2 )
+    {
+        return x1.data.size() == x2.data.size();
+    }
+};
+
+} } }
+
+// Operations. Every part is updated by its own device.
+template <size_t N>
+struct chain_scale_sum {
+    std::array<precision::accum, N> a;
+
+    template <class... Fac>
+    chain_scale_sum(Fac... alpha) : a{{ static_cast<precision::accum>(alpha)... }} { }
+
+    template <class... V>
+    void operator()(chain_vector &v0, const V&... v) const {
+        static const std::string name = "scale_sum" + std::to_string(N);
+
+        for(size_t d = 0; d < v0.data.size(); ++d)
+            operations::scale_sum(name.c_str(), a.data(), v0.data[d], v.data[d]...);
+    }
+
+    typedef void result_type;
+};
+
+struct chain_operations {
+    template< class Fac1 = double , class Fac2 = Fac1 >
+    struct scale_sum2 : chain_scale_sum<2> {
+        scale_sum2( Fac1 a1 , Fac2 a2 )
+            : chain_scale_sum<2>( a1 , a2 ) { }
+    };
+
+    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 >
+    struct scale_sum3 : chain_scale_sum<3> {
+        scale_sum3( Fac1 a1 , Fac2 a2 , Fac3 a3 )
+            : chain_scale_sum<3>( a1 , a2 , a3 ) { }
+    };
+
+    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 , class Fac4 = Fac3 >
+    struct scale_sum4 : chain_scale_sum<4> {
+        scale_sum4( Fac1 a1 , Fac2 a2 , Fac3 a3 , Fac4 a4 )
+            : chain_scale_sum<4>( a1 , a2 , a3 , a4 ) { }
+    };
+
+    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 , class Fac4 = Fac3 , class Fac5 = Fac4 >
+    struct scale_sum5 : chain_scale_sum<5> {
+        scale_sum5( Fac1 a1 , Fac2 a2 , Fac3 a3 , Fac4 a4 , Fac5 a5 )
+            : chain_scale_sum<5>( a1 , a2 , a3 , a4 , a5 ) { }
+    };
+};
+
+static const value_type dt = 0.01;
+static const value_type t_max = 100.0;
+
+typedef chain_vector state_type;
+
+struct sys_func
+{
+    partition &parts;
+
+    sys_func( partition &parts ) : parts(parts) { }
+
+    void operator()( const chain_vector &x , chain_vector &dxdt , value_type t ) const
+    {
+        const size_t np = parts.size();
+
+        VT_USER_START("chain_system");
+
+        for(size_t d = 0; d < np; ++d) {
+            part &p = parts[d];
+
+            p.compute().enqueueReadBuffer(x.data[d].data, CL_FALSE,
+                    0, sizeof(value_type), &p.edge[0]);
+            p.compute().enqueueReadBuffer(x.data[d].data, CL_FALSE,
+                    sizeof(value_type) * (p.size - 1), sizeof(value_type), &p.edge[1],
+                    0, &p.edge_ready);
+
+            if (p.size > 2) {
+                cl::Kernel &krn = p.ctx.kernel("chain_interior");
+                set_args(krn, 0, static_cast<cl_ulong>(p.size),
+                        dxdt.data[d].data, x.data[d].data, p.omega.data);
+
+                p.ctx.launch(0, krn, p.size - 2, "chain_interior");
+            }
+
+            p.compute().flush();
+        }
+
+        VT_USER_START("halo_exchange");
+        for(size_t d = 0; d < np; ++d) parts[d].edge_ready.wait();
+
+        for(size_t d = 0; d < np; ++d) {
+            part &p = parts[d];
+
+            // The chain ends see themselves, which makes the coupling
+            // term vanish as in the single device version.
+            p.ghost[0] = d > 0      ? parts[d - 1].edge[1] : p.edge[0];
+            p.ghost[1] = d + 1 < np ? parts[d + 1].edge[0] : p.edge[1];
+
+            p.copy.enqueueWriteBuffer(p.halo, CL_FALSE, 0,
+                    2 * sizeof(value_type), p.ghost, 0, &p.halo_ready);
+            p.copy.flush();
+        }
+        VT_USER_END("halo_exchange");
+
+        for(size_t d = 0; d < np; ++d) {
+            part &p = parts[d];
+
+            std::vector<cl::Event> wait(1, p.halo_ready);
+
+            cl::Kernel &krn = p.ctx.kernel("chain_boundary");
+            set_args(krn, 0, static_cast<cl_ulong>(p.size),
+                    dxdt.data[d].data, x.data[d].data, p.omega.data, p.halo);
+
+            p.ctx.launch(0, krn, cl::NDRange(2), cl::NullRange, "chain_boundary", wait);
+
+            p.ctx.bytes_touched += 5 * sizeof(value_type) * p.size;
+        }
+
+        VT_USER_END("chain_system");
+    }
+};
+
+// Splits the device into sub-devices, either equally into k parts or
+// along its NUMA domains.
+std::vector<cl::Device> split(const cl::Device &device, const std::string &how) {
+    std::vector<cl_device_partition_property> prop;
+    size_t k = 0;
+
+    if (how == "numa") {
+        prop.push_back(CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN);
+        prop.push_back(CL_DEVICE_AFFINITY_DOMAIN_NUMA);
+    } else {
+        k = std::stoul(how);
+        size_t cu = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+        if (k == 0 || k > cu)
+            throw std::invalid_argument("cannot split " + std::to_string(cu) +
+                    " compute units into " + how + " sub-devices");
+
+        prop.push_back(CL_DEVICE_PARTITION_EQUALLY);
+        prop.push_back(cu / k);
+    }
+    prop.push_back(0);
+
+    std::vector<cl::Device> sub;
+    device.createSubDevices(prop.data(), &sub);
+
+    // Equal partitioning leaves the remainder as an extra sub-device.
+    if (k && sub.size() > k) sub.resize(k);
+
+    return sub;
+}
+
+int main(int argc, char *argv[]) {
+    const size_t n = argc > 1 ? atoi(argv[1]) : 1024;
+    const value_type epsilon = 6.0 / ( n * n ); // should be < 8/N^2 to see phase locking
+
+    try {
+        benchmark::harness bench("multi_phase_oscillator", n);
+
+        bench.start("setup");
+
+        partition parts;
+
+        std::vector<cl::Device> device = vex::device_list(vex::Filter::Env);
+        if (device.empty()) throw std::runtime_error("No compute devices");
+
+        if (argc > 2) device = split(device[0], argv[2]);
+
+        if (device.size() > n) throw std::runtime_error("Chain is shorter than the number of devices");
+
+        for(size_t d = 0; d < device.size(); ++d) {
+            size_t b = n * d / device.size();
+            size_t e = n * (d + 1) / device.size();
+
+            parts.emplace_back(device[d], b, e - b);
+
+            std::cout << d << ". " << device[d].getInfo<CL_DEVICE_NAME>()
+                      << " [" << b << ", " << e << ")" << std::endl;
+        }
+
+        std::vector< value_type > omega( n );
+        std::vector< value_type > x( n );
+        for( size_t i=0 ; i<n ; ++i )
+        {
+            x[i] = 2.0 * M_PI * drand48();
+            omega[i] = double( n - i ) * epsilon; // decreasing frequencies
+        }
+
+        for(size_t d = 0; d < parts.size(); ++d)
+            parts[d].omega = clbuf::vector<value_type>(parts[d].ctx, slice(omega, parts[d]));
+
+        bench.stop("setup");
+
+        bench.start("compile");
+        for(size_t d = 0; d < parts.size(); ++d) {
+            parts[d].ctx.build(source);
+            operations::compile<value_type>(parts[d].ctx);
+        }
+        bench.stop("compile");
+
+        std::vector<value_type> res( n );
+
+        while(bench.next()) {
+            bench.start("upload");
+            state_type X( parts , x );
+            bench.stop("upload");
+
+            for(size_t d = 0; d < parts.size(); ++d) parts[d].ctx.bytes_touched = 0;
+
+            bench.start("integrate");
+            VT_USER_START("integrate");
+            odeint::runge_kutta4<
+                state_type , value_type , state_type , value_type ,
+                           odeint::vector_space_algebra , chain_operations
+                               > stepper;
+
+            odeint::integrate_const( stepper , sys_func( parts ) , X , value_type( 0.0 ) , t_max , dt );
+
+            for(size_t d = 0; d < parts.size(); ++d) parts[d].ctx.finish();
+            VT_USER_END("integrate");
+            bench.stop("integrate");
+
+            bench.start("readback");
+            X.read(res);
+            bench.stop("readback");
+
+            bench.bytes(bytes_touched(parts));
+        }
+
+        std::cout << res[0] << std::endl;
+        std::cout << "bytes io: " << bytes_touched(parts) << std::endl;
+
+        bench.check(res);
+
+        bench.report();
+    } catch (const cl::Error &e) {
+        std::cerr << "OpenCL error: " << e << std::endl;
+        return 1;
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,356 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <memory>
+
+#include <unistd.h>
+
+#include <native/vector.hpp>
+#include <native/operations.hpp>
+
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "observer.hpp"
+#include "observables.hpp"
+
+#include <boost/numeric/odeint.hpp>
+
+namespace odeint = boost::numeric::odeint;
+typedef precision::real value_type;
+
+typedef native::vector<value_type> state_type;
+
+static const value_type dt = 0.01;
+static const value_type t_max = 100.0;
+
+enum stage_kind { stage_first, stage_inner, stage_last };
+
+// Runge-Kutta stage on m sites of a tile, in the order of the fused stepper
+// of the reference version: k = f(src), then
+//   first: acc  = x + w * k;  dst = x + a * k;
+//   inner: acc += w * k;      dst = x + a * k;
+//   last:  x    = acc + w * k.
+// The ends of the tile clamp their neighbours like the ends of the chain.
+void stage(stage_kind kind, size_t m, value_type *x, const value_type *src,
+        value_type *dst, value_type *acc, const value_type *omega,
+        value_type a, value_type w)
+{
+    auto update = [=](auto k, size_t i) {
+        typedef decltype(k) V;
+
+        switch (kind) {
+            case stage_first:
+                native::store(native::load<V>(src + i) + V(w) * k, acc + i);
+                native::store(native::load<V>(src + i) + V(a) * k, dst + i);
+                break;
+            case stage_inner:
+                native::store(native::load<V>(acc + i) + V(w) * k, acc + i);
+                native::store(native::load<V>(x + i)   + V(a) * k, dst + i);
+                break;
+            case stage_last:
+                native::store(native::load<V>(acc + i) + V(w) * k, x + i);
+                break;
+        }
+    };
+
+    native::simd_for<value_type>(1, m - 1, [=](auto v, size_t i) {
+            typedef decltype(v) V;
+
+            V xl = native::load<V>(src + i - 1);
+            V x0 = native::load<V>(src + i);
+            V xr = native::load<V>(src + i + 1);
+
+            update(native::load<V>(omega + i) + sin(xl - x0) + sin(x0 - xr), i);
+            });
+
+    // Both ends of the tile, or its only site when m == 1.
+    for(size_t i = 0; i < m; i += std::max<size_t>(m - 1, 1)) {
+        typedef native::simd<value_type>::scalar S;
+
+        S xl(src[i > 0 ? i - 1 : 0]);
+        S x0(src[i]);
+        S xr(src[i < m - 1 ? i + 1 : m - 1]);
+
+        update(S(omega[i]) + sin(xl - x0) + sin(x0 - xr), i);
+    }
+}
+
+struct sys_func
+{
+    const state_type &omega;
+
+    sys_func( const state_type &omega ) : omega(omega) { }
+
+    void operator()( const state_type &x , state_type &dxdt , value_type t ) const
+    {
+        const size_t n = x.size();
+
+        const value_type *s = x.data();
+        const value_type *w = omega.data();
+        value_type *ds = dxdt.data();
+
+        // Interior points: neighbours are plain unaligned loads.
+        native::simd_loop<value_type>(1, n - 1, [=](auto v, size_t i) {
+                typedef decltype(v) V;
+
+                V xl = native::load<V>(s + i - 1);
+                V x0 = native::load<V>(s + i);
+                V xr = native::load<V>(s + i + 1);
+
+                native::store(native::load<V>(w + i) + sin(xl - x0) + sin(x0 - xr), ds + i);
+                });
+
+        // Chain ends, same clamping as in the reference kernel; a single
+        // site is computed once.
+        for(size_t i = 0; i < n; i += std::max<size_t>(n - 1, 1)) {
+            value_type xl = s[i > 0 ? i - 1 : 0];
+            value_type x0 = s[i];
+            value_type xr = s[i < n - 1 ? i + 1 : n - 1];
+
+            ds[i] = w[i] + std::sin(xl - x0) + std::sin(x0 - xr);
+        }
+
+        native::bytes_touched += 5 * sizeof(value_type) * n;
+    }
+
+    // `steps` Runge-Kutta steps of dt, one tile per thread at a time. A
+    // tile and a halo of four sites per step on both sides are copied to
+    // buffers that stay in cache, and all the steps are made there. The
+    // sites at the edges of the halo see stale neighbours, but the error
+    // moves inwards by one site per stage and only reaches the tile after
+    // the last step. The buffers are cut at the chain ends, so their end
+    // sites clamp like the chain does.
+    void block( const state_type &x , state_type &out , value_type dt ,
+            unsigned steps , size_t tile ) const
+    {
+        const size_t    n     = x.size();
+        const size_t    halo  = 4 * steps;
+        const size_t    block = tile + 2 * halo;
+        const ptrdiff_t tiles = (n + tile - 1) / tile;
+
+        const value_type *s = x.data();
+        const value_type *w = omega.data();
+        value_type       *r = out.data();
+
+#pragma omp parallel
+        {
+            std::vector<value_type> buf(5 * block);
+
+            value_type *y    = buf.data();
+            value_type *acc  = y    + block;
+            value_type *tmp0 = acc  + block;
+            value_type *tmp1 = tmp0 + block;
+            value_type *om   = tmp1 + block;
+
+#pragma omp for schedule(static)
+            for(ptrdiff_t b = 0; b < tiles; ++b) {
+                const size_t begin = b * tile;
+                const size_t end   = std::min(n, begin + tile);
+                const size_t lo    = begin > halo ? begin - halo : 0;
+                const size_t hi    = std::min(n, end + halo);
+
+                std::copy(s + lo, s + hi, y);
+                std::copy(w + lo, w + hi, om);
+
+                for(unsigned k = 0; k < steps; ++k) {
+                    stage(stage_first, hi - lo, y, y,    tmp0, acc, om, dt / 2, dt / 6);
+                    stage(stage_inner, hi - lo, y, tmp0, tmp1, acc, om, dt / 2, dt / 3);
+                    stage(stage_inner, hi - lo, y, tmp1, tmp0, acc, om, dt,     dt / 3);
+                    stage(stage_last,  hi - lo, y, tmp0, tmp1, acc, om, 0,      dt / 6);
+                }
+
+                std::copy(y + (begin - lo), y + (end - lo), r + begin);
+            }
+        }
+
+        // x and omega are read with the halos, out is written once.
+        native::bytes_touched += sizeof(value_type) * (
+                2 * std::min(n, tiles * block) + n);
+    }
+};
+
+// Temporally blocked mode. A step of dt is made of `steps` Runge-Kutta
+// steps in a single pass over the chain (see sys_func::block), so the
+// state is read and written once per block instead of once per stage. The
+// halos of a tile are read from x, so the result goes to a second buffer
+// which is swapped in.
+struct blocked_runge_kutta4 {
+    typedef ::state_type          state_type;
+    typedef ::state_type          deriv_type;
+    typedef ::value_type          value_type;
+    typedef ::value_type          time_type;
+    typedef unsigned short        order_type;
+    typedef odeint::stepper_tag   stepper_category;
+
+    blocked_runge_kutta4(unsigned steps, size_t tile) : m_steps(steps), m_tile(tile) { }
+
+    static order_type order() { return 4; }
+
+    template< class System >
+    void do_step( System system , state_type &x , time_type t , time_type dt )
+    {
+        typename odeint::unwrap_reference< System >::type &sys = system;
+
+        if (!odeint::same_size(m_out, x)) odeint::resize(m_out, x);
+
+        sys.block(x, m_out, dt / m_steps, m_steps, m_tile);
+        x.swap(m_out);
+    }
+
+    unsigned   m_steps;
+    size_t     m_tile;
+    state_type m_out;
+};
+
+// Order parameter and phase locked clusters (see observables.hpp). The
+// phases of the previous sample are kept in prev.
+struct probe
+{
+    std::vector<value_type> prev, save;
+    value_type tol;
+    double     last;
+    bool       first;
+
+    probe(size_t n, value_type tol) : prev(n), save(n), tol(tol), last(0), first(true) { }
+
+    std::vector<double> operator()( const state_type &x , double t )
+    {
+        const double window = first ? 0 : t - last;
+
+        std::vector<double> s = chain::sums(x.size(), x.data(),
+                prev.data(), save.data(), window, double(tol));
+
+        prev.swap(save);
+        last  = t;
+        first = false;
+
+        return chain::finish(x.size(), window, s);
+    }
+};
+
+template <class Stepper>
+void integrate(Stepper &stepper, const state_type &Omega, state_type &X,
+        value_type t1, value_type dt, observer::table *table, probe *obs)
+{
+    if (table)
+        odeint::integrate_const( stepper , sys_func( Omega ) , X , value_type( 0.0 ) , t1 , dt ,
+                observer::sample( *table , *obs ) );
+    else
+        odeint::integrate_const( stepper , sys_func( Omega ) , X , value_type( 0.0 ) , t1 , dt );
+}
+
+int main(int argc, char *argv[]) {
+    const size_t n = argc > 1 ? atoi(argv[1]) : 1024;
+    const value_type epsilon = 6.0 / ( n * n ); // should be < 8/N^2 to see phase locking
+
+    // Modes:
+    //   observe=K   write the observables of every K-th step to <name>.obs;
+    //   blocked=K   temporally blocked stepper, K steps per pass over the
+    //               chain; observe then counts blocks, and t_max must be
+    //               a multiple of K * dt.
+    unsigned observe = 0, blocked = 0;
+    for(int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a.compare(0, 8, "observe=") == 0) observe = atoi(a.c_str() + 8);
+        if (a.compare(0, 8, "blocked=") == 0) blocked = atoi(a.c_str() + 8);
+    }
+
+    try {
+        std::string name = "native_phase_oscillator_chain";
+        if (blocked) name += "_blocked";
+        if (observe) name += "_observe";
+
+        benchmark::harness bench(name, n);
+
+        bench.start("setup");
+
+        native::flush_denormals();
+        native::info<value_type>(std::cout) << std::endl;
+
+        std::vector< value_type > omega( n );
+        std::vector< value_type > x( n );
+        for( size_t i=0 ; i<n ; ++i )
+        {
+            x[i] = 2.0 * M_PI * drand48();
+            omega[i] = double( n - i ) * epsilon; // decreasing frequencies
+        }
+
+        state_type Omega( omega );
+
+        // The largest tile whose five buffers, halos included, fit in the
+        // L2 cache of a core.
+        size_t tile = 0;
+        if (blocked) {
+            long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+            if (l2 <= 0) l2 = 256 * 1024;
+
+            const size_t block = l2 / (5 * sizeof(value_type));
+
+            if (block <= 8 * blocked)
+                throw std::runtime_error("The halo of the blocked steps does not fit in cache");
+
+            // integrate_const would stop at the last whole block before t_max.
+            if (static_cast<size_t>(t_max / dt + 0.5) % blocked)
+                throw std::runtime_error("t_max is not a multiple of blocked * dt");
+
+            tile = std::min(n, block - 8 * blocked);
+
+            std::cout << "tile: " << tile << std::endl;
+        }
+
+        bench.stop("setup");
+
+        std::vector<value_type> res( n );
+
+        while(bench.next()) {
+            bench.start("upload");
+            state_type X( x );
+            bench.stop("upload");
+
+            // Neighbouring intrinsic frequencies differ by epsilon.
+            std::unique_ptr<observer::table> table;
+            std::unique_ptr<probe>           obs;
+            if (observe) {
+                table.reset(new observer::table(name + ".obs", chain::columns, observe));
+                obs.reset(new probe(n, epsilon / 2));
+            }
+
+            native::bytes_touched = 0;
+
+            bench.start("integrate");
+            if (blocked) {
+                blocked_runge_kutta4 stepper( blocked , tile );
+
+                // Half a block past t_max, so that rounding in k * K * dt
+                // does not drop the last block.
+                integrate( stepper , Omega , X , t_max + blocked * dt / 2 , blocked * dt , table.get() , obs.get() );
+            } else {
+                odeint::runge_kutta4<
+                    state_type , value_type , state_type , value_type ,
+                               odeint::vector_space_algebra , native::basic_operations<precision::accum>
+                                   > stepper;
+
+                integrate( stepper , Omega , X , t_max , dt , table.get() , obs.get() );
+            }
+            bench.stop("integrate");
+
+            bench.start("readback");
+            std::copy(X.begin(), X.end(), res.begin());
+            bench.stop("readback");
+
+            bench.bytes(native::bytes_touched);
+        }
+
+        std::cout << res[0] << std::endl;
+        std::cout << "bytes io: " << native::bytes_touched << std::endl;
+
+        bench.check(res);
+
+        bench.report();
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef CHAIN_OBSERVABLES_HPP
+#define CHAIN_OBSERVABLES_HPP
+
+// Observables of the phase oscillator chain:
+//
+//   order     the Kuramoto order parameter r = |sum_j exp(i x_j)| / n;
+//   clusters  the number of phase locked clusters.
+//
+// Clusters are told apart by the mean frequencies over the window T since
+// the previous sample, (x_j(t) - x_j(t - T)) / T: neighbours whose mean
+// frequencies differ by more than tol belong to different clusters. Inside
+// a locked cluster the phase differences settle, so T only has to be long
+// against the transient. The first sample has no window and reports zero
+// clusters.
+//
+// Every backend reduces the state where it lives to sum cos x_j, sum sin
+// x_j and the number of cluster boundaries (quantities), keeping a copy of
+// the phases for the next window, and passes the sums to finish(), which
+// gives the row of the observer table (see observer.hpp). sums() is the
+// host version, for the native backend; reduce_args and reduce_body make
+// the clbuf kernel (see clbuf::reduce_source()).
+
+#include <vector>
+#include <cmath>
+
+namespace chain {
+
+const char     columns[]  = "order\tclusters";
+const unsigned quantities = 3;
+
+// Saves x to save for the next window.
+template <typename T>
+std::vector<double> sums(size_t n, const T *x, const T *prev, T *save,
+        double window, double tol)
+{
+    double c = 0, s = 0, b = 0;
+
+#pragma omp parallel for reduction(+:c,s,b) schedule(static)
+    for(long i = 0; i < static_cast<long>(n); ++i) {
+        c += std::cos(x[i]);
+        s += std::sin(x[i]);
+
+        if (window > 0 && i + 1 < static_cast<long>(n))
+            b += std::fabs((x[i + 1] - prev[i + 1]) - (x[i] - prev[i])) > tol * window;
+
+        save[i] = x[i];
+    }
+
+    std::vector<double> sum(quantities);
+    sum[0] = c;
+    sum[1] = s;
+    sum[2] = b;
+    return sum;
+}
+
+inline std::vector<double> finish(size_t n, double window, const std::vector<double> &s) {
+    std::vector<double> row(2);
+    row[0] = std::sqrt(s[0] * s[0] + s[1] * s[1]) / n;
+    row[1] = window > 0 ? s[2] + 1 : 0;
+    return row;
+}
+
+const char reduce_args[] =
+"real window,\n"
+"    real tol,\n"
+"    global const real *x,\n"
+"    global const real *prev,\n"
+"    global real *save";
+
+const char reduce_body[] =
+"            real X = x[i];\n"
+"            v[0] = cos(X);\n"
+"            v[1] = sin(X);\n"
+"            v[2] = (window > 0 && i + 1 < n) ?\n"
+"                fabs((x[i + 1] - prev[i + 1]) - (X - prev[i])) > tol * window : 0;\n"
+"            save[i] = X;\n";
+
+} // namespace chain
+
+#endif
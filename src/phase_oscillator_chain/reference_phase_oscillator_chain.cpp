@@ -1,417 +1,506 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <string>
+#include <sstream>
+#include <memory>
 
 #include <vexcl/devlist.hpp>
 
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "vt_user.h"
+#include "clbuf/clbuf.hpp"
+#include "observer.hpp"
+#include "observables.hpp"
+
 #include <boost/numeric/odeint.hpp>
-#include <boost/numeric/odeint/util/is_resizeable.hpp>
-#include <boost/numeric/odeint/util/resize.hpp>
-#include <boost/numeric/odeint/util/same_size.hpp>
 
 namespace odeint = boost::numeric::odeint;
-typedef double value_type;
-
-static const size_t wgsize = 256;
-
-static cl::Context      ctx;
-static cl::Device       device;
-static cl::CommandQueue queue;
-static cl::Program      program;
-
-size_t bytes_touched = 0;
+typedef precision::real value_type;
+typedef clbuf::basic_operations<precision::accum> operations;
 
-const char clbuf_source[] =
-"#if defined(cl_khr_fp64)\n"
-"#  pragma OPENCL EXTENSION cl_khr_fp64: enable\n"
-"#elif defined(cl_amd_fp64)\n"
-"#  pragma OPENCL EXTENSION cl_amd_fp64: enable\n"
-"#endif\n"
-"\n"
-"typedef double real;\n"
-"\n"
-"kernel void scale_sum2(\n"
+const char oscillator_source[] =
+PRECISION_CL_PREAMBLE
+"kernel void oscillator_system(\n"
 "    ulong n,\n"
-"    global real *v0, \n"
-"    global real *v1, \n"
-"    global real *v2, \n"
-"    real a1,\n"
-"    real a2\n"
+"    global real *dsdt,\n"
+"    global real *s,\n"
+"    global real *omega\n"
 "    )\n"
 "{\n"
-"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0))\n"
-"        v0[i] =\n"
-"            a1 * v1[i] +\n"
-"            a2 * v2[i];\n"
+"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+"        real xl = s[i > 0 ? i - 1 : 0];\n"
+"        real x0 = s[i];\n"
+"        real xr = s[i < n - 1 ? i + 1 : n - 1];\n"
+"        dsdt[i] = omega[i] + sin(xl - x0) + sin(x0 - xr);\n"
+"    }\n"
 "}\n"
 "\n"
-"kernel void scale_sum3(\n"
-"    ulong n,\n"
-"    global real *v0, \n"
-"    global real *v1, \n"
-"    global real *v2, \n"
-"    global real *v3, \n"
-"    real a1,\n"
-"    real a2,\n"
-"    real a3\n"
-"    )\n"
-"{\n"
-"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0))\n"
-"        v0[i] =\n"
-"            a1 * v1[i] +\n"
-"            a2 * v2[i] +\n"
-"            a3 * v3[i];\n"
-"}\n"
+"#define STAGE_FIRST 0\n"
+"#define STAGE_INNER 1\n"
+"#define STAGE_LAST  2\n"
 "\n"
-"kernel void scale_sum4(\n"
+"kernel void oscillator_stage(\n"
 "    ulong n,\n"
-"    global real *v0, \n"
-"    global real *v1, \n"
-"    global real *v2, \n"
-"    global real *v3, \n"
-"    global real *v4, \n"
-"    real a1,\n"
-"    real a2,\n"
-"    real a3,\n"
-"    real a4\n"
+"    uint stage,\n"
+"    global real *s,\n"
+"    global const real *src,\n"
+"    global real *dst,\n"
+"    global real *acc,\n"
+"    global const real *omega,\n"
+"    real a,\n"
+"    real w\n"
 "    )\n"
 "{\n"
-"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0))\n"
-"        v0[i] =\n"
-"            a1 * v1[i] +\n"
-"            a2 * v2[i] +\n"
-"            a3 * v3[i] +\n"
-"            a4 * v4[i];\n"
-"}\n"
+"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+"        real xl = src[i > 0 ? i - 1 : 0];\n"
+"        real x0 = src[i];\n"
+"        real xr = src[i < n - 1 ? i + 1 : n - 1];\n"
+"        real k  = omega[i] + sin(xl - x0) + sin(x0 - xr);\n"
 "\n"
-"kernel void scale_sum5(\n"
-"    ulong n,\n"
-"    global real *v0, \n"
-"    global real *v1, \n"
-"    global real *v2, \n"
-"    global real *v3, \n"
-"    global real *v4, \n"
-"    global real *v5, \n"
-"    real a1,\n"
-"    real a2,\n"
-"    real a3,\n"
-"    real a4,\n"
-"    real a5\n"
+"        if (stage == STAGE_FIRST) {\n"
+"            acc[i] = x0 + w * k;\n"
+"            dst[i] = x0 + a * k;\n"
+"        } else if (stage == STAGE_INNER) {\n"
+"            acc[i] += w * k;\n"
+"            dst[i] = s[i] + a * k;\n"
+"        } else {\n"
+"            s[i] = acc[i] + w * k;\n"
+"        }\n"
+"    }\n"
+"}\n";
+
+// Temporal blocking: every work-group loads a tile of the chain and a halo
+// of four sites per step on both sides into local memory, makes STEPS
+// Runge-Kutta steps there (the stages of oscillator_stage) and writes the
+// tile back. The sites at the edges of the halo see stale neighbours; the
+// error moves inwards by one site per stage, so it just reaches the tile
+// after STEPS steps. STEPS and TILE are defined in front of the source (see
+// blocked_source()).
+const char oscillator_blocked_source[] =
+"#define HALO  (4 * STEPS)\n"
+"#define BLOCK (TILE + 2 * HALO)\n"
+"\n"
+"void blocked_stage(\n"
+"    ulong n, long base, uint stage,\n"
+"    local real *s,\n"
+"    local const real *src,\n"
+"    local real *dst,\n"
+"    local real *acc,\n"
+"    local const real *omega,\n"
+"    real a,\n"
+"    real w\n"
 "    )\n"
 "{\n"
-"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0))\n"
-"        v0[i] =\n"
-"            a1 * v1[i] +\n"
-"            a2 * v2[i] +\n"
-"            a3 * v3[i] +\n"
-"            a4 * v4[i] +\n"
-"            a5 * v5[i];\n"
+"    for(size_t j = get_local_id(0); j < BLOCK; j += get_local_size(0)) {\n"
+"        long g = base + (long)j;\n"
+"        if (g < 0 || g >= (long)n) continue;\n"
+"\n"
+"        real xl = src[j == 0 || g == 0 ? j : j - 1];\n"
+"        real x0 = src[j];\n"
+"        real xr = src[j == BLOCK - 1 || g == (long)n - 1 ? j : j + 1];\n"
+"        real k  = omega[j] + sin(xl - x0) + sin(x0 - xr);\n"
+"\n"
+"        if (stage == STAGE_FIRST) {\n"
+"            acc[j] = x0 + w * k;\n"
+"            dst[j] = x0 + a * k;\n"
+"        } else if (stage == STAGE_INNER) {\n"
+"            acc[j] += w * k;\n"
+"            dst[j] = s[j] + a * k;\n"
+"        } else {\n"
+"            s[j] = acc[j] + w * k;\n"
+"        }\n"
+"    }\n"
+"\n"
+"    barrier(CLK_LOCAL_MEM_FENCE);\n"
 "}\n"
 "\n"
-"kernel void oscillator_system(\n"
+"kernel void oscillator_blocked(\n"
 "    ulong n,\n"
-"    global real *dsdt,\n"
-"    global real *s,\n"
-"    global real *omega\n"
+"    global const real *s,\n"
+"    global real *s_out,\n"
+"    global const real *omega,\n"
+"    real dt\n"
 "    )\n"
 "{\n"
-"    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
-"        real xl = s[i > 0 ? i - 1 : 0];\n"
-"        real x0 = s[i];\n"
-"        real xr = s[i < n - 1 ? i + 1 : n - 1];\n"
-"        dsdt[i] = omega[i] + sin(xl - x0) + sin(x0 - xr);\n"
+"    local real x[BLOCK], acc[BLOCK], tmp0[BLOCK], tmp1[BLOCK], om[BLOCK];\n"
+"\n"
+"    for(size_t b = get_group_id(0); b * TILE < n; b += get_num_groups(0)) {\n"
+"        long base = (long)(b * TILE) - HALO;\n"
+"\n"
+"        for(size_t j = get_local_id(0); j < BLOCK; j += get_local_size(0)) {\n"
+"            long g = base + (long)j;\n"
+"            if (g >= 0 && g < (long)n) {\n"
+"                x[j]  = s[g];\n"
+"                om[j] = omega[g];\n"
+"            }\n"
+"        }\n"
+"        barrier(CLK_LOCAL_MEM_FENCE);\n"
+"\n"
+"        for(uint k = 0; k < STEPS; ++k) {\n"
+"            blocked_stage(n, base, STAGE_FIRST, x, x,    tmp0, acc, om, dt / 2, dt / 6);\n"
+"            blocked_stage(n, base, STAGE_INNER, x, tmp0, tmp1, acc, om, dt / 2, dt / 3);\n"
+"            blocked_stage(n, base, STAGE_INNER, x, tmp1, tmp0, acc, om, dt,     dt / 3);\n"
+"            blocked_stage(n, base, STAGE_LAST,  x, tmp0, tmp1, acc, om, 0,      dt / 6);\n"
+"        }\n"
+"\n"
+"        for(size_t j = HALO + get_local_id(0); j < HALO + TILE; j += get_local_size(0)) {\n"
+"            long g = base + (long)j;\n"
+"            if (g < (long)n) s_out[g] = x[j];\n"
+"        }\n"
+"        barrier(CLK_LOCAL_MEM_FENCE);\n"
 "    }\n"
 "}\n";
 
-inline size_t alignup(size_t n, size_t m = 16U) {
-    return n % m ? n - n % m + m : n;
-}
+// The chain kernels with the blocked one for the given steps and tile.
+std::string blocked_source(unsigned steps, size_t tile) {
+    std::ostringstream s;
 
-template <typename T>
-struct clbuf {
-    size_t      n;
-    cl::Buffer  data;
+    s << oscillator_source
+      << "\n#define STEPS " << steps
+      << "\n#define TILE  " << tile << "\n\n"
+      << oscillator_blocked_source;
 
-    clbuf() : n(0) {}
+    return s.str();
+}
 
-    clbuf(size_t n)
-        : n(n), data(ctx, CL_MEM_READ_WRITE, sizeof(T) * n) 
-    {}
+// Fused operations mode. Classic Runge-Kutta stepper where each stage
+// evaluates the system function and applies the following scale_sum update
+// in a single kernel. Instead of keeping all the stage derivatives around,
+// the final update is accumulated in m_acc as the stages go, so the state
+// is only touched once per stage. The system has to provide
+// stage(kind, x, src, dst, acc, a, w) which computes k = f(src) and then
+//   first: acc  = x + w * k;  dst = x + a * k;
+//   inner: acc += w * k;      dst = x + a * k;
+//   last:  x    = acc + w * k.
+enum stage_kind { stage_first = 0, stage_inner = 1, stage_last = 2 };
+
+struct fused_runge_kutta4 {
+    typedef clbuf::vector< ::value_type > state_type;
+    typedef clbuf::vector< ::value_type > deriv_type;
+    typedef ::value_type          value_type;
+    typedef ::value_type          time_type;
+    typedef unsigned short        order_type;
+    typedef odeint::stepper_tag   stepper_category;
+
+    static order_type order() { return 4; }
+
+    template< class System >
+    void do_step( System system , state_type &x , time_type t , time_type dt )
+    {
+        typename odeint::unwrap_reference< System >::type &sys = system;
 
-    clbuf(const std::vector<T> &host)
-        : n(host.size()),
-          data(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
-                  sizeof(T) * host.size(), const_cast<T*>(host.data())) 
-    {}
+        if (!odeint::same_size(m_acc, x)) {
+            odeint::resize(m_acc,    x);
+            odeint::resize(m_tmp[0], x);
+            odeint::resize(m_tmp[1], x);
+        }
 
-    void swap(clbuf &other) {
-        std::swap(n,    other.n);
-        std::swap(data, other.data);
+        // Stage inputs are ping-ponged between two buffers, so that systems
+        // that read neighbouring elements never see a partially updated src.
+        VT_USER_START("fused_runge_kutta4");
+        sys.stage(stage_first, x, x,        m_tmp[0], m_acc, dt / 2, dt / 6);
+        sys.stage(stage_inner, x, m_tmp[0], m_tmp[1], m_acc, dt / 2, dt / 3);
+        sys.stage(stage_inner, x, m_tmp[1], m_tmp[0], m_acc, dt,     dt / 3);
+        sys.stage(stage_last,  x, m_tmp[0], m_tmp[1], m_acc, 0,      dt / 6);
+        VT_USER_END("fused_runge_kutta4");
     }
+
+    state_type m_acc;
+    state_type m_tmp[2];
 };
 
-// Resizing
-namespace boost { namespace numeric { namespace odeint {
+// Temporally blocked mode. A step of dt is made of `steps` Runge-Kutta
+// steps in a single pass over the chain, so the state is read and written
+// once per block instead of four times per step. The system has to provide
+// block(x, out, dt, steps, tile) (see oscillator_blocked); other work-groups
+// read the halos of a tile from x, so the result goes to a second buffer
+// which is swapped in.
+struct blocked_runge_kutta4 {
+    typedef clbuf::vector< ::value_type > state_type;
+    typedef clbuf::vector< ::value_type > deriv_type;
+    typedef ::value_type          value_type;
+    typedef ::value_type          time_type;
+    typedef unsigned short        order_type;
+    typedef odeint::stepper_tag   stepper_category;
+
+    blocked_runge_kutta4(unsigned steps, size_t tile) : m_steps(steps), m_tile(tile) { }
+
+    static order_type order() { return 4; }
+
+    template< class System >
+    void do_step( System system , state_type &x , time_type t , time_type dt )
+    {
+        typename odeint::unwrap_reference< System >::type &sys = system;
 
-template <typename T>
-struct is_resizeable< clbuf<T> > : boost::true_type {};
+        if (!odeint::same_size(m_out, x)) odeint::resize(m_out, x);
 
-template< typename T >
-struct resize_impl< clbuf<T> , clbuf<T> >
-{
-    static void resize( clbuf<T> &x1 , const clbuf<T> &x2 )
-    {
-        clbuf<T>(x2.n).swap(x1);
+        VT_USER_START("blocked_runge_kutta4");
+        sys.block(x, m_out, dt / m_steps, m_steps, m_tile);
+        x.swap(m_out);
+        VT_USER_END("blocked_runge_kutta4");
     }
+
+    unsigned   m_steps;
+    size_t     m_tile;
+    state_type m_out;
 };
 
-template< typename T >
-struct same_size_impl< clbuf<T> , clbuf<T> >
+static const value_type dt = 0.01;
+static value_type t_max = 100.0;
+
+typedef clbuf::vector<value_type> state_type;
+
+
+struct sys_func
 {
-    static bool same_size( const clbuf<T> &x1 , const clbuf<T> &x2 )
-    {
-        return x1.n == x2.n;
-    }
-};
+    const state_type &omega;
 
-} } }
+    sys_func( const state_type &omega ) : omega(omega) { }
 
-// Operations
-struct clbuf_operations {
-    template< class Fac1 = double , class Fac2 = Fac1 >
-    struct scale_sum2
+    void operator()( const state_type &x , state_type &dxdt , value_type t )
     {
-        const Fac1 m_alpha1;
-        const Fac2 m_alpha2;
-
-        scale_sum2( Fac1 alpha1 , Fac2 alpha2 )
-            : m_alpha1( alpha1 ) , m_alpha2( alpha2 )
-        { }
-
-        template< class T1 , class T2 , class T3 >
-        void operator()(clbuf<T1> &v1 ,
-                  const clbuf<T2> &v2 ,
-                  const clbuf<T3> &v3
-                  ) const
-        {
-            static cl::Kernel krn(program, "scale_sum2");
-
-            uint pos = 0;
-            krn.setArg(pos++, v1.n);
-            krn.setArg(pos++, v1.data);
-            krn.setArg(pos++, v2.data);
-            krn.setArg(pos++, v3.data);
-            krn.setArg(pos++, m_alpha1);
-            krn.setArg(pos++, m_alpha2);
-
-            queue.enqueueNDRangeKernel(
-                    krn, cl::NullRange, alignup(v1.n, wgsize), wgsize
-                    );
-
-            bytes_touched +=
-                v1.n * sizeof(T1) +
-                v2.n * sizeof(T2) +
-                v3.n * sizeof(T3);
-        }
+        clbuf::context &ctx = *x.ctx;
+        cl::Kernel     &krn = ctx.kernel("oscillator_system");
 
-        typedef void result_type;
-    };
+        VT_USER_START("oscillator_system");
 
-    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 >
-    struct scale_sum3
-    {
-        const Fac1 m_alpha1;
-        const Fac2 m_alpha2;
-        const Fac3 m_alpha3;
-
-        scale_sum3( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 )
-            : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 )
-        { }
-
-        template< class T1 , class T2 , class T3 , class T4 >
-        void operator()(clbuf<T1> &v1 ,
-                  const clbuf<T2> &v2 ,
-                  const clbuf<T3> &v3 ,
-                  const clbuf<T4> &v4
-                  ) const
-        {
-            static cl::Kernel krn(program, "scale_sum3");
-
-            uint pos = 0;
-            krn.setArg(pos++, v1.n);
-            krn.setArg(pos++, v1.data);
-            krn.setArg(pos++, v2.data);
-            krn.setArg(pos++, v3.data);
-            krn.setArg(pos++, v4.data);
-            krn.setArg(pos++, m_alpha1);
-            krn.setArg(pos++, m_alpha2);
-            krn.setArg(pos++, m_alpha3);
-
-            queue.enqueueNDRangeKernel(
-                    krn, cl::NullRange, alignup(v1.n, wgsize), wgsize
-                    );
-
-            bytes_touched +=
-                v1.n * sizeof(T1) +
-                v2.n * sizeof(T2) +
-                v3.n * sizeof(T2) +
-                v4.n * sizeof(T3);
-        }
+        uint pos = 0;
+        krn.setArg(pos++, x.n);
+        krn.setArg(pos++, dxdt.data);
+        krn.setArg(pos++, x.data);
+        krn.setArg(pos++, omega.data);
 
-        typedef void result_type;
-    };
+        dxdt.ready = ctx.launch(dxdt.queue, krn, x.n, "oscillator_system",
+                clbuf::wait_list(dxdt.queue, x, omega));
+        VT_USER_END("oscillator_system");
 
+        ctx.bytes_touched += 5 * sizeof(value_type) * x.n;
+    }
 
-    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 , class Fac4 = Fac3 >
-    struct scale_sum4
+    void stage(stage_kind kind, state_type &x,
+            const state_type &src, state_type &dst,
+            state_type &acc, value_type a, value_type w)
     {
-        const Fac1 m_alpha1;
-        const Fac2 m_alpha2;
-        const Fac3 m_alpha3;
-        const Fac4 m_alpha4;
-
-        scale_sum4( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 , Fac4 alpha4 )
-        : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 ) , m_alpha4( alpha4 ) { }
-
-        template< class T1 , class T2 , class T3 , class T4 , class T5 >
-        void operator()(clbuf<T1> &v1 ,
-                  const clbuf<T2> &v2 ,
-                  const clbuf<T3> &v3 ,
-                  const clbuf<T4> &v4 ,
-                  const clbuf<T5> &v5
-                  ) const
-        {
-            static cl::Kernel krn(program, "scale_sum4");
-
-            uint pos = 0;
-            krn.setArg(pos++, v1.n);
-            krn.setArg(pos++, v1.data);
-            krn.setArg(pos++, v2.data);
-            krn.setArg(pos++, v3.data);
-            krn.setArg(pos++, v4.data);
-            krn.setArg(pos++, v5.data);
-            krn.setArg(pos++, m_alpha1);
-            krn.setArg(pos++, m_alpha2);
-            krn.setArg(pos++, m_alpha3);
-            krn.setArg(pos++, m_alpha4);
-
-            queue.enqueueNDRangeKernel(
-                    krn, cl::NullRange, alignup(v1.n, wgsize), wgsize
-                    );
-
-            bytes_touched +=
-                v1.n * sizeof(T1) +
-                v2.n * sizeof(T2) +
-                v3.n * sizeof(T2) +
-                v4.n * sizeof(T2) +
-                v5.n * sizeof(T3);
-        }
+        clbuf::context &ctx = *x.ctx;
+        cl::Kernel     &krn = ctx.kernel("oscillator_stage");
 
-        typedef void result_type;
-    };
+        VT_USER_START("oscillator_stage");
 
+        uint pos = 0;
+        krn.setArg(pos++, x.n);
+        krn.setArg(pos++, static_cast<cl_uint>(kind));
+        krn.setArg(pos++, x.data);
+        krn.setArg(pos++, src.data);
+        krn.setArg(pos++, dst.data);
+        krn.setArg(pos++, acc.data);
+        krn.setArg(pos++, omega.data);
+        krn.setArg(pos++, a);
+        krn.setArg(pos++, w);
+
+        cl::Event done = ctx.launch(x.queue, krn, x.n, "oscillator_stage",
+                clbuf::wait_list(x.queue, src, acc, omega));
+        if (kind == stage_last)
+            x.ready = done;
+        else
+            acc.ready = dst.ready = done;
+        VT_USER_END("oscillator_stage");
+
+        // Same neighbour reuse as in oscillator_system: src and omega are
+        // always read; first stage writes acc and dst, inner stages also
+        // read x and acc, last stage reads acc and writes x.
+        switch (kind) {
+            case stage_first:
+                ctx.bytes_touched += 6 * sizeof(value_type) * x.n;
+                break;
+            case stage_inner:
+                ctx.bytes_touched += 8 * sizeof(value_type) * x.n;
+                break;
+            case stage_last:
+                ctx.bytes_touched += 6 * sizeof(value_type) * x.n;
+                break;
+        }
+    }
 
-    template< class Fac1 = double , class Fac2 = Fac1 , class Fac3 = Fac2 , class Fac4 = Fac3 , class Fac5 = Fac4 >
-    struct scale_sum5
+    void block(const state_type &x, state_type &out, value_type dt,
+            unsigned steps, size_t tile)
     {
-        const Fac1 m_alpha1;
-        const Fac2 m_alpha2;
-        const Fac3 m_alpha3;
-        const Fac4 m_alpha4;
-        const Fac5 m_alpha5;
-
-        scale_sum5( Fac1 alpha1 , Fac2 alpha2 , Fac3 alpha3 , Fac4 alpha4 , Fac5 alpha5 )
-        : m_alpha1( alpha1 ) , m_alpha2( alpha2 ) , m_alpha3( alpha3 ) , m_alpha4( alpha4 ) , m_alpha5( alpha5 ) { }
-
-        template< class T1 , class T2 , class T3 , class T4 , class T5 , class T6 >
-        void operator()(clbuf<T1> &v1 ,
-                const clbuf<T2> &v2 ,
-                const clbuf<T3> &v3 ,
-                const clbuf<T4> &v4 ,
-                const clbuf<T5> &v5 ,
-                const clbuf<T6> &v6
-                ) const
-        {
-
-            static cl::Kernel krn(program, "scale_sum5");
-
-            uint pos = 0;
-            krn.setArg(pos++, v1.n);
-            krn.setArg(pos++, v1.data);
-            krn.setArg(pos++, v2.data);
-            krn.setArg(pos++, v3.data);
-            krn.setArg(pos++, v4.data);
-            krn.setArg(pos++, v5.data);
-            krn.setArg(pos++, v6.data);
-            krn.setArg(pos++, m_alpha1);
-            krn.setArg(pos++, m_alpha2);
-            krn.setArg(pos++, m_alpha3);
-            krn.setArg(pos++, m_alpha4);
-            krn.setArg(pos++, m_alpha5);
-
-            queue.enqueueNDRangeKernel(
-                    krn, cl::NullRange, alignup(v1.n, wgsize), wgsize
-                    );
-
-            bytes_touched +=
-                v1.n * sizeof(T1) +
-                v2.n * sizeof(T2) +
-                v3.n * sizeof(T2) +
-                v4.n * sizeof(T2) +
-                v5.n * sizeof(T2) +
-                v6.n * sizeof(T3);
-        }
+        clbuf::context &ctx = *x.ctx;
+        cl::Kernel     &krn = ctx.kernel("oscillator_blocked");
 
-        typedef void result_type;
-    };
+        VT_USER_START("oscillator_blocked");
 
-};
+        uint pos = 0;
+        krn.setArg(pos++, x.n);
+        krn.setArg(pos++, x.data);
+        krn.setArg(pos++, out.data);
+        krn.setArg(pos++, omega.data);
+        krn.setArg(pos++, dt);
 
-static const value_type dt = 0.01;
-static const value_type t_max = 100.0;
+        // One work-group per tile. The tile size is built into the kernel,
+        // so the range is not left to the tuner.
+        const size_t groups = (x.n + tile - 1) / tile;
 
-typedef clbuf<value_type> state_type;
+        out.ready = ctx.launch(out.queue, krn, cl::NDRange(groups * ctx.wgsize),
+                cl::NDRange(ctx.wgsize), "oscillator_blocked",
+                clbuf::wait_list(out.queue, x, omega));
+        VT_USER_END("oscillator_blocked");
 
+        // x and omega are read with the halos, out is written once.
+        ctx.bytes_touched += sizeof(value_type) * (
+                2 * std::min(x.n, groups * (tile + 8 * steps)) + x.n);
+    }
+};
 
-struct sys_func
+// Order parameter and phase locked clusters (see observables.hpp), reduced
+// on the device. The phases of the previous sample are kept in prev.
+struct probe
 {
-    const clbuf<value_type> &omega;
-
-    sys_func( const clbuf<value_type> &omega ) : omega(omega) { }
+    clbuf::reduction<precision::accum> sum;
+    state_type prev, save;
+    value_type tol;
+    double     last;
+    bool       first;
+
+    probe(clbuf::context &ctx, size_t n, value_type tol)
+        : sum(ctx, n, chain::quantities), prev(ctx, n), save(ctx, n),
+          tol(tol), last(0), first(true)
+    { }
+
+    static std::string source(const clbuf::context &ctx) {
+        return PRECISION_CL_PREAMBLE + clbuf::reduce_source("chain_observables",
+                chain::reduce_args, chain::quantities, chain::reduce_body,
+                ctx.wgsize);
+    }
 
-    void operator()( const clbuf<value_type> &x , clbuf<value_type> &dxdt , value_type t )
+    std::vector<double> operator()( const state_type &x , double t )
     {
-        static cl::Kernel krn(program, "oscillator_system");
+        clbuf::context &ctx = *x.ctx;
+        cl::Kernel     &krn = ctx.kernel("chain_observables");
 
-        uint pos = 0;
-        krn.setArg(pos++, x.n);
-        krn.setArg(pos++, dxdt.data);
+        const value_type window = first ? 0 : t - last;
+
+        VT_USER_START("chain_observables");
+
+        uint pos = 2;
+        krn.setArg(pos++, window);
+        krn.setArg(pos++, tol);
         krn.setArg(pos++, x.data);
-        krn.setArg(pos++, omega.data);
+        krn.setArg(pos++, prev.data);
+        krn.setArg(pos++, save.data);
 
-        queue.enqueueNDRangeKernel(
-                krn, cl::NullRange, alignup(x.n, wgsize), wgsize
-                );
+        std::vector<double> s = sum(krn, "chain_observables",
+                clbuf::wait_list(sum.queue(), x, prev));
+        VT_USER_END("chain_observables");
+
+        prev.swap(save);
+        last  = t;
+        first = false;
 
-        bytes_touched += 5 * sizeof(value_type) * x.n;
+        return chain::finish(x.n, window, s);
     }
 };
 
+// Optional outputs of a run, null when not wanted.
+struct outputs {
+    clbuf::stream     *trajectory;
+    observer::table   *table;
+    probe             *obs;
+    clbuf::checkpoint *checkpoint;
+};
+
+template <class Stepper>
+void integrate(Stepper &stepper, const state_type &Omega, state_type &X,
+        value_type t0, value_type t1, value_type dt, const outputs &out)
+{
+    if (out.trajectory || out.table || out.checkpoint)
+        odeint::integrate_const( stepper , sys_func( Omega ) , X , t0 , t1 , dt ,
+                [&out](const state_type &x, value_type t) {
+                    if (out.trajectory) {
+                        clbuf::stream_observer write(*out.trajectory);
+                        write(x, t);
+                    }
+                    if (out.table) {
+                        observer::sampler<probe> sample(*out.table, *out.obs);
+                        sample(x, t);
+                    }
+                    if (out.checkpoint) {
+                        clbuf::checkpoint_observer save(*out.checkpoint);
+                        save(x, t);
+                    }
+                } );
+    else
+        odeint::integrate_const( stepper , sys_func( Omega ) , X , t0 , t1 , dt );
+}
+
 int main(int argc, char *argv[]) {
     const size_t n = argc > 1 ? atoi(argv[1]) : 1024;
     const value_type epsilon = 6.0 / ( n * n ); // should be < 8/N^2 to see phase locking
 
+    // Modes:
+    //   fused       fused Runge-Kutta stepper;
+    //   blocked=K   temporally blocked stepper, K steps per pass over the
+    //               chain; stream, observe and checkpoint then count blocks,
+    //               and t_max must be a multiple of K * dt;
+    //   stream=K    write every K-th step to <name>.trj;
+    //   observe=K   write the observables of every K-th step to <name>.obs;
+    //   checkpoint=K
+    //               save every K-th step to <name>.ckp;
+    //   restart     resume from <name>.ckp (with repetitions, each one
+    //               resumes from the latest checkpoint);
+    //   seed=S      seed of the initial phases (the default state of
+    //               drand48);
+    //   t_max=T     end of the integration;
+    //   tune        sweep the launch configurations of the kernels in a
+    //               warm-up repetition and save them for later runs.
+    bool     fused = false, restart = false, tune = false;
+    unsigned every = 0, observe = 0, save = 0, blocked = 0;
+    unsigned long long seed = 0x1234ABCD;
+    for(int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        fused   = fused   || a == "fused";
+        restart = restart || a == "restart";
+        tune    = tune    || a == "tune";
+        if (a.compare(0,  7, "stream=")     == 0) every   = atoi(a.c_str() + 7);
+        if (a.compare(0,  8, "blocked=")    == 0) blocked = atoi(a.c_str() + 8);
+        if (a.compare(0,  8, "observe=")    == 0) observe = atoi(a.c_str() + 8);
+        if (a.compare(0, 11, "checkpoint=") == 0) save    = atoi(a.c_str() + 11);
+        if (a.compare(0,  5, "seed=")       == 0) seed    = strtoull(a.c_str() + 5, 0, 0);
+        if (a.compare(0,  6, "t_max=")      == 0) t_max   = atof(a.c_str() + 6);
+    }
+
     try {
-        vex::Context vctx( vex::Filter::Exclusive( vex::Filter::Env && vex::Filter::Count(1) ) );
+        // Checkpoints are found by name, so checkpoint and restart do not
+        // change it.
+        std::string name = "reference_phase_oscillator";
+        if (fused)   name += "_fused";
+        if (blocked) name += "_blocked";
+        if (every)   name += "_stream";
+        if (observe) name += "_observe";
+
+        benchmark::harness bench(name, n);
+        if (tune) bench.warm_up(1);
+
+        bench.start("setup");
+
+        std::unique_ptr<clbuf::snapshot> snapshot;
+        if (restart) {
+            snapshot.reset(new clbuf::snapshot(name + ".ckp"));
+            seed = snapshot->seed();
+        }
+
+        vex::Context vctx(
+                vex::Filter::Exclusive( vex::Filter::Env && vex::Filter::Count(1) ),
+                vt::queue_properties()
+                );
         if (!vctx) throw std::runtime_error("No compute devices");
 
         std::cout << vctx << std::endl;
 
-        ctx     = vctx.context(0);
-        device  = vctx.device(0);
-        queue   = vctx.queue(0);
-        program = vex::build_sources(ctx, clbuf_source);
+        clbuf::context ctx(vctx.queue(0));
 
+        srand48(seed);
 
         std::vector< value_type > omega( n );
         std::vector< value_type > x( n );
@@ -421,20 +510,111 @@ int main(int argc, char *argv[]) {
             omega[i] = double( n - i ) * epsilon; // decreasing frequencies
         }
 
-        state_type X( x );
-        state_type Omega( omega );
+        state_type Omega( ctx, omega );
+
+        bench.stop("setup");
 
-        odeint::runge_kutta4<
-            state_type , value_type , state_type , value_type ,
-                       odeint::vector_space_algebra , clbuf_operations
-                           > stepper;
+        // The largest tile whose five local arrays, halos included, fit in
+        // local memory.
+        size_t tile = 0;
+        if (blocked) {
+            const size_t block = ctx.device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>()
+                / (5 * sizeof(value_type));
+
+            if (block <= 8 * blocked)
+                throw std::runtime_error("The halo of the blocked steps does not fit in local memory");
+
+            // integrate_const would stop at the last whole block before t_max.
+            if (static_cast<size_t>(t_max / dt + 0.5) % blocked)
+                throw std::runtime_error("t_max is not a multiple of blocked * dt");
+
+            tile = std::min(n, block - 8 * blocked);
+
+            std::cout << "tile: " << tile << std::endl;
+        }
+
+        bench.start("compile");
+        ctx.build(blocked ? blocked_source(blocked, tile) : std::string(oscillator_source));
+        if (observe) ctx.build(probe::source(ctx));
+        operations::compile<value_type>(ctx);
+        bench.stop("compile");
+
+        std::vector<value_type> res( n );
+
+        while(bench.next()) {
+            ctx.autotune = tune && bench.warming();
+
+            bench.start("upload");
+            state_type X;
+            value_type t0 = 0;
+            if (snapshot) {
+                state_type( ctx, n ).swap( X );
+                t0 = snapshot->restore( ctx, 0, clbuf::parts( X ) );
+            } else {
+                state_type( ctx, x ).swap( X );
+            }
+            ctx.finish();
+            bench.stop("upload");
+
+            std::unique_ptr<clbuf::stream> trajectory( every ?
+                    new clbuf::stream(ctx, name + ".trj", sizeof(value_type), n, every) : 0 );
+
+            // Neighbouring intrinsic frequencies differ by epsilon.
+            std::unique_ptr<observer::table> table;
+            std::unique_ptr<probe>           obs;
+            if (observe) {
+                table.reset(new observer::table(name + ".obs", chain::columns, observe));
+                obs.reset(new probe(ctx, n, epsilon / 2));
+            }
+
+            // The state of a tuning repetition is not worth saving.
+            std::unique_ptr<clbuf::checkpoint> checkpoint( save && !ctx.autotune ?
+                    new clbuf::checkpoint(ctx, name + ".ckp", sizeof(value_type), n, save, seed) : 0 );
+
+            outputs out = { trajectory.get(), table.get(), obs.get(), checkpoint.get() };
+
+            ctx.bytes_touched = 0;
+
+            bench.start("integrate");
+            VT_USER_START("integrate");
+            if (blocked) {
+                blocked_runge_kutta4 stepper( blocked , tile );
+
+                // Half a block past t_max, so that rounding in t0 + k * K * dt
+                // does not drop the last block.
+                integrate( stepper , Omega , X , t0 , t_max + blocked * dt / 2 , blocked * dt , out );
+            } else if (fused) {
+                fused_runge_kutta4 stepper;
+
+                integrate( stepper , Omega , X , t0 , t_max , dt , out );
+            } else {
+                odeint::runge_kutta4<
+                    state_type , value_type , state_type , value_type ,
+                               odeint::vector_space_algebra , operations
+                                   > stepper;
+
+                integrate( stepper , Omega , X , t0 , t_max , dt , out );
+            }
+            trajectory.reset();
+            checkpoint.reset();
+            ctx.finish();
+            VT_USER_END("integrate");
+            bench.stop("integrate");
+
+            bench.start("readback");
+            X.read(res);
+            bench.stop("readback");
+
+            bench.bytes(ctx.bytes_touched);
+        }
 
-        odeint::integrate_const( stepper , sys_func( Omega ) , X , value_type( 0.0 ) , t_max , dt );
+        std::cout << res[0] << std::endl;
+        std::cout << "bytes io: " << ctx.bytes_touched << std::endl;
+        std::cout << "device memory: " << ctx.buffers.stats() << std::endl;
 
+        bench.check(res);
 
-        queue.enqueueReadBuffer(X.data, CL_TRUE, 0, sizeof(value_type), x.data());
-        std::cout << x[0] << std::endl;
-        std::cout << "bytes io: " << bytes_touched << std::endl;
+        bench.report();
     } catch (const cl::Error &e) {
         std::cerr << "OpenCL error: " << e << std::endl;
         return 1;
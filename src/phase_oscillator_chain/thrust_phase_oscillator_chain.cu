@@ -32,13 +32,16 @@
 #include <boost/numeric/odeint/external/thrust/thrust_operations.hpp>
 #include <boost/numeric/odeint/external/thrust/thrust_resize.hpp>
 
+#include "precision.hpp"
+#include "benchmark.hpp"
+
 using namespace std;
 
 using namespace boost::numeric::odeint;
 
 
-//change this to float if your device does not support double computation
-typedef double value_type;
+//set with cmake -DPRECISION=float if your device does not support double computation
+typedef precision::real value_type;
 
 
 typedef thrust::device_vector< value_type > state_type;
@@ -121,6 +124,10 @@ int main( int argc , char* argv[] )
     n = ( argc > 1 ) ? atoi(argv[1]) : 1024;
     const value_type epsilon = 6.0 / ( n * n ); // should be < 8/N^2 to see phase locking
 
+    benchmark::harness bench( "thrust_phase_oscillator_chain" , n );
+
+    bench.start( "setup" );
+
     vector< value_type > x_host( n );
     vector< value_type > omega_host( n );
     for( size_t i=0 ; i<n ; ++i )
@@ -129,16 +136,36 @@ int main( int argc , char* argv[] )
         omega_host[i] = double( n - i ) * epsilon; // decreasing frequencies
     }
 
-    state_type x = x_host;
     state_type omega = omega_host;
 
-    runge_kutta4< state_type , value_type , state_type , value_type , thrust_algebra , thrust_operations > stepper;
-
     phase_oscillators sys( omega );
 
-    integrate_const( stepper , sys , x , 0.0 , t_max , dt );
+    bench.stop( "setup" );
 
     std::vector< value_type > res( n );
-    thrust::copy( x.begin() , x.end() , res.begin() );
+
+    while( bench.next() )
+    {
+        bench.start( "upload" );
+        state_type x = x_host;
+        cudaThreadSynchronize();
+        bench.stop( "upload" );
+
+        bench.start( "integrate" );
+        runge_kutta4< state_type , value_type , state_type , value_type , thrust_algebra , thrust_operations > stepper;
+
+        integrate_const( stepper , sys , x , 0.0 , t_max , dt );
+        cudaThreadSynchronize();
+        bench.stop( "integrate" );
+
+        bench.start( "readback" );
+        thrust::copy( x.begin() , x.end() , res.begin() );
+        bench.stop( "readback" );
+    }
+
     cout << res[0] << endl;
+
+    bench.check(res);
+
+    bench.report();
 }
@@ -3,17 +3,24 @@
 #include <utility>
 #include <tuple>
 #include <cmath>
+#include <string>
+#include <memory>
 
 #include <vexcl/vexcl.hpp>
 
 #include <boost/array.hpp>
 #include <boost/numeric/odeint.hpp>
-#include <boost/numeric/odeint/external/vexcl/vexcl_resize.hpp>
+
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "clbuf/vexcl.hpp"
+#include "observer.hpp"
+#include "observables.hpp"
 
 
 namespace odeint = boost::numeric::odeint;
 
-typedef double value_type;
+typedef precision::real value_type;
 
 typedef vex::vector< value_type > state_type;
 
@@ -28,13 +35,58 @@ struct sys_func
 
     void operator()( const state_type &x , state_type &dxdt , value_type t ) const
     {
-        static VEX_STENCIL_OPERATOR(S, double, 3, 1,
+        static VEX_STENCIL_OPERATOR(S, value_type, 3, 1,
                 "return sin(X[1] - X[0]) + sin(X[0] - X[-1]);",
                 omega.queue_list());
         dxdt = omega + S( x );
     }
 };
 
+// Order parameter and phase locked clusters (see observables.hpp), reduced
+// on the device. The phases of the previous sample are kept in prev.
+struct probe
+{
+    vex::Reductor< precision::accum , vex::SUM > sum;
+    vex::Reductor< size_t , vex::SUM >           count;
+
+    state_type prev, w, dw;
+    value_type tol;
+    double     last;
+    bool       first;
+
+    probe( const std::vector< cl::CommandQueue > &queue , size_t n , value_type tol )
+        : sum( queue ) , count( queue ) ,
+          prev( queue , n ) , w( queue , n ) , dw( queue , n ) ,
+          tol( tol ) , last( 0 ) , first( true )
+    { }
+
+    std::vector<double> operator()( const state_type &x , double t )
+    {
+        // Differences to the right neighbour, zero at the end of the chain.
+        static VEX_STENCIL_OPERATOR(D, value_type, 2, 0,
+                "return X[1] - X[0];",
+                x.queue_list());
+
+        const double window = first ? 0 : t - last;
+
+        std::vector<double> s( chain::quantities , 0.0 );
+        s[0] = sum( cos( x ) );
+        s[1] = sum( sin( x ) );
+
+        if( window > 0 ) {
+            w  = x - prev;
+            dw = D( w );
+            s[2] = count( fabs( dw ) > static_cast<value_type>( tol * window ) );
+        }
+
+        prev  = x;
+        last  = t;
+        first = false;
+
+        return chain::finish( x.size() , window , s );
+    }
+};
+
 size_t n;
 const value_type dt = 0.01;
 const value_type t_max = 100.0;
@@ -45,6 +97,18 @@ int main( int argc , char **argv )
     const value_type epsilon = 6.0 / ( n * n ); // should be < 8/N^2 to see phase locking
     using namespace std;
 
+    // "observe=K" writes the observables of every K-th step to <name>.obs.
+    unsigned observe = 0;
+    for( int i = 2 ; i < argc ; ++i )
+        if( std::string( argv[i] ).compare( 0 , 8 , "observe=" ) == 0 )
+            observe = atoi( argv[i] + 8 );
+
+    const std::string name = observe ? "vexcl_phase_oscillator_observe" : "vexcl_phase_oscillator";
+
+    benchmark::harness bench(name, n);
+
+    bench.start("setup");
+
     vex::Context ctx( vex::Filter::Exclusive( vex::Filter::Env ) );
     std::cout << ctx << std::endl;
 
@@ -58,20 +122,55 @@ int main( int argc , char **argv )
         omega[i] = double( n - i ) * epsilon; // decreasing frequencies
     }
 
-    state_type X( ctx.queue() , x );
+    state_type X( ctx.queue() , n );
     state_type Omega( ctx.queue() , omega );
 
-    odeint::runge_kutta4<
-	    state_type , value_type , state_type , value_type ,
-	    odeint::vector_space_algebra , odeint::default_operations
-	    > stepper;
-
-    odeint::integrate_const( stepper , sys_func( Omega ) , X , value_type( 0.0 ) , t_max , dt );
+    bench.stop("setup");
 
     std::vector< value_type > res( n );
-    vex::copy( X , res );
+
+    // Kernels are compiled on first use, so the first (warm-up) repetition
+    // includes the compilation time.
+    while(bench.next()) {
+	bench.start("upload");
+	vex::copy( x , X );
+	bench.stop("upload");
+
+	// Neighbouring intrinsic frequencies differ by epsilon.
+	std::unique_ptr< observer::table > table;
+	std::unique_ptr< probe >           obs;
+	if( observe ) {
+	    table.reset( new observer::table( name + ".obs" , chain::columns , observe ) );
+	    obs.reset( new probe( ctx.queue() , n , epsilon / 2 ) );
+	}
+
+	bench.start("integrate");
+	clbuf::vexcl::scope temporaries;
+	odeint::runge_kutta4<
+		state_type , value_type , state_type , value_type ,
+		odeint::vector_space_algebra , odeint::default_operations
+		> stepper;
+
+	if( table )
+	    odeint::integrate_const( stepper , sys_func( Omega ) , X , value_type( 0.0 ) , t_max , dt ,
+		    observer::sample( *table , *obs ) );
+	else
+	    odeint::integrate_const( stepper , sys_func( Omega ) , X , value_type( 0.0 ) , t_max , dt );
+	ctx.finish();
+	bench.stop("integrate");
+
+	bench.start("readback");
+	vex::copy( X , res );
+	bench.stop("readback");
+    }
+
     cout << res[0] << endl;
+    cout << "device memory: " << clbuf::vexcl::usage() << endl;
 //    for( size_t i=0 ; i<n ; ++i ) cout << res[i] << endl;
 
+    bench.check(res);
+
+    bench.report();
+
     return 0;
 }
@@ -7,6 +7,9 @@
 #include <vexcl/vexcl.hpp>
 #include <viennacl/vector.hpp>
 
+#include "precision.hpp"
+#include "benchmark.hpp"
+
 #include <boost/array.hpp>
 #include <boost/numeric/odeint.hpp>
 #include <boost/numeric/odeint/external/vexcl/vexcl_resize.hpp>
@@ -17,7 +20,7 @@
 
 namespace odeint = boost::numeric::odeint;
 
-typedef double value_type;
+typedef precision::real value_type;
 
 typedef viennacl::vector< value_type > state_type;
 
@@ -47,6 +50,10 @@ int main( int argc , char **argv )
     const value_type epsilon = 6.0 / ( n * n ); // should be < 8/N^2 to see phase locking
     using namespace std;
 
+    benchmark::harness bench("viennacl_phase_oscillator", n);
+
+    bench.start("setup");
+
     vex::Context ctx( vex::Filter::Exclusive( vex::Filter::Env && vex::Filter::Count(1)) );
     std::vector<cl_device_id> dev_id(1, ctx.queue(0).getInfo<CL_QUEUE_DEVICE>()());
     std::vector<cl_command_queue> queue_id(1, ctx.queue(0)());
@@ -66,21 +73,43 @@ int main( int argc , char **argv )
     state_type X( n );
     state_type Omega( n );
 
-    viennacl::copy(x, X);
     viennacl::copy(omega, Omega);
 
-    odeint::runge_kutta4<
-	    state_type , value_type , state_type , value_type ,
-	    odeint::vector_space_algebra , odeint::viennacl_operations
-	    > stepper;
-
     sys_func sys(Omega);
-    odeint::integrate_const( stepper , std::ref( sys ) , X , value_type( 0.0 ) , t_max , dt );
+
+    bench.stop("setup");
 
     std::vector< value_type > res( n );
-    viennacl::copy( X , res );
+
+    // Kernels are compiled on first use, so the first (warm-up) repetition
+    // includes the compilation time.
+    while(bench.next()) {
+	bench.start("upload");
+	viennacl::copy(x, X);
+	ctx.finish();
+	bench.stop("upload");
+
+	bench.start("integrate");
+	odeint::runge_kutta4<
+		state_type , value_type , state_type , value_type ,
+		odeint::vector_space_algebra , odeint::viennacl_operations
+		> stepper;
+
+	odeint::integrate_const( stepper , std::ref( sys ) , X , value_type( 0.0 ) , t_max , dt );
+	ctx.finish();
+	bench.stop("integrate");
+
+	bench.start("readback");
+	viennacl::copy( X , res );
+	bench.stop("readback");
+    }
+
     cout << res[0] << endl;
 //    for( size_t i=0 ; i<n ; ++i ) cout << res[i] << endl;
 
+    bench.check(res);
+
+    bench.report();
+
     exit(0);
 }
@@ -0,0 +1,71 @@
+#ifndef PRECISION_HPP
+#define PRECISION_HPP
+
+// Floating point type the benchmarks are built with, chosen at configure
+// time (cmake -DPRECISION=double|float|mixed), which defines one of
+// PRECISION_DOUBLE (the default), PRECISION_FLOAT or PRECISION_MIXED.
+//
+// mixed keeps the state in single precision, but evaluates the linear
+// combinations of the stepper (scale_sumN) in double precision. Only the
+// backends that implement their own operations (the clbuf reference
+// programs and the native backend) distinguish it from float.
+//
+// OpenCL sources start with PRECISION_CL_PREAMBLE, which defines real,
+// real3 and accum to match the host types.
+
+#define PRECISION_CL_FP64 \
+    "#if defined(cl_khr_fp64)\n" \
+    "#  pragma OPENCL EXTENSION cl_khr_fp64: enable\n" \
+    "#elif defined(cl_amd_fp64)\n" \
+    "#  pragma OPENCL EXTENSION cl_amd_fp64: enable\n" \
+    "#endif\n"
+
+namespace precision {
+
+#if defined(PRECISION_FLOAT)
+
+typedef float  real;
+typedef float  accum;
+
+#define PRECISION_NAME "float"
+#define PRECISION_CL_PREAMBLE \
+    "typedef float  real;\n" \
+    "typedef float3 real3;\n" \
+    "typedef float  accum;\n" \
+    "\n"
+
+#elif defined(PRECISION_MIXED)
+
+typedef float  real;
+typedef double accum;
+
+#define PRECISION_NAME "mixed"
+#define PRECISION_CL_PREAMBLE PRECISION_CL_FP64 \
+    "\n" \
+    "typedef float  real;\n" \
+    "typedef float3 real3;\n" \
+    "typedef double accum;\n" \
+    "\n"
+
+#else
+
+typedef double real;
+typedef double accum;
+
+#define PRECISION_NAME "double"
+#define PRECISION_CL_PREAMBLE PRECISION_CL_FP64 \
+    "\n" \
+    "typedef double  real;\n" \
+    "typedef double3 real3;\n" \
+    "typedef double  accum;\n" \
+    "\n"
+
+#endif
+
+inline const char* name() {
+    return PRECISION_NAME;
+}
+
+} // namespace precision
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef PROGRAM_CACHE_HPP
+#define PROGRAM_CACHE_HPP
+
+// On-disk cache of OpenCL program binaries.
+//
+// program_cache::build(context, source, options) is a drop-in replacement
+// for vex::build_sources(). Binaries are stored per device under a key made
+// of the source, the device name, the driver version and the build
+// options, so a driver update or a changed kernel simply misses. Binaries
+// that fail to load or build are recompiled from source and overwritten.
+//
+// The cache lives in $CL_PROGRAM_CACHE, or in $HOME/.cache/clprograms when
+// that is not set. CL_PROGRAM_CACHE=off disables it. Files are written to
+// a temporary name and renamed, so concurrent jobs may share the cache.
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdio>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vexcl/util.hpp>
+
+namespace program_cache {
+
+// The directory named by the environment variable var, or
+// $HOME/.cache/<fallback> when var is not set. Empty when var is "off" or
+// there is no home directory. Also used by the launch tuner of clbuf.
+inline std::string cache_directory(const char *var, const char *fallback) {
+    const char *v = getenv(var);
+    if (v) return std::string(v) == "off" ? std::string() : std::string(v);
+
+    const char *home = getenv("HOME");
+    return home ? std::string(home) + "/.cache/" + fallback : std::string();
+}
+
+// Creates file in dir (and dir with its parents, like mkdir -p) with the
+// contents write(f) puts in the std::ofstream f. The file is written to a
+// temporary name and renamed, so concurrent jobs may share the directory;
+// nothing is renamed when a write fails.
+template <class Writer>
+void save_file(const std::string &dir, const std::string &file, Writer write,
+        std::ios::openmode mode = std::ios::out)
+{
+    for(size_t p = dir.find('/', 1); ; p = dir.find('/', p + 1)) {
+        mkdir(dir.substr(0, p).c_str(), 0755);
+        if (p == std::string::npos) break;
+    }
+
+    std::ostringstream tmp;
+    tmp << file << "." << getpid();
+
+    {
+        std::ofstream f(tmp.str().c_str(), mode);
+        if (!f) return;
+
+        write(f);
+
+        if (!f) {
+            f.close();
+            std::remove(tmp.str().c_str());
+            return;
+        }
+    }
+
+    std::rename(tmp.str().c_str(), file.c_str());
+}
+
+inline const std::string& directory() {
+    static const std::string dir = cache_directory("CL_PROGRAM_CACHE", "clprograms");
+    return dir;
+}
+
+// 64 bit FNV-1a.
+inline unsigned long long hash(const std::string &s, unsigned long long h = 14695981039346656037ULL) {
+    for(std::string::const_iterator c = s.begin(); c != s.end(); ++c) {
+        h ^= static_cast<unsigned char>(*c);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Identifies the binary of source for device; stored in the file and
+// compared on load.
+inline std::string key(const cl::Device &device,
+        const std::string &source, const std::string &options)
+{
+    std::ostringstream k;
+    k << device.getInfo<CL_DEVICE_NAME>()    << '\n'
+      << device.getInfo<CL_DRIVER_VERSION>() << '\n'
+      << options                             << '\n'
+      << std::hex << hash(source) << ':' << std::dec << source.size();
+    return k.str();
+}
+
+inline std::string path(const std::string &key) {
+    std::ostringstream p;
+    p << directory() << "/" << std::hex << std::setw(16) << std::setfill('0')
+      << hash(key) << ".bin";
+    return p.str();
+}
+
+inline bool load(const std::string &key, std::vector<char> &binary) {
+    std::ifstream f(path(key).c_str(), std::ios::binary);
+    if (!f) return false;
+
+    unsigned long long klen, blen;
+    if (!f.read(reinterpret_cast<char*>(&klen), sizeof(klen))) return false;
+
+    std::string stored(klen, '\0');
+    if (!f.read(&stored[0], klen) || stored != key) return false;
+
+    if (!f.read(reinterpret_cast<char*>(&blen), sizeof(blen))) return false;
+
+    binary.resize(blen);
+    return blen && f.read(&binary[0], blen);
+}
+
+inline void save(const std::string &key, const std::vector<char> &binary) {
+    save_file(directory(), path(key), [&](std::ofstream &f) {
+            unsigned long long klen = key.size(), blen = binary.size();
+            f.write(reinterpret_cast<const char*>(&klen), sizeof(klen));
+            f.write(key.data(), klen);
+            f.write(reinterpret_cast<const char*>(&blen), sizeof(blen));
+            f.write(binary.data(), blen);
+            }, std::ios::binary);
+}
+
+inline cl::Program build(const cl::Context &context,
+        const std::string &source, const std::string &options = "")
+{
+    if (directory().empty())
+        return vex::build_sources(context, source, options);
+
+    std::vector<cl::Device> device = context.getInfo<CL_CONTEXT_DEVICES>();
+
+    std::vector<std::string>       keys(device.size());
+    std::vector< std::vector<char> > bin(device.size());
+
+    bool hit = true;
+    for(size_t d = 0; d < device.size(); ++d) {
+        keys[d] = key(device[d], source, options);
+        hit = load(keys[d], bin[d]) && hit;
+    }
+
+    if (hit) {
+        cl::Program::Binaries b;
+        for(size_t d = 0; d < device.size(); ++d)
+            b.push_back(std::make_pair(
+                        static_cast<const void*>(bin[d].data()), bin[d].size()));
+
+        try {
+            cl::Program program(context, device, b);
+            program.build(device, options.c_str());
+            return program;
+        } catch(const cl::Error&) {
+            // Stale or foreign binary: rebuild from source below.
+        }
+    }
+
+    cl::Program program = vex::build_sources(context, source, options);
+
+    // Binaries come in the order of CL_PROGRAM_DEVICES.
+    std::vector<cl::Device> pdev  = program.getInfo<CL_PROGRAM_DEVICES>();
+    std::vector<size_t>     sizes = program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+
+    std::vector< std::vector<char> > out(pdev.size());
+    std::vector<char*>               ptr(pdev.size());
+    for(size_t d = 0; d < pdev.size(); ++d) {
+        out[d].resize(sizes[d]);
+        ptr[d] = out[d].data();
+    }
+
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES,
+                ptr.size() * sizeof(char*), ptr.data(), 0) != CL_SUCCESS)
+        return program;
+
+    for(size_t d = 0; d < pdev.size(); ++d)
+        if (sizes[d]) save(key(pdev[d], source, options), out[d]);
+
+    return program;
+}
+
+} // namespace program_cache
+
+#endif
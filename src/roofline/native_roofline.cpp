@@ -0,0 +1,112 @@
+#include <iostream>
+#include <vector>
+#include <string>
+
+#include <native/vector.hpp>
+#include <native/operations.hpp>
+
+#include "precision.hpp"
+#include "benchmark.hpp"
+
+typedef precision::real value_type;
+typedef native::vector<value_type> state_type;
+
+// Every kernel is a benchmark of its own, named native_roofline_<kernel>,
+// so that it reports in the format of the programs it is compared with
+// (see roofline.sh). One repetition calls kernel `launches` times.
+template <class Kernel>
+void measure(const std::string &name, size_t n, unsigned launches,
+        size_t bytes, double flops, Kernel &&kernel)
+{
+    benchmark::harness bench(name, n);
+
+    while(bench.next()) {
+        bench.start("integrate");
+        for(unsigned k = 0; k < launches; ++k) kernel();
+        bench.stop("integrate");
+
+        bench.bytes(launches * bytes);
+        bench.flops(launches * flops);
+    }
+
+    bench.report();
+}
+
+// STREAM a = f(b, c, s) through the SIMD loop of the native operations.
+template <class F>
+void stream(state_type &a, const state_type &b, const state_type &c, F f) {
+    value_type       *A = a.data();
+    const value_type *B = b.data();
+    const value_type *C = c.data();
+
+    native::simd_loop<value_type>(0, a.size(), [=](auto v, size_t i) {
+            typedef decltype(v) V;
+
+            native::store(f(native::load<V>(B + i), native::load<V>(C + i)), A + i);
+            });
+}
+
+// Eight independent chains x = s * x + (1 - s) per thread, which converge
+// to 1; gcc contracts them into fused multiply-adds. Returns the sum of the
+// chains, so that they are not optimized away.
+value_type peak(size_t iterations, value_type s) {
+    typedef native::simd<value_type>::type V;
+
+    value_type sum = 0;
+
+#pragma omp parallel reduction(+:sum)
+    {
+        const V S(s), T(1 - s);
+
+        V x0(value_type(0.000)), x1(value_type(0.125)), x2(value_type(0.250)), x3(value_type(0.375));
+        V x4(value_type(0.500)), x5(value_type(0.625)), x6(value_type(0.750)), x7(value_type(0.875));
+
+        for(size_t k = 0; k < iterations; ++k) {
+            x0 = x0 * S + T; x1 = x1 * S + T; x2 = x2 * S + T; x3 = x3 * S + T;
+            x4 = x4 * S + T; x5 = x5 * S + T; x6 = x6 * S + T; x7 = x7 * S + T;
+        }
+
+        sum += native::stdx::reduce(x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7);
+    }
+
+    return sum;
+}
+
+int main(int argc, char *argv[]) {
+    const size_t n = argc > 1 ? atoi(argv[1]) : 1 << 24;
+
+    const unsigned   launches   = 10;
+    const size_t     iterations = 1 << 22;
+    const value_type s          = 0.5;
+
+    native::flush_denormals();
+    native::info<value_type>(std::cout) << std::endl;
+
+    state_type a(n, 0), b(n, 1), c(n, 2);
+
+    const size_t bytes = n * sizeof(value_type);
+
+    measure("native_roofline_copy", n, launches, 2 * bytes, 0, [&] {
+            stream(a, b, c, [](auto x, auto) { return x; });
+            });
+
+    measure("native_roofline_scale", n, launches, 2 * bytes, 0, [&] {
+            stream(a, b, c, [s](auto x, auto) { return decltype(x)(s) * x; });
+            });
+
+    measure("native_roofline_add", n, launches, 3 * bytes, 0, [&] {
+            stream(a, b, c, [](auto x, auto y) { return x + y; });
+            });
+
+    measure("native_roofline_triad", n, launches, 3 * bytes, 0, [&] {
+            stream(a, b, c, [s](auto x, auto y) { return x + decltype(x)(s) * y; });
+            });
+
+    value_type sum = 0;
+
+    measure("native_roofline_peak", n, launches, 0,
+            2.0 * 8 * native::simd<value_type>::width() * iterations * native::num_threads(),
+            [&] { sum += peak(iterations, s); });
+
+    std::cout << a[0] << " " << sum << std::endl;
+}
@@ -0,0 +1,191 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+
+#include <vexcl/devlist.hpp>
+
+#include "precision.hpp"
+#include "benchmark.hpp"
+#include "vt_user.h"
+#include "clbuf/clbuf.hpp"
+
+typedef precision::real value_type;
+
+// STREAM copy, scale, add and triad, a = f(b, c, s), on vectors of WIDTH
+// elements (see context::vector_width()), and a chain of fused multiply-adds
+// for the peak floating point rate. vreal and WIDTH are defined in front of
+// the source.
+const char roofline_source[] =
+"#define STREAM_KERNEL(name, f)                                              \\\n"
+"kernel void name(                                                           \\\n"
+"    ulong n,                                                                \\\n"
+"    global real *a,                                                         \\\n"
+"    global const real *b,                                                   \\\n"
+"    global const real *c,                                                   \\\n"
+"    real s                                                                  \\\n"
+"    )                                                                       \\\n"
+"{                                                                           \\\n"
+"    const size_t m = n / WIDTH;                                             \\\n"
+"                                                                            \\\n"
+"    for(size_t i = get_global_id(0); i < m; i += get_global_size(0)) {      \\\n"
+"        vreal x = ((global const vreal*)b)[i];                              \\\n"
+"        vreal y = ((global const vreal*)c)[i];                              \\\n"
+"        ((global vreal*)a)[i] = f;                                          \\\n"
+"    }                                                                       \\\n"
+"                                                                            \\\n"
+"    for(size_t i = m * WIDTH + get_global_id(0); i < n; i += get_global_size(0)) { \\\n"
+"        real x = b[i];                                                      \\\n"
+"        real y = c[i];                                                      \\\n"
+"        a[i] = f;                                                           \\\n"
+"    }                                                                       \\\n"
+"}\n"
+"\n"
+"STREAM_KERNEL(stream_copy,  x)\n"
+"STREAM_KERNEL(stream_scale, s * x)\n"
+"STREAM_KERNEL(stream_add,   x + y)\n"
+"STREAM_KERNEL(stream_triad, x + s * y)\n"
+"\n"
+"// Eight independent chains x = s * x + (1 - s), which converge to 1.\n"
+"kernel void peak_flops(\n"
+"    ulong iterations,\n"
+"    global real *a,\n"
+"    real s\n"
+"    )\n"
+"{\n"
+"    const vreal S = s, T = 1 - s;\n"
+"\n"
+"    vreal x0 = (real)get_global_id(0) / get_global_size(0);\n"
+"    vreal x1 = x0 + (vreal)(0.125f), x2 = x0 + (vreal)(0.25f), x3 = x0 + (vreal)(0.375f);\n"
+"    vreal x4 = x0 + (vreal)(0.5f),   x5 = x0 + (vreal)(0.625f), x6 = x0 + (vreal)(0.75f);\n"
+"    vreal x7 = x0 + (vreal)(0.875f);\n"
+"\n"
+"    for(ulong k = 0; k < iterations; ++k) {\n"
+"        x0 = fma(x0, S, T); x1 = fma(x1, S, T); x2 = fma(x2, S, T); x3 = fma(x3, S, T);\n"
+"        x4 = fma(x4, S, T); x5 = fma(x5, S, T); x6 = fma(x6, S, T); x7 = fma(x7, S, T);\n"
+"    }\n"
+"\n"
+"    ((global vreal*)a)[get_global_id(0)] = x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7;\n"
+"}\n";
+
+std::string source(unsigned width) {
+    std::ostringstream s;
+
+    s << PRECISION_CL_PREAMBLE
+      << "#define WIDTH " << width << "\n"
+      << "typedef " << clbuf::type_name<value_type>::cl();
+    if (width > 1) s << width;
+    s << " vreal;\n\n" << roofline_source;
+
+    return s.str();
+}
+
+// Every kernel is a benchmark of its own, named <prefix>_<kernel>, so that
+// it reports in the format of the programs it is compared with (see
+// roofline.sh). One repetition makes `launches` launches over items
+// elements in the tuned configuration, or of items work-items in groups of
+// local when local is set.
+void measure(clbuf::context &ctx, bool tune, const std::string &name,
+        size_t n, cl::Kernel &krn, size_t items, size_t local,
+        unsigned launches, size_t bytes, double flops)
+{
+    benchmark::harness bench(name, n);
+    if (tune) bench.warm_up(1);
+
+    while(bench.next()) {
+        ctx.autotune = tune && bench.warming();
+
+        bench.start("integrate");
+        VT_USER_START("integrate");
+        for(unsigned k = 0; k < launches; ++k) {
+            if (local)
+                ctx.launch(0, krn, items, local, name.c_str());
+            else
+                ctx.launch(0, krn, items, name.c_str());
+        }
+        ctx.finish();
+        VT_USER_END("integrate");
+        bench.stop("integrate");
+
+        bench.bytes(launches * bytes);
+        bench.flops(launches * flops);
+    }
+
+    bench.report();
+}
+
+int main(int argc, char *argv[]) {
+    const size_t n = argc > 1 ? atoi(argv[1]) : 1 << 24;
+
+    // Modes: "tune" (sweep the launch configurations of the kernels in a
+    // warm-up repetition and save them for later runs).
+    bool tune = false;
+    for(int i = 2; i < argc; ++i)
+        tune = tune || std::string(argv[i]) == "tune";
+
+    const unsigned   launches   = 10;
+    const cl_ulong   iterations = 256;
+    const value_type s          = 0.5;
+
+    try {
+        vex::Context vctx(
+                vex::Filter::Exclusive( vex::Filter::Env && vex::Filter::Count(1) ),
+                vt::queue_properties()
+                );
+        if (!vctx) throw std::runtime_error("No compute devices");
+
+        std::cout << vctx << std::endl;
+
+        clbuf::context ctx(vctx.queue(0));
+
+        const unsigned w     = ctx.vector_width(sizeof(value_type));
+        const size_t   items = (n + w - 1) / w;
+
+        // Enough work-items to fill every compute unit many times over.
+        const size_t peak_items =
+            64 * ctx.device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * ctx.wgsize;
+
+        std::cout << "vector width: " << w << std::endl;
+
+        ctx.build(source(w));
+
+        clbuf::vector<value_type> a(ctx, std::vector<value_type>(n, 0));
+        clbuf::vector<value_type> b(ctx, std::vector<value_type>(n, 1));
+        clbuf::vector<value_type> c(ctx, std::vector<value_type>(n, 2));
+        clbuf::vector<value_type> x(ctx, peak_items * w);
+
+        const char *stream[] = { "copy", "scale", "add", "triad" };
+        const size_t arrays[] = { 2, 2, 3, 3 };
+
+        for(int k = 0; k < 4; ++k) {
+            cl::Kernel &krn = ctx.kernel(std::string("stream_") + stream[k]);
+
+            krn.setArg(0, static_cast<cl_ulong>(n));
+            krn.setArg(1, a.data);
+            krn.setArg(2, b.data);
+            krn.setArg(3, c.data);
+            krn.setArg(4, s);
+
+            measure(ctx, tune, std::string("reference_roofline_") + stream[k],
+                    n, krn, items, 0, launches,
+                    arrays[k] * n * sizeof(value_type), 0);
+        }
+
+        cl::Kernel &krn = ctx.kernel("peak_flops");
+
+        krn.setArg(0, iterations);
+        krn.setArg(1, x.data);
+        krn.setArg(2, s);
+
+        // Every work-item does a fixed amount of work, so the range is not
+        // left to the tuner.
+        measure(ctx, tune, "reference_roofline_peak", n, krn, peak_items, ctx.wgsize,
+                launches, 0, 2.0 * 8 * w * iterations * peak_items);
+    } catch (const cl::Error &e) {
+        std::cerr << "OpenCL error: " << e << std::endl;
+        return 1;
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,103 @@
+#!/bin/bash
+#
+# Joins the roofline baselines with the results of the programs and reports
+# how close every program gets to the bandwidth of the device.
+#
+# Run the roofline targets and the programs on the same machine, writing
+# csv to one file (see benchmark.hpp):
+#
+#   export BENCH_FORMAT=csv BENCH_OUTPUT=results.csv
+#   ./reference_roofline; ./native_roofline
+#   ./reference_lorenz 1048576; ./native_lorenz 1048576; ...
+#
+#   ./roofline.sh results.csv
+#
+# Every program is compared with the best triad bandwidth measured in the
+# same precision on its path: native_* programs with native_roofline, all
+# the others (OpenCL, or CUDA on the same GPU) with reference_roofline. The
+# peak floating point rate of the path is listed for reference; none of the
+# problems comes close to it.
+#
+# The library programs (vexcl_*, viennacl_*, thrust_*, cmtl_*, ...) do not
+# count their traffic. Their bandwidth is the one they would need to move
+# the bytes of the reference program of the same problem, n and precision
+# in their own integrate time (marked with *). The reference is found by
+# swapping the library prefix for reference_ and dropping trailing _parts
+# of the name until a reference row matches, so run reference_<problem>
+# for every n the libraries run at; rows without bytes are left blank.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 results.csv" >&2
+    exit 1
+fi
+
+awk -F, '
+$3 != "integrate" { next }
+
+function path(name) {
+    return name ~ /^native_/ ? "native" : "reference"
+}
+
+$1 ~ /_roofline_triad$/ {
+    key = path($1) SUBSEP $11
+    if ($10 > triad[key]) triad[key] = $10
+    next
+}
+
+$1 ~ /_roofline_peak$/ {
+    key = path($1) SUBSEP $11
+    if ($15 > peak[key]) peak[key] = $15
+    next
+}
+
+$1 ~ /_roofline_/ { next }
+
+{
+    rows[++count] = $0
+    if ($9 > 0) bytes[$1 SUBSEP $2 SUBSEP $11] = $9
+}
+
+# Bytes per repetition of the reference program of the problem of f[1].
+function reference_bytes(f,    name, key) {
+    name = "reference_" substr(f[1], index(f[1], "_") + 1)
+
+    while (1) {
+        key = name SUBSEP f[2] SUBSEP f[11]
+        if (key in bytes) return bytes[key]
+        if (!match(name, /_[^_]*$/) || RSTART <= length("reference")) return 0
+        name = substr(name, 1, RSTART - 1)
+    }
+}
+
+END {
+    printf "%-40s %10s %-9s %10s %10s %8s %12s\n",
+        "program", "n", "precision", "GB/s", "triad GB/s", "% roof", "peak GFLOP/s"
+
+    for(i = 1; i <= count; ++i) {
+        split(rows[i], f, ",")
+
+        key  = path(f[1]) SUBSEP f[11]
+        gbps = f[10]
+        mark = " "
+
+        if (f[9] == 0 && f[5] > 0 && (b = reference_bytes(f)) > 0) {
+            gbps = 1e-9 * b / f[5]
+            mark = "*"
+            ++borrowed
+        }
+
+        if (gbps == 0)
+            printf "%-40s %10d %-9s %10s %10s %8s %12s\n",
+                f[1], f[2], f[11], "-", "-", "-", "-"
+        else if (key in triad && triad[key] > 0)
+            printf "%-40s %10d %-9s %9.2f%s %10.2f %8.1f %12.1f\n",
+                f[1], f[2], f[11], gbps, mark, triad[key], 100 * gbps / triad[key], peak[key]
+        else
+            printf "%-40s %10d %-9s %9.2f%s %10s %8s %12s\n",
+                f[1], f[2], f[11], gbps, mark, "-", "-", "-"
+    }
+
+    if (borrowed)
+        print "* bytes of the reference program of the same problem and n"
+}
+' "$1"
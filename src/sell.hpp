@@ -0,0 +1,124 @@
+#ifndef SELL_HPP
+#define SELL_HPP
+
+// SELL-C-sigma sparse matrix format (Kreutzer et al., 2014).
+//
+// Rows are grouped into chunks of C consecutive rows. Every chunk is stored
+// like a small ELL matrix in column major order: element j of row r lives at
+//
+//   ptr[r / C] + j * C + r % C,     j < len[r / C],
+//
+// so C neighbouring work-items (or SIMD lanes) read consecutive addresses.
+// Short rows are padded with zeros pointing at column 0, which keeps the
+// inner loop free of branches. Before chunking, rows are sorted by length
+// within windows of sigma rows to keep the padding small.
+//
+// The sorting is a symmetric permutation of the matrix: column indices are
+// renumbered as well, so the matrix acts on vectors stored in the permuted
+// order. Use permute() and unpermute() on the host side state.
+//
+// C should match the hardware: the SIMD width on CPUs and the warp or
+// wavefront size on GPUs.
+
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+
+namespace sell {
+
+template <typename T>
+struct matrix {
+    size_t n;     // rows
+    size_t C;     // chunk height
+    size_t sigma; // sorting scope
+
+    std::vector<int> perm; // perm[new row] = old row
+    std::vector<int> ptr;  // chunk offsets, ptr.back() == stored()
+    std::vector<int> len;  // chunk widths
+    std::vector<int> col;
+    std::vector<T>   val;
+
+    // Builds the matrix from CSR arrays.
+    matrix(size_t n,
+            const std::vector<int> &row,
+            const std::vector<int> &c,
+            const std::vector<T>   &v,
+            size_t C, size_t sigma = 1
+          ) : n(n), C(C), sigma(std::max<size_t>(sigma, 1)), perm(n)
+    {
+        if (!C) throw std::invalid_argument("sell: zero chunk height");
+
+        std::iota(perm.begin(), perm.end(), 0);
+
+        for(size_t i = 0; i < n; i += this->sigma) {
+            std::vector<int>::iterator e = perm.begin() + std::min(n, i + this->sigma);
+            std::stable_sort(perm.begin() + i, e, longer(row));
+        }
+
+        std::vector<int> inv(n);
+        for(size_t i = 0; i < n; ++i) inv[perm[i]] = i;
+
+        size_t chunks = (n + C - 1) / C;
+
+        ptr.resize(chunks + 1);
+        len.resize(chunks);
+
+        ptr[0] = 0;
+        for(size_t k = 0; k < chunks; ++k) {
+            int w = 0;
+            for(size_t i = k * C; i < std::min(n, k * C + C); ++i)
+                w = std::max(w, row[perm[i] + 1] - row[perm[i]]);
+
+            len[k]     = w;
+            ptr[k + 1] = ptr[k] + w * C;
+        }
+
+        col.resize(ptr.back(), 0);
+        val.resize(ptr.back(), T());
+
+        for(size_t i = 0; i < n; ++i) {
+            size_t k = i / C, l = i % C;
+            int    r = perm[i];
+
+            for(int j = row[r], m = 0; j < row[r + 1]; ++j, ++m) {
+                col[ptr[k] + m * C + l] = inv[c[j]];
+                val[ptr[k] + m * C + l] = v[j];
+            }
+        }
+    }
+
+    // Number of stored elements, padding included.
+    size_t stored() const {
+        return ptr.back();
+    }
+
+    template <class Vector>
+    Vector permute(const Vector &x) const {
+        Vector y(x);
+        for(size_t i = 0; i < n; ++i) y[i] = x[perm[i]];
+        return y;
+    }
+
+    template <class Vector>
+    Vector unpermute(const Vector &x) const {
+        Vector y(x);
+        for(size_t i = 0; i < n; ++i) y[perm[i]] = x[i];
+        return y;
+    }
+
+    private:
+        struct longer {
+            const std::vector<int> &row;
+
+            longer(const std::vector<int> &row) : row(row) {}
+
+            bool operator()(int a, int b) const {
+                return row[a + 1] - row[a] > row[b + 1] - row[b];
+            }
+        };
+};
+
+} // namespace sell
+
+#endif
@@ -1,7 +1,327 @@
 #ifndef VT_USER_H
 #define VT_USER_H
 
-#define VT_USER_START(name)
-#define VT_USER_END(name)
+// Lightweight replacement for the VampirTrace user API.
+//
+// VT_USER_START(name) / VT_USER_END(name) mark a (possibly nested) region
+// on the calling thread. Regions are timed with the monotonic clock and kept
+// in a per-thread ring buffer; when the buffer is full the oldest regions
+// are dropped. The trace is written at exit in the Chrome trace event format
+// and may be opened with chrome://tracing or ui.perfetto.dev.
+//
+// When this header is included after CL/cl.hpp, kernel execution times can
+// be recorded as well. VT_USER_KERNEL(name) returns the cl::Event pointer to
+// pass to enqueueNDRangeKernel (NULL when device tracing is off), and the
+// command queue has to be created with vt::queue_properties():
+//
+//   VT_USER_START("scale_sum2");
+//   krn.setArg(...);
+//   queue.enqueueNDRangeKernel(krn, cl::NullRange, g, l, 0,
+//           VT_USER_KERNEL("scale_sum2"));
+//   VT_USER_END("scale_sum2");
+//
+// The host region then covers argument setup and launch, and the device
+// region the execution of the kernel. Device timestamps are mapped onto the
+// host clock using the time the kernel was enqueued.
+//
+// Tracing is off unless requested through the environment:
+//
+//   VT_TRACE         file to write the trace to;
+//   VT_TRACE_BUFFER  regions kept per thread (default 65536);
+//   VT_TRACE_DEVICE  record OpenCL kernel execution times when set to 1.
+//
+// Only C++03 and POSIX are used, so the header may be included from the
+// CUDA sources as well.
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+
+namespace vt {
+
+typedef unsigned long long ticks; // nanoseconds
+
+inline ticks now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<ticks>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+struct settings {
+    std::string file;
+    size_t      capacity;
+    bool        device;
+
+    settings() : capacity(65536), device(false) {
+        const char *v;
+
+        if ((v = getenv("VT_TRACE")))        file     = v;
+        if ((v = getenv("VT_TRACE_BUFFER"))) capacity = std::max(1L, atol(v));
+        if ((v = getenv("VT_TRACE_DEVICE"))) device   = !file.empty() && atoi(v);
+    }
+};
+
+inline const settings& config() {
+    static const settings s;
+    return s;
+}
+
+inline bool enabled() {
+    return !config().file.empty();
+}
+
+struct region {
+    const char *name;
+    ticks       begin, end;
+    ticks       queued; // device regions only: time the kernel was enqueued
+};
+
+// Fixed size ring of completed regions. count is the total number of
+// regions ever recorded, the newest one lives at (count - 1) % size.
+struct ring {
+    std::vector<region> buf;
+    size_t              count;
+
+    ring() : count(0) {}
+
+    void reserve(size_t n) {
+        buf.resize(n);
+    }
+
+    region& push() {
+        return buf[count++ % buf.size()];
+    }
+
+    size_t size() const {
+        return count < buf.size() ? count : buf.size();
+    }
+
+    const region& operator[](size_t i) const {
+        return buf[(count - size() + i) % buf.size()];
+    }
+};
+
+struct thread_buffer {
+    static const int max_depth = 64;
+
+    int  tid;
+    ring regions;
+
+    int         depth;
+    const char *open_name[max_depth];
+    ticks       open_time[max_depth];
+
+    thread_buffer(int tid, size_t capacity) : tid(tid), depth(0) {
+        regions.reserve(capacity);
+    }
+};
+
+class registry {
+    public:
+        registry() : base(now()) {
+            pthread_mutex_init(&mx, 0);
+        }
+
+        ~registry() {
+            write();
+
+            for(size_t i = 0; i < threads.size(); ++i) delete threads[i];
+            pthread_mutex_destroy(&mx);
+        }
+
+        thread_buffer* attach() {
+            pthread_mutex_lock(&mx);
+            thread_buffer *b = new thread_buffer(threads.size(), config().capacity);
+            threads.push_back(b);
+            pthread_mutex_unlock(&mx);
+            return b;
+        }
+
+        // Resolved device regions are handed over here before the OpenCL
+        // objects go away.
+        void device_region(const region &r) {
+            pthread_mutex_lock(&mx);
+            device.push_back(r);
+            pthread_mutex_unlock(&mx);
+        }
+    private:
+        ticks                        base;
+        pthread_mutex_t              mx;
+        std::vector<thread_buffer*>  threads;
+        std::vector<region>          device;
+
+        double us(ticks t) const {
+            return t > base ? 1e-3 * (t - base) : 0.0;
+        }
+
+        void write() const {
+            FILE *f = fopen(config().file.c_str(), "w");
+            if (!f) {
+                fprintf(stderr, "vt: cannot write %s\n", config().file.c_str());
+                return;
+            }
+
+            fprintf(f, "{\"traceEvents\": [\n");
+            fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, "
+                    "\"args\": {\"name\": \"host\"}}");
+
+            for(size_t i = 0; i < threads.size(); ++i) {
+                const thread_buffer &b = *threads[i];
+
+                fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+                        "\"tid\": %d, \"args\": {\"name\": \"thread %d\"}}", b.tid, b.tid);
+
+                for(size_t j = 0; j < b.regions.size(); ++j) {
+                    const region &r = b.regions[j];
+                    fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, "
+                            "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                            r.name, b.tid, us(r.begin), 1e-3 * (r.end - r.begin));
+                }
+            }
+
+            if (!device.empty())
+                fprintf(f, ",\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+                        "\"args\": {\"name\": \"device\"}}");
+
+            for(size_t i = 0; i < device.size(); ++i) {
+                const region &r = device[i];
+                fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+                        "\"tid\": 0, \"ts\": %.3f, \"dur\": %.3f, "
+                        "\"args\": {\"queued_us\": %.3f}}",
+                        r.name, us(r.begin), 1e-3 * (r.end - r.begin),
+                        1e-3 * (r.begin - r.queued));
+            }
+
+            fprintf(f, "\n],\n\"displayTimeUnit\": \"ns\"}\n");
+            fclose(f);
+        }
+};
+
+inline registry& trace() {
+    static registry r;
+    return r;
+}
+
+inline thread_buffer* local() {
+    static __thread thread_buffer *b = 0;
+    if (!b) b = trace().attach();
+    return b;
+}
+
+inline void start(const char *name) {
+    if (!enabled()) return;
+
+    thread_buffer *b = local();
+
+    if (b->depth < thread_buffer::max_depth) {
+        b->open_name[b->depth] = name;
+        b->open_time[b->depth] = now();
+    }
+    ++b->depth;
+}
+
+inline void end(const char*) {
+    if (!enabled()) return;
+
+    ticks t = now();
+    thread_buffer *b = local();
+
+    if (b->depth == 0) return;
+    if (--b->depth >= thread_buffer::max_depth) return;
+
+    region &r = b->regions.push();
+    r.name   = b->open_name[b->depth];
+    r.begin  = b->open_time[b->depth];
+    r.end    = t;
+    r.queued = t;
+}
+
+#ifdef CL_HPP_
+
+// Kernel events waiting to be resolved. Profiling info is only read at exit,
+// so that querying it does not stall the queue while the program runs.
+class device_trace {
+    public:
+        device_trace() : count(0) {
+            trace(); // constructed first, so that it outlives us.
+            pthread_mutex_init(&mx, 0);
+            pending.resize(config().capacity);
+        }
+
+        ~device_trace() {
+            size_t m = count < pending.size() ? count : pending.size();
+
+            for(size_t i = 0; i < m; ++i) {
+                const slot &s = pending[(count - m + i) % pending.size()];
+                if (!s.event()) continue;
+
+                cl_ulong q, b, e;
+                if (
+                        clGetEventProfilingInfo(s.event(), CL_PROFILING_COMMAND_QUEUED, sizeof(q), &q, 0) != CL_SUCCESS ||
+                        clGetEventProfilingInfo(s.event(), CL_PROFILING_COMMAND_START,  sizeof(b), &b, 0) != CL_SUCCESS ||
+                        clGetEventProfilingInfo(s.event(), CL_PROFILING_COMMAND_END,    sizeof(e), &e, 0) != CL_SUCCESS
+                   ) continue;
+
+                region r;
+                r.name   = s.name;
+                r.queued = s.queued;
+                r.begin  = s.queued + (b - q);
+                r.end    = s.queued + (e - q);
+
+                trace().device_region(r);
+            }
+
+            pthread_mutex_destroy(&mx);
+        }
+
+        cl::Event* push(const char *name) {
+            pthread_mutex_lock(&mx);
+            slot &s = pending[count++ % pending.size()];
+            pthread_mutex_unlock(&mx);
+
+            s.name   = name;
+            s.queued = now();
+            s.event  = cl::Event();
+
+            return &s.event;
+        }
+    private:
+        struct slot {
+            const char *name;
+            ticks       queued;
+            cl::Event   event;
+        };
+
+        pthread_mutex_t   mx;
+        std::vector<slot> pending;
+        size_t            count;
+};
+
+inline cl::Event* kernel_event(const char *name) {
+    if (!config().device) return 0;
+
+    static device_trace d;
+    return d.push(name);
+}
+
+// Properties for the command queues the traced kernels are submitted to.
+inline cl_command_queue_properties queue_properties() {
+    return config().device ? CL_QUEUE_PROFILING_ENABLE : 0;
+}
+
+#endif
+
+} // namespace vt
+
+#define VT_USER_START(name) ::vt::start(name)
+#define VT_USER_END(name)   ::vt::end(name)
+
+#ifdef CL_HPP_
+#  define VT_USER_KERNEL(name) ::vt::kernel_event(name)
+#endif
 
 #endif